@@ -1,491 +1,1960 @@
 #include "chip8.h"
+#include "chip8aot.h"
+#include "chip8audio.h"
+#include "chip8capture.h"
+#include "chip8jit.h"
+#include "chip8movie.h"
+#include "chip8profile.h"
+#include "chip8rewind.h"
+#include "chip8state.h"
+#include "chip8trace.h"
 
+#include <ctype.h>
+#include <math.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Resets the registers, screen and timers without touching the loaded ROM
+static void chip8InitState(Chip8Machine* m);
+
+// True if the ROM can't do anything but wait for a key to change
+static bool chip8WaitsForInput(Chip8Machine* m);
+
+#define CHIP8_WAIT_FOREVER UINT32_MAX
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Blocks until chip8Wake() is called after wakeups was read as seen, or until milliseconds have passed
+static void chip8WaitForWake(Chip8Machine* m, uint32_t seen, uint32_t milliseconds)
+{
+    platformMutexLock(&m->wakeMutex);
+    if (milliseconds == CHIP8_WAIT_FOREVER)
+    {
+        while (m->wakeups == seen) platformConditionWait(&m->wakeCondition, &m->wakeMutex);
+    }
+    else if (m->wakeups == seen)
+    {
+        // A spurious wakeup only makes chip8Run() work out the wait again
+        platformConditionWaitTimeout(&m->wakeCondition, &m->wakeMutex, milliseconds);
+    }
+    platformMutexUnlock(&m->wakeMutex);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Runs the next frame and records it for rewinding, or steps one frame back while the rewind key is held
+static void chip8AdvanceFrame(Chip8Machine* m)
+{
+    if (m->rewind == NULL)
+    {
+        chip8RunFrame(m);
+    }
+    else if (m->rewinding)
+    {
+        if (chip8RewindStep(m->rewind, m)) chip8MovieRewound(m);
+    }
+    else
+    {
+        chip8RunFrame(m);
+        chip8RewindCapture(m->rewind, m);
+    }
+}
 
 // ********************************************************************************************************************
 // ********************************************************************************************************************
-void chip8Run()
+void chip8Run(Chip8Machine* m)
 {
-    uint64_t prevTick; // When the last instruction was processed
-    QueryPerformanceCounter(&prevTick);
+    // Pacing only decides when the next frame runs, never what happens in it.  Frames are scheduled relative to
+    // startTick so rounding in the sleeps doesn't add up.
+    uint64_t startTick = platformGetTick(); // When frame 0 of the schedule was due
+    uint64_t framesPaced = 0;               // Frames run since startTick
+    uint64_t stepTick = startTick;          // When the last single step was taken
+    uint64_t idleSeen = 0;                  // Chip8Machine.idleInstructions when the last frame ended
 
-    while (_chip8_Running)
+    while (m->running)
     {
-        Sleep(10);
+        // Read before looking at any flag, so a change made after that always ends the wait below
+        uint32_t seen = platformAtomicLoad(&m->wakeups);
 
-        if (_chip8_Reset)
+        if (m->reset)
         {
-            chip8Init();
-            QueryPerformanceCounter(&prevTick);
+            chip8EndMovie(m);
+            chip8InitState(m);
+            if (m->rewind != NULL) chip8RewindClear(m->rewind);
+            startTick = platformGetTick();
+            framesPaced = 0;
         }
 
-        // Update the delay/sound timer as necessary
-        chip8TimerUpdate();
+        // Save states are taken and loaded between frames, so they always hold a consistent machine
+        chip8ProcessStateRequests(m);
+        chip8ProcessTraceRequest(m);
+        chip8ProcessMovieRequest(m);
+        chip8ProcessProfileRequest(m);
+        chip8ProcessCaptureRequest(m);
 
-        // Run enough instructions to simulate a clock speed of _chip8_ClockSpeed
-        int32_t instructionsToExecute = getElapsedTimeSinceHighPerfTick(prevTick) * _chip8_ClockSpeed;
-        while (instructionsToExecute-- > 0)
+        if (m->stepMode)
         {
-            // In step mode we only execute the instruction if we've been told to
-            if (_chip8_StepMode)
+            // In step mode we only execute the instruction if we've been told to, and not too often
+            if (m->stepOnIt)
             {
-                if (_chip8_StepOnIt && getElapsedTimeSinceHighPerfTick(prevTick) < _chip8_StepRateLimit)
+                if (getElapsedTimeSinceHighPerfTick(stepTick) < m->stepRateLimit)
                 {
                     // Not enough time has elapsed since the last instruction
-                    _chip8_StepOnIt = false;
-                    break;
+                    m->stepOnIt = false;
                 }
-                else if (!_chip8_StepOnIt)
+                else if (chip8StepInstruction(m) > 0)
                 {
-                    // In step mode but have not been commanded to execute an instruction
-                    break;
+                    // We've done a single step, disable the flag
+                    stepTick = platformGetTick();
+                    m->stepOnIt = false;
                 }
             }
 
-            uint16_t ins = chip8ReadInstruction();
-            if (ins == 0) break;
-            chip8ProcessInstruction(ins);
-            QueryPerformanceCounter(&prevTick);
+            // Nothing happens until the frontend steps again or asks for something else.  Leaving step mode resumes
+            // the schedule from there instead of catching up on the time spent stepping.
+            chip8WaitForWake(m, seen, CHIP8_WAIT_FOREVER);
+            startTick = platformGetTick();
+            framesPaced = 0;
+            continue;
+        }
 
-            // If we're in step mode, we've done a single step, disable the flag and break
-            if (_chip8_StepOnIt)
-            {
-                _chip8_StepOnIt = false;
-                break;
-            }
+        // Frames of a ROM waiting for a key with both timers run out change nothing but the frame count, so none run
+        // until a key changes.  The schedule then resumes from there, as after step mode.  Only a frame that skipped
+        // part of an idle loop can end in one, which keeps the check out of turbo frames that don't.
+        bool skippedIdle = m->idleInstructions != idleSeen;
+        idleSeen = m->idleInstructions;
+        if (skippedIdle && chip8WaitsForInput(m))
+        {
+            // The frame that sees the new key is due right away
+            chip8WaitForWake(m, seen, CHIP8_WAIT_FOREVER);
+            startTick = platformGetTick() - platformGetTickFrequency() / CHIP8_FRAME_RATE;
+            framesPaced = 0;
+            continue;
         }
+
+        // Turbo: frames run back to back.  Timers still tick once per emulated frame, so the ROM sees the same time
+        // pass as in real time, only faster.  Turning turbo off resumes the schedule from there.
+        if (!m->realTime)
+        {
+            chip8AdvanceFrame(m);
+            startTick = platformGetTick();
+            framesPaced = 0;
+            continue;
+        }
+
+        // Run the next frame if it is due.  After a long stall (a debugger, a suspended process) the schedule skips
+        // ahead instead of running a burst of frames to catch up.
+        double elapsed = getElapsedTimeSinceHighPerfTick(startTick);
+        uint64_t due = (uint64_t)(elapsed * CHIP8_FRAME_RATE);
+        if (due > framesPaced + CHIP8_FRAME_RATE) framesPaced = due - CHIP8_FRAME_RATE;
+        if (framesPaced < due)
+        {
+            chip8AdvanceFrame(m);
+            framesPaced++;
+            continue;
+        }
+
+        // Sleep until the next frame is due, or the frontend wants something
+        double wait = ((framesPaced + 1) * 1.0 / CHIP8_FRAME_RATE - elapsed) * 1000;
+        chip8WaitForWake(m, seen, wait >= 1 ? (uint32_t)wait : 1);
     }
 }
 
 // ********************************************************************************************************************
 // ********************************************************************************************************************
-uint16_t chip8ReadInstruction()
+uint16_t chip8ReadInstruction(Chip8Machine* m)
 {
-    // NOTE: Instructions are two bytes and stored as big endian
-    return (_chip8_Mem[_chip8_ProgramCounter] << 8) | _chip8_Mem[_chip8_ProgramCounter + 1];
+    // NOTE: Instructions are two bytes and stored as big endian.  The second byte of one at 0xFFFF wraps to 0.
+    return (m->mem[m->programCounter] << 8) | m->mem[(uint16_t)(m->programCounter + 1)];
 }
 
 // ********************************************************************************************************************
 // ********************************************************************************************************************
-void chip8ProcessInstruction(uint16_t instruction)
+// Bytes a taken skip jumps over: the next instruction, which on XO-CHIP may be the 4-byte F000 nnnn
+static inline uint16_t chip8SkipLength(const Chip8Machine* m, const Chip8Decoded* d)
 {
-    uint16_t nnn = instruction & 0x0FFF;
-    uint8_t x = (instruction & 0x0F00) >> 8;
-    uint8_t kk = instruction & 0x00FF;
-    uint8_t y = (instruction & 0x00F0) >> 4;
-    uint8_t n = instruction & 0x000F;
+    if (m->variant != CHIP8_VARIANT_XOCHIP) return 2;
+    return m->mem[d->nextPc] == 0xF0 && m->mem[(uint16_t)(d->nextPc + 1)] == 0x00 ? 4 : 2;
+}
 
-    chip8BuildDebugString(instruction);
+// ********************************************************************************************************************
+// Marks the whole screen as changed
+static inline void chip8DamageScreen(Chip8Machine* m)
+{
+    m->damageRows = ~0ull;
+    for (uint32_t w = 0; w < CHIP8_ROW_WORDS; w++) m->damageColumns[w] = ~0ull;
+}
 
-    if (instruction == 0x00E0)
-    {
-        // 00E0 - CLS
-        // Clear the display.
-        memset(_chip8_Screen, 0, CHIP8_SCREEN_WIDTH * CHIP8_SCREEN_HEIGHT);
-        _chip8_ProgramCounter += 2;
-    }
-    else if (instruction == 0x00EE)
-    {
-        // 00EE - RET
-        // Return from a subroutine. The interpreter sets the program counter to the address at the top of the
-        // stack, then subtracts 1 from the stack pointer.
-        _chip8_ProgramCounter = _chip8_Stack[_chip8_StackPointer];
-        if (_chip8_StackPointer > 0) _chip8_StackPointer--;
-    }
-    else if ((instruction & 0xF000) == 0x1000)
-    {
-        // 1nnn - JP addr
-        // Jump to location nnn. The interpreter sets the program counter to nnn.
-        _chip8_ProgramCounter = nnn;
-    }
-    else if ((instruction & 0xF000) == 0x2000)
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Clears the rows of the current mode in the given planes
+static inline void chip8ClearPlanes(Chip8Machine* m, uint32_t planes)
+{
+    Chip8Screen* s = &m->screen;
+    uint32_t words = s->height * (s->width / 64);
+    for (uint32_t p = 0; p < CHIP8_PLANE_COUNT; p++)
     {
-        // 2nnn - CALL addr
-        // Call subroutine at nnn. The interpreter increments the stack pointer, then puts the current PC on the top
-        // of the stack. The PC is then set to nnn.
-        _chip8_Stack[++_chip8_StackPointer] = _chip8_ProgramCounter + 2;
-        _chip8_ProgramCounter = nnn;
+        if (planes & (1u << p)) memset(s->pixels[p], 0, words * sizeof(uint64_t));
     }
-    else if ((instruction & 0xF000) == 0x3000)
+    chip8DamageScreen(m);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Dxyn in SUPER-CHIP and XO-CHIP: drawn in the current resolution into every plane selected by Fn01, the sprite data
+// of each plane following the last one's.  n = 0 draws a 16x16 sprite.  Rows and columns past the edges wrap around,
+// or are cut off with the clip quirk.  The sprite itself always starts on the screen.
+static void chip8DrawSprite(Chip8Machine* m, const Chip8Decoded* d)
+{
+    Chip8Screen* s = &m->screen;
+    uint32_t stride = s->width / 64;
+    uint32_t n = d->kk & 0x0F;
+    uint32_t bytes = n == 0 ? 2 : 1;   // Bytes per sprite row
+    uint32_t height = n == 0 ? 16 : n; // Rows in the sprite
+    uint32_t x = m->genRegs[d->x] & (s->width - 1);
+    uint32_t y = m->genRegs[d->y] & (s->height - 1);
+    uint32_t word = x / 64;
+    uint32_t shift = x % 64;
+    uint16_t address = m->i;
+    uint64_t erased = 0;
+    for (uint32_t p = 0; p < CHIP8_PLANE_COUNT; p++)
     {
-        // 3xkk - SE Vx, byte
-        // Skip next instruction if Vx = kk. The interpreter compares register Vx to kk, and if they are equal,
-        // increments the program counter by 2.
-        _chip8_ProgramCounter += 2;
-        if (_chip8_GenRegs[x] == kk)
+        if ((m->planeMask & (1u << p)) == 0) continue;
+
+        uint64_t* pixels = s->pixels[p];
+        for (uint32_t rowNum = 0; rowNum < height; rowNum++, address += bytes)
         {
-            _chip8_ProgramCounter += 2;
+            uint32_t yPos = y + rowNum;
+            if (yPos >= s->height)
+            {
+                if (m->clipQuirkMode) continue;
+                yPos -= s->height;
+            }
+
+            // Line the row up at the left of a word, then split it over the word x is in and the one after it
+            uint64_t row = (uint64_t)m->mem[address] << 56;
+            if (bytes == 2) row |= (uint64_t)m->mem[(uint16_t)(address + 1)] << 48;
+            uint64_t* line = pixels + yPos * stride;
+            uint64_t left = row >> shift;
+            uint64_t right = shift != 0 ? row << (64 - shift) : 0;
+            uint32_t next = word + 1 < stride ? word + 1 : 0;
+            if (next == 0 && m->clipQuirkMode) right = 0;
+
+            erased |= (line[word] & left) | (line[next] & right);
+            line[word] ^= left;
+            line[next] ^= right;
+            m->damageColumns[word] |= left;
+            m->damageColumns[next] |= right;
+            m->damageRows |= 1ull << yPos;
         }
     }
-    else if ((instruction & 0xF000) == 0x4000)
+
+    s->planes |= m->planeMask;
+    m->genRegs[0xF] = erased != 0;
+    m->programCounter = d->nextPc;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Moves the selected planes down by n rows of the current resolution, or up if n is negative, clearing the rows that
+// come in at the edge
+static void chip8ScrollRows(Chip8Machine* m, int32_t n)
+{
+    Chip8Screen* s = &m->screen;
+    uint32_t stride = s->width / 64;
+    uint32_t count = (uint32_t)(n < 0 ? -n : n);
+    if (count > s->height) count = s->height;
+
+    uint32_t moved = (s->height - count) * stride; // Words that stay on the screen
+    uint32_t cleared = count * stride;             // Words that come in
+    for (uint32_t p = 0; p < CHIP8_PLANE_COUNT; p++)
     {
-        // 4xkk - SNE Vx, byte
-        // Skip next instruction if Vx != kk. The interpreter compares register Vx to kk, and if they are not equal,
-        // increments the program counter by 2.
-        _chip8_ProgramCounter += 2;
-        if (_chip8_GenRegs[x] != kk)
+        if ((m->planeMask & (1u << p)) == 0) continue;
+
+        uint64_t* pixels = s->pixels[p];
+        if (n > 0)
+        {
+            memmove(pixels + cleared, pixels, moved * sizeof(uint64_t));
+            memset(pixels, 0, cleared * sizeof(uint64_t));
+        }
+        else
         {
-            _chip8_ProgramCounter += 2;
+            memmove(pixels, pixels + cleared, moved * sizeof(uint64_t));
+            memset(pixels + moved, 0, cleared * sizeof(uint64_t));
         }
     }
-    else if ((instruction & 0xF00F) == 0x5000)
+    chip8DamageScreen(m);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Moves the selected planes 4 pixels right, or left, clearing the columns that come in at the edge
+static void chip8ScrollColumns(Chip8Machine* m, bool right)
+{
+    Chip8Screen* s = &m->screen;
+    uint32_t stride = s->width / 64;
+    for (uint32_t p = 0; p < CHIP8_PLANE_COUNT; p++)
     {
-        // 5xy0 - SE Vx, Vy
-        // Skip next instruction if Vx = Vy.The interpreter compares register Vx to register Vy, and if they are
-        // equal, increments the program counter by 2.
-        _chip8_ProgramCounter += 2;
-        if (_chip8_GenRegs[x] == _chip8_GenRegs[y])
+        if ((m->planeMask & (1u << p)) == 0) continue;
+
+        for (uint32_t y = 0; y < s->height; y++)
         {
-            _chip8_ProgramCounter += 2;
+            uint64_t* line = s->pixels[p] + y * stride;
+            if (right)
+            {
+                for (uint32_t w = stride - 1; w > 0; w--) line[w] = line[w] >> 4 | line[w - 1] << 60;
+                line[0] >>= 4;
+            }
+            else
+            {
+                for (uint32_t w = 0; w + 1 < stride; w++) line[w] = line[w] << 4 | line[w + 1] >> 60;
+                line[stride - 1] <<= 4;
+            }
         }
     }
-    else if ((instruction & 0xF000) == 0x6000)
+    chip8DamageScreen(m);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Switches between 64x32 and 128x64.  Every plane is cleared, as in Octo.
+static void chip8SetResolution(Chip8Machine* m, bool hires)
+{
+    m->screen.width = hires ? CHIP8_SCREEN_WIDTH : CHIP8_LORES_WIDTH;
+    m->screen.height = hires ? CHIP8_SCREEN_HEIGHT : CHIP8_LORES_HEIGHT;
+    chip8ClearPlanes(m, (1u << CHIP8_PLANE_COUNT) - 1);
+}
+
+// ********************************************************************************************************************
+// Instruction handlers.  One per Chip8Op, shared by every dispatch engine so the semantics only live in one place.
+// ********************************************************************************************************************
+static inline void opUNKNOWN(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // Unknown instruction?!
+}
+
+static inline void op00E0(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 00E0 - CLS
+    // Clear the display.  On XO-CHIP only the planes selected by Fn01 are cleared.
+    chip8ClearPlanes(m, m->planeMask);
+    m->programCounter = d->nextPc;
+}
+
+static inline void op00EE(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 00EE - RET
+    // Return from a subroutine. The interpreter sets the program counter to the address at the top of the
+    // stack, then subtracts 1 from the stack pointer.
+    m->programCounter = m->stack[m->stackPointer];
+    if (m->stackPointer > 0) m->stackPointer--;
+}
+
+static inline void op1nnn(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 1nnn - JP addr
+    // Jump to location nnn. The interpreter sets the program counter to nnn.
+    m->programCounter = d->nnn;
+}
+
+static inline void op2nnn(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 2nnn - CALL addr
+    // Call subroutine at nnn. The interpreter increments the stack pointer, then puts the current PC on the top
+    // of the stack. The PC is then set to nnn.
+    m->stack[++m->stackPointer] = d->nextPc;
+    m->programCounter = d->nnn;
+}
+
+static inline void op3xkk(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 3xkk - SE Vx, byte
+    // Skip next instruction if Vx = kk. The interpreter compares register Vx to kk, and if they are equal,
+    // increments the program counter by 2.
+    m->programCounter = d->nextPc;
+    if (m->genRegs[d->x] == d->kk)
     {
-        // 6xkk - LD Vx, byte
-        // Set Vx = kk. The interpreter puts the value kk into register Vx.
-        _chip8_GenRegs[x] = kk;
-        _chip8_ProgramCounter += 2;
+        m->programCounter += chip8SkipLength(m, d);
     }
-    else if ((instruction & 0xF000) == 0x7000)
+}
+
+static inline void op4xkk(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 4xkk - SNE Vx, byte
+    // Skip next instruction if Vx != kk. The interpreter compares register Vx to kk, and if they are not equal,
+    // increments the program counter by 2.
+    m->programCounter = d->nextPc;
+    if (m->genRegs[d->x] != d->kk)
     {
-        // 7xkk - ADD Vx, byte
-        // Set Vx = Vx + kk. Adds the value kk to the value of register Vx, then stores the result in Vx.
-        _chip8_GenRegs[x] += kk;
-        _chip8_ProgramCounter += 2;
+        m->programCounter += chip8SkipLength(m, d);
     }
-    else if ((instruction & 0xF00F) == 0x8000)
+}
+
+static inline void op5xy0(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 5xy0 - SE Vx, Vy
+    // Skip next instruction if Vx = Vy.The interpreter compares register Vx to register Vy, and if they are
+    // equal, increments the program counter by 2.
+    m->programCounter = d->nextPc;
+    if (m->genRegs[d->x] == m->genRegs[d->y])
     {
-        // 8xy0 - LD Vx, Vy
-        // Set Vx = Vy. Stores the value of register Vy in register Vx.
-        _chip8_GenRegs[x] = _chip8_GenRegs[y];
-        _chip8_ProgramCounter += 2;
+        m->programCounter += chip8SkipLength(m, d);
     }
-    else if ((instruction & 0xF00F) == 0x8001)
+}
+
+static inline void op6xkk(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 6xkk - LD Vx, byte
+    // Set Vx = kk. The interpreter puts the value kk into register Vx.
+    m->genRegs[d->x] = d->kk;
+    m->programCounter = d->nextPc;
+}
+
+static inline void op7xkk(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 7xkk - ADD Vx, byte
+    // Set Vx = Vx + kk. Adds the value kk to the value of register Vx, then stores the result in Vx.
+    m->genRegs[d->x] += d->kk;
+    m->programCounter = d->nextPc;
+}
+
+static inline void op8xy0(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 8xy0 - LD Vx, Vy
+    // Set Vx = Vy. Stores the value of register Vy in register Vx.
+    m->genRegs[d->x] = m->genRegs[d->y];
+    m->programCounter = d->nextPc;
+}
+
+static inline void op8xy1(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 8xy1 - OR Vx, Vy
+    // Set Vx = Vx OR Vy. Performs a bitwise OR on the values of Vx and Vy, then stores the result in Vx. A
+    // bitwise OR compares the corrseponding bits from two values, and if either bit is 1, then the same bit in
+    // the result is also 1. Otherwise, it is 0.
+    m->genRegs[d->x] |= m->genRegs[d->y];
+    m->programCounter = d->nextPc;
+}
+
+static inline void op8xy2(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 8xy2 - AND Vx, Vy
+    // Set Vx = Vx AND Vy. Performs a bitwise AND on the values of Vx and Vy, then stores the result in Vx. A
+    // bitwise AND compares the corrseponding bits from two values, and if both bits are 1, then the same bit in
+    // the result is also 1. Otherwise, it is 0.
+    m->genRegs[d->x] &= m->genRegs[d->y];
+    m->programCounter = d->nextPc;
+}
+
+static inline void op8xy3(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 8xy3 - XOR Vx, Vy
+    // Set Vx = Vx XOR Vy. Performs a bitwise exclusive OR on the values of Vx and Vy, then stores the result in
+    // Vx. An exclusive OR compares the corrseponding bits from two values, and if the bits are not both the
+    // same, then the corresponding bit in the result is set to 1. Otherwise, it is 0.
+    m->genRegs[d->x] ^= m->genRegs[d->y];
+    m->programCounter = d->nextPc;
+}
+
+static inline void op8xy4(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 8xy4 - ADD Vx, Vy
+    // Set Vx = Vx + Vy, set VF = carry. The values of Vx and Vy are added together. If the result is greater
+    // than 8 bits (i.e., > 255,) VF is set to 1, otherwise 0. Only the lowest 8 bits of the result are kept,
+    // and stored in Vx.
+    uint16_t sum = m->genRegs[d->x] + m->genRegs[d->y];
+    m->genRegs[d->x] = sum & 0x00FF;
+    if ((sum & 0xFF00) > 0)
+        m->genRegs[0xF] = 1;
+    else
+        m->genRegs[0xF] = 0;
+    m->programCounter = d->nextPc;
+}
+
+static inline void op8xy5(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 8xy5 - SUB Vx, Vy
+    // Set Vx = Vx - Vy, set VF = NOT borrow. If Vx > Vy, then VF is set to 1, otherwise 0. Then Vy is
+    // subtracted from Vx, and the results stored in Vx.
+    if (m->genRegs[d->x] > m->genRegs[d->y])
+        m->genRegs[0xF] = 1;
+    else
+        m->genRegs[0xF] = 0;
+
+    m->genRegs[d->x] -= m->genRegs[d->y];
+    m->programCounter = d->nextPc;
+}
+
+static inline void op8xy6(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 8xy6 - SHR Vx {, Vy}
+    // Set Vx = Vx SHR 1. If the least-significant bit of Vx is 1, then VF is set to 1, otherwise 0. Then Vx is
+    // divided by 2.
+    uint8_t valToShift = m->genRegs[d->y];
+    if (m->shiftQuirkMode) valToShift = m->genRegs[d->x];
+
+    if ((valToShift & 0x01) == 0x01)
+        m->genRegs[0xF] = 1;
+    else
+        m->genRegs[0xF] = 0;
+
+    m->genRegs[d->x] = valToShift >> 1;
+    m->programCounter = d->nextPc;
+}
+
+static inline void op8xy7(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 8xy7 - SUBN Vx, Vy
+    // Set Vx = Vy - Vx, set VF = NOT borrow. If Vy > Vx, then VF is set to 1, otherwise 0. Then Vx is
+    // subtracted from Vy, and the results stored in Vx.
+    if (m->genRegs[d->y] > m->genRegs[d->x])
+        m->genRegs[0xF] = 1;
+    else
+        m->genRegs[0xF] = 0;
+
+    m->genRegs[d->x] = m->genRegs[d->y] - m->genRegs[d->x];
+    m->programCounter = d->nextPc;
+}
+
+static inline void op8xyE(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 8xyE - SHL Vx {, Vy}
+    // Set Vx = Vx SHL 1. If the most-significant bit of Vx is 1, then VF is set to 1, otherwise to 0. Then Vx
+    // is multiplied by 2. NOTE: This does not agree with other chip 8 instruction references?!
+    uint8_t valToShift = m->genRegs[d->y];
+    if (m->shiftQuirkMode) valToShift = m->genRegs[d->x];
+
+    if ((valToShift & 0x80) == 0x80)
+        m->genRegs[0xF] = 1;
+    else
+        m->genRegs[0xF] = 0;
+
+    m->genRegs[d->x] = valToShift << 1;
+    m->programCounter = d->nextPc;
+}
+
+static inline void op9xy0(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 9xy0 - SNE Vx, Vy
+    // Skip next instruction if Vx != Vy. The values of Vx and Vy are compared, and if they are not equal, the
+    // program counter is increased by 2.
+    m->programCounter = d->nextPc;
+    if (m->genRegs[d->x] != m->genRegs[d->y])
     {
-        // 8xy1 - OR Vx, Vy
-        // Set Vx = Vx OR Vy. Performs a bitwise OR on the values of Vx and Vy, then stores the result in Vx. A
-        // bitwise OR compares the corrseponding bits from two values, and if either bit is 1, then the same bit in
-        // the result is also 1. Otherwise, it is 0.
-        _chip8_GenRegs[x] |= _chip8_GenRegs[y];
-        _chip8_ProgramCounter += 2;
+        m->programCounter += chip8SkipLength(m, d);
     }
-    else if ((instruction & 0xF00F) == 0x8002)
+}
+
+static inline void opAnnn(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // Annn - LD I, addr
+    // Set I = nnn. The value of register I is set to nnn.
+    m->i = d->nnn;
+    m->programCounter = d->nextPc;
+}
+
+static inline void opBnnn(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // Bnnn - JP V0, addr
+    // Jump to location nnn + V0. The program counter is set to nnn plus the value of V0.  With the jump quirk
+    // (SUPER-CHIP) it is Bxnn, jumping to xnn plus the value of Vx.
+    m->programCounter = d->nnn + m->genRegs[m->jumpQuirkMode ? d->x : 0];
+}
+
+static inline uint8_t chip8NextRandom(Chip8Machine* m)
+{
+    // xorshift64*: three shifts and a multiply, whose top byte is well mixed
+    uint64_t x = m->randomState;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    m->randomState = x;
+    return (uint8_t)((x * 0x2545F4914F6CDD1Dull) >> 56);
+}
+
+static inline void opCxkk(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // Cxkk - RND Vx, byte
+    // Set Vx = random byte AND kk. The interpreter generates a random number from 0 to 255, which is then ANDed
+    // with the value kk. The results are stored in Vx. See instruction 8xy2 for more information on AND.
+    m->genRegs[d->x] = chip8NextRandom(m) & d->kk;
+    m->programCounter = d->nextPc;
+}
+
+static inline void opDxyn(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // Dxyn - DRW Vx, Vy, nibble
+    // Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision. The interpreter
+    // reads n bytes from memory, starting at the address stored in I. These bytes are then displayed as sprites
+    // on screen at coordinates (Vx, Vy). Sprites are XORed onto the existing screen. If this causes any pixels
+    // to be erased, VF is set to 1, otherwise it is set to 0. If the sprite is positioned so part of it is
+    // outside the coordinates of the display, it wraps around to the opposite side of the screen. See
+    // instruction 8xy3 for more information on XOR, and section 2.4, Display, for more information on the
+    // Chip-8 screen and sprites.
+    //
+    // SUPER-CHIP and XO-CHIP sprites can be 16 pixels wide, go to other planes and be cut off at the edges, which
+    // chip8DrawSprite() takes care of.  The original's only ever take the lo-res path below.
+    if (m->variant != CHIP8_VARIANT_CHIP8)
     {
-        // 8xy2 - AND Vx, Vy
-        // Set Vx = Vx AND Vy. Performs a bitwise AND on the values of Vx and Vy, then stores the result in Vx. A
-        // bitwise AND compares the corrseponding bits from two values, and if both bits are 1, then the same bit in
-        // the result is also 1. Otherwise, it is 0.
-        _chip8_GenRegs[x] &= _chip8_GenRegs[y];
-        _chip8_ProgramCounter += 2;
+        chip8DrawSprite(m, d);
+        return;
     }
-    else if ((instruction & 0xF00F) == 0x8003)
+
+    uint8_t n = d->kk & 0x0F;
+    uint8_t x = m->genRegs[d->x] % CHIP8_LORES_WIDTH;
+    uint8_t y = m->genRegs[d->y];
+    uint64_t* screen = m->screen.pixels[0];
+    uint64_t erased = 0;
+    uint64_t columns = 0; // Columns the sprite covers, for the damage
+    for (int rowNum = 0; rowNum < n; rowNum++)
     {
-        // 8xy3 - XOR Vx, Vy
-        // Set Vx = Vx XOR Vy. Performs a bitwise exclusive OR on the values of Vx and Vy, then stores the result in
-        // Vx. An exclusive OR compares the corrseponding bits from two values, and if the bits are not both the
-        // same, then the corresponding bit in the result is set to 1. Otherwise, it is 0.
-        _chip8_GenRegs[x] ^= _chip8_GenRegs[y];
-        _chip8_ProgramCounter += 2;
+        // Line the row of pixels up with its screen row, MSB first because it's "left most".  Rotating instead of
+        // shifting wraps the pixels that fall off the right edge around to the left.
+        uint64_t row = (uint64_t)m->mem[(uint16_t)(m->i + rowNum)] << (CHIP8_LORES_WIDTH - 8);
+        row = (row >> x) | (row << ((CHIP8_LORES_WIDTH - x) % CHIP8_LORES_WIDTH));
+
+        // XOR the row into the screen, remembering any pixel that was on and gets turned off
+        uint8_t yPos = (uint8_t)(y + rowNum) % CHIP8_LORES_HEIGHT;
+        erased |= screen[yPos] & row;
+        screen[yPos] ^= row;
+        columns |= row;
     }
-    else if ((instruction & 0xF00F) == 0x8004)
+
+    // The sprite covers n rows from y down, wrapping around the bottom
+    uint32_t rows = (1u << n) - 1;
+    uint8_t top = y % CHIP8_LORES_HEIGHT;
+    m->damageRows |= rows << top | (uint32_t)((uint64_t)rows >> (CHIP8_LORES_HEIGHT - top));
+    m->damageColumns[0] |= columns;
+
+    m->genRegs[0xF] = erased != 0;
+    m->programCounter = d->nextPc;
+}
+
+static inline void opEx9E(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // Ex9E - SKP Vx
+    // Skip next instruction if key with the value of Vx is pressed. Checks the keyboard, and if the key
+    // corresponding to the value of Vx is currently in the down position, PC is increased by 2.
+    uint8_t key = m->genRegs[d->x];
+    m->programCounter = d->nextPc;
+    if (m->keyboard[key])
     {
-        // 8xy4 - ADD Vx, Vy
-        // Set Vx = Vx + Vy, set VF = carry. The values of Vx and Vy are added together. If the result is greater
-        // than 8 bits (i.e., > 255,) VF is set to 1, otherwise 0. Only the lowest 8 bits of the result are kept,
-        // and stored in Vx.
-        uint16_t sum = _chip8_GenRegs[x] + _chip8_GenRegs[y];
-        _chip8_GenRegs[x] = sum & 0x00FF;
-        if ((sum & 0xFF00) > 0)
-            _chip8_GenRegs[0xF] = 1;
-        else
-            _chip8_GenRegs[0xF] = 0;
-        _chip8_ProgramCounter += 2;
+        m->programCounter += chip8SkipLength(m, d);
     }
-    else if ((instruction & 0xF00F) == 0x8005)
+}
+
+static inline void opExA1(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // ExA1 - SKNP Vx
+    // Skip next instruction if key with the value of Vx is not pressed. Checks the keyboard, and if the key
+    // corresponding to the value of Vx is currently in the up position, PC is increased by 2.
+    uint8_t key = m->genRegs[d->x];
+    m->programCounter = d->nextPc;
+    if (!m->keyboard[key])
     {
-        // 8xy5 - SUB Vx, Vy
-        // Set Vx = Vx - Vy, set VF = NOT borrow. If Vx > Vy, then VF is set to 1, otherwise 0. Then Vy is
-        // subtracted from Vx, and the results stored in Vx.
-        if (_chip8_GenRegs[x] > _chip8_GenRegs[y])
-            _chip8_GenRegs[0xF] = 1;
-        else
-            _chip8_GenRegs[0xF] = 0;
+        m->programCounter += chip8SkipLength(m, d);
+    }
+}
+
+static inline void opFx07(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // Fx07 - LD Vx, DT
+    // Set Vx = delay timer value. The value of DT is placed into Vx.
+    m->genRegs[d->x] = m->delayTimerReg;
+    m->programCounter = d->nextPc;
+}
+
+static inline void opFx0A(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // Fx0A - LD Vx, K
+    // Wait for a key press, store the value of the key in Vx. All execution stops until a key is pressed, then
+    // the value of that key is stored in Vx.
+    uint32_t key = 0;
+    do
+    {
+        if (m->keyboard[key])
+        {
+            m->genRegs[d->x] = key;
+            m->programCounter = d->nextPc; // Only increment PC on key press
+            break;
+        }
+    } while (++key <= 0xF);
+}
+
+static inline void opFx15(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // Fx15 - LD DT, Vx
+    // Set delay timer = Vx. DT is set equal to the value of Vx.
+    m->delayTimerReg = m->genRegs[d->x];
+    m->programCounter = d->nextPc;
+}
 
-        _chip8_GenRegs[x] -= _chip8_GenRegs[y];
-        _chip8_ProgramCounter += 2;
+static inline void opFx18(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // Fx18 - LD ST, Vx
+    // Set sound timer = Vx. ST is set equal to the value of Vx.
+    m->soundTimerReg = m->genRegs[d->x];
+    m->programCounter = d->nextPc;
+}
+
+static inline void opFx1E(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // Fx1E - ADD I, Vx
+    // Set I = I + Vx. The values of I and Vx are added, and the results are stored in I.
+    m->i += m->genRegs[d->x];
+    m->programCounter = d->nextPc;
+}
+
+static inline void opFx29(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // Fx29 - LD F, Vx
+    // Set I = location of sprite for digit Vx. The value of I is set to the location for the hexadecimal
+    // sprite corresponding to the value of Vx. See section 2.4, Display, for more information on the
+    // Chip-8 hexadecimal font.
+    m->i = CHIP8_HEX_SPRITE_START_OFFSET + CHIP8_HEX_SPRITE_SIZE_PER * m->genRegs[d->x];
+    m->programCounter = d->nextPc;
+}
+
+static inline void opFx33(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // Fx33 - LD B, Vx
+    // Store BCD representation of Vx in memory locations I, I+1, and I+2. The interpreter takes the decimal
+    // value of Vx, and places the hundreds digit in memory at location in I, the tens digit at location I+1,
+    // and the ones digit at location I+2.
+    uint16_t memOffset = m->i;
+    uint8_t value = m->genRegs[d->x];
+    uint8_t onesDigit = value % 10;
+    uint8_t tensDigit = ((value % 100) - onesDigit) / 10;
+    uint8_t hundredsDigit = ((value % 1000) - tensDigit - onesDigit) / 100;
+
+    m->mem[memOffset] = hundredsDigit;
+    m->mem[(uint16_t)(memOffset + 1)] = tensDigit;
+    m->mem[(uint16_t)(memOffset + 2)] = onesDigit;
+    chip8InvalidateDecodeCache(m, memOffset, 3);
+    m->programCounter = d->nextPc;
+}
+
+static inline void opFx55(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // Fx55 - LD [I], Vx
+    // Store registers V0 through Vx in memory starting at location I. The interpreter copies the values of
+    // registers V0 through Vx into memory, starting at the address in I.
+    for (uint8_t i = 0; i <= d->x; i++)
+    {
+        m->mem[(uint16_t)(m->i + i)] = m->genRegs[i];
     }
-    else if ((instruction & 0xF00F) == 0x8006)
+    chip8InvalidateDecodeCache(m, m->i, d->x + 1);
+    if (m->loadStoreQuirkMode) m->i += d->x + 1;
+    m->programCounter = d->nextPc;
+}
+
+static inline void opFx65(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // Fx65 - LD Vx, [I]
+    // Read registers V0 through Vx from memory starting at location I. The interpreter reads values from
+    // memory starting at location I into registers V0 through Vx.
+    for (uint8_t i = 0; i <= d->x; i++)
+    {
+        m->genRegs[i] = m->mem[(uint16_t)(m->i + i)];
+    }
+    if (m->loadStoreQuirkMode) m->i += d->x + 1;
+    m->programCounter = d->nextPc;
+}
+
+// ********************************************************************************************************************
+// SUPER-CHIP and XO-CHIP instructions.  On a variant that doesn't have one it does nothing, like any unknown
+// instruction.
+// ********************************************************************************************************************
+static inline void op00Cn(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 00Cn - SCD n (SUPER-CHIP)
+    // Scroll the display down by n rows.
+    if (m->variant == CHIP8_VARIANT_CHIP8) return;
+    chip8ScrollRows(m, d->kk & 0x0F);
+    m->programCounter = d->nextPc;
+}
+
+static inline void op00Dn(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 00Dn - SCU n (XO-CHIP)
+    // Scroll the display up by n rows.
+    if (m->variant != CHIP8_VARIANT_XOCHIP) return;
+    chip8ScrollRows(m, -(int32_t)(d->kk & 0x0F));
+    m->programCounter = d->nextPc;
+}
+
+static inline void op00FB(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 00FB - SCR (SUPER-CHIP)
+    // Scroll the display right by 4 pixels.
+    if (m->variant == CHIP8_VARIANT_CHIP8) return;
+    chip8ScrollColumns(m, true);
+    m->programCounter = d->nextPc;
+}
+
+static inline void op00FC(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 00FC - SCL (SUPER-CHIP)
+    // Scroll the display left by 4 pixels.
+    if (m->variant == CHIP8_VARIANT_CHIP8) return;
+    chip8ScrollColumns(m, false);
+    m->programCounter = d->nextPc;
+}
+
+static inline void op00FD(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 00FD - EXIT (SUPER-CHIP)
+    // Exit the interpreter.  There is nothing to exit to, so the program counter stays here.
+}
+
+static inline void op00FE(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 00FE - LOW (SUPER-CHIP)
+    // Switch to the 64x32 display.
+    if (m->variant == CHIP8_VARIANT_CHIP8) return;
+    chip8SetResolution(m, false);
+    m->programCounter = d->nextPc;
+}
+
+static inline void op00FF(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 00FF - HIGH (SUPER-CHIP)
+    // Switch to the 128x64 display.
+    if (m->variant == CHIP8_VARIANT_CHIP8) return;
+    chip8SetResolution(m, true);
+    m->programCounter = d->nextPc;
+}
+
+static inline void op5xy2(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 5xy2 - SAVE Vx - Vy (XO-CHIP)
+    // Store registers Vx through Vy in memory starting at location I, in reverse order if x > y.  I is not changed.
+    if (m->variant != CHIP8_VARIANT_XOCHIP) return;
+    int32_t step = d->x <= d->y ? 1 : -1;
+    uint32_t count = (uint32_t)((d->y - d->x) * step) + 1;
+    for (uint32_t n = 0; n < count; n++)
     {
-        // 8xy6 - SHR Vx {, Vy}
-        // Set Vx = Vx SHR 1. If the least-significant bit of Vx is 1, then VF is set to 1, otherwise 0. Then Vx is
-        // divided by 2.
-        uint8_t valToShift = _chip8_GenRegs[y];
-        if (_chip8_ShiftQuirkMode) valToShift = _chip8_GenRegs[x];
+        m->mem[(uint16_t)(m->i + n)] = m->genRegs[d->x + step * (int32_t)n];
+    }
+    chip8InvalidateDecodeCache(m, m->i, count);
+    m->programCounter = d->nextPc;
+}
 
-        if ((valToShift & 0x01) == 0x01)
-            _chip8_GenRegs[0xF] = 1;
-        else
-            _chip8_GenRegs[0xF] = 0;
+static inline void op5xy3(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // 5xy3 - LOAD Vx - Vy (XO-CHIP)
+    // Read registers Vx through Vy from memory starting at location I, in reverse order if x > y.  I is not changed.
+    if (m->variant != CHIP8_VARIANT_XOCHIP) return;
+    int32_t step = d->x <= d->y ? 1 : -1;
+    uint32_t count = (uint32_t)((d->y - d->x) * step) + 1;
+    for (uint32_t n = 0; n < count; n++)
+    {
+        m->genRegs[d->x + step * (int32_t)n] = m->mem[(uint16_t)(m->i + n)];
+    }
+    m->programCounter = d->nextPc;
+}
+
+static inline void opF000(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // F000 nnnn - LD I, long addr (XO-CHIP)
+    // Set I = nnnn, the 16-bit word after the instruction, and continue after it.
+    if (m->variant != CHIP8_VARIANT_XOCHIP || d->x != 0) return;
+    m->i = m->mem[d->nextPc] << 8 | m->mem[(uint16_t)(d->nextPc + 1)];
+    m->programCounter = d->nextPc + 2;
+}
 
-        _chip8_GenRegs[x] = valToShift >> 1;
-        _chip8_ProgramCounter += 2;
+static inline void opFn01(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // Fn01 - PLANE n (XO-CHIP)
+    // Select the bitplanes that CLS, DRW and the scrolls work on.  Bit 0 is the first plane, bit 1 the second.
+    if (m->variant != CHIP8_VARIANT_XOCHIP) return;
+    m->planeMask = d->x & ((1u << CHIP8_PLANE_COUNT) - 1);
+    m->programCounter = d->nextPc;
+}
+
+static inline void opF002(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // F002 - AUDIO (XO-CHIP)
+    // Load the 16 bytes at I into the audio pattern buffer.
+    if (m->variant != CHIP8_VARIANT_XOCHIP || d->x != 0) return;
+    for (uint32_t n = 0; n < sizeof(m->audioPattern); n++)
+    {
+        m->audioPattern[n] = m->mem[(uint16_t)(m->i + n)];
     }
-    else if ((instruction & 0xF00F) == 0x8007)
+    m->programCounter = d->nextPc;
+}
+
+static inline void opFx30(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // Fx30 - LD HF, Vx (SUPER-CHIP)
+    // Set I = location of the 10-byte sprite for the digit Vx.  Like Fx29, only the low nibble of Vx is used.
+    if (m->variant == CHIP8_VARIANT_CHIP8) return;
+    m->i = CHIP8_BIG_SPRITE_START_OFFSET + CHIP8_BIG_SPRITE_SIZE_PER * (m->genRegs[d->x] & 0x0F);
+    m->programCounter = d->nextPc;
+}
+
+static inline void opFx3A(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // Fx3A - PITCH Vx (XO-CHIP)
+    // Set the playback rate of the audio pattern buffer to 4000 * 2^((Vx - 64) / 48) bits per second.
+    if (m->variant != CHIP8_VARIANT_XOCHIP) return;
+    m->audioPitch = m->genRegs[d->x];
+    m->programCounter = d->nextPc;
+}
+
+static inline void opFx75(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // Fx75 - LD R, Vx (SUPER-CHIP)
+    // Store registers V0 through Vx in the RPL user flags.
+    if (m->variant == CHIP8_VARIANT_CHIP8) return;
+    memcpy(m->rpl, m->genRegs, d->x + 1);
+    m->programCounter = d->nextPc;
+}
+
+static inline void opFx85(Chip8Machine* m, const Chip8Decoded* d)
+{
+    // Fx85 - LD Vx, R (SUPER-CHIP)
+    // Read registers V0 through Vx from the RPL user flags.
+    if (m->variant == CHIP8_VARIANT_CHIP8) return;
+    memcpy(m->genRegs, m->rpl, d->x + 1);
+    m->programCounter = d->nextPc;
+}
+
+// ********************************************************************************************************************
+// Decode tables.  The top nibble selects either an instruction directly or, for the groups where the low bits matter,
+// a second level table indexed by the low nibble or low byte.
+// ********************************************************************************************************************
+#define CHIP8_OP_GROUP CHIP8_OP_COUNT // Marks top nibbles that need a second level lookup
+
+typedef struct Chip8DecodeGroup
+{
+    const uint8_t* table; // Second level table, indexed by (instruction & keyMask)
+    uint16_t keyMask;
+} Chip8DecodeGroup;
+
+static const uint8_t _chip8_DecodeTop[16] = {
+    CHIP8_OP_GROUP, CHIP8_OP_1nnn, CHIP8_OP_2nnn, CHIP8_OP_3xkk, CHIP8_OP_4xkk, CHIP8_OP_GROUP,
+    CHIP8_OP_6xkk,  CHIP8_OP_7xkk, CHIP8_OP_GROUP, CHIP8_OP_GROUP, CHIP8_OP_Annn, CHIP8_OP_Bnnn,
+    CHIP8_OP_Cxkk,  CHIP8_OP_Dxyn, CHIP8_OP_GROUP, CHIP8_OP_GROUP};
+
+// The 16 entries of a second level table for an instruction with n in the low nibble of its key
+#define CHIP8_DECODE_N(key, op)                                                                                        \
+    [key | 0x0] = op, [key | 0x1] = op, [key | 0x2] = op, [key | 0x3] = op, [key | 0x4] = op, [key | 0x5] = op,        \
+    [key | 0x6] = op, [key | 0x7] = op, [key | 0x8] = op, [key | 0x9] = op, [key | 0xA] = op, [key | 0xB] = op,        \
+    [key | 0xC] = op, [key | 0xD] = op, [key | 0xE] = op, [key | 0xF] = op
+
+static const uint8_t _chip8_Decode0[256] = {CHIP8_DECODE_N(0xC0, CHIP8_OP_00Cn), CHIP8_DECODE_N(0xD0, CHIP8_OP_00Dn),
+                                            [0xE0] = CHIP8_OP_00E0, [0xEE] = CHIP8_OP_00EE, [0xFB] = CHIP8_OP_00FB,
+                                            [0xFC] = CHIP8_OP_00FC, [0xFD] = CHIP8_OP_00FD, [0xFE] = CHIP8_OP_00FE,
+                                            [0xFF] = CHIP8_OP_00FF};
+static const uint8_t _chip8_Decode5[16] = {[0x0] = CHIP8_OP_5xy0, [0x2] = CHIP8_OP_5xy2, [0x3] = CHIP8_OP_5xy3};
+static const uint8_t _chip8_Decode8[16] = {[0x0] = CHIP8_OP_8xy0, [0x1] = CHIP8_OP_8xy1, [0x2] = CHIP8_OP_8xy2,
+                                           [0x3] = CHIP8_OP_8xy3, [0x4] = CHIP8_OP_8xy4, [0x5] = CHIP8_OP_8xy5,
+                                           [0x6] = CHIP8_OP_8xy6, [0x7] = CHIP8_OP_8xy7, [0xE] = CHIP8_OP_8xyE};
+static const uint8_t _chip8_Decode9[16] = {[0x0] = CHIP8_OP_9xy0};
+static const uint8_t _chip8_DecodeE[256] = {[0x9E] = CHIP8_OP_Ex9E, [0xA1] = CHIP8_OP_ExA1};
+static const uint8_t _chip8_DecodeF[256] = {[0x00] = CHIP8_OP_F000, [0x01] = CHIP8_OP_Fn01, [0x02] = CHIP8_OP_F002,
+                                            [0x07] = CHIP8_OP_Fx07, [0x0A] = CHIP8_OP_Fx0A, [0x15] = CHIP8_OP_Fx15,
+                                            [0x18] = CHIP8_OP_Fx18, [0x1E] = CHIP8_OP_Fx1E, [0x29] = CHIP8_OP_Fx29,
+                                            [0x30] = CHIP8_OP_Fx30, [0x33] = CHIP8_OP_Fx33, [0x3A] = CHIP8_OP_Fx3A,
+                                            [0x55] = CHIP8_OP_Fx55, [0x65] = CHIP8_OP_Fx65, [0x75] = CHIP8_OP_Fx75,
+                                            [0x85] = CHIP8_OP_Fx85};
+#undef CHIP8_DECODE_N
+
+static const Chip8DecodeGroup _chip8_DecodeGroups[16] = {
+    [0x0] = {_chip8_Decode0, 0x0FFF}, [0x5] = {_chip8_Decode5, 0x000F}, [0x8] = {_chip8_Decode8, 0x000F},
+    [0x9] = {_chip8_Decode9, 0x000F}, [0xE] = {_chip8_DecodeE, 0x00FF}, [0xF] = {_chip8_DecodeF, 0x00FF}};
+
+// Internal op used for the 0000 instruction.  It behaves like UNKNOWN when processed on its own, but stops
+// chip8ExecuteInstructions() the same way the original run loop did.
+#define CHIP8_OP_HALT CHIP8_OP_COUNT
+
+// Handler for every Chip8Op (plus HALT), indexed by the decoded op
+static const Chip8Handler _chip8_Handlers[CHIP8_OP_COUNT + 1] = {
+#define CHIP8_OP_HANDLER(name) op##name,
+    CHIP8_OP_LIST(CHIP8_OP_HANDLER)
+#undef CHIP8_OP_HANDLER
+        opUNKNOWN,
+};
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static inline uint8_t chip8DecodeOpInline(uint16_t instruction)
+{
+    uint8_t op = _chip8_DecodeTop[instruction >> 12];
+    if (op == CHIP8_OP_GROUP)
     {
-        // 8xy7 - SUBN Vx, Vy
-        // Set Vx = Vy - Vx, set VF = NOT borrow. If Vy > Vx, then VF is set to 1, otherwise 0. Then Vx is
-        // subtracted from Vy, and the results stored in Vx.
-        if (_chip8_GenRegs[y] > _chip8_GenRegs[x])
-            _chip8_GenRegs[0xF] = 1;
-        else
-            _chip8_GenRegs[0xF] = 0;
+        // The 00xx instructions need the x nibble to be zero too, so group 0 is keyed by the low 12 bits
+        const Chip8DecodeGroup* group = &_chip8_DecodeGroups[instruction >> 12];
+        uint16_t key = instruction & group->keyMask;
+        op = key < 256 ? group->table[key] : CHIP8_OP_UNKNOWN;
+    }
+    return op;
+}
+
+Chip8Op chip8DecodeOp(uint16_t instruction) { return chip8DecodeOpInline(instruction); }
 
-        _chip8_GenRegs[x] = _chip8_GenRegs[y] - _chip8_GenRegs[x];
-        _chip8_ProgramCounter += 2;
+Chip8Handler chip8GetHandler(Chip8Op op) { return _chip8_Handlers[op]; }
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static inline void chip8Decode(Chip8Decoded* d, uint16_t instruction, uint16_t address)
+{
+    d->op = instruction == 0 ? CHIP8_OP_HALT : chip8DecodeOpInline(instruction);
+    d->x = (instruction & 0x0F00) >> 8;
+    d->y = (instruction & 0x00F0) >> 4;
+    d->kk = instruction & 0x00FF;
+    d->nnn = instruction & 0x0FFF;
+    d->nextPc = address + 2;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static inline const Chip8Decoded* chip8Fetch(Chip8Machine* m, Chip8Decoded* scratch)
+{
+    uint16_t pc = m->programCounter;
+
+    // Even addresses inside memory come from the decode cache, filling the entry on first use
+    if ((pc & ~(CHIP8_MEM_SIZE - 2)) == 0)
+    {
+        Chip8Decoded* d = &m->decodeCache[pc >> 1];
+        if (d->op == CHIP8_OP_NOT_DECODED) chip8Decode(d, chip8ReadInstruction(m), pc);
+        return d;
     }
-    else if ((instruction & 0xF00F) == 0x800E)
+
+    // Misaligned or out of range jumps are rare, so they are simply decoded every time
+    chip8Decode(scratch, chip8ReadInstruction(m), pc);
+    return scratch;
+}
+
+// ********************************************************************************************************************
+// Superinstructions.  Each one runs the regular handlers of its sequence back to back on consecutive decode cache
+// entries, so registers, VF and the PC end up exactly as if the instructions had been dispatched one by one, and
+// returns the number of instructions it executed.
+// ********************************************************************************************************************
+typedef uint32_t (*Chip8FusionHandler)(Chip8Machine* m, const Chip8Decoded* d);
+
+#define CHIP8_FUSION_MAX_LENGTH 3 // Instructions in the longest sequence
+
+// first, then a skip that may jump over the final 1nnn.  A taken skip leaves the PC past the jump after 2 instructions.
+#define CHIP8_FUSE_SKIP_JUMP(first, skip)                                                                              \
+    static uint32_t fuse##first##_##skip##_1nnn(Chip8Machine* m, const Chip8Decoded* d)                                \
+    {                                                                                                                  \
+        op##first(m, d);                                                                                               \
+        op##skip(m, d + 1);                                                                                            \
+        if (m->programCounter != d[1].nextPc) return 2;                                                                \
+        op1nnn(m, d + 2);                                                                                              \
+        return 3;                                                                                                      \
+    }
+
+CHIP8_FUSE_SKIP_JUMP(Fx07, 3xkk)
+CHIP8_FUSE_SKIP_JUMP(Fx07, 4xkk)
+CHIP8_FUSE_SKIP_JUMP(7xkk, 3xkk)
+CHIP8_FUSE_SKIP_JUMP(7xkk, 4xkk)
+#undef CHIP8_FUSE_SKIP_JUMP
+
+static uint32_t fuseAnnn_Dxyn(Chip8Machine* m, const Chip8Decoded* d)
+{
+    opAnnn(m, d);
+    opDxyn(m, d + 1);
+    return 2;
+}
+
+// Handler, instructions and name of every Chip8Fusion, indexed by the fusion.  NONE is never dispatched.
+static const Chip8FusionHandler _chip8_FusionHandlers[CHIP8_FUSION_COUNT] = {
+    NULL,
+#define CHIP8_FUSION_HANDLER(name) fuse##name,
+    CHIP8_FUSION_LIST(CHIP8_FUSION_HANDLER)
+#undef CHIP8_FUSION_HANDLER
+};
+
+static const uint8_t _chip8_FusionOps[CHIP8_FUSION_COUNT][CHIP8_FUSION_MAX_LENGTH] = {
+    [CHIP8_FUSION_Fx07_3xkk_1nnn] = {CHIP8_OP_Fx07, CHIP8_OP_3xkk, CHIP8_OP_1nnn},
+    [CHIP8_FUSION_Fx07_4xkk_1nnn] = {CHIP8_OP_Fx07, CHIP8_OP_4xkk, CHIP8_OP_1nnn},
+    [CHIP8_FUSION_7xkk_3xkk_1nnn] = {CHIP8_OP_7xkk, CHIP8_OP_3xkk, CHIP8_OP_1nnn},
+    [CHIP8_FUSION_7xkk_4xkk_1nnn] = {CHIP8_OP_7xkk, CHIP8_OP_4xkk, CHIP8_OP_1nnn},
+    [CHIP8_FUSION_Annn_Dxyn] = {CHIP8_OP_Annn, CHIP8_OP_Dxyn},
+};
+
+static const char* const _chip8_FusionNames[CHIP8_FUSION_COUNT] = {
+    "none",
+#define CHIP8_FUSION_NAME(name) #name,
+    CHIP8_FUSION_LIST(CHIP8_FUSION_NAME)
+#undef CHIP8_FUSION_NAME
+};
+
+// Name of every Chip8Op, as in CHIP8_OP_LIST
+static const char* const _chip8_OpNames[CHIP8_OP_COUNT] = {
+#define CHIP8_OP_NAME(name) #name,
+    CHIP8_OP_LIST(CHIP8_OP_NAME)
+#undef CHIP8_OP_NAME
+};
+
+const char* chip8GetOpName(Chip8Op op) { return _chip8_OpNames[op]; }
+
+const char* chip8GetFusionName(Chip8Fusion fusion) { return _chip8_FusionNames[fusion]; }
+
+void chip8GetFusionStats(Chip8Machine* m, Chip8FusionStats* stats) { *stats = m->fusionStats; }
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static uint32_t chip8FusionLength(Chip8Fusion fusion)
+{
+    uint32_t length = 0;
+    while (length < CHIP8_FUSION_MAX_LENGTH && _chip8_FusionOps[fusion][length] != CHIP8_OP_UNKNOWN) length++;
+    return length;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static uint8_t chip8MatchFusion(Chip8Machine* m, uint16_t pc)
+{
+    // Decode the instructions that may take part, filling their decode cache entries as the fused handlers read them
+    Chip8Decoded* d = &m->decodeCache[pc >> 1];
+    uint32_t available = CHIP8_MEM_SIZE / 2 - (pc >> 1);
+    if (available > CHIP8_FUSION_MAX_LENGTH) available = CHIP8_FUSION_MAX_LENGTH;
+    for (uint32_t i = 0; i < available; i++)
     {
-        // 8xyE - SHL Vx {, Vy}
-        // Set Vx = Vx SHL 1. If the most-significant bit of Vx is 1, then VF is set to 1, otherwise to 0. Then Vx
-        // is multiplied by 2. NOTE: This does not agree with other chip 8 instruction references?!
+        uint16_t address = pc + 2 * i;
+        if (d[i].op == CHIP8_OP_NOT_DECODED) chip8Decode(&d[i], (m->mem[address] << 8) | m->mem[address + 1], address);
+    }
 
-        uint8_t valToShift = _chip8_GenRegs[y];
-        if (_chip8_ShiftQuirkMode) valToShift = _chip8_GenRegs[x];
+    for (uint32_t fusion = CHIP8_FUSION_NONE + 1; fusion < CHIP8_FUSION_COUNT; fusion++)
+    {
+        uint32_t length = chip8FusionLength(fusion);
+        if (length > available) continue;
 
-        if ((valToShift & 0x80) == 0x80)
-            _chip8_GenRegs[0xF] = 1;
-        else
-            _chip8_GenRegs[0xF] = 0;
+        uint32_t i = 0;
+        while (i < length && d[i].op == _chip8_FusionOps[fusion][i]) i++;
+        if (i == length) return fusion;
+    }
+    return CHIP8_FUSION_NONE;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8InvalidateDecodeCache(Chip8Machine* m, uint32_t address, uint32_t length)
+{
+    if (length == 0 || address >= CHIP8_MEM_SIZE) return;
+
+    uint32_t last = address + length - 1;
+    if (last >= CHIP8_MEM_SIZE) last = CHIP8_MEM_SIZE - 1;
 
-        _chip8_GenRegs[x] = valToShift << 1;
-        _chip8_ProgramCounter += 2;
+    for (uint32_t entry = address >> 1; entry <= last >> 1; entry++)
+    {
+        m->decodeCache[entry].op = CHIP8_OP_NOT_DECODED;
     }
+
+    // A fused sequence is matched again if any of its instructions changed, so start up to the longest one earlier
+    uint32_t firstFusion = address >> 1;
+    firstFusion = firstFusion >= CHIP8_FUSION_MAX_LENGTH - 1 ? firstFusion - (CHIP8_FUSION_MAX_LENGTH - 1) : 0;
+    memset(m->fusionCache + firstFusion, CHIP8_FUSION_NOT_CHECKED, (last >> 1) - firstFusion + 1);
+
+    if (m->jit != NULL) chip8JitInvalidate(m, address, length);
+    if (m->aot != NULL) chip8AotInvalidate(m, address, length);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void chip8ProcessInstructionChain(Chip8Machine* m, uint16_t instruction, const Chip8Decoded* d)
+{
+    if (instruction == 0x00E0)
+        op00E0(m, d);
+    else if (instruction == 0x00EE)
+        op00EE(m, d);
+    else if ((instruction & 0xF000) == 0x1000)
+        op1nnn(m, d);
+    else if ((instruction & 0xF000) == 0x2000)
+        op2nnn(m, d);
+    else if ((instruction & 0xF000) == 0x3000)
+        op3xkk(m, d);
+    else if ((instruction & 0xF000) == 0x4000)
+        op4xkk(m, d);
+    else if ((instruction & 0xF00F) == 0x5000)
+        op5xy0(m, d);
+    else if ((instruction & 0xF000) == 0x6000)
+        op6xkk(m, d);
+    else if ((instruction & 0xF000) == 0x7000)
+        op7xkk(m, d);
+    else if ((instruction & 0xF00F) == 0x8000)
+        op8xy0(m, d);
+    else if ((instruction & 0xF00F) == 0x8001)
+        op8xy1(m, d);
+    else if ((instruction & 0xF00F) == 0x8002)
+        op8xy2(m, d);
+    else if ((instruction & 0xF00F) == 0x8003)
+        op8xy3(m, d);
+    else if ((instruction & 0xF00F) == 0x8004)
+        op8xy4(m, d);
+    else if ((instruction & 0xF00F) == 0x8005)
+        op8xy5(m, d);
+    else if ((instruction & 0xF00F) == 0x8006)
+        op8xy6(m, d);
+    else if ((instruction & 0xF00F) == 0x8007)
+        op8xy7(m, d);
+    else if ((instruction & 0xF00F) == 0x800E)
+        op8xyE(m, d);
     else if ((instruction & 0xF00F) == 0x9000)
+        op9xy0(m, d);
+    else if ((instruction & 0xF000) == 0xA000)
+        opAnnn(m, d);
+    else if ((instruction & 0xF000) == 0xB000)
+        opBnnn(m, d);
+    else if ((instruction & 0xF000) == 0xC000)
+        opCxkk(m, d);
+    else if ((instruction & 0xF000) == 0xD000)
+        opDxyn(m, d);
+    else if ((instruction & 0xF0FF) == 0xE09E)
+        opEx9E(m, d);
+    else if ((instruction & 0xF0FF) == 0xE0A1)
+        opExA1(m, d);
+    else if ((instruction & 0xF0FF) == 0xF007)
+        opFx07(m, d);
+    else if ((instruction & 0xF0FF) == 0xF00A)
+        opFx0A(m, d);
+    else if ((instruction & 0xF0FF) == 0xF015)
+        opFx15(m, d);
+    else if ((instruction & 0xF0FF) == 0xF018)
+        opFx18(m, d);
+    else if ((instruction & 0xF0FF) == 0xF01E)
+        opFx1E(m, d);
+    else if ((instruction & 0xF0FF) == 0xF029)
+        opFx29(m, d);
+    else if ((instruction & 0xF0FF) == 0xF033)
+        opFx33(m, d);
+    else if ((instruction & 0xF0FF) == 0xF055)
+        opFx55(m, d);
+    else if ((instruction & 0xF0FF) == 0xF065)
+        opFx65(m, d);
+    else if ((instruction & 0xFFF0) == 0x00C0)
+        op00Cn(m, d);
+    else if ((instruction & 0xFFF0) == 0x00D0)
+        op00Dn(m, d);
+    else if (instruction == 0x00FB)
+        op00FB(m, d);
+    else if (instruction == 0x00FC)
+        op00FC(m, d);
+    else if (instruction == 0x00FD)
+        op00FD(m, d);
+    else if (instruction == 0x00FE)
+        op00FE(m, d);
+    else if (instruction == 0x00FF)
+        op00FF(m, d);
+    else if ((instruction & 0xF00F) == 0x5002)
+        op5xy2(m, d);
+    else if ((instruction & 0xF00F) == 0x5003)
+        op5xy3(m, d);
+    else if ((instruction & 0xF0FF) == 0xF000)
+        opF000(m, d);
+    else if ((instruction & 0xF0FF) == 0xF001)
+        opFn01(m, d);
+    else if ((instruction & 0xF0FF) == 0xF002)
+        opF002(m, d);
+    else if ((instruction & 0xF0FF) == 0xF030)
+        opFx30(m, d);
+    else if ((instruction & 0xF0FF) == 0xF03A)
+        opFx3A(m, d);
+    else if ((instruction & 0xF0FF) == 0xF075)
+        opFx75(m, d);
+    else if ((instruction & 0xF0FF) == 0xF085)
+        opFx85(m, d);
+    else
+        opUNKNOWN(m, d);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8ProcessInstruction(Chip8Machine* m, uint16_t instruction)
+{
+    if (m->debugString) chip8BuildDebugString(m, instruction);
+
+    // The instruction doesn't necessarily come from memory, so it is decoded without touching the cache
+    Chip8Decoded d;
+    chip8Decode(&d, instruction, m->programCounter);
+
+    if (m->dispatch == CHIP8_DISPATCH_CHAIN)
+        chip8ProcessInstructionChain(m, instruction, &d);
+    else
+        _chip8_Handlers[d.op](m, &d);
+}
+
+#if defined(__GNUC__)
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static uint32_t chip8ExecuteThreaded(Chip8Machine* m, uint32_t count)
+{
+    // One label per Chip8Op.  Every handler jumps straight to the handler of the next instruction instead of returning
+    // to a central loop, which gives the branch predictor one indirect jump per opcode to learn.
+#define CHIP8_OP_LABEL(name) &&label##name,
+    static void* const labels[CHIP8_OP_COUNT + 1] = {CHIP8_OP_LIST(CHIP8_OP_LABEL) &&labelHALT};
+#undef CHIP8_OP_LABEL
+
+    uint32_t executed = 0;
+    Chip8Decoded scratch;
+    const Chip8Decoded* d;
+
+#define CHIP8_DISPATCH_NEXT()                                                                                          \
+    if (executed == count) return executed;                                                                            \
+    d = chip8Fetch(m, &scratch);                                                                                       \
+    if (m->debugString && d->op != CHIP8_OP_HALT) chip8BuildDebugString(m, chip8ReadInstruction(m));                   \
+    executed++;                                                                                                        \
+    goto* labels[d->op];
+
+    CHIP8_DISPATCH_NEXT();
+
+#define CHIP8_OP_BODY(name)                                                                                            \
+    label##name : op##name(m, d);                                                                                      \
+    CHIP8_DISPATCH_NEXT();
+    CHIP8_OP_LIST(CHIP8_OP_BODY)
+#undef CHIP8_OP_BODY
+#undef CHIP8_DISPATCH_NEXT
+
+labelHALT:
+    return executed - 1;
+}
+#endif
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static uint32_t chip8ExecuteTable(Chip8Machine* m, uint32_t count)
+{
+    uint32_t executed = 0;
+    Chip8Decoded scratch;
+    while (executed < count)
     {
-        // 9xy0 - SNE Vx, Vy
-        // Skip next instruction if Vx != Vy. The values of Vx and Vy are compared, and if they are not equal, the
-        // program counter is increased by 2.
-        _chip8_ProgramCounter += 2;
-        if (_chip8_GenRegs[x] != _chip8_GenRegs[y])
+        const Chip8Decoded* d = chip8Fetch(m, &scratch);
+        if (d->op == CHIP8_OP_HALT) break;
+        if (m->debugString) chip8BuildDebugString(m, chip8ReadInstruction(m));
+        _chip8_Handlers[d->op](m, d);
+        executed++;
+    }
+    return executed;
+}
+
+// Ops that write Vx, whose new value goes in the trace record
+static const bool _chip8_TraceWritesVx[CHIP8_OP_COUNT + 1] = {
+    [CHIP8_OP_6xkk] = true, [CHIP8_OP_7xkk] = true, [CHIP8_OP_8xy0] = true, [CHIP8_OP_8xy1] = true,
+    [CHIP8_OP_8xy2] = true, [CHIP8_OP_8xy3] = true, [CHIP8_OP_8xy4] = true, [CHIP8_OP_8xy5] = true,
+    [CHIP8_OP_8xy6] = true, [CHIP8_OP_8xy7] = true, [CHIP8_OP_8xyE] = true, [CHIP8_OP_Cxkk] = true,
+    [CHIP8_OP_Fx07] = true, [CHIP8_OP_Fx0A] = true, [CHIP8_OP_Fx65] = true, [CHIP8_OP_5xy3] = true,
+    [CHIP8_OP_Fx85] = true,
+};
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// TABLE plus a trace record after every instruction
+static uint32_t chip8ExecuteTraced(Chip8Machine* m, uint32_t count)
+{
+    // The ring position lives in locals: stores to the byte-sized record fields may alias anything, and would make the
+    // compiler reload it from the trace after every one
+    Chip8Trace* trace = m->trace;
+    Chip8TraceRecord* records = trace->records;
+    uint32_t mask = trace->writer.capacity - 1;
+    uint32_t head = trace->headLocal;
+    uint32_t executed = 0;
+    Chip8Decoded scratch;
+    while (executed < count)
+    {
+        const Chip8Decoded* d = chip8Fetch(m, &scratch);
+        if (d->op == CHIP8_OP_HALT) break;
+        uint16_t pc = m->programCounter;
+        uint16_t instruction = chip8ReadInstruction(m);
+        if (m->debugString) chip8BuildDebugString(m, instruction);
+
+        _chip8_Handlers[d->op](m, d);
+        executed++;
+
+        if (head - trace->tailCached == mask + 1)
         {
-            _chip8_ProgramCounter += 2;
+            trace->headLocal = head;
+            chip8TraceWaitForSpace(trace);
         }
+        Chip8TraceRecord record;
+        record.pc = pc;
+        record.opcode = instruction;
+        record.i = m->i;
+        record.reg = _chip8_TraceWritesVx[d->op] ? d->x : CHIP8_TRACE_NO_REGISTER;
+        record.value = m->genRegs[d->x];
+        record.vf = m->genRegs[0xF];
+        record.dt = m->delayTimerReg;
+        record.st = m->soundTimerReg;
+        record.sp = m->stackPointer;
+        record.frame = (uint32_t)m->frameCount;
+        records[head++ & mask] = record;
     }
-    else if ((instruction & 0xF000) == 0xA000)
+    trace->headLocal = head;
+    chip8TracePublish(trace);
+    return executed;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// TABLE plus counting every instruction for the profiler
+static uint32_t chip8ExecuteProfiled(Chip8Machine* m, uint32_t count)
+{
+    // The counts and the current node live in locals for the same reason as in chip8ExecuteTraced()
+    Chip8Profile* profile = m->profile;
+    uint64_t* hits = profile->hits;
+    uint64_t* ops = profile->ops;
+    Chip8ProfileNode* nodes = profile->nodes;
+    uint32_t node = profile->node;
+    uint32_t executed = 0;
+    Chip8Decoded scratch;
+    while (executed < count)
     {
-        // Annn - LD I, addr
-        // Set I = nnn. The value of register I is set to nnn.
-        _chip8_I = nnn;
-        _chip8_ProgramCounter += 2;
+        const Chip8Decoded* d = chip8Fetch(m, &scratch);
+        if (d->op == CHIP8_OP_HALT) break;
+        uint16_t pc = m->programCounter;
+        if (m->debugString) chip8BuildDebugString(m, chip8ReadInstruction(m));
+
+        _chip8_Handlers[d->op](m, d);
+        executed++;
+
+        // The call is charged to the caller and the return to the subroutine
+        hits[pc >> 1]++;
+        ops[d->op]++;
+        nodes[node].self++;
+        if (d->op == CHIP8_OP_2nnn)
+            node = chip8ProfileCall(profile, node, d->nnn);
+        else if (d->op == CHIP8_OP_00EE)
+            node = chip8ProfileReturn(profile, node);
     }
-    else if ((instruction & 0xF000) == 0xB000)
+    profile->node = node;
+    return executed;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static uint32_t chip8ExecuteFused(Chip8Machine* m, uint32_t count)
+{
+    uint32_t executed = 0;
+    Chip8Decoded scratch;
+    while (executed < count)
     {
-        // Bnnn - JP V0, addr
-        // Jump to location nnn + V0. The program counter is set to nnn plus the value of V0.
-        _chip8_ProgramCounter = nnn + _chip8_GenRegs[0];
+        const Chip8Decoded* d;
+        uint16_t pc = m->programCounter;
+        if ((pc & ~(CHIP8_MEM_SIZE - 2)) == 0)
+        {
+            // Matching a sequence decodes its instructions, and invalidating any of them resets the match, so a checked
+            // fusion cache entry always comes with a filled decode cache entry
+            uint8_t fusion = m->fusionCache[pc >> 1];
+            if (fusion == CHIP8_FUSION_NOT_CHECKED) fusion = m->fusionCache[pc >> 1] = chip8MatchFusion(m, pc);
+            d = &m->decodeCache[pc >> 1];
+
+            // A sequence only runs if it fits in what is left of count, to keep the instruction count exact
+            if (fusion != CHIP8_FUSION_NONE && count - executed >= CHIP8_FUSION_MAX_LENGTH)
+            {
+                uint32_t ran = _chip8_FusionHandlers[fusion](m, d);
+                m->fusionStats.hits[fusion]++;
+                m->fusionStats.instructions[fusion] += ran;
+                executed += ran;
+                continue;
+            }
+        }
+        else
+        {
+            // Sequences are only matched at even addresses, where the instructions that follow are in the cache too
+            d = chip8Fetch(m, &scratch);
+        }
+
+        if (d->op == CHIP8_OP_HALT) break;
+        _chip8_Handlers[d->op](m, d);
+        executed++;
     }
-    else if ((instruction & 0xF000) == 0xC000)
+    m->fusionStats.executed += executed;
+    return executed;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static uint32_t chip8ExecuteCompiled(Chip8Machine* m, uint32_t count)
+{
+    uint32_t executed = 0;
+    while (executed < count)
     {
-        // Cxkk - RND Vx, byte
-        // Set Vx = random byte AND kk. The interpreter generates a random number from 0 to 255, which is then ANDed
-        // with the value kk. The results are stored in Vx. See instruction 8xy2 for more information on AND.
-        _chip8_GenRegs[x] = (rand() % 256) & kk;
-        _chip8_ProgramCounter += 2;
+        // Compiled blocks only run whole, so near the end of count (or where there is no usable block) the interpreter
+        // steps single instructions to keep the instruction count exact
+        uint32_t left = count - executed;
+        uint32_t ran = m->dispatch == CHIP8_DISPATCH_AOT ? chip8AotRun(m, left) : chip8JitRun(m, left);
+        if (ran == 0) ran = chip8ExecuteTable(m, 1);
+        if (ran == 0) break;
+        executed += ran;
     }
-    else if ((instruction & 0xF000) == 0xD000)
+    return executed;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static uint32_t chip8ExecuteEngine(Chip8Machine* m, uint32_t count)
+{
+    uint32_t executed = 0;
+
+    // Tracing and profiling see every instruction, which only the plain interpreter loop can do
+    if (m->trace != NULL && m->trace->active) return chip8ExecuteTraced(m, count);
+    if (m->profile != NULL && m->profile->active) return chip8ExecuteProfiled(m, count);
+
+    if (m->dispatch == CHIP8_DISPATCH_CHAIN)
     {
-        // Dxyn - DRW Vx, Vy, nibble
-        // Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision. The interpreter
-        // reads n bytes from memory, starting at the address stored in I. These bytes are then displayed as sprites
-        // on screen at coordinates (Vx, Vy). Sprites are XORed onto the existing screen. If this causes any pixels
-        // to be erased, VF is set to 1, otherwise it is set to 0. If the sprite is positioned so part of it is
-        // outside the coordinates of the display, it wraps around to the opposite side of the screen. See
-        // instruction 8xy3 for more information on XOR, and section 2.4, Display, for more information on the
-        // Chip-8 screen and sprites.
-
-        uint8_t x = _chip8_GenRegs[(instruction & 0x0F00) >> 8];
-        uint8_t y = _chip8_GenRegs[(instruction & 0x00F0) >> 4];
-        bool pixelCleared = false;
-        for (int rowNum = 0; rowNum < n; rowNum++)
+        // The original path: fetch, then classify with the if/else chain, every single time
+        while (executed < count)
         {
-            uint8_t row = _chip8_Mem[_chip8_I + rowNum]; // Read a row of pixels
+            uint16_t ins = chip8ReadInstruction(m);
+            if (ins == 0) break;
+            chip8ProcessInstruction(m, ins);
+            executed++;
+        }
+        return executed;
+    }
 
-            // Display on the screen, start with MSB because it's "left most"
-            for (int bitNum = 7; bitNum >= 0; bitNum--)
-            {
-                bool bit = (row >> bitNum) & 0x01;
+#if defined(__GNUC__)
+    if (m->dispatch == CHIP8_DISPATCH_THREADED) return chip8ExecuteThreaded(m, count);
+#endif
 
-                uint8_t bitOffset = 7 - bitNum;
+    // Compiled blocks can't build the debug string, so they only take over when it is turned off
+    if (m->dispatch == CHIP8_DISPATCH_JIT && m->jit != NULL && !m->debugString) return chip8ExecuteCompiled(m, count);
+    // Ahead of time compiled ROMs are classic CHIP-8 code, so the other variants fall back to the table
+    if (m->dispatch == CHIP8_DISPATCH_AOT && m->aot != NULL && !m->debugString && m->variant == CHIP8_VARIANT_CHIP8)
+        return chip8ExecuteCompiled(m, count);
 
-                // Get the x/y positions considering the bit # and row # of the sprite
-                uint8_t xPos = x + bitOffset;
-                uint8_t yPos = y + rowNum;
-                xPos %= CHIP8_SCREEN_WIDTH;
-                yPos %= CHIP8_SCREEN_HEIGHT;
+    // Superinstructions can't build the debug string for the instructions inside them either
+    if (m->dispatch == CHIP8_DISPATCH_FUSED && !m->debugString) return chip8ExecuteFused(m, count);
 
-                bool oldValue = _chip8_Screen[xPos][yPos];
+    return chip8ExecuteTable(m, count);
+}
 
-                // XOR the bit into the screen
-                _chip8_Screen[xPos][yPos] ^= bit;
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8PublishScreen(Chip8Machine* m)
+{
+    Chip8Frame* frame = &m->frames[m->frameBack];
+    chip8CopyScreen(&frame->screen, &m->screen);
+    frame->damageRows = m->damageRows | m->frameCarryRows;
+    for (uint32_t w = 0; w < CHIP8_ROW_WORDS; w++)
+    {
+        frame->damageColumns[w] = m->damageColumns[w] | m->frameCarryColumns[w];
+    }
+    frame->generation = ++m->frameGeneration;
+    frame->keyChanges = m->frameKeyChanges;
 
-                if (oldValue && !_chip8_Screen[xPos][yPos])
-                {
-                    pixelCleared = true;
-                }
-            }
-        }
+    // Swap the finished frame in as the middle one.  The frame that comes back is the one to fill next: either the
+    // previous middle frame, or the renderer's old front frame if the renderer took a frame in the meantime.
+    uint32_t old = platformAtomicExchange(&m->frameMiddle, m->frameBack | CHIP8_FRAME_FRESH);
+    m->frameBack = old & ~CHIP8_FRAME_FRESH;
 
-        _chip8_GenRegs[0xF] = pixelCleared;
-        _chip8_ProgramCounter += 2;
-    }
-    else if ((instruction & 0xF0FF) == 0xE09E)
+    // If the renderer never took the frame that was replaced, it hasn't seen the damage of that frame either.  The new
+    // frame already includes it, so the next one has to include all of the new frame's damage.
+    bool fresh = (old & CHIP8_FRAME_FRESH) != 0;
+    m->frameCarryRows = fresh ? frame->damageRows : m->damageRows;
+    for (uint32_t w = 0; w < CHIP8_ROW_WORDS; w++)
     {
-        // Ex9E - SKP Vx
-        // Skip next instruction if key with the value of Vx is pressed. Checks the keyboard, and if the key
-        // corresponding to the value of Vx is currently in the down position, PC is increased by 2.
-        uint8_t key = _chip8_GenRegs[x];
-        _chip8_ProgramCounter += 2;
-        if (_chip8_Keyboard[key])
-        {
-            _chip8_ProgramCounter += 2;
-        }
+        m->frameCarryColumns[w] = fresh ? frame->damageColumns[w] : m->damageColumns[w];
+        m->damageColumns[w] = 0;
     }
-    else if ((instruction & 0xF0FF) == 0xE0A1)
+    m->damageRows = 0;
+
+    // The exchange above is a full barrier, so either the renderer sees the frame before it waits or this sees it wait
+    if (platformAtomicLoad(&m->screenWaiting))
     {
-        // ExA1 - SKNP Vx
-        // Skip next instruction if key with the value of Vx is not pressed. Checks the keyboard, and if the key
-        // corresponding to the value of Vx is currently in the up position, PC is increased by 2.
-        uint8_t key = _chip8_GenRegs[x];
-        _chip8_ProgramCounter += 2;
-        if (!_chip8_Keyboard[key])
-        {
-            _chip8_ProgramCounter += 2;
-        }
+        platformMutexLock(&m->screenMutex);
+        platformConditionSignal(&m->screenCondition);
+        platformMutexUnlock(&m->screenMutex);
     }
-    else if ((instruction & 0xF0FF) == 0xF007)
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+uint32_t chip8ExecuteInstructions(Chip8Machine* m, uint32_t count)
+{
+    uint32_t executed = chip8ExecuteEngine(m, count);
+    m->instructionCount += executed;
+
+    // The renderer gets a complete frame at the end of every call that drew something, which is every 60 Hz frame (or
+    // more often) for the run loop and the headless tools
+    if (m->damageRows != 0) chip8PublishScreen(m);
+    return executed;
+}
+
+// ********************************************************************************************************************
+// Idle loops.  Most ROMs wait by spinning in a loop that does nothing but poll the delay timer or a key, and the timers
+// only change at the end of a frame and the keys at the start of one.  Once the machine spins in such a loop it will
+// keep spinning until the frame ends, so the rest of its iterations can be counted instead of executed.
+// ********************************************************************************************************************
+#define CHIP8_IDLE_MAX_LENGTH 3 // Instructions in the longest idle loop recognized
+#define CHIP8_IDLE_FIRST_SLICE 32 // Instructions a frame runs before the first check for an idle loop
+#define CHIP8_IDLE_LAST_SLICE 512 // Most instructions run between checks, the slices double up to it
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Returns the length in instructions of the idle loop starting at head, decoded into d, if the machine is spinning in
+// it: another iteration would run and leave the machine exactly as it is.  Returns 0 otherwise.
+static uint32_t chip8MatchIdleLoop(Chip8Machine* m, uint16_t head, Chip8Decoded* d)
+{
+    uint32_t count = 0;
+    for (; count < CHIP8_IDLE_MAX_LENGTH && head + count * 2 + 1 < CHIP8_MEM_SIZE; count++)
     {
-        // Fx07 - LD Vx, DT
-        // Set Vx = delay timer value. The value of DT is placed into Vx.
-        _chip8_GenRegs[x] = _chip8_DelayTimerReg;
-        _chip8_ProgramCounter += 2;
+        uint16_t address = head + count * 2;
+        chip8Decode(&d[count], m->mem[address] << 8 | m->mem[address + 1], address);
     }
-    else if ((instruction & 0xF0FF) == 0xF00A)
+    if (count == 0) return 0;
+
+    // A jump to itself, the way many ROMs end
+    if (d[0].op == CHIP8_OP_1nnn) return d[0].nnn == head ? 1 : 0;
+
+    // The SUPER-CHIP exit, which leaves the PC where it is
+    if (d[0].op == CHIP8_OP_00FD) return m->variant != CHIP8_VARIANT_CHIP8 ? 1 : 0;
+
+    // Fx0A waiting for a key while none is held
+    if (d[0].op == CHIP8_OP_Fx0A)
     {
-        // Fx0A - LD Vx, K
-        // Wait for a key press, store the value of the key in Vx. All execution stops until a key is pressed, then
-        // the value of that key is stored in Vx.
-        uint32_t key = 0;
-        do
+        for (uint32_t key = 0; key <= 0xF; key++)
         {
-            if (_chip8_Keyboard[key])
-            {
-                _chip8_GenRegs[x] = key;
-                _chip8_ProgramCounter += 2; // Only increment PC on key press
-                break;
-            }
-        } while (++key <= 0xF);
+            if (m->keyboard[key]) return 0;
+        }
+        return 1;
     }
-    else if ((instruction & 0xF0FF) == 0xF015)
+
+    // Ex9E or ExA1 and a jump back to it, waiting for a key to be pressed or released
+    if ((d[0].op == CHIP8_OP_Ex9E || d[0].op == CHIP8_OP_ExA1) && count >= 2 && d[1].op == CHIP8_OP_1nnn &&
+        d[1].nnn == head)
     {
-        // Fx15 - LD DT, Vx
-        // Set delay timer = Vx. DT is set equal to the value of Vx.
-        _chip8_DTLastSetValue = _chip8_DelayTimerReg = _chip8_GenRegs[x];
-        QueryPerformanceCounter(&_chip8_DTStartTick);
-        _chip8_ProgramCounter += 2;
+        uint8_t key = m->genRegs[d[0].x];
+        return key <= 0xF && m->keyboard[key] == (d[0].op == CHIP8_OP_ExA1) ? 2 : 0;
     }
-    else if ((instruction & 0xF0FF) == 0xF018)
+
+    // Fx07, then 3xkk or 4xkk on the same register and a jump back, waiting for DT to reach or leave kk.  Vx has to
+    // hold DT already, as it does after the first iteration in a frame.
+    if (d[0].op == CHIP8_OP_Fx07 && count >= 3 && (d[1].op == CHIP8_OP_3xkk || d[1].op == CHIP8_OP_4xkk) &&
+        d[1].x == d[0].x && d[2].op == CHIP8_OP_1nnn && d[2].nnn == head)
     {
-        // Fx18 - LD ST, Vx
-        // Set sound timer = Vx. ST is set equal to the value of Vx.
-        _chip8_STLastSetValue = _chip8_SoundTimerReg = _chip8_GenRegs[x];
-        QueryPerformanceCounter(&_chip8_STStartTick);
-        _chip8_ProgramCounter += 2;
+        uint8_t dt = m->delayTimerReg;
+        return m->genRegs[d[0].x] == dt && (dt == d[1].kk) == (d[1].op == CHIP8_OP_4xkk) ? 3 : 0;
     }
-    else if ((instruction & 0xF0FF) == 0xF01E)
+    return 0;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Returns the length of the idle loop the machine is spinning in, decoded into d, or 0 if it isn't in one.  The PC can
+// be at any instruction of the loop.
+static uint32_t chip8FindIdleLoop(Chip8Machine* m, Chip8Decoded* d)
+{
+    uint16_t pc = m->programCounter;
+    for (uint32_t back = 0; back < CHIP8_IDLE_MAX_LENGTH && back * 2 <= pc; back++)
     {
-        // Fx1E - ADD I, Vx
-        // Set I = I + Vx. The values of I and Vx are added, and the results are stored in I.
-        _chip8_I += _chip8_GenRegs[x];
-        _chip8_ProgramCounter += 2;
+        uint32_t length = chip8MatchIdleLoop(m, pc - back * 2, d);
+        if (length > back) return length;
     }
-    else if ((instruction & 0xF0FF) == 0xF029)
+    return 0;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// If the machine is spinning in an idle loop, counts as many whole iterations of it as executed as fit in the frame,
+// always leaving at least one cycle and at most maxInstructions instructions.  The rest of the frame then runs as
+// usual, so it ends exactly as if every iteration had been executed.  Returns the number of instructions counted.
+static uint32_t chip8SkipIdleLoop(Chip8Machine* m, uint32_t maxInstructions)
+{
+    if (m->frameCycles <= 1) return 0;
+
+    // A whole number of iterations brings the PC back to where it is, wherever in the loop that is
+    Chip8Decoded d[CHIP8_IDLE_MAX_LENGTH];
+    uint32_t length = chip8FindIdleLoop(m, d);
+    if (length == 0) return 0;
+
+    uint32_t cycles = length;
+    if (m->cycleCosts != NULL)
     {
-        // Fx29 - LD F, Vx
-        // Set I = location of sprite for digit Vx. The value of I is set to the location for the hexadecimal
-        // sprite corresponding to the value of Vx. See section 2.4, Display, for more information on the
-        // Chip-8 hexadecimal font.
-        _chip8_I = CHIP8_HEX_SPRITE_START_OFFSET + CHIP8_HEX_SPRITE_SIZE_PER * _chip8_GenRegs[x];
-        _chip8_ProgramCounter += 2;
+        cycles = 0;
+        for (uint32_t i = 0; i < length; i++) cycles += m->cycleCosts[d[i].op];
+        if (cycles == 0) return 0;
     }
-    else if ((instruction & 0xF0FF) == 0xF033)
+
+    uint32_t iterations = (uint32_t)(m->frameCycles - 1) / cycles;
+    if (iterations > maxInstructions / length) iterations = maxInstructions / length;
+    uint32_t skipped = iterations * length;
+    m->frameCycles -= iterations * cycles;
+    m->instructionCount += skipped;
+    m->idleInstructions += skipped;
+    return skipped;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static bool chip8WaitsForInput(Chip8Machine* m)
+{
+    // Only at the end of a frame, with nothing but a key change able to make the next one differ.  A movie that plays
+    // or a rewind would change the keys without one.
+    if (!m->skipIdleLoops || m->frameCycles > 0 || m->delayTimerReg != 0 || m->soundTimerReg != 0 || m->rewinding)
+        return false;
+    if (m->movie != NULL && m->movie->mode == CHIP8_MOVIE_PLAYING) return false;
+
+    uint32_t keys = 0;
+    for (uint32_t k = 0; k < 16; k++) keys |= (uint32_t)m->keyboard[k] << k;
+    if (keys != platformAtomicLoad(&m->keyInput)) return false;
+
+    // Every idle loop waits for DT or a key, if for anything, and DT has run out
+    Chip8Decoded d[CHIP8_IDLE_MAX_LENGTH];
+    return chip8FindIdleLoop(m, d) > 0;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void chip8BeginFrame(Chip8Machine* m)
+{
+    // Keys only change between frames, so what a frame does never depends on when the host delivered them.  While a
+    // movie plays the keys come from it instead, and while one records it notes the changes.
+    if (m->movie == NULL || m->movie->mode == CHIP8_MOVIE_IDLE || !chip8MovieLatchKeys(m->movie, m))
     {
-        // Fx33 - LD B, Vx
-        // Store BCD representation of Vx in memory locations I, I+1, and I+2. The interpreter takes the decimal
-        // value of Vx, and places the hundreds digit in memory at location in I, the tens digit at location I+1,
-        // and the ones digit at location I+2.
-        uint16_t memOffset = _chip8_I;
-        uint8_t value = _chip8_GenRegs[x];
-        uint8_t onesDigit = _chip8_GenRegs[x] % 10;
-        uint8_t tensDigit = ((_chip8_GenRegs[x] % 100) - onesDigit) / 10;
-        uint8_t hundredsDigit = ((_chip8_GenRegs[x] % 1000) - tensDigit - onesDigit) / 100;
-
-        _chip8_Mem[memOffset] = hundredsDigit;
-        _chip8_Mem[memOffset + 1] = tensDigit;
-        _chip8_Mem[memOffset + 2] = onesDigit;
-        _chip8_ProgramCounter += 2;
+        uint32_t keys = platformAtomicLoad(&m->keyInput);
+        for (uint32_t k = 0; k < 16; k++) m->keyboard[k] = (keys >> k) & 1;
     }
-    else if ((instruction & 0xF0FF) == 0xF055)
+    m->frameKeyChanges = platformAtomicLoad(&m->keyChanges);
+
+    // clockSpeed rarely divides evenly into frames, so the fraction left over is carried to the following ones
+    uint32_t cycles = m->clockSpeed + m->frameCycleFraction;
+    m->frameCycles += cycles / CHIP8_FRAME_RATE;
+    m->frameCycleFraction = cycles % CHIP8_FRAME_RATE;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void chip8EndFrame(Chip8Machine* m)
+{
+    // The tone sounds for every frame the sound timer runs in, so Fx18 with Vx = n beeps for exactly n frames
+    if (m->audio != NULL) chip8AudioFrame(m->audio, m->soundTimerReg > 0);
+
+    // The timers count down once per frame
+    if (m->delayTimerReg > 0) m->delayTimerReg--;
+    if (m->soundTimerReg > 0) m->soundTimerReg--;
+    m->frameCount++;
+
+    // The video gets the screen the frame ended on
+    if (m->capture != NULL && m->capture->active) chip8CaptureFrame(m->capture, m);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static uint32_t chip8ExecuteCycles(Chip8Machine* m, uint32_t maxInstructions)
+{
+    if (m->frameCycles <= 0) return 0;
+
+    // Traces and profiles account for every instruction, so idle loops run as usual while one is active
+    bool skipIdle = m->skipIdleLoops && (m->trace == NULL || !m->trace->active) &&
+                    (m->profile == NULL || !m->profile->active);
+
+    // With every instruction costing a cycle the whole budget goes to the dispatch engine in one go, or in slices with
+    // a check for an idle loop after each while those are skipped.  ROMs usually start to wait early in a frame, so
+    // the first slices are short, and later ones longer to keep the checks cheap in frames that never wait.
+    uint32_t executed = 0;
+    if (m->cycleCosts == NULL)
     {
-        // Fx55 - LD [I], Vx
-        // Store registers V0 through Vx in memory starting at location I. The interpreter copies the values of
-        // registers V0 through Vx into memory, starting at the address in I.
-        for (uint8_t i = 0; i <= x; i++)
+        uint32_t slice = CHIP8_IDLE_FIRST_SLICE;
+        while (m->frameCycles > 0 && executed < maxInstructions)
         {
-            _chip8_Mem[_chip8_I + i] = _chip8_GenRegs[i];
+            // The frame before often ended in the loop, so the first check comes before the first slice
+            if (skipIdle) executed += chip8SkipIdleLoop(m, maxInstructions - executed);
+            uint32_t left = maxInstructions - executed;
+            uint32_t count = (uint32_t)m->frameCycles < left ? (uint32_t)m->frameCycles : left;
+            if (skipIdle && count > slice) count = slice;
+            uint32_t ran = chip8ExecuteEngine(m, count);
+            m->instructionCount += ran;
+            m->frameCycles -= ran;
+            executed += ran;
+            if (ran < count) break;
+            if (slice < CHIP8_IDLE_LAST_SLICE) slice *= 2;
         }
-        _chip8_ProgramCounter += 2;
+
+        // Published once, as chip8ExecuteInstructions() would have done for the whole budget
+        if (m->damageRows != 0) chip8PublishScreen(m);
+        return executed;
     }
-    else if ((instruction & 0xF0FF) == 0xF065)
+
+    // Otherwise instructions are costed one by one.  The last one may overrun the budget.  Idle loops all end in a
+    // jump back or are a lone Fx0A, so only those are followed by a check for one.
+    while (m->frameCycles > 0 && executed < maxInstructions)
     {
-        // Fx65 - LD Vx, [I]
-        // Read registers V0 through Vx from memory starting at location I. The interpreter reads values from
-        // memory starting at location I into registers V0 through Vx.
-        for (uint8_t i = 0; i <= x; i++)
-        {
-            _chip8_GenRegs[i] = _chip8_Mem[_chip8_I + i];
-        }
-        _chip8_ProgramCounter += 2;
+        Chip8Op op = chip8DecodeOp(chip8ReadInstruction(m));
+        if (chip8ExecuteInstructions(m, 1) == 0) break;
+        m->frameCycles -= m->cycleCosts[op];
+        executed++;
+        if (skipIdle && (op == CHIP8_OP_1nnn || op == CHIP8_OP_Fx0A))
+            executed += chip8SkipIdleLoop(m, maxInstructions - executed);
     }
-    else
+    return executed;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+uint32_t chip8RunFrame(Chip8Machine* m)
+{
+    if (m->frameCycles <= 0) chip8BeginFrame(m);
+
+    uint32_t executed = chip8ExecuteCycles(m, UINT32_MAX);
+
+    // A machine stuck on a 0000 doesn't bank the cycles it couldn't use
+    if (m->frameCycles > 0) m->frameCycles = 0;
+    chip8EndFrame(m);
+    return executed;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+uint32_t chip8StepInstruction(Chip8Machine* m)
+{
+    // Frames too short to hold an instruction (clock speeds under 60 Hz) pass the same way they would when running
+    while (m->frameCycles <= 0)
+    {
+        chip8BeginFrame(m);
+        if (m->frameCycles <= 0) chip8EndFrame(m);
+    }
+
+    uint32_t executed = chip8ExecuteCycles(m, 1);
+    if (executed > 0 && m->frameCycles <= 0) chip8EndFrame(m);
+    return executed;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8Init(Chip8Machine* m)
+{
+    memset(m, 0, sizeof(*m));
+
+    platformMutexInit(&m->mutex);
+    platformMutexInit(&m->wakeMutex);
+    platformConditionInit(&m->wakeCondition);
+    platformMutexInit(&m->screenMutex);
+    platformConditionInit(&m->screenCondition);
+
+    m->dispatch = CHIP8_DISPATCH_TABLE;
+    m->debugString = true;
+    m->realTime = true;
+    m->skipIdleLoops = true;
+
+    // Frame 0 is filled first, 1 waits in the middle (and is not new) and 2 is the renderer's
+    m->frameBack = 0;
+    m->frameMiddle = 1;
+    m->frameFront = 2;
+
+    chip8SeedRandom(m, (uint64_t)time(NULL));
+    chip8InitState(m);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8Destroy(Chip8Machine* m)
+{
+    chip8JitDestroy(m);
+    chip8AotDetach(m);
+    free(m->autosaveBuffer);
+    m->autosaveBuffer = NULL;
+    platformMutexDestroy(&m->mutex);
+    platformConditionDestroy(&m->wakeCondition);
+    platformMutexDestroy(&m->wakeMutex);
+    platformConditionDestroy(&m->screenCondition);
+    platformMutexDestroy(&m->screenMutex);
+}
+
+// ********************************************************************************************************************
+// Variants.  Each one is the instruction set of an interpreter along with the quirks ROMs written for it expect, which
+// follow Octo's.
+// ********************************************************************************************************************
+typedef struct Chip8VariantInfo
+{
+    const char* name;      // Name the tools take
+    const char* extension; // File name extension of its ROMs
+    uint32_t memSize;      // Bytes of memory
+    bool shiftQuirk;       // Chip8Machine.shiftQuirkMode
+    bool loadStoreQuirk;   // Chip8Machine.loadStoreQuirkMode
+    bool jumpQuirk;        // Chip8Machine.jumpQuirkMode
+    bool clipQuirk;        // Chip8Machine.clipQuirkMode
+} Chip8VariantInfo;
+
+static const Chip8VariantInfo _chip8_Variants[CHIP8_VARIANT_COUNT] = {
+    [CHIP8_VARIANT_CHIP8] = {"chip8", ".ch8", CHIP8_CLASSIC_MEM_SIZE, true, false, false, false},
+    [CHIP8_VARIANT_SCHIP] = {"schip", ".sc8", CHIP8_CLASSIC_MEM_SIZE, true, false, true, true},
+    [CHIP8_VARIANT_XOCHIP] = {"xochip", ".xo8", CHIP8_MEM_SIZE, false, true, false, false},
+};
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8SetVariant(Chip8Machine* m, Chip8Variant variant)
+{
+    m->variant = variant < CHIP8_VARIANT_COUNT ? variant : CHIP8_VARIANT_CHIP8;
+    chip8InitState(m);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+Chip8Variant chip8GetRomVariant(const char* filename)
+{
+    const char* dot = strrchr(filename, '.');
+    for (uint32_t v = 0; dot != NULL && v < CHIP8_VARIANT_COUNT; v++)
     {
-        // Unknown instruction?!
+        // Extensions are compared without case, for Windows
+        const char* extension = _chip8_Variants[v].extension;
+        uint32_t c = 0;
+        while (extension[c] != 0 && tolower((unsigned char)dot[c]) == extension[c]) c++;
+        if (extension[c] == 0 && dot[c] == 0) return (Chip8Variant)v;
     }
+    return CHIP8_VARIANT_CHIP8;
+}
+
+const char* chip8GetVariantName(Chip8Variant variant)
+{
+    return variant < CHIP8_VARIANT_COUNT ? _chip8_Variants[variant].name : NULL;
+}
+
+uint32_t chip8GetMemorySize(Chip8Variant variant)
+{
+    return variant < CHIP8_VARIANT_COUNT ? _chip8_Variants[variant].memSize : CHIP8_CLASSIC_MEM_SIZE;
 }
 
 // ********************************************************************************************************************
 // ********************************************************************************************************************
-void chip8Init()
+static void chip8InitState(Chip8Machine* m)
 {
-    _chip8_SoundPlaying = false;
-    _chip8_Reset = false;
-    _chip8_StepMode = false;
-    _chip8_StepOnIt = false;
-    _chip8_StepRateLimit = 0.2;
+    m->reset = false;
+    m->stepMode = false;
+    m->stepOnIt = false;
+    m->stepRateLimit = 0.2;
 
-    _chip8_ClockSpeed = CHIP8_CLOCK_SPEED_HZ;
+    m->clockSpeed = CHIP8_CLOCK_SPEED_HZ;
+    m->frameCycles = 0;
+    m->frameCycleFraction = 0;
+    m->frameCount = 0;
+    m->instructionCount = 0;
+    m->idleInstructions = 0;
 
-    _chip8_Mutex = CreateMutex(NULL, FALSE, NULL);
-    _chip8_Mutex_Screen = CreateMutex(NULL, FALSE, NULL);
+    // The variant decides the memory size, the quirks and which instructions exist
+    const Chip8VariantInfo* variant = &_chip8_Variants[m->variant];
+    m->memSize = variant->memSize;
+    m->shiftQuirkMode = variant->shiftQuirk;
+    m->loadStoreQuirkMode = variant->loadStoreQuirk;
+    m->jumpQuirkMode = variant->jumpQuirk;
+    m->clipQuirkMode = variant->clipQuirk;
 
     // Clear registers/stack/memory space
-    memset(_chip8_Msg, 0, CHIP8_STR_SIZE);
-    memset(_chip8_Mem, 0, CHIP8_PROGRAM_START_OFFSET);
-    memset(_chip8_GenRegs, 0, 16);
-    memset(_chip8_Stack, 0, 32);
-    memset(_chip8_Screen, 0, CHIP8_SCREEN_WIDTH * CHIP8_SCREEN_HEIGHT);
-    memset(_chip8_Keyboard, 0, 16);
-    _chip8_I = _chip8_DelayTimerReg = _chip8_SoundTimerReg = _chip8_ProgramCounter = _chip8_StackPointer = 0;
-    _chip8_ProgramCounter = CHIP8_PROGRAM_START_OFFSET;
+    memset(m->msg, 0, CHIP8_STR_SIZE);
+    memset(m->mem, 0, CHIP8_PROGRAM_START_OFFSET);
+    memset(m->genRegs, 0, 16);
+    memset(m->stack, 0, 32);
+    memset(m->keyboard, 0, 16);
+    memset(m->rpl, 0, sizeof(m->rpl));
+    memset(m->audioPattern, 0, sizeof(m->audioPattern));
+    m->audioPitch = 64; // 4000 Hz
+
+    // Every variant starts in 64x32 with only the first plane
+    memset(&m->screen, 0, sizeof(m->screen));
+    m->screen.width = CHIP8_LORES_WIDTH;
+    m->screen.height = CHIP8_LORES_HEIGHT;
+    m->screen.planes = 1;
+    m->planeMask = 1;
+    chip8DamageScreen(m);
+    m->i = m->delayTimerReg = m->soundTimerReg = m->programCounter = m->stackPointer = 0;
+    m->programCounter = CHIP8_PROGRAM_START_OFFSET;
 
     // Load hex digit sprites:
     // clang-format off
@@ -508,34 +1977,95 @@ void chip8Init()
         0xF0, 0x80, 0xF0, 0x80, 0x80  // F
     };
     // clang-format on
-    memcpy(_chip8_Mem + CHIP8_HEX_SPRITE_START_OFFSET, letters, 80);
+    memcpy(m->mem + CHIP8_HEX_SPRITE_START_OFFSET, letters, 80);
+
+    // And the 8x10 ones, for the variants that have Fx30.  These are Octo's.
+    // clang-format off
+    unsigned char bigLetters[160] = {
+        0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+        0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+        0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+        0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+        0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+        0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+    };
+    // clang-format on
+    if (m->variant != CHIP8_VARIANT_CHIP8) memcpy(m->mem + CHIP8_BIG_SPRITE_START_OFFSET, bigLetters, 160);
+    chip8InvalidateDecodeCache(m, 0, CHIP8_MEM_SIZE);
+
+    m->running = true;
+}
 
-    // Initialize rng
-    time_t t;
-    srand((unsigned)time(&t));
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8Shutdown(Chip8Machine* m)
+{
+    m->running = false;
+    chip8Wake(m);
+}
 
-    // Many ROMs assume quirky shifting
-    // TODO: Make this configurable?
-    _chip8_ShiftQuirkMode = true;
+void chip8Reset(Chip8Machine* m)
+{
+    m->reset = true;
+    chip8Wake(m);
+}
 
-    _chip8_Running = true;
+void chip8Wake(Chip8Machine* m)
+{
+    platformMutexLock(&m->wakeMutex);
+    m->wakeups++;
+    platformConditionSignal(&m->wakeCondition);
+    platformMutexUnlock(&m->wakeMutex);
 }
 
 // ********************************************************************************************************************
 // ********************************************************************************************************************
-void chip8Shutdown() { _chip8_Running = false; }
+void chip8SetKey(Chip8Machine* m, uint8_t key, bool pressed)
+{
+    // Only one thread writes keyInput, so reading it back can't lose another thread's change
+    uint32_t bit = 1u << (key & 0xF);
+    uint32_t keys = platformAtomicLoad(&m->keyInput);
+    uint32_t changed = pressed ? keys | bit : keys & ~bit;
+    if (changed == keys) return; // Held keys repeat
+    platformAtomicExchange(&m->keyInput, changed);
 
-void chip8Reset() { _chip8_Reset = true; }
+    // The time is stored before the count that makes it visible goes up
+    uint32_t count = m->keyChanges;
+    m->keyTicks[count % CHIP8_KEY_TICKS] = platformGetTick();
+    platformAtomicExchange(&m->keyChanges, count + 1);
+    chip8Wake(m);
+}
 
 // ********************************************************************************************************************
 // ********************************************************************************************************************
-int32_t chip8LoadRom(WCHAR* filename)
+void chip8SeedRandom(Chip8Machine* m, uint64_t seed)
 {
-    FILE* fp;
+    // splitmix64 spreads seeds that differ in a bit or two (consecutive times, small numbers) over the whole state,
+    // which xorshift needs to be non-zero
+    uint64_t z = seed + 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z ^= z >> 31;
+    m->randomState = z != 0 ? z : 1;
+}
 
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+int32_t chip8LoadRom(Chip8Machine* m, const char* filename)
+{
     // Attempt to open the file
-    errno_t err = _wfopen_s(&fp, filename, TEXT("rb"));
-    if (err == 0)
+    FILE* fp = fopen(filename, "rb");
+    if (fp != NULL)
     {
         printf("File was opened\n");
     }
@@ -545,13 +2075,14 @@ int32_t chip8LoadRom(WCHAR* filename)
         return -1;
     }
 
-    // Clear the ROM space
-    memset(_chip8_Mem + CHIP8_PROGRAM_START_OFFSET, 0, CHIP8_MEM_SIZE - CHIP8_PROGRAM_START_OFFSET);
+    // Clear the ROM space, all of it in case the last ROM was for a variant with more memory
+    memset(m->mem + CHIP8_PROGRAM_START_OFFSET, 0, CHIP8_MEM_SIZE - CHIP8_PROGRAM_START_OFFSET);
 
     // Read the ROM
-    const uint32_t MAX_SIZE = CHIP8_MEM_SIZE - CHIP8_PROGRAM_START_OFFSET;
-    int32_t size = fread(_chip8_Mem + CHIP8_PROGRAM_START_OFFSET, 1, MAX_SIZE, fp);
+    const uint32_t MAX_SIZE = chip8GetMemorySize(m->variant) - CHIP8_PROGRAM_START_OFFSET;
+    int32_t size = fread(m->mem + CHIP8_PROGRAM_START_OFFSET, 1, MAX_SIZE, fp);
     printf("%i bytes read\n", size);
+    chip8InvalidateDecodeCache(m, CHIP8_PROGRAM_START_OFFSET, CHIP8_MEM_SIZE - CHIP8_PROGRAM_START_OFFSET);
 
     // Verify no errors
     if (ferror(fp) != 0)
@@ -559,7 +2090,7 @@ int32_t chip8LoadRom(WCHAR* filename)
         printf("File error!\n");
         size = -1;
     }
-    else if (feof(fp) != 1)
+    else if (feof(fp) == 0 && fgetc(fp) != EOF)
     {
         printf("ROM is too large?!\n");
         size = -1;
@@ -569,6 +2100,18 @@ int32_t chip8LoadRom(WCHAR* filename)
     return size;
 }
 
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+int32_t chip8LoadRomData(Chip8Machine* m, const uint8_t* data, uint32_t size)
+{
+    if (size > chip8GetMemorySize(m->variant) - CHIP8_PROGRAM_START_OFFSET) return -1;
+
+    memset(m->mem + CHIP8_PROGRAM_START_OFFSET, 0, CHIP8_MEM_SIZE - CHIP8_PROGRAM_START_OFFSET);
+    memcpy(m->mem + CHIP8_PROGRAM_START_OFFSET, data, size);
+    chip8InvalidateDecodeCache(m, CHIP8_PROGRAM_START_OFFSET, CHIP8_MEM_SIZE - CHIP8_PROGRAM_START_OFFSET);
+    return size;
+}
+
 // ********************************************************************************************************************
 // ********************************************************************************************************************
 void appendFormatted(char* dest, const char* format, ...)
@@ -583,189 +2126,215 @@ void appendFormatted(char* dest, const char* format, ...)
 
 // ********************************************************************************************************************
 // ********************************************************************************************************************
-void chip8BuildDebugString(uint16_t instruction)
+void chip8BuildDebugString(Chip8Machine* m, uint16_t instruction)
 {
-    WaitForSingleObject(_chip8_Mutex, INFINITE);
+    platformMutexLock(&m->mutex);
 
-    memset(_chip8_Msg, 0, sizeof(_chip8_Msg));
-    char* str = _chip8_Msg;
-
-    // Read 2 bytes at a time, identifying instructions
-    uint16_t nnn = instruction & 0x0FFF;
-    uint16_t kk = instruction & 0x00FF;
-    uint8_t x = (instruction & 0x0F00) >> 8;
-    uint8_t y = (instruction & 0x00F0) >> 4;
-    uint8_t n = instruction & 0x000F;
+    memset(m->msg, 0, sizeof(m->msg));
+    char* str = m->msg;
 
     appendFormatted(str, "                ", instruction);
     for (int i = 0; i < 16; i++) appendFormatted(str, "     %X", i);
     appendFormatted(str, "\n");
     appendFormatted(str, "         GENERAL");
-    for (int i = 0; i < 16; i++) appendFormatted(str, "    %02X", _chip8_GenRegs[i]);
+    for (int i = 0; i < 16; i++) appendFormatted(str, "    %02X", m->genRegs[i]);
     appendFormatted(str, "\n");
     appendFormatted(str, "           STACK");
-    for (int i = 0; i < 16; i++) appendFormatted(str, "  %04X", _chip8_Stack[i]);
+    for (int i = 0; i < 16; i++) appendFormatted(str, "  %04X", m->stack[i]);
     appendFormatted(str, "\n");
     appendFormatted(str, "        KEYBOARD");
-    for (int i = 0; i < 16; i++) appendFormatted(str, "     %01X", _chip8_Keyboard[i]);
+    for (int i = 0; i < 16; i++) appendFormatted(str, "     %01X", m->keyboard[i]);
     appendFormatted(str, "\n");
-    appendFormatted(str, "               I  %04X\n", _chip8_I);
-    appendFormatted(str, "     DELAY TIMER  %02X\n", _chip8_DelayTimerReg);
-    appendFormatted(str, "     SOUND TIMER  %02X\n", _chip8_SoundTimerReg);
-    appendFormatted(str, " PROGRAM COUNTER  %04X\n", _chip8_ProgramCounter);
-    appendFormatted(str, "   STACK POINTER  %02X\n", _chip8_StackPointer);
+    appendFormatted(str, "               I  %04X\n", m->i);
+    appendFormatted(str, "     DELAY TIMER  %02X\n", m->delayTimerReg);
+    appendFormatted(str, "     SOUND TIMER  %02X\n", m->soundTimerReg);
+    appendFormatted(str, " PROGRAM COUNTER  %04X\n", m->programCounter);
+    appendFormatted(str, "   STACK POINTER  %02X\n", m->stackPointer);
     appendFormatted(str, "     INSTRUCTION  %04X ", instruction);
 
-    if (instruction == 0x00E0)
-        appendFormatted(str, "CLEAR DISPLAY");
-    else if (instruction == 0x00EE)
-        appendFormatted(str, "RETURN");
-    else if ((instruction & 0xF000) == 0x1000)
-        appendFormatted(str, "JUMP TO %3X", nnn);
-    else if ((instruction & 0xF000) == 0x2000)
-        appendFormatted(str, "CALL %3X", nnn);
-    else if ((instruction & 0xF000) == 0x3000)
-        appendFormatted(str, "SKIP IF V%X == %02X", x, kk);
-    else if ((instruction & 0xF000) == 0x4000)
-        appendFormatted(str, "SKIP IF V%X != %02X", x, kk);
-    else if ((instruction & 0xF00F) == 0x5000)
-        appendFormatted(str, "SKIP IF V%X == V%X", x, y);
-    else if ((instruction & 0xF000) == 0x6000)
-        appendFormatted(str, "LOAD %02X INTO V%X", kk, x);
-    else if ((instruction & 0xF000) == 0x7000)
-        appendFormatted(str, "SET V%X += %02X", x, kk);
-    else if ((instruction & 0xF00F) == 0x8000)
-        appendFormatted(str, "SET V%X = V%X", x, y);
-    else if ((instruction & 0xF00F) == 0x8001)
-        appendFormatted(str, "SET V%X |= V%X", x, y);
-    else if ((instruction & 0xF00F) == 0x8002)
-        appendFormatted(str, "SET V%X &= V%X", x, y);
-    else if ((instruction & 0xF00F) == 0x8003)
-        appendFormatted(str, "SET V%X ^= V%X", x, y);
-    else if ((instruction & 0xF00F) == 0x8004)
-        appendFormatted(str, "SET V%X += V%X, SET VF = CARRY", x, y);
-    else if ((instruction & 0xF00F) == 0x8005)
-        appendFormatted(str, "SET V%X -= V%X, SET VF = NOT BORROW", x, y);
-    else if ((instruction & 0xF00F) == 0x8006)
-        appendFormatted(str, "SET V%X = V%X >> 1, SET VF = DROPPED BIT", x, x);
-    else if ((instruction & 0xF00F) == 0x8007)
-        appendFormatted(str, "SET V%X = V%X - V%X, SET VF = NOT BORROW", x, y, x);
-    else if ((instruction & 0xF00F) == 0x800E)
-        appendFormatted(str, "SET V%X = V%X << 1, SET VF = DROPPED BIT", x, x);
-    else if ((instruction & 0xF00F) == 0x9000)
-        appendFormatted(str, "SKIP IF %X != %X", _chip8_GenRegs[x], _chip8_GenRegs[y]);
-    else if ((instruction & 0xF000) == 0xA000)
-        appendFormatted(str, "SET I = %03X", nnn);
-    else if ((instruction & 0xF000) == 0xB000)
-        appendFormatted(str, "JUMP TO %03X + V0", nnn);
-    else if ((instruction & 0xF000) == 0xC000)
-        appendFormatted(str, "SET V%X = RANDOM & %02X", x, kk);
-    else if ((instruction & 0xF000) == 0xD000)
-        appendFormatted(str, "DRAW %i-BYTE SPRITE AT %X,%X", n, _chip8_GenRegs[x], _chip8_GenRegs[y]);
-    else if ((instruction & 0xF0FF) == 0xE09E)
-        appendFormatted(str, "SKIP IF KEY AT V%X IS PRESSED", x);
-    else if ((instruction & 0xF0FF) == 0xE0A1)
-        appendFormatted(str, "SKIP IF KEY AT V%X IS NOT PRESSED", x);
-    else if ((instruction & 0xF0FF) == 0xF007)
-        appendFormatted(str, "SET V%X = DT", x);
-    else if ((instruction & 0xF0FF) == 0xF00A)
-        appendFormatted(str, "WAIT FOR KEY, STORE IN V%X", x);
-    else if ((instruction & 0xF0FF) == 0xF015)
-        appendFormatted(str, "SET DT = V%X", x);
-    else if ((instruction & 0xF0FF) == 0xF018)
-        appendFormatted(str, "SET ST = V%X", x);
-    else if ((instruction & 0xF0FF) == 0xF01E)
-        appendFormatted(str, "SET I += V%X", x);
-    else if ((instruction & 0xF0FF) == 0xF029)
-        appendFormatted(str, "SET I = SPRITE FOR DIGIT IN V%X", x);
-    else if ((instruction & 0xF0FF) == 0xF033)
-        appendFormatted(str, "STORE BCD OF V%X IN I, I+1, I+2", x);
-    else if ((instruction & 0xF0FF) == 0xF055)
-        appendFormatted(str, "STORE V0 THROUGH V%X AT LOCATION I", x);
-    else if ((instruction & 0xF0FF) == 0xF065)
-        appendFormatted(str, "LOAD V0 THROUGH V%X FROM LOCATION I", x);
-    else
-        appendFormatted(str, "UNKNOWN\n", instruction);
-
-    appendFormatted(str, "\n");
+    // The same text the trace and profile tools show for it
+    char text[64];
+    chip8Disassemble(instruction, chip8GetDisassemblyFlags(m), text, sizeof(text));
+    appendFormatted(str, "%s\n", text);
 
-    ReleaseMutex(_chip8_Mutex);
+    platformMutexUnlock(&m->mutex);
 }
 
 // ********************************************************************************************************************
 // ********************************************************************************************************************
-uint64_t getElapsed60HzTicksSinceHighPerfTick(uint64_t startTick)
+void chip8GetDebugString(Chip8Machine* m, char* buffer, uint32_t size)
 {
-    double elapsedTime = getElapsedTimeSinceHighPerfTick(startTick);
-    uint64_t elapsed60HzTicks = 60 * elapsedTime;
-    return elapsed60HzTicks;
+    platformMutexLock(&m->mutex);
+    strncpy(buffer, m->msg, size - 1);
+    buffer[size - 1] = 0;
+    platformMutexUnlock(&m->mutex);
 }
 
 // ********************************************************************************************************************
 // ********************************************************************************************************************
 double getElapsedTimeSinceHighPerfTick(uint64_t startTick)
 {
-    static uint64_t systemTickFreq = 0;
-    if (systemTickFreq == 0) QueryPerformanceFrequency(&systemTickFreq);
+    uint64_t elapsedHighPerfTicks = platformGetTick() - startTick;
+    return (elapsedHighPerfTicks * 1.0) / platformGetTickFrequency();
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8UpdateSpeedMeter(Chip8Machine* m, Chip8SpeedMeter* meter, double interval)
+{
+    uint64_t tick = platformGetTick();
+    uint64_t instructions = m->instructionCount;
+    uint64_t frames = m->frameCount;
+
+    double elapsed = (tick - meter->tick) * 1.0 / platformGetTickFrequency();
+    if (meter->tick != 0 && elapsed < interval) return false;
 
-    uint64_t tick;
-    QueryPerformanceCounter(&tick);
-    uint64_t elapsedHighPerfTicks = tick - startTick;
-    return (elapsedHighPerfTicks * 1.0) / systemTickFreq;
+    // The first call and a reset of the machine (counters going backwards) only start a new measurement
+    bool valid = meter->tick != 0 && instructions >= meter->instructions && frames >= meter->frames;
+    meter->mips = valid ? (instructions - meter->instructions) / elapsed / 1e6 : 0;
+    meter->fps = valid ? (frames - meter->frames) / elapsed : 0;
+    meter->tick = tick;
+    meter->instructions = instructions;
+    meter->frames = frames;
+    return valid;
 }
 
 // ********************************************************************************************************************
 // ********************************************************************************************************************
-void chip8TimerUpdate()
+void chip8RecordPresent(Chip8Machine* m, Chip8PresentMeter* meter, uint64_t tick, uint32_t keyChanges)
 {
-    // If the delay timer is non-zero, determine how many 60Hz ticks have elapsed and decrement accordingly
-    if (_chip8_DelayTimerReg > 0)
+    // A screen that stood still for a while pauses the presents, which says nothing about how evenly they come
+    double freq = (double)platformGetTickFrequency();
+    if (meter->lastPresent != 0)
     {
-        uint64_t elapsedTicks = getElapsed60HzTicksSinceHighPerfTick(_chip8_DTStartTick);
-        if (elapsedTicks < _chip8_DTLastSetValue)
-            _chip8_DelayTimerReg = _chip8_DTLastSetValue - elapsedTicks;
-        else
-            _chip8_DelayTimerReg = 0;
+        double interval = (tick - meter->lastPresent) / freq;
+        if (interval < CHIP8_PRESENT_PAUSE)
+        {
+            meter->intervals++;
+            meter->intervalSum += interval;
+            meter->intervalSquares += interval * interval;
+        }
     }
+    meter->lastPresent = tick;
+    meter->presents++;
 
-    // If the sound timer is non-zero, determine how many 60Hz ticks have elapsed and decrement accordingly
-    if (_chip8_SoundTimerReg > 0)
+    // The first key change this frame saw that no frame presented before it had seen is the one that waited longest.
+    // Its time is gone if the keys changed more often than the ring remembers in between.  Only changed screens are
+    // presented, so a key the ROM ignores is only shown by whatever changes the screen next, and isn't counted.
+    uint32_t unseen = keyChanges - meter->lastKeyChanges;
+    double latency = unseen > 0 ? (tick - m->keyTicks[meter->lastKeyChanges % CHIP8_KEY_TICKS]) / freq : 0;
+    if (unseen > 0 && unseen <= CHIP8_KEY_TICKS && latency < CHIP8_LATENCY_LIMIT)
     {
-        uint64_t elapsedTicks = getElapsed60HzTicksSinceHighPerfTick(_chip8_STStartTick);
-        if (elapsedTicks < _chip8_STLastSetValue)
-            _chip8_SoundTimerReg = _chip8_STLastSetValue - elapsedTicks;
-        else
-            _chip8_SoundTimerReg = 0;
+        meter->latencies++;
+        meter->latencySum += latency;
+        if (latency > meter->latencyMax) meter->latencyMax = latency;
     }
+    meter->lastKeyChanges = keyChanges;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8UpdatePresentMeter(Chip8PresentMeter* meter, double interval)
+{
+    uint64_t tick = platformGetTick();
+    double elapsed = (tick - meter->tick) * 1.0 / platformGetTickFrequency();
+    if (meter->tick != 0 && elapsed < interval) return false;
+
+    bool valid = meter->tick != 0;
+    double mean = meter->intervals > 0 ? meter->intervalSum / meter->intervals : 0;
+    double variance = meter->intervals > 0 ? meter->intervalSquares / meter->intervals - mean * mean : 0;
+    meter->fps = valid ? meter->presents / elapsed : 0;
+    meter->intervalMs = mean * 1e3;
+    meter->jitterMs = variance > 0 ? sqrt(variance) * 1e3 : 0;
+    meter->latencyMs = meter->latencies > 0 ? meter->latencySum / meter->latencies * 1e3 : 0;
+    meter->latencyMaxMs = meter->latencyMax * 1e3;
+
+    meter->tick = tick;
+    meter->presents = meter->intervals = meter->latencies = 0;
+    meter->intervalSum = meter->intervalSquares = meter->latencySum = meter->latencyMax = 0;
+    return valid;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8HasNewScreen(Chip8Machine* m) { return (platformAtomicLoad(&m->frameMiddle) & CHIP8_FRAME_FRESH) != 0; }
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8WaitForScreen(Chip8Machine* m, uint32_t milliseconds)
+{
+    if (chip8HasNewScreen(m)) return true;
+
+    // Setting screenWaiting is a full barrier, so a frame published after it is either seen below or signaled
+    platformMutexLock(&m->screenMutex);
+    platformAtomicExchange(&m->screenWaiting, 1);
+    if (!chip8HasNewScreen(m)) platformConditionWaitTimeout(&m->screenCondition, &m->screenMutex, milliseconds);
+    platformAtomicExchange(&m->screenWaiting, 0);
+    platformMutexUnlock(&m->screenMutex);
+    return chip8HasNewScreen(m);
+}
 
-    // If no sound is playing but it should be, start playing it
-    if (_chip8_SoundTimerReg > 0 && !_chip8_SoundPlaying)
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static const Chip8Frame* chip8TakeFrame(Chip8Machine* m)
+{
+    // Only the renderer clears the fresh flag, so once it is seen set the exchange is sure to return a new frame (maybe
+    // an even newer one than when the flag was checked)
+    if (chip8HasNewScreen(m))
     {
-        PlaySound(MAKEINTRESOURCE(_chip8_SoundId), _chip8_ModuleInstance, SND_RESOURCE | SND_ASYNC);
-        _chip8_SoundPlaying = true;
+        uint32_t old = platformAtomicExchange(&m->frameMiddle, m->frameFront);
+        m->frameFront = old & ~CHIP8_FRAME_FRESH;
+        return &m->frames[m->frameFront];
     }
+    return NULL;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8GetScreen(Chip8Machine* m, Chip8Screen* pScreen)
+{
+    chip8TakeFrame(m);
+    chip8CopyScreen(pScreen, &m->frames[m->frameFront].screen);
+}
 
-    // If sound is playing but it shouldn't be, stop playing it
-    if (_chip8_SoundTimerReg == 0 && _chip8_SoundPlaying)
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8CopyScreen(Chip8Screen* to, const Chip8Screen* from)
+{
+    uint32_t words = from->height * (from->width / 64);
+    to->width = from->width;
+    to->height = from->height;
+    to->planes = from->planes;
+    for (uint32_t p = 0; p < CHIP8_PLANE_COUNT; p++)
     {
-        PlaySound(NULL, NULL, NULL);
-        _chip8_SoundPlaying = false;
+        if (from->planes & (1u << p)) memcpy(to->pixels[p], from->pixels[p], words * sizeof(uint64_t));
     }
 }
 
 // ********************************************************************************************************************
 // ********************************************************************************************************************
-void chip8GetScreen(bool* pScreen)
+static inline bool chip8ColumnChanged(const uint64_t* columns, uint32_t x)
 {
-    WaitForSingleObject(_chip8_Mutex_Screen, INFINITE);
-    memcpy(pScreen, _chip8_Screen, sizeof(_chip8_Screen));
-    ReleaseMutex(_chip8_Mutex_Screen);
+    // Bit 63 of the first word is column 0
+    return (columns[x / 64] >> (63 - x % 64)) & 1;
 }
 
 // ********************************************************************************************************************
 // ********************************************************************************************************************
-void chip8InitSound(HINSTANCE hInstance, uint32_t id)
+bool chip8GetScreenDamage(Chip8Machine* m, Chip8Screen* pScreen, Chip8Damage* damage)
 {
-    _chip8_ModuleInstance = hInstance;
-    _chip8_SoundId = id;
-}
\ No newline at end of file
+    const Chip8Frame* frame = chip8TakeFrame(m);
+    if (frame == NULL) return false;
+
+    chip8CopyScreen(pScreen, &frame->screen);
+    damage->generation = frame->generation;
+    damage->rows = frame->damageRows;
+    damage->keyChanges = frame->keyChanges;
+
+    // Turn the changed columns into a span
+    damage->left = 0;
+    damage->right = frame->screen.width - 1;
+    while (damage->left < damage->right && !chip8ColumnChanged(frame->damageColumns, damage->left)) damage->left++;
+    while (damage->right > damage->left && !chip8ColumnChanged(frame->damageColumns, damage->right)) damage->right--;
+    return true;
+}
@@ -3,87 +3,444 @@
 
 #define _CRT_SECURE_NO_WARNINGS // let me use sprintf/vsprintf!
 
-#include <Windows.h>
+#include "platform.h"
+
 #include <stdbool.h>
 #include <stdint.h>
 
-#define CHIP8_MEM_SIZE 4096
-#define CHIP8_SCREEN_WIDTH 64
-#define CHIP8_SCREEN_HEIGHT 32
+#define CHIP8_MEM_SIZE 65536        // Address space of XO-CHIP, the largest variant
+#define CHIP8_CLASSIC_MEM_SIZE 4096 // Memory of CHIP-8 and SUPER-CHIP
+#define CHIP8_LORES_WIDTH 64
+#define CHIP8_LORES_HEIGHT 32
+#define CHIP8_SCREEN_WIDTH 128                                     // Width of the largest screen, in hi-res mode
+#define CHIP8_SCREEN_HEIGHT 64                                     // Height of the largest screen
+#define CHIP8_ROW_WORDS (CHIP8_SCREEN_WIDTH / 64)                  // Words a row of the largest screen takes
+#define CHIP8_SCREEN_WORDS (CHIP8_SCREEN_HEIGHT * CHIP8_ROW_WORDS) // Words a plane of the largest screen takes
+#define CHIP8_PLANE_COUNT 2                                        // Bitplanes of the XO-CHIP screen
 #define CHIP8_PROGRAM_START_OFFSET 0x200
 #define CHIP8_HEX_SPRITE_START_OFFSET 0x100
 #define CHIP8_HEX_SPRITE_SIZE_PER 5
+#define CHIP8_BIG_SPRITE_START_OFFSET 0x150 // SUPER-CHIP 8x10 digits, right after the small ones
+#define CHIP8_BIG_SPRITE_SIZE_PER 10
 #define CHIP8_CLOCK_SPEED_HZ 500 // Online sources say 500Hz is a good CHIP-8 emulator clock speed  TODO: Configurable?
+#define CHIP8_FRAME_RATE 60      // Rate of the delay and sound timers, and of the frames the scheduler runs
 #define CHIP8_STR_SIZE 2048
+#define CHIP8_STATE_PATH_SIZE 260 // Longest file name a save state can be written to, including the terminator
+
+// Every instruction the interpreter understands, named after its pattern in Cowgod's reference.  The order defines the
+// Chip8Op values used by the dispatch tables.  The SUPER-CHIP and XO-CHIP instructions come last, so the original
+// ones keep their values.
+#define CHIP8_OP_LIST(X)                                                                                               \
+    X(UNKNOWN)                                                                                                         \
+    X(00E0) X(00EE) X(1nnn) X(2nnn) X(3xkk) X(4xkk) X(5xy0) X(6xkk) X(7xkk)                                            \
+    X(8xy0) X(8xy1) X(8xy2) X(8xy3) X(8xy4) X(8xy5) X(8xy6) X(8xy7) X(8xyE)                                            \
+    X(9xy0) X(Annn) X(Bnnn) X(Cxkk) X(Dxyn) X(Ex9E) X(ExA1)                                                            \
+    X(Fx07) X(Fx0A) X(Fx15) X(Fx18) X(Fx1E) X(Fx29) X(Fx33) X(Fx55) X(Fx65)                                            \
+    X(00Cn) X(00Dn) X(00FB) X(00FC) X(00FD) X(00FE) X(00FF) X(5xy2) X(5xy3)                                            \
+    X(F000) X(Fn01) X(F002) X(Fx30) X(Fx3A) X(Fx75) X(Fx85)
+
+typedef enum Chip8Op
+{
+#define CHIP8_OP_ENUM(name) CHIP8_OP_##name,
+    CHIP8_OP_LIST(CHIP8_OP_ENUM)
+#undef CHIP8_OP_ENUM
+    CHIP8_OP_COUNT
+} Chip8Op;
+
+// Ops from here on are SUPER-CHIP and XO-CHIP instructions.  On a machine of a variant without them they do nothing
+// and don't advance, like UNKNOWN.
+#define CHIP8_OP_FIRST_EXTENDED CHIP8_OP_00Cn
+
+// Machine a ROM was written for.  The variant decides which instructions exist, the quirks and the size of memory.
+typedef enum Chip8Variant
+{
+    CHIP8_VARIANT_CHIP8,  // The original: 64x32 screen, 4 KB of memory
+    CHIP8_VARIANT_SCHIP,  // SUPER-CHIP 1.1: 128x64 hi-res mode, scrolling, 16x16 sprites, big digits and RPL flags
+    CHIP8_VARIANT_XOCHIP, // XO-CHIP: SUPER-CHIP plus two bitplanes, 64 KB of memory, F000 nnnn and register ranges
+    CHIP8_VARIANT_COUNT
+} Chip8Variant;
+
+#define CHIP8_OP_NOT_DECODED 0xFF // Marks a decode cache entry that has not been filled yet
+
+// A pre-decoded instruction: the handler to run plus its operands, so executing it again skips fetch and decode
+typedef struct Chip8Decoded
+{
+    uint8_t op;      // Chip8Op of the instruction, or CHIP8_OP_NOT_DECODED
+    uint8_t x;       // Register index in bits 8-11
+    uint8_t y;       // Register index in bits 4-7
+    uint8_t kk;      // Low byte.  The low nibble of it is n.
+    uint16_t nnn;    // Address in the low 12 bits
+    uint16_t nextPc; // Address of the instruction that follows (the fall-through PC)
+} Chip8Decoded;
+
+// Instruction sequences the FUSED engine executes as a single superinstruction, named after the instructions they
+// combine.  The sequences ending in a skip and a jump are the delay polling loops and counters most ROMs spin in.
+#define CHIP8_FUSION_LIST(X)                                                                                           \
+    X(Fx07_3xkk_1nnn) X(Fx07_4xkk_1nnn) X(7xkk_3xkk_1nnn) X(7xkk_4xkk_1nnn) X(Annn_Dxyn)
+
+typedef enum Chip8Fusion
+{
+    CHIP8_FUSION_NONE, // No sequence starts at this address, the instruction runs on its own
+#define CHIP8_FUSION_ENUM(name) CHIP8_FUSION_##name,
+    CHIP8_FUSION_LIST(CHIP8_FUSION_ENUM)
+#undef CHIP8_FUSION_ENUM
+    CHIP8_FUSION_COUNT
+} Chip8Fusion;
+
+#define CHIP8_FUSION_NOT_CHECKED 0xFF // Marks a fusion cache entry that has not been matched against the sequences yet
+
+// How often the FUSED engine found each sequence.  hits[] and instructions[] are indexed by Chip8Fusion.
+typedef struct Chip8FusionStats
+{
+    uint64_t executed;                         // Instructions executed by the FUSED engine, fused or not
+    uint64_t hits[CHIP8_FUSION_COUNT];         // Times each sequence ran as a superinstruction
+    uint64_t instructions[CHIP8_FUSION_COUNT]; // Instructions covered by those runs.  A taken skip ends one early.
+} Chip8FusionStats;
+
+// Executes one decoded instruction, advancing the program counter as needed
+struct Chip8Machine;
+typedef void (*Chip8Handler)(struct Chip8Machine* m, const Chip8Decoded* d);
+
+// Selects how the interpreter finds the handler for an instruction
+typedef enum Chip8Dispatch
+{
+    CHIP8_DISPATCH_CHAIN,    // Linear chain of mask-and-compare branches (the original interpreter)
+    CHIP8_DISPATCH_TABLE,    // 16-way top-nibble jump table, with second level tables for the 0, 5, 8, 9, E, F groups
+    CHIP8_DISPATCH_THREADED, // Computed-goto threaded dispatch.  Needs GCC/Clang, falls back to TABLE otherwise.
+    CHIP8_DISPATCH_JIT,      // x86-64 dynamic recompiler (see chip8jit.h).  Falls back to TABLE if not attached.
+    CHIP8_DISPATCH_AOT,      // ROM compiled ahead of time to C (see chip8aot.h).  Falls back to TABLE if not attached.
+    CHIP8_DISPATCH_FUSED,    // TABLE plus superinstructions for the sequences in CHIP8_FUSION_LIST
+} Chip8Dispatch;
+
+// The display: planes of height rows of width pixels, each row packed into width / 64 words with the leftmost pixel
+// (x = 0) in the most significant bit of its first word, and the rows one after the other.  A lo-res plane is 32
+// words, one per row, and a hi-res one 128.  Scrolling moves whole words, and copying a lo-res screen costs no more
+// than it did before hi-res mode existed.  Only the rows of the current mode and the planes set in planes hold pixels.
+typedef struct Chip8Screen
+{
+    uint8_t width;                                          // CHIP8_LORES_WIDTH, or CHIP8_SCREEN_WIDTH in hi-res mode
+    uint8_t height;                                         // CHIP8_LORES_HEIGHT, or CHIP8_SCREEN_HEIGHT in hi-res
+    uint8_t planes;                                         // Bit n set if plane n may have lit pixels.  Bit 0 always.
+    uint64_t pixels[CHIP8_PLANE_COUNT][CHIP8_SCREEN_WORDS]; // Rows of each plane, top first
+} Chip8Screen;
+
+// Part of the screen changed by Dxyn, 00E0 and the scrolls, so a renderer only has to repaint what changed
+typedef struct Chip8Damage
+{
+    uint32_t generation; // Number of the frame, incremented every time the core publishes one
+    uint64_t rows;       // Bit n is set if row n changed, 0 if nothing changed
+    uint8_t left;        // Leftmost column that changed.  Only valid if rows is not 0.
+    uint8_t right;       // Rightmost column that changed
+    uint32_t keyChanges; // Chip8Machine.keyChanges the frame had seen, to measure input latency with
+} Chip8Damage;
+
+// A complete screen handed from the core to the renderer, see chip8GetScreenDamage()
+typedef struct Chip8Frame
+{
+    Chip8Screen screen;                      // Pixels
+    uint64_t damageColumns[CHIP8_ROW_WORDS]; // Columns changed since the frame the renderer took before this one
+    uint64_t damageRows;                     // Rows changed since then
+    uint32_t generation;                     // Number of the frame
+    uint32_t keyChanges;                     // Chip8Machine.keyChanges as of the start of the frame it was published in
+} Chip8Frame;
+
+// Emulation speed measured over wall-clock time by chip8UpdateSpeedMeter().  Zero-initialize before the first update.
+typedef struct Chip8SpeedMeter
+{
+    uint64_t tick;         // When the current measurement started (platformGetTick)
+    uint64_t instructions; // Chip8Machine.instructionCount at that tick
+    uint64_t frames;       // Chip8Machine.frameCount at that tick
+    double mips;           // Millions of instructions executed per second over the last measurement
+    double fps;            // Emulated frames run per second over the last measurement.  CHIP8_FRAME_RATE in real time.
+} Chip8SpeedMeter;
+
+// Presentation measured by chip8RecordPresent() and chip8UpdatePresentMeter().  Zero-initialize before the first use.
+typedef struct Chip8PresentMeter
+{
+    uint64_t tick;           // When the current measurement started (platformGetTick)
+    uint64_t lastPresent;    // When the last frame was presented
+    uint32_t lastKeyChanges; // Chip8Damage.keyChanges of that frame
+    uint32_t presents;       // Frames presented in the current measurement
+    uint32_t intervals;      // Times between two of them counted, leaving out pauses of the screen
+    double intervalSum;      // Sum of those times, in seconds
+    double intervalSquares;  // Sum of their squares
+    uint32_t latencies;      // Key changes seen by the frames presented
+    double latencySum;       // Sum of the times from each change to the present of the first frame that saw it
+    double latencyMax;       // Longest of those times
+    double fps;              // Frames presented per second over the last measurement
+    double intervalMs;       // Mean time between presents, in milliseconds
+    double jitterMs;         // Standard deviation of the time between presents, in milliseconds
+    double latencyMs;        // Mean input-to-present latency, in milliseconds.  0 if no key changed.
+    double latencyMaxMs;     // Longest input-to-present latency, in milliseconds
+} Chip8PresentMeter;
+
+#define CHIP8_FRAME_FRESH 0x4   // Set in Chip8Machine.frameMiddle while the renderer hasn't taken the frame
+#define CHIP8_KEY_TICKS 64      // Key changes whose time is remembered for measuring latency
+#define CHIP8_PRESENT_PAUSE 0.1 // Seconds between two presents beyond which the screen is taken to have stood still
+#define CHIP8_LATENCY_LIMIT 0.5 // Seconds from a key change to a present beyond which the key didn't cause the change
+
+struct Chip8Jit; // Recompiler state, owned by chip8jit.c
+struct Chip8Aot; // Compiled ROM module state, owned by chip8aot.c
+
+// Complete state of a single CHIP-8 machine.  Every core function takes the machine it operates on explicitly, so any
+// number of independent machines can be hosted in one process.  The registers touched by nearly every instruction are
+// grouped at the front of the struct so they share a couple of cache lines, directly followed by the memory.
+typedef struct Chip8Machine
+{
+    // Various registers and other strucures defined in the CHIP-8 spec
+    uint8_t genRegs[16];
+    uint16_t i;
+    uint16_t programCounter;
+    uint8_t stackPointer;
+    uint8_t delayTimerReg;
+    uint8_t soundTimerReg;
+    bool shiftQuirkMode;     // Different CHIP-8 docs disagree on exact details of SHL/SHR
+    bool loadStoreQuirkMode; // Fx55 and Fx65 leave I just past the last register, as on XO-CHIP
+    bool jumpQuirkMode;      // Bxnn jumps to xnn + Vx instead of nnn + V0, as on SUPER-CHIP
+    bool clipQuirkMode;      // Sprites are cut off at the edges of the screen instead of wrapping, as on SUPER-CHIP
+    uint8_t planeMask;       // Planes Dxyn, 00E0 and the scrolls work on, selected by Fn01.  Plane 0 after a reset.
+    uint16_t stack[16];
+    bool keyboard[16]; // Tracks status of the keys
+    uint8_t mem[CHIP8_MEM_SIZE];
+
+    // Variant emulated (see Chip8Variant).  Changing it takes effect on the next reset, which sets the quirks above and
+    // the size of memory to the variant's.
+    Chip8Variant variant;
+    uint32_t memSize;         // Memory the variant addresses, CHIP8_CLASSIC_MEM_SIZE or CHIP8_MEM_SIZE
+    uint8_t rpl[16];          // SUPER-CHIP RPL user flags, saved by Fx75 and loaded by Fx85
+    uint8_t audioPattern[16]; // XO-CHIP 1-bit sample pattern loaded by F002.  Kept for save states, not played.
+    uint8_t audioPitch;       // XO-CHIP playback rate of the pattern, set by Fx3A.  Not played either.
+
+    Chip8Screen screen;
+    uint64_t damageRows;                     // Rows changed since the last frame was published, bit n for row n
+    uint64_t damageColumns[CHIP8_ROW_WORDS]; // Columns changed since then, one bit per column like a screen row
+
+    // Decoded instruction for every even address, filled lazily by the TABLE and THREADED engines.  Any write to memory
+    // that may hit code (Fx33, Fx55, ROM loading) must go through chip8InvalidateDecodeCache().
+    Chip8Decoded decodeCache[CHIP8_MEM_SIZE / 2];
+    uint8_t fusionCache[CHIP8_MEM_SIZE / 2]; // Chip8Fusion starting at every even address, filled lazily by FUSED
+    Chip8FusionStats fusionStats;            // Updated by the FUSED engine
+    struct Chip8Jit* jit;                    // Attached by chip8JitInit(), NULL if the recompiler is not in use
+    struct Chip8Aot* aot;                    // Attached by chip8AotAttach(), NULL if no compiled ROM is in use
+
+    uint32_t clockSpeed;         // Cycles per emulated second, one per instruction unless cycleCosts is set
+    const uint8_t* cycleCosts;   // Cycles taken by each Chip8Op, indexed by op.  NULL if every instruction takes one.
+    int32_t frameCycles;         // Cycles left in the current frame.  Overruns are paid back by the next frame.
+    uint32_t frameCycleFraction; // Part of clockSpeed / CHIP8_FRAME_RATE not handed out yet, in 1/60 cycles
+    uint64_t frameCount;         // Emulated frames completed
+    uint64_t instructionCount;   // Instructions executed since the last reset
+    uint64_t idleInstructions;   // Of those, the ones counted by skipping idle loops instead of executed
+    uint64_t randomState;        // xorshift64* state of the generator behind Cxkk, never 0.  See chip8SeedRandom().
+    bool realTime;               // If true, chip8Run() paces frames to wall-clock time, otherwise runs them flat out
+    bool skipIdleLoops;          // If true, frames skip to their end when the ROM spins waiting for DT or a key
+    Chip8Dispatch dispatch;      // Dispatch engine used to execute instructions
+    bool debugString;            // If true, the debug msg is rebuilt for every executed instruction
+    bool running;                // True while the emulator is running
+    bool reset;                  // If true, re-initializes all registers
+    bool stepMode;               // Flag to know when step-by-step instruction execution is enabled
+    bool stepOnIt;               // Flag to indicate user has pressed button to execute a single instruction
+    double stepRateLimit;        // Minimum amount of time between individual steps
+    char msg[CHIP8_STR_SIZE];    // String description of the various structures
+    PlatformMutex mutex;         // Mutex used for exclusive access to the debug msg
+
+    // chip8Run() blocks on wakeCondition whenever it has nothing to do: in step mode, between frames in real time, and
+    // while the ROM waits for a key with both timers run out.  Whatever gives it something to do calls chip8Wake().
+    PlatformMutex wakeMutex;         // Guards wakeups
+    PlatformCondition wakeCondition; // Signaled when wakeups changes
+    volatile uint32_t wakeups;       // Calls to chip8Wake() so far
+
+    // Sound (see chip8audio.h).  The end of every frame synthesizes a frame of samples, with the tone if the sound
+    // timer is running, and hands it to the backend.
+    struct Chip8Audio* audio; // Open audio the frames of sound go to, NULL for silence
+
+    // Save states (see chip8state.h).  Requests from other threads are carried out by chip8Run() between frames.
+    volatile uint32_t stateRequest;           // Chip8StateRequest waiting for the emulator thread
+    uint8_t* stateBuffer;                     // CHIP8_STATE_SIZE bytes the pending request saves to or loads from
+    char statePath[CHIP8_STATE_PATH_SIZE];    // File the pending save is written to, empty for none
+    struct Chip8StateWriter* stateWriter;     // Writer thread that puts states on disk, NULL if none is
+    double autosaveInterval;                  // Seconds between autosaves to autosavePath, 0 disables them
+    char autosavePath[CHIP8_STATE_PATH_SIZE]; // File the autosave is written to
+    uint64_t autosaveTick;                    // When the last autosave was taken (platformGetTick)
+    uint8_t* autosaveBuffer;                  // CHIP8_STATE_SIZE bytes, allocated on the first autosave
+
+    // Rewind (see chip8rewind.h).  chip8Run() records every frame it runs, or while rewinding is set steps back one
+    // frame instead of running one.  Resetting the machine drops the frames recorded.
+    struct Chip8Rewind* rewind; // Ring the frames are recorded in, NULL to record none
+    volatile bool rewinding;    // Set by the frontend while the rewind key is held
+
+    // Instruction trace (see chip8trace.h).  chip8Run() starts and stops it between frames as tracing changes.  While
+    // it is active every engine runs as TABLE and appends a record per instruction.
+    struct Chip8Trace* trace; // Ring and writer the trace goes to, NULL if tracing is not available
+    volatile bool tracing;    // Set by the frontend to trace, cleared to stop
+
+    // Input movie (see chip8movie.h).  chip8Run() starts and stops it between frames as movieMode changes.  The keys
+    // the ROM sees only change at the start of a frame, taken from keyInput, or from the movie while one plays.
+    struct Chip8Movie* movie;           // Movie recorded and played, NULL if movies are not available
+    volatile uint32_t movieMode;        // Chip8MovieMode the frontend wants
+    volatile uint32_t keyInput;         // Keys held on the host, bit n for key n.  Written by chip8SetKey().
+    volatile uint32_t keyChanges;       // Presses and releases chip8SetKey() got so far
+    uint64_t keyTicks[CHIP8_KEY_TICKS]; // When change n happened (platformGetTick), at n % CHIP8_KEY_TICKS
+    uint32_t frameKeyChanges;           // keyChanges as of the start of the current frame.  Emulator only.
 
-// Various registers and other strucures defined in the CHIP-8 spec
-uint8_t _chip8_Mem[CHIP8_MEM_SIZE];
-uint8_t _chip8_GenRegs[16];
-uint16_t _chip8_I;
-uint8_t _chip8_DelayTimerReg;
-uint8_t _chip8_SoundTimerReg;
-uint16_t _chip8_ProgramCounter;
-uint8_t _chip8_StackPointer;
-uint16_t _chip8_Stack[16];
-uint32_t _chip8_ClockSpeed;
-
-bool _chip8_Screen[CHIP8_SCREEN_WIDTH][CHIP8_SCREEN_HEIGHT];
-
-bool _chip8_Keyboard[16];        // Tracks status of the keys
-bool _chip8_Running;             // True while the emulator is running
-char _chip8_Msg[CHIP8_STR_SIZE]; // String description of the various structures
-bool _chip8_SoundPlaying;        // Flag that tracks whether or not a sound is playing
-uint64_t _chip8_DTStartTick;     // The system timer at the moment the delay timer was set
-uint64_t _chip8_STStartTick;     // The system timer at the moment the sound timer was set
-uint8_t _chip8_DTLastSetValue;   // The value the delay timer was last set to
-uint8_t _chip8_STLastSetValue;   // The value the delay timer was last set to
-bool _chip8_ShiftQuirkMode;      // Different CHIP-8 docs disagree on exact details of SHL/SHR
-bool _chip8_Reset;               // If true, re-initializes all registers
-HANDLE _chip8_Mutex;             // Mutex used for exclusive access to the debug msg
-HANDLE _chip8_Mutex_Screen;      // Mutex used for exclusive access to the screen buffer
-HINSTANCE _chip8_ModuleInstance; // Handle to the module running the emulator.  Used to play sounds.
-uint32_t _chip8_SoundId;         // The integer ID of the resource that contains the WAV file for the sound.
-bool _chip8_StepMode;            // Flag to know when step-by-step instruction execution is enabled
-bool _chip8_StepOnIt;            // Flag to indicate user has pressed button to execute a single instruction
-double _chip8_StepRateLimit;     // Minimum amount of time between individual steps
-
-// Initializes the chip 8 emulator.  Must be called before *any* other function.
-void chip8Init();
-
-// Interpreter function.  Runs the ROM.  Does not return until chip8Shutdown() is called
-void chip8Run();
-
-// Updates the timer registers if necessary (also starts/stops sound)
-void chip8TimerUpdate();
+    // Guest profiler (see chip8profile.h).  chip8Run() starts and stops it between frames as profiling changes.  While
+    // it is active every engine runs as TABLE and counts every instruction; a trace takes precedence over it.
+    struct Chip8Profile* profile; // Counts the profile goes to, NULL if profiling is not available
+    volatile bool profiling;      // Set by the frontend to profile, cleared to stop and write the profile
+
+    // Frame capture (see chip8capture.h).  chip8Run() starts and stops it between frames as capturing changes.  While
+    // it is active the screen is handed to it at the end of every frame.
+    struct Chip8Capture* capture; // Ring and writer the video goes to, NULL if capturing is not available
+    volatile bool capturing;      // Set by the frontend to capture, cleared to stop and finish the video
+
+    // Lock-free triple buffer handing frames from the emulator thread to the renderer.  The core fills the back frame
+    // and swaps it with the middle one, the renderer swaps the middle one with its front frame, so neither thread ever
+    // waits for the other and the renderer always gets the latest complete frame.
+    Chip8Frame frames[3];
+    uint32_t frameBack;                          // Frame the core fills next.  Only used by the emulator thread.
+    uint32_t frameGeneration;                    // Number of the last frame published.  Emulator only.
+    uint64_t frameCarryRows;                     // Rows changed in published frames the renderer may not have taken
+    uint64_t frameCarryColumns[CHIP8_ROW_WORDS]; // Columns changed in those frames.  Only used by the emulator thread.
+    volatile uint32_t frameMiddle;               // Frame waiting to be taken, plus CHIP8_FRAME_FRESH if it is a new one
+    uint32_t frameFront;                         // Frame the renderer took last.  Only used by the renderer.
+
+    // The renderer blocks in chip8WaitForScreen() until a frame is published.  Publishing only takes the mutex to
+    // signal it while the renderer is waiting.
+    PlatformMutex screenMutex;         // Guards the wait for a frame
+    PlatformCondition screenCondition; // Signaled when a frame is published while screenWaiting is set
+    volatile uint32_t screenWaiting;   // Set while the renderer waits for a frame
+} Chip8Machine;
+
+// Initializes the chip 8 emulator.  Must be called once before *any* other function is used on the machine.
+void chip8Init(Chip8Machine* m);
+
+// Releases the resources owned by a machine.  The machine must not be running.
+void chip8Destroy(Chip8Machine* m);
+
+// Interpreter function.  Runs the ROM one emulated frame at a time, paced to CHIP8_FRAME_RATE frames per second of
+// wall-clock time if m->realTime is set.  Does not return until chip8Shutdown() is called
+void chip8Run(Chip8Machine* m);
+
+// Runs the rest of the current emulated frame: clockSpeed / CHIP8_FRAME_RATE cycles worth of instructions, then sends
+// the frame's sound to m->audio and decrements the delay and sound timers.  Only depends on the machine state, never
+// on the host's timing, so runs of any speed produce identical results.  Returns the number of instructions executed,
+// including the iterations of idle loops skipped (see skipIdleLoops).
+uint32_t chip8RunFrame(Chip8Machine* m);
+
+// Executes a single instruction as part of the current frame, ending the frame if it used up its cycles.  Stepping
+// through a frame has the same result as running it.  Returns the number of instructions executed (0 on a 0000).
+uint32_t chip8StepInstruction(Chip8Machine* m);
 
 // Shuts down the emulator
-void chip8Shutdown();
+void chip8Shutdown(Chip8Machine* m);
 
 // Sets the reset flag.  Emulator will reset before processing the next instruction.
-void chip8Reset();
+void chip8Reset(Chip8Machine* m);
 
-// Loads a Chip-8 ROM at PROGRAM_START_OFFSET
-int32_t chip8LoadRom(WCHAR* filename);
+// Wakes chip8Run() if it is waiting, so it looks at the machine's flags again.  Call after changing stepMode,
+// stepOnIt, realTime, rewinding, tracing, profiling or movieMode from another thread.  The other functions that
+// give chip8Run() something to do (chip8SetKey(), chip8Reset(), chip8Shutdown(), the state requests) call it already.
+void chip8Wake(Chip8Machine* m);
+
+// Switches the machine to another variant and resets it.  Only call it while the machine is not running; a running
+// machine takes a new m->variant on its next reset (see chip8Reset()).
+void chip8SetVariant(Chip8Machine* m, Chip8Variant variant);
+
+// Guesses the variant a ROM was written for from the extension of its file name: .sc8 for SUPER-CHIP, .xo8 for
+// XO-CHIP and CHIP-8 for anything else
+Chip8Variant chip8GetRomVariant(const char* filename);
+
+// Gets the name of a variant, e.g. "schip"
+const char* chip8GetVariantName(Chip8Variant variant);
+
+// Gets the size of the memory a variant addresses
+uint32_t chip8GetMemorySize(Chip8Variant variant);
+
+// Loads a Chip-8 ROM at PROGRAM_START_OFFSET.  It may fill the memory of the machine's variant.
+int32_t chip8LoadRom(Chip8Machine* m, const char* filename);
+
+// Loads a Chip-8 ROM that is already in memory at PROGRAM_START_OFFSET.  Returns the size loaded or -1 if too large
+// for the memory of the machine's variant.
+int32_t chip8LoadRomData(Chip8Machine* m, const uint8_t* data, uint32_t size);
 
 // Surprise: processes a single instruction
-void chip8ProcessInstruction(uint16_t instruction);
+void chip8ProcessInstruction(Chip8Machine* m, uint16_t instruction);
+
+// Executes up to count instructions starting at the program counter, using the machine's dispatch engine.  Stops early
+// if a 0000 instruction is read.  Returns the number of instructions executed.
+uint32_t chip8ExecuteInstructions(Chip8Machine* m, uint32_t count);
 
 // Reads a single instruction at the program counter
-uint16_t chip8ReadInstruction();
+uint16_t chip8ReadInstruction(Chip8Machine* m);
 
-// Helper for the timer thread.  Used to calculate how many 60Hz ticks have elapsed while it slept.
-uint64_t getElapsed60HzTicksSinceHighPerfTick(uint64_t startTick);
+// Classifies an instruction, returning one of the Chip8Op values
+Chip8Op chip8DecodeOp(uint16_t instruction);
 
-// Given a tick (QueryPerformanceCounter), get the elapsed time in seconds
+// Gets the handler that executes instructions of the given op
+Chip8Handler chip8GetHandler(Chip8Op op);
+
+// Gets the name of an op, e.g. "Dxyn"
+const char* chip8GetOpName(Chip8Op op);
+
+// Gets the name of a fused sequence, e.g. "Annn_Dxyn"
+const char* chip8GetFusionName(Chip8Fusion fusion);
+
+// Gets a copy of the FUSED engine's statistics.  Not thread-safe, call it while the machine is not executing.
+void chip8GetFusionStats(Chip8Machine* m, Chip8FusionStats* stats);
+
+// Discards the decoded instructions overlapping length bytes of memory starting at address.  Must be called after
+// anything other than the interpreter itself writes to m->mem.
+void chip8InvalidateDecodeCache(Chip8Machine* m, uint32_t address, uint32_t length);
+
+// Sets the pressed/released state of one of the 16 keys.  The ROM sees it from the start of the next frame.  Only
+// one thread may set keys.
+void chip8SetKey(Chip8Machine* m, uint8_t key, bool pressed);
+
+// Seeds the generator behind Cxkk.  A machine started from the same state with the same seed and keys always does the
+// same thing.  chip8Init() seeds it from the clock.
+void chip8SeedRandom(Chip8Machine* m, uint64_t seed);
+
+// Given a tick (platformGetTick), get the elapsed time in seconds
 double getElapsedTimeSinceHighPerfTick(uint64_t startTick);
 
+// Ends the meter's measurement if at least interval seconds have passed since it started, updating mips and fps and
+// starting the next one.  Returns true if the figures were updated.  Can be called from any thread while the machine
+// runs; the counters it reads are only advisory.
+bool chip8UpdateSpeedMeter(Chip8Machine* m, Chip8SpeedMeter* meter, double interval);
+
 // Creates a summary of the various registers as well as a description of the current instruction
-void chip8BuildDebugString(uint16_t instruction);
+void chip8BuildDebugString(Chip8Machine* m, uint16_t instruction);
+
+// Gets a copy of the debug string built by chip8BuildDebugString().  Thread-safe.
+void chip8GetDebugString(Chip8Machine* m, char* buffer, uint32_t size);
+
+// Hands the screen to the renderer as a new frame, with everything marked as damaged since the last one.  Only call it
+// from the thread running the machine; executing instructions already publishes every frame that draws something.
+void chip8PublishScreen(Chip8Machine* m);
+
+// Gets a copy of the latest frame.  Only the rows and planes the screen uses are copied.  Like the functions below it
+// takes the frame from the triple buffer, so it must only be called by the (single) renderer thread.  Never blocks.
+void chip8GetScreen(Chip8Machine* m, Chip8Screen* pScreen);
+
+// Copies the rows and planes a screen uses to another
+void chip8CopyScreen(Chip8Screen* to, const Chip8Screen* from);
+
+// Returns true if the core published a frame the renderer hasn't taken yet
+bool chip8HasNewScreen(Chip8Machine* m);
+
+// Blocks the renderer until the core publishes a frame it hasn't taken yet, or until milliseconds have passed.
+// Returns true if there is a new frame.
+bool chip8WaitForScreen(Chip8Machine* m, uint32_t milliseconds);
+
+// Notes that a frame was presented at tick, whose Chip8Damage.keyChanges is given, for the meter's interval and latency
+// figures.  Must be called by the renderer, in the order the frames were taken.
+void chip8RecordPresent(Chip8Machine* m, Chip8PresentMeter* meter, uint64_t tick, uint32_t keyChanges);
 
-// Gets a copy of the screen buffer.  Thread-safe.
-void chip8GetScreen(bool* pScreen);
+// Ends the meter's measurement if at least interval seconds have passed since it started, updating its figures and
+// starting the next one.  Returns true if the figures were updated.
+bool chip8UpdatePresentMeter(Chip8PresentMeter* meter, double interval);
 
-// Initializes the values used when playing the sound tone
-void chip8InitSound(HINSTANCE hInstance, uint32_t id);
+// If the core published a new frame, takes it and gets a copy of its pixels and of the damage since the frame taken
+// before, and returns true.  Returns false without copying anything otherwise.  Never blocks.
+bool chip8GetScreenDamage(Chip8Machine* m, Chip8Screen* pScreen, Chip8Damage* damage);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,95 @@
+#include "chip8aot.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define CHIP8_AOT_UNCHECKED 0 // Memory under the block may have been written since it was last compared to the ROM
+#define CHIP8_AOT_VALID 1     // Memory under the block holds the code it was compiled from
+#define CHIP8_AOT_MODIFIED 2  // Memory under the block was modified, the interpreter runs it instead
+
+struct Chip8Aot
+{
+    const Chip8AotModule* module;
+    uint8_t state[CHIP8_MEM_SIZE]; // One of the CHIP8_AOT_ values for every block
+};
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8AotAttach(Chip8Machine* m, const Chip8AotModule* module)
+{
+    chip8AotDetach(m);
+
+    // calloc leaves every block unchecked, so nothing runs until the loaded ROM has been compared to the module's
+    struct Chip8Aot* aot = calloc(1, sizeof(struct Chip8Aot));
+    if (aot == NULL) return false;
+
+    aot->module = module;
+    m->aot = aot;
+    return true;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8AotDetach(Chip8Machine* m)
+{
+    free(m->aot);
+    m->aot = NULL;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static bool chip8AotCheckBlock(Chip8Machine* m, uint16_t start, const Chip8AotBlock* block)
+{
+    const Chip8AotModule* module = m->aot->module;
+    if (start < CHIP8_PROGRAM_START_OFFSET || block->end > CHIP8_PROGRAM_START_OFFSET + module->romSize) return false;
+
+    return memcmp(m->mem + start, module->rom + (start - CHIP8_PROGRAM_START_OFFSET), block->end - start) == 0;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+uint32_t chip8AotRun(Chip8Machine* m, uint32_t count)
+{
+    struct Chip8Aot* aot = m->aot;
+    uint32_t executed = 0;
+
+    while (executed < count)
+    {
+        // Unlike the decode cache, blocks may start at odd addresses: plenty of ROMs jump over an odd length title
+        uint16_t pc = m->programCounter;
+        if (pc >= aot->module->blockCount) break;
+
+        const Chip8AotBlock* block = &aot->module->blocks[pc];
+        if (block->run == NULL || block->length > count - executed) break;
+
+        if (aot->state[pc] != CHIP8_AOT_VALID)
+        {
+            if (aot->state[pc] == CHIP8_AOT_UNCHECKED)
+                aot->state[pc] = chip8AotCheckBlock(m, pc, block) ? CHIP8_AOT_VALID : CHIP8_AOT_MODIFIED;
+            if (aot->state[pc] == CHIP8_AOT_MODIFIED) break;
+        }
+
+        block->run(m);
+        executed += block->length;
+    }
+    return executed;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8AotInvalidate(Chip8Machine* m, uint32_t address, uint32_t length)
+{
+    struct Chip8Aot* aot = m->aot;
+    if (length == 0 || address >= CHIP8_MEM_SIZE) return;
+
+    // Only blocks starting up to the longest block before the range can overlap it, and there are none past the table
+    uint32_t maxBytes = aot->module->maxBlockBytes;
+    uint32_t first = address > maxBytes ? address - maxBytes : 0;
+    uint32_t last = address + length;
+    if (last > aot->module->blockCount) last = aot->module->blockCount;
+
+    for (uint32_t start = first; start < last; start++)
+    {
+        if (aot->module->blocks[start].end > address) aot->state[start] = CHIP8_AOT_UNCHECKED;
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef CHIP_8_AOT_H_
+#define CHIP_8_AOT_H_
+
+#include "chip8.h"
+
+// Runtime for ROMs compiled ahead of time to C by tools/chip8aot.  A generated module contains one C function per basic
+// block reachable from 0x200 and a table of them indexed by address.  Blocks operate directly on the Chip8Machine and
+// call the interpreter's handlers for the screen, keyboard, timer and memory instructions, so they mix freely with
+// interpreted code.
+//
+// A block only runs while the memory it was compiled from still holds the ROM's bytes.  Any write reported through
+// chip8InvalidateDecodeCache() makes the overlapping blocks check their bytes again before the next run, so
+// self-modified code (and a different ROM being loaded) falls back to the interpreter, as do computed Bnnn targets.
+
+typedef struct Chip8AotBlock
+{
+    void (*run)(Chip8Machine* m); // Compiled block, NULL if no block starts at this address
+    uint16_t end;                 // Address just past the last instruction
+    uint16_t length;              // Number of CHIP-8 instructions in the block
+} Chip8AotBlock;
+
+typedef struct Chip8AotModule
+{
+    const char* name;            // Name of the ROM the module was generated from
+    const uint8_t* rom;          // The ROM itself, loaded at CHIP8_PROGRAM_START_OFFSET
+    uint32_t romSize;            // Size of the ROM in bytes
+    const Chip8AotBlock* blocks; // Indexed by the block's start address
+    uint32_t blockCount;         // Entries in blocks: the start address of the last block, plus one
+    uint32_t maxBlockBytes;      // Size in bytes of the longest block
+} Chip8AotModule;
+
+// Attaches a compiled module to the machine.  Set m->dispatch to CHIP8_DISPATCH_AOT to use it.  Returns false if the
+// runtime state could not be allocated.
+bool chip8AotAttach(Chip8Machine* m, const Chip8AotModule* module);
+
+// Detaches the module attached to the machine, if any
+void chip8AotDetach(Chip8Machine* m);
+
+// Runs compiled blocks from the program counter on until the next block would exceed count instructions, there is no
+// compiled block at the program counter or its code was modified.  Returns the number of instructions executed, 0 if
+// the interpreter has to execute the next instruction.
+uint32_t chip8AotRun(Chip8Machine* m, uint32_t count);
+
+// Makes every block overlapping the given memory range check its code again.  Called by chip8InvalidateDecodeCache().
+void chip8AotInvalidate(Chip8Machine* m, uint32_t address, uint32_t length);
+
+#endif
@@ -0,0 +1,186 @@
+#include "chip8audio.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define WAV_HEADER_SIZE 44
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void put16(uint8_t** p, uint16_t value)
+{
+    *(*p)++ = value & 0xFF;
+    *(*p)++ = value >> 8;
+}
+
+static void put32(uint8_t** p, uint32_t value)
+{
+    put16(p, value & 0xFFFF);
+    put16(p, value >> 16);
+}
+
+static void putTag(uint8_t** p, const char* tag)
+{
+    memcpy(*p, tag, 4);
+    *p += 4;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Writes the RIFF header of a 16-bit mono WAV file holding the given number of samples
+static bool chip8WriteWavHeader(FILE* fp, uint64_t samples)
+{
+    uint32_t dataSize = (uint32_t)(samples * 2);
+    uint8_t header[WAV_HEADER_SIZE];
+    uint8_t* p = header;
+    putTag(&p, "RIFF");
+    put32(&p, WAV_HEADER_SIZE - 8 + dataSize);
+    putTag(&p, "WAVE");
+    putTag(&p, "fmt ");
+    put32(&p, 16);                          // Size of the format chunk
+    put16(&p, 1);                           // PCM
+    put16(&p, 1);                           // Channels
+    put32(&p, CHIP8_AUDIO_SAMPLE_RATE);     // Samples per second
+    put32(&p, CHIP8_AUDIO_SAMPLE_RATE * 2); // Bytes per second
+    put16(&p, 2);                           // Bytes per sample
+    put16(&p, 16);                          // Bits per sample
+    putTag(&p, "data");
+    put32(&p, dataSize);
+    return fwrite(header, sizeof(header), 1, fp) == 1;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static bool chip8NullOpen(Chip8Audio* audio, const char* target) { return true; }
+
+static bool chip8NullWrite(Chip8Audio* audio, const int16_t* samples, uint32_t count) { return true; }
+
+static uint32_t chip8NullQueued(Chip8Audio* audio) { return 0; }
+
+static void chip8NullClose(Chip8Audio* audio) {}
+
+const Chip8AudioBackend chip8AudioNull = {"null", chip8NullOpen, chip8NullWrite, chip8NullQueued, chip8NullClose};
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static bool chip8WavOpen(Chip8Audio* audio, const char* target)
+{
+    // The sizes in the header are filled in when the file is closed
+    FILE* fp = fopen(target, "wb");
+    if (fp == NULL) return false;
+    if (!chip8WriteWavHeader(fp, 0))
+    {
+        fclose(fp);
+        return false;
+    }
+    audio->file = fp;
+    return true;
+}
+
+static bool chip8WavWrite(Chip8Audio* audio, const int16_t* samples, uint32_t count)
+{
+    // WAV files are little endian whatever the host is
+    uint8_t bytes[CHIP8_AUDIO_FRAME_SAMPLES * 2];
+    uint8_t* p = bytes;
+    for (uint32_t n = 0; n < count; n++) put16(&p, (uint16_t)samples[n]);
+    if (fwrite(bytes, 2, count, audio->file) != count) audio->failed = true;
+    return true;
+}
+
+static void chip8WavClose(Chip8Audio* audio)
+{
+    FILE* fp = audio->file;
+    if (fseek(fp, 0, SEEK_SET) != 0 || !chip8WriteWavHeader(fp, audio->frames * CHIP8_AUDIO_FRAME_SAMPLES))
+        audio->failed = true;
+    if (fclose(fp) != 0) audio->failed = true;
+    audio->file = NULL;
+}
+
+const Chip8AudioBackend chip8AudioWav = {"wav", chip8WavOpen, chip8WavWrite, chip8NullQueued, chip8WavClose};
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static bool chip8DeviceOpen(Chip8Audio* audio, const char* target)
+{
+    return platformAudioOpen(CHIP8_AUDIO_SAMPLE_RATE, CHIP8_AUDIO_FRAME_SAMPLES, CHIP8_AUDIO_QUEUE);
+}
+
+static bool chip8DeviceWrite(Chip8Audio* audio, const int16_t* samples, uint32_t count)
+{
+    return platformAudioWrite(samples, count);
+}
+
+static uint32_t chip8DeviceQueued(Chip8Audio* audio) { return platformAudioQueued(); }
+
+static void chip8DeviceClose(Chip8Audio* audio) { platformAudioClose(); }
+
+const Chip8AudioBackend chip8AudioDevice = {"device", chip8DeviceOpen, chip8DeviceWrite, chip8DeviceQueued,
+                                            chip8DeviceClose};
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8AudioOpen(Chip8Audio* audio, const Chip8AudioBackend* backend, const char* target)
+{
+    memset(audio, 0, sizeof(*audio));
+    if (!backend->open(audio, target)) return false;
+    audio->backend = backend;
+    return true;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8AudioClose(Chip8Audio* audio)
+{
+    if (audio->backend == NULL) return;
+    audio->backend->close(audio);
+    audio->backend = NULL;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8AudioFrame(Chip8Audio* audio, bool tone)
+{
+    int16_t* samples = audio->samples;
+    if (tone)
+    {
+        // Every beep starts at the top of the wave, so the same beep always comes out as the same samples.  The phase
+        // advances by the pitch every sample and wraps at the sample rate, which keeps the pitch exact.
+        uint32_t phase = audio->tone ? audio->phase : 0;
+        for (uint32_t n = 0; n < CHIP8_AUDIO_FRAME_SAMPLES; n++)
+        {
+            samples[n] = phase < CHIP8_AUDIO_SAMPLE_RATE / 2 ? CHIP8_AUDIO_AMPLITUDE : -CHIP8_AUDIO_AMPLITUDE;
+            phase += CHIP8_AUDIO_TONE_HZ;
+            if (phase >= CHIP8_AUDIO_SAMPLE_RATE) phase -= CHIP8_AUDIO_SAMPLE_RATE;
+        }
+        audio->phase = phase;
+        audio->toneFrames++;
+        if (!audio->tone) audio->beeps++;
+    }
+    else if (audio->tone)
+    {
+        // Silent frames are all the same, so the buffer only needs clearing after a tone
+        memset(samples, 0, sizeof(audio->samples));
+    }
+    audio->tone = tone;
+    audio->frames++;
+
+    // What is still queued plays before this frame, so it is how late the frame is heard.  Dropped frames aren't
+    // heard at all and don't count.
+    uint32_t queued = audio->backend->queued(audio);
+    if (!audio->backend->write(audio, samples, CHIP8_AUDIO_FRAME_SAMPLES))
+    {
+        audio->dropped++;
+        return;
+    }
+    audio->queuedSamples += queued;
+    if (queued > audio->queuedMax) audio->queuedMax = queued;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+double chip8AudioGetLatencyMs(const Chip8Audio* audio, double* maxMs)
+{
+    if (maxMs != NULL) *maxMs = audio->queuedMax * 1000.0 / CHIP8_AUDIO_SAMPLE_RATE;
+    uint64_t written = audio->frames - audio->dropped;
+    return written > 0 ? (double)audio->queuedSamples / written * 1000.0 / CHIP8_AUDIO_SAMPLE_RATE : 0.0;
+}
@@ -0,0 +1,77 @@
+#ifndef CHIP_8_AUDIO_H_
+#define CHIP_8_AUDIO_H_
+
+#include "chip8.h"
+
+// Sound output: the core synthesizes the tone itself, one emulated frame of samples at a time, and hands each frame to
+// a backend.  The tone sounds for exactly the frames that end with the sound timer running, so a beep of n frames is
+// n * CHIP8_AUDIO_FRAME_SAMPLES samples long and starts at the sample of the frame it was set in, on any host, at any
+// speed and with any dispatch engine.  Because the samples only depend on emulated time, a run written to a WAV file
+// can be compared sample for sample against another.
+//
+// Backends are a small table of functions, so a frontend can bring its own.  The null backend only counts, the WAV
+// backend writes a file, and the device backend plays through the host's sound device (see platformAudioOpen()),
+// queueing at most CHIP8_AUDIO_QUEUE frames so the tone is never more than that far behind the emulation.  Frames the
+// device has no room for, as happens in turbo mode, are dropped.  Everything runs on the emulator thread, from the
+// end of every frame; see Chip8Machine.audio.
+//
+// The tone is gated at frame boundaries only: whether a frame beeps is decided once, when it ends, so the beep
+// changes state at most once per frame and a sound timer set mid-frame is heard from the start of that frame's
+// samples.  Those samples reach the backend only once the frame has run, and then play after the ones still queued
+// on the device.  Chip8Audio.queuedSamples and queuedMax measure that queue, which is the latency beyond the frame
+// of synthesis; see chip8AudioGetLatencyMs().
+
+#define CHIP8_AUDIO_SAMPLE_RATE 44100                                         // Samples per second, 16-bit mono
+#define CHIP8_AUDIO_FRAME_SAMPLES (CHIP8_AUDIO_SAMPLE_RATE / CHIP8_FRAME_RATE) // Samples per emulated frame
+#define CHIP8_AUDIO_TONE_HZ 300                                               // Pitch of the square wave
+#define CHIP8_AUDIO_AMPLITUDE 6000                                            // Peak of the square wave
+#define CHIP8_AUDIO_QUEUE 3                                                   // Frames the device queues at most
+
+struct Chip8Audio;
+
+// Where the samples go.  open() gets the target given to chip8AudioOpen(), write() one frame of samples.
+typedef struct Chip8AudioBackend
+{
+    const char* name;                                                                // Shown in reports
+    bool (*open)(struct Chip8Audio* audio, const char* target);                      // Returns false if it can't play
+    bool (*write)(struct Chip8Audio* audio, const int16_t* samples, uint32_t count); // Returns false if it dropped them
+    uint32_t (*queued)(struct Chip8Audio* audio);                                    // Samples written, not yet heard
+    void (*close)(struct Chip8Audio* audio);                                         // Flushes and releases
+} Chip8AudioBackend;
+
+typedef struct Chip8Audio
+{
+    const Chip8AudioBackend* backend;           // Backend the frames go to, NULL until opened
+    void* file;                                 // FILE the WAV backend writes to
+    bool failed;                                // True if the WAV backend could not write some samples
+    uint32_t phase;                             // Position in the tone's period, in units of 1 / sample rate
+    bool tone;                                  // True if the last frame had the tone in it
+    uint64_t frames;                            // Frames synthesized
+    uint64_t toneFrames;                        // Of those, the ones with the tone in them
+    uint64_t beeps;                             // Times the tone started
+    uint64_t dropped;                           // Frames the backend had no room for
+    uint64_t queuedSamples;                     // Sum over the frames written of the samples queued ahead of them
+    uint32_t queuedMax;                         // Most samples queued ahead of a frame
+    int16_t samples[CHIP8_AUDIO_FRAME_SAMPLES]; // Frame being handed to the backend
+} Chip8Audio;
+
+extern const Chip8AudioBackend chip8AudioNull;   // Discards the samples
+extern const Chip8AudioBackend chip8AudioWav;    // Writes the samples to the WAV file named by the target
+extern const Chip8AudioBackend chip8AudioDevice; // Plays the samples on the host's sound device
+
+// Opens a backend.  Returns false, leaving the audio closed, if the backend can't be used: there is no sound device,
+// or the WAV file can't be created.
+bool chip8AudioOpen(Chip8Audio* audio, const Chip8AudioBackend* backend, const char* target);
+
+// Closes the backend.  The WAV backend finishes the file.
+void chip8AudioClose(Chip8Audio* audio);
+
+// Synthesizes the next frame, with or without the tone, and hands it to the backend
+void chip8AudioFrame(Chip8Audio* audio, bool tone);
+
+// Returns the mean time, in milliseconds, a frame's samples waited behind those queued ahead of them, and sets *maxMs
+// to the longest wait if it is not NULL.  The frame of synthesis comes on top, see above.  Files don't queue, so it
+// is 0 for them.
+double chip8AudioGetLatencyMs(const Chip8Audio* audio, double* maxMs);
+
+#endif
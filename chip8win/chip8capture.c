@@ -0,0 +1,538 @@
+#include "chip8capture.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHIP8_CAPTURE_ACTL_OFFSET 33 // File offset of the acTL chunk: after the signature and IHDR
+
+// Base lengths and distances of the deflate length and distance codes, and the extra bits that follow each
+static const uint16_t _chip8_LengthBase[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                               31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t _chip8_LengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                               2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t _chip8_DistanceBase[30] = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,
+                                                 33,  49,  65,  97,  129, 193,  257,  385,  513,  769,
+                                                 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t _chip8_DistanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                                 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// Deflate output, written least significant bit first
+typedef struct Chip8BitStream
+{
+    uint8_t* out;   // Bytes written so far
+    uint32_t size;  // Number of them
+    uint32_t bits;  // Bits not yet written, the first in bit 0
+    uint32_t count; // Number of them, always below 8 between calls
+} Chip8BitStream;
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void chip8PutBits(Chip8BitStream* s, uint32_t value, uint32_t count)
+{
+    s->bits |= value << s->count;
+    s->count += count;
+    while (s->count >= 8)
+    {
+        s->out[s->size++] = (uint8_t)s->bits;
+        s->bits >>= 8;
+        s->count -= 8;
+    }
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Huffman codes are written starting from their most significant bit
+static void chip8PutCode(Chip8BitStream* s, uint32_t code, uint32_t length)
+{
+    uint32_t reversed = 0;
+    for (uint32_t bit = 0; bit < length; bit++) reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+    chip8PutBits(s, reversed, length);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Literal or length symbol, in the fixed Huffman code
+static void chip8PutSymbol(Chip8BitStream* s, uint32_t symbol)
+{
+    if (symbol < 144)
+        chip8PutCode(s, 0x30 + symbol, 8);
+    else if (symbol < 256)
+        chip8PutCode(s, 0x190 + symbol - 144, 9);
+    else if (symbol < 280)
+        chip8PutCode(s, symbol - 256, 7);
+    else
+        chip8PutCode(s, 0xC0 + symbol - 280, 8);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void chip8PutMatch(Chip8BitStream* s, uint32_t length, uint32_t distance)
+{
+    uint32_t l = 28;
+    while (_chip8_LengthBase[l] > length) l--;
+    chip8PutSymbol(s, 257 + l);
+    chip8PutBits(s, length - _chip8_LengthBase[l], _chip8_LengthExtra[l]);
+
+    uint32_t d = 29;
+    while (_chip8_DistanceBase[d] > distance) d--;
+    chip8PutCode(s, d, 5);
+    chip8PutBits(s, distance - _chip8_DistanceBase[d], _chip8_DistanceExtra[d]);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Compresses an image of rows rowBytes long into a zlib stream, and returns its size.  A scaled-up screen is runs of
+// one color and rows repeating the one above, so only those two matches are looked for, which keeps this fast and
+// still gets most of what a full search would.  out must hold size * 9 / 8 + 16 bytes.
+static uint32_t chip8Deflate(const uint8_t* data, uint32_t size, uint32_t rowBytes, uint8_t* out)
+{
+    Chip8BitStream s = {out, 0, 0, 0};
+    out[s.size++] = 0x78; // Deflate with a 32 KB window
+    out[s.size++] = 0x01; // No dictionary, fastest compression, and the check bits making the header a multiple of 31
+    chip8PutBits(&s, 1, 1); // Last block
+    chip8PutBits(&s, 1, 2); // Fixed Huffman codes
+
+    uint32_t distances[2] = {1, rowBytes};
+    for (uint32_t pos = 0; pos < size;)
+    {
+        uint32_t longest = size - pos < 258 ? size - pos : 258;
+        uint32_t best = 0, bestDistance = 0;
+        for (uint32_t c = 0; c < 2; c++)
+        {
+            uint32_t distance = distances[c];
+            if (distance > pos) continue;
+            uint32_t length = 0;
+            while (length < longest && data[pos + length] == data[pos + length - distance]) length++;
+            if (length > best)
+            {
+                best = length;
+                bestDistance = distance;
+            }
+        }
+
+        if (best >= 3)
+        {
+            chip8PutMatch(&s, best, bestDistance);
+            pos += best;
+        }
+        else
+        {
+            chip8PutSymbol(&s, data[pos++]);
+        }
+    }
+    chip8PutSymbol(&s, 256); // End of block
+    chip8PutBits(&s, 0, 7);  // Pads the last byte
+
+    // Adler-32 of the uncompressed data, big endian.  The sums are reduced often enough not to overflow.
+    uint32_t a = 1, b = 0;
+    for (uint32_t pos = 0; pos < size;)
+    {
+        uint32_t end = size - pos < 5552 ? size : pos + 5552;
+        for (; pos < end; pos++)
+        {
+            a += data[pos];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    uint32_t adler = b << 16 | a;
+    for (int32_t shift = 24; shift >= 0; shift -= 8) out[s.size++] = (uint8_t)(adler >> shift);
+    return s.size;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void chip8PutBigEndian(uint8_t* p, uint32_t value)
+{
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static uint32_t chip8Crc(const Chip8Capture* capture, uint32_t crc, const uint8_t* data, uint32_t size)
+{
+    for (uint32_t n = 0; n < size; n++) crc = capture->crcTable[(crc ^ data[n]) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static bool chip8WriteChunk(const Chip8Capture* capture, const char* type, const uint8_t* data, uint32_t size)
+{
+    uint8_t header[8], trailer[4];
+    chip8PutBigEndian(header, size);
+    memcpy(header + 4, type, 4);
+    chip8PutBigEndian(trailer, ~chip8Crc(capture, chip8Crc(capture, ~0u, header + 4, 4), data, size));
+    return fwrite(header, 1, 8, capture->writer.file) == 8 && fwrite(data, 1, size, capture->writer.file) == size &&
+           fwrite(trailer, 1, 4, capture->writer.file) == 4;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static bool chip8WriteAnimationControl(const Chip8Capture* capture, uint32_t frames)
+{
+    uint8_t control[8];
+    chip8PutBigEndian(control, frames);
+    chip8PutBigEndian(control + 4, 0); // Loops forever
+    return chip8WriteChunk(capture, "acTL", control, sizeof(control));
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static bool chip8WriteCaptureHeader(const Chip8Capture* capture)
+{
+    uint32_t width = CHIP8_SCREEN_WIDTH * capture->scale;
+    uint32_t height = CHIP8_SCREEN_HEIGHT * capture->scale;
+    if (capture->format == CHIP8_CAPTURE_Y4M)
+    {
+        return fprintf(capture->writer.file, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C444\n", width, height,
+                       CHIP8_FRAME_RATE) > 0;
+    }
+
+    // An 8-bit palette image with one entry per color.  The frame count in acTL is filled in when the video ends.
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    uint8_t header[13] = {0};
+    chip8PutBigEndian(header, width);
+    chip8PutBigEndian(header + 4, height);
+    header[8] = 8; // Bits per index
+    header[9] = 3; // Palette
+    uint8_t palette[12];
+    for (uint32_t c = 0; c < 4; c++)
+    {
+        palette[c * 3] = (uint8_t)(capture->colors[c] >> 16);
+        palette[c * 3 + 1] = (uint8_t)(capture->colors[c] >> 8);
+        palette[c * 3 + 2] = (uint8_t)capture->colors[c];
+    }
+    return fwrite(signature, 1, sizeof(signature), capture->writer.file) == sizeof(signature) &&
+           chip8WriteChunk(capture, "IHDR", header, sizeof(header)) && chip8WriteAnimationControl(capture, 0) &&
+           chip8WriteChunk(capture, "PLTE", palette, sizeof(palette));
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Expands the pending screen into capture->image: for every output row a filter byte (none), then the palette index
+// of every pixel
+static void chip8ScaleCapture(Chip8Capture* capture)
+{
+    const Chip8Screen* screen = &capture->pending.screen;
+    uint32_t rowBytes = CHIP8_SCREEN_WIDTH * capture->scale + 1;
+    uint32_t factor = CHIP8_SCREEN_WIDTH / screen->width * capture->scale;
+    uint32_t stride = screen->width / 64;
+    bool twoPlanes = (screen->planes & 2) != 0;
+
+    uint8_t* out = capture->image;
+    for (uint32_t y = 0; y < screen->height; y++)
+    {
+        const uint64_t* row0 = screen->pixels[0] + y * stride;
+        const uint64_t* row1 = screen->pixels[1] + y * stride;
+        uint8_t* pixel = out;
+        *pixel++ = 0;
+        for (uint32_t x = 0; x < screen->width; x++)
+        {
+            uint32_t shift = 63 - x % 64;
+            uint32_t index = (row0[x / 64] >> shift) & 1;
+            if (twoPlanes) index |= ((row1[x / 64] >> shift) & 1) << 1;
+            memset(pixel, index, factor);
+            pixel += factor;
+        }
+        for (uint32_t n = 1; n < factor; n++) memcpy(out + n * rowBytes, out, rowBytes);
+        out += factor * rowBytes;
+    }
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Writes the pending screen to stay up for the given number of frames.  Returns false if a write failed.
+static bool chip8WriteCaptureFrame(Chip8Capture* capture, uint64_t duration, uint64_t* written)
+{
+    uint32_t width = CHIP8_SCREEN_WIDTH * capture->scale;
+    uint32_t height = CHIP8_SCREEN_HEIGHT * capture->scale;
+    chip8ScaleCapture(capture);
+
+    if (capture->format == CHIP8_CAPTURE_Y4M)
+    {
+        // BT.601 studio range, like most players assume
+        uint8_t yuv[3][4];
+        for (uint32_t c = 0; c < 4; c++)
+        {
+            int32_t r = (capture->colors[c] >> 16) & 0xFF, g = (capture->colors[c] >> 8) & 0xFF;
+            int32_t b = capture->colors[c] & 0xFF;
+            yuv[0][c] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+            yuv[1][c] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            yuv[2][c] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+        uint32_t planeSize = width * height;
+        for (uint32_t y = 0; y < height; y++)
+        {
+            const uint8_t* indices = capture->image + y * (width + 1) + 1;
+            for (uint32_t x = 0; x < width; x++)
+            {
+                for (uint32_t p = 0; p < 3; p++) capture->encoded[p * planeSize + y * width + x] = yuv[p][indices[x]];
+            }
+        }
+
+        // Y4M has no durations, so the frame is repeated
+        if (duration > CHIP8_CAPTURE_Y4M_MAX_FRAMES) duration = CHIP8_CAPTURE_Y4M_MAX_FRAMES;
+        for (; duration > 0; duration--, (*written)++)
+        {
+            if (fputs("FRAME\n", capture->writer.file) < 0 ||
+                fwrite(capture->encoded, 1, planeSize * 3, capture->writer.file) != planeSize * 3)
+                return false;
+        }
+        return true;
+    }
+
+    // The sequence number of an fdAT chunk goes in front of the image data, so it is compressed after room for it
+    uint32_t size = chip8Deflate(capture->image, (width + 1) * height, width + 1, capture->encoded + 4);
+
+    // A delay only goes up to 65535 frames, so a screen that stays up longer is written again
+    while (duration > 0)
+    {
+        uint32_t frames = duration < 0xFFFF ? (uint32_t)duration : 0xFFFF;
+        uint8_t control[26] = {0};
+        chip8PutBigEndian(control, capture->sequence++);
+        chip8PutBigEndian(control + 4, width);
+        chip8PutBigEndian(control + 8, height);
+        control[20] = (uint8_t)(frames >> 8); // Delay numerator, then denominator
+        control[21] = (uint8_t)frames;
+        control[22] = (uint8_t)(CHIP8_FRAME_RATE >> 8);
+        control[23] = (uint8_t)CHIP8_FRAME_RATE;
+        if (!chip8WriteChunk(capture, "fcTL", control, sizeof(control))) return false;
+
+        // The first frame is the default image every PNG viewer shows
+        bool ok;
+        if (*written == 0)
+        {
+            ok = chip8WriteChunk(capture, "IDAT", capture->encoded + 4, size);
+        }
+        else
+        {
+            chip8PutBigEndian(capture->encoded, capture->sequence++);
+            ok = chip8WriteChunk(capture, "fdAT", capture->encoded, size + 4);
+        }
+        if (!ok) return false;
+        duration -= frames;
+        (*written)++;
+    }
+    return true;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static bool chip8FinishCaptureFile(Chip8Capture* capture, uint64_t written)
+{
+    if (capture->format == CHIP8_CAPTURE_Y4M) return true;
+    return chip8WriteChunk(capture, "IEND", NULL, 0) &&
+           fseek(capture->writer.file, CHIP8_CAPTURE_ACTL_OFFSET, SEEK_SET) == 0 &&
+           chip8WriteAnimationControl(capture, (uint32_t)written);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static bool chip8WriteCaptureScreens(void* context, FILE* file, uint32_t first, uint32_t last)
+{
+    Chip8Capture* capture = context;
+
+    // A screen is only encoded once the next one says how long it stayed up, so the last one taken is kept aside.
+    // Encoding is slow next to emulating, so each slot goes back to the emulator as soon as its screen is copied out,
+    // rather than with the rest of the chunk.
+    for (uint32_t tail = first; tail != last; tail++)
+    {
+        const Chip8CaptureFrame* frame = &capture->frames[tail & (capture->writer.capacity - 1)];
+        if (capture->hasPending &&
+            !chip8WriteCaptureFrame(capture, frame->frame - capture->pending.frame, &capture->written))
+            return false;
+        capture->pending.frame = frame->frame;
+        chip8CopyScreen(&capture->pending.screen, &frame->screen);
+        capture->hasPending = true;
+        chip8WriterRelease(&capture->writer, tail + 1);
+    }
+    return true;
+}
+
+static bool chip8FinishCaptureScreens(void* context, FILE* file, bool ok)
+{
+    Chip8Capture* capture = context;
+
+    // The last screen stays up until the capture ended, and at least a frame so a screen drawn in the last one is
+    // seen too.  endFrame was set before the writer was told to finish.
+    if (capture->hasPending)
+    {
+        uint64_t endFrame = capture->endFrame;
+        uint64_t duration = endFrame > capture->pending.frame ? endFrame - capture->pending.frame : 1;
+        ok = ok && chip8WriteCaptureFrame(capture, duration, &capture->written);
+        capture->hasPending = false;
+    }
+    return ok && chip8FinishCaptureFile(capture, capture->written);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8CaptureInit(Chip8Capture* capture, const char* filename, uint32_t capacity, uint32_t scale)
+{
+    memset(capture, 0, sizeof(*capture));
+    snprintf(capture->filename, sizeof(capture->filename), "%s", filename);
+    uint32_t size = CHIP8_CAPTURE_CHUNK * 2;
+    while (size < capacity) size *= 2;
+    capture->scale = scale < 1 ? 1 : scale > CHIP8_CAPTURE_MAX_SCALE ? CHIP8_CAPTURE_MAX_SCALE : scale;
+
+    // Extensions are compared without case, for Windows
+    const char* dot = strrchr(filename, '.');
+    uint32_t c = 0;
+    while (dot != NULL && c < 4 && tolower((unsigned char)dot[c]) == ".y4m"[c]) c++;
+    capture->format = c == 4 && dot[c] == '\0' ? CHIP8_CAPTURE_Y4M : CHIP8_CAPTURE_APNG;
+
+    // Same colors as a new Chip8Renderer
+    capture->colors[0] = 0xFF000000;
+    capture->colors[1] = 0xFFFFFFFF;
+    capture->colors[2] = 0xFFFF6600;
+    capture->colors[3] = 0xFF662200;
+
+    // CRC-32 as used by PNG, one byte at a time
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t crc = n;
+        for (uint32_t bit = 0; bit < 8; bit++) crc = crc & 1 ? 0xEDB88320 ^ (crc >> 1) : crc >> 1;
+        capture->crcTable[n] = crc;
+    }
+
+    // The encoded frame is the bigger of the three YUV planes and the deflated image, which takes at most 9 bits per
+    // byte, after the fdAT sequence number
+    size_t pixels = (size_t)CHIP8_SCREEN_WIDTH * capture->scale * CHIP8_SCREEN_HEIGHT * capture->scale;
+    size_t imageSize = pixels + CHIP8_SCREEN_HEIGHT * capture->scale;
+    size_t deflated = 4 + imageSize * 9 / 8 + 16;
+    capture->frames = malloc((size_t)size * sizeof(Chip8CaptureFrame));
+    capture->image = malloc(imageSize);
+    capture->encoded = malloc(pixels * 3 > deflated ? pixels * 3 : deflated);
+    // The ring holds two chunks at least, so screens go on being queued while the writer encodes one.  Screens that
+    // find it full are dropped rather than waited for.
+    if (capture->frames != NULL && capture->image != NULL && capture->encoded != NULL &&
+        chip8WriterInit(&capture->writer, size, CHIP8_CAPTURE_CHUNK, chip8WriteCaptureScreens,
+                        chip8FinishCaptureScreens, capture))
+        return true;
+    free(capture->frames);
+    free(capture->image);
+    free(capture->encoded);
+    return false;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8CaptureDestroy(Chip8Capture* capture)
+{
+    if (capture->active) chip8CaptureEnd(capture);
+    chip8WriterDestroy(&capture->writer);
+    free(capture->frames);
+    free(capture->image);
+    free(capture->encoded);
+    capture->frames = NULL;
+    capture->image = capture->encoded = NULL;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static bool chip8SameScreen(const Chip8Screen* a, const Chip8Screen* b)
+{
+    if (a->width != b->width || a->height != b->height || a->planes != b->planes) return false;
+
+    uint32_t words = a->height * (a->width / 64);
+    for (uint32_t p = 0; p < CHIP8_PLANE_COUNT; p++)
+    {
+        if ((a->planes & (1u << p)) && memcmp(a->pixels[p], b->pixels[p], words * sizeof(uint64_t)) != 0) return false;
+    }
+    return true;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Copies the screen into the ring, unless it is full.  Never waits for the writer, which is only woken up once a chunk
+// of screens is queued: a screen stays in the ring until then, and the frame it appeared in says how long it is shown.
+static void chip8CaptureQueue(Chip8Capture* capture, const Chip8Screen* screen)
+{
+    uint32_t head = capture->writer.head;
+    if (head - platformAtomicLoad(&capture->writer.tail) >= capture->writer.capacity)
+    {
+        capture->dropped++;
+        return;
+    }
+
+    Chip8CaptureFrame* slot = &capture->frames[head & (capture->writer.capacity - 1)];
+    slot->frame = capture->frame;
+    chip8CopyScreen(&slot->screen, screen);
+    chip8CopyScreen(&capture->last, screen);
+    capture->captured++;
+    chip8WriterPublish(&capture->writer, head + 1);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8CaptureBegin(Chip8Capture* capture, const Chip8Machine* m)
+{
+    // The last video must be finished before its file is replaced.  The writer is idle after that, so the header can
+    // be written through its file before it is opened.
+    chip8WriterWaitUntilClosed(&capture->writer);
+    FILE* fp = fopen(capture->filename, "wb");
+    if (fp == NULL) return false;
+    capture->writer.file = fp;
+    if (!chip8WriteCaptureHeader(capture))
+    {
+        fclose(fp);
+        capture->writer.file = NULL;
+        return false;
+    }
+
+    capture->frame = 0;
+    capture->captured = capture->unchanged = capture->dropped = 0;
+    capture->endFrame = 0;
+    capture->written = 0;
+    capture->hasPending = false;
+    capture->sequence = 0;
+    capture->active = true;
+    chip8WriterOpen(&capture->writer, fp);
+
+    // The video starts with whatever is on the screen
+    chip8CaptureQueue(capture, &m->screen);
+    return true;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8CaptureEnd(Chip8Capture* capture)
+{
+    capture->active = false;
+    capture->endFrame = capture->frame;
+    chip8WriterEnd(&capture->writer, capture->writer.head);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8CaptureFrame(Chip8Capture* capture, const Chip8Machine* m)
+{
+    capture->frame++;
+    if (chip8SameScreen(&capture->last, &m->screen))
+        capture->unchanged++;
+    else
+        chip8CaptureQueue(capture, &m->screen);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8CaptureFlush(Chip8Capture* capture) { chip8WriterWaitUntilClosed(&capture->writer); }
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8ProcessCaptureRequest(Chip8Machine* m)
+{
+    if (m->capture == NULL || m->capturing == m->capture->active) return;
+
+    // A capture that can't be started is given up on rather than retried every frame
+    if (!m->capturing)
+        chip8CaptureEnd(m->capture);
+    else if (!chip8CaptureBegin(m->capture, m))
+        m->capturing = false;
+}
@@ -0,0 +1,100 @@
+#ifndef CHIP_8_CAPTURE_H_
+#define CHIP_8_CAPTURE_H_
+
+#include "chip8.h"
+#include "chip8writer.h"
+
+#include <stdio.h>
+
+// Frame capture: records what the screen shows to a lossless video file.  At the end of every emulated frame the
+// emulator thread compares the screen with the last one it captured and, only if it changed, copies it into a ring of
+// packed screens.  A background writer thread (see Chip8Writer) takes them from there a chunk at a time, scales them
+// up and encodes them, so the emulator never waits for the encoder or the disk.  If the writer falls behind and the
+// ring fills, the new screen is dropped (and counted) instead; the previous one just stays up longer in the video.
+//
+// Every screen stays up for as many emulated frames as passed before the screen changed again, so a ROM that only
+// draws now and then makes a short file.  The frame rate is CHIP8_FRAME_RATE in emulated time, whatever speed the
+// machine ran at.  Two formats are written, picked by the file name:
+//
+// - APNG (any name but *.y4m): a palette PNG any browser plays, one frame per screen with its duration in the frame
+//   control chunk.  The image data is deflated with the fixed Huffman codes, using matches against the pixel to the
+//   left and the row above, which is most of what a scaled-up screen is.
+// - Y4M (*.y4m): raw 4:4:4 YUV for piping into an encoder.  The format has no frame durations, so a screen is written
+//   once for every frame it stays up, but for at most CHIP8_CAPTURE_Y4M_MAX_FRAMES frames: in turbo mode a screen
+//   can stay up for millions of them.
+//
+// The video is always CHIP8_SCREEN_WIDTH x CHIP8_SCREEN_HEIGHT emulated pixels times the scale; low resolution
+// screens take twice the scale.  The colors default to Chip8Renderer's.
+
+#define CHIP8_CAPTURE_CAPACITY 64        // Screens the ring holds by default
+#define CHIP8_CAPTURE_CHUNK 8            // Screens the writer waits for before encoding, unless the video is ending
+#define CHIP8_CAPTURE_SCALE 4            // Output pixels per hi-res pixel by default, so 512 x 256 videos
+#define CHIP8_CAPTURE_MAX_SCALE 16       // Largest scale, which keeps a row of the image well within deflate's window
+#define CHIP8_CAPTURE_Y4M_MAX_FRAMES 600 // Longest a screen is repeated in a Y4M video, 10 seconds
+
+typedef enum Chip8CaptureFormat
+{
+    CHIP8_CAPTURE_APNG,
+    CHIP8_CAPTURE_Y4M,
+} Chip8CaptureFormat;
+
+// A screen in the ring
+typedef struct Chip8CaptureFrame
+{
+    uint64_t frame;     // Emulated frames since the capture began when the screen appeared
+    Chip8Screen screen; // Only the planes in screen.planes hold pixels
+} Chip8CaptureFrame;
+
+typedef struct Chip8Capture
+{
+    Chip8CaptureFrame* frames;            // Ring of screens, writer.capacity long
+    char filename[CHIP8_STATE_PATH_SIZE]; // File videos are written to
+    Chip8CaptureFormat format;            // Picked from the file name
+    uint32_t scale;                       // Output pixels per hi-res pixel
+    uint32_t colors[4];                   // 0xAARRGGBB of unlit pixels, then of pixels lit in plane 1, 2 and both
+    Chip8Writer writer;                   // Takes the screens to the encoder.  writer.failed is set if some were lost.
+
+    // Only written by the emulator thread
+    bool active;        // True between chip8CaptureBegin() and chip8CaptureEnd()
+    uint64_t frame;     // Emulated frames since the capture began
+    Chip8Screen last;   // Last screen queued, what the next one is compared with
+    uint64_t captured;  // Screens queued for the current video
+    uint64_t unchanged; // Frames that ended on the same screen as the last one queued
+    uint64_t dropped;   // Screens that found the ring full.  They are queued later if they stay up.
+    uint64_t endFrame;  // frame when the capture ended, which is when the last screen goes off
+
+    // Only used by the writer thread
+    Chip8CaptureFrame pending; // Last screen taken, written once the next one says how long it stayed up
+    bool hasPending;           // pending holds a screen
+    uint64_t written;          // Video frames in the current file
+    uint8_t* image;            // Scaled screen, a filter byte and a palette index per pixel for each row
+    uint8_t* encoded;          // The image deflated after 4 bytes for the fdAT sequence number, or as YUV planes
+    uint32_t sequence;         // Next APNG chunk sequence number
+    uint32_t crcTable[256];    // CRC-32 of every byte value, for the PNG chunks.  chip8CaptureBegin() uses it too.
+} Chip8Capture;
+
+// Allocates a ring of capacity screens (rounded up to a power of two, and two chunks at least) and the writer's buffers
+// for videos at the given scale, and starts the writer thread.  Videos go to filename.  Returns false if the memory or
+// the thread could not be had.
+bool chip8CaptureInit(Chip8Capture* capture, const char* filename, uint32_t capacity, uint32_t scale);
+
+// Finishes the current video, if any, stops the writer thread and frees the ring
+void chip8CaptureDestroy(Chip8Capture* capture);
+
+// Starts a new video file, replacing the last one, with the screen as it is now.  Waits for the previous video to be
+// finished if it still is being written.  Emulator thread only.  Returns false if the file can't be created.
+bool chip8CaptureBegin(Chip8Capture* capture, const Chip8Machine* m);
+
+// Stops capturing.  The writer finishes the file in the background.  Emulator thread only.
+void chip8CaptureEnd(Chip8Capture* capture);
+
+// Queues the screen if it changed.  Called at the end of every emulated frame while the capture is active.
+void chip8CaptureFrame(Chip8Capture* capture, const Chip8Machine* m);
+
+// Waits until the writer has finished the last video, so the file is complete
+void chip8CaptureFlush(Chip8Capture* capture);
+
+// Starts or stops capturing when Chip8Machine.capturing has changed.  Called by chip8Run() between frames.
+void chip8ProcessCaptureRequest(Chip8Machine* m);
+
+#endif
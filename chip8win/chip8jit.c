@@ -0,0 +1,793 @@
+#include "chip8jit.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define CHIP8_JIT_CODE_SIZE (1024 * 1024) // Native code buffer per machine
+#define CHIP8_JIT_MAX_BLOCK_LENGTH 64     // Instructions per block at most
+#define CHIP8_JIT_MAX_BLOCK_BYTES 8192    // Worst case size of a translated block
+
+// Host registers, numbered the way x86-64 encodes them
+#define HOST_RAX 0
+#define HOST_RCX 1
+#define HOST_RDX 2
+#define HOST_RBX 3
+#define HOST_RBP 5
+#define HOST_R12 12
+#define HOST_R13 13
+#define HOST_R14 14
+#define HOST_R15 15
+
+// Condition codes for setcc/cmovcc
+#define COND_E 0x4
+#define COND_NE 0x5
+#define COND_A 0x7
+
+// x86 ALU opcodes for the "op r/m32, r32" form
+#define ALU_ADD 0x01
+#define ALU_OR 0x09
+#define ALU_AND 0x21
+#define ALU_SUB 0x29
+#define ALU_XOR 0x31
+#define ALU_CMP 0x39
+#define ALU_MOV 0x89
+
+// Callee-saved host registers that hold guest V registers while a block runs.  The machine pointer lives in rbx.
+static const int8_t _jit_GuestHostRegs[] = {HOST_R12, HOST_R13, HOST_R14, HOST_R15, HOST_RBP};
+#define CHIP8_JIT_GUEST_HOST_REGS (sizeof(_jit_GuestHostRegs) / sizeof(_jit_GuestHostRegs[0]))
+
+typedef struct Chip8JitBlock
+{
+    const uint8_t* code; // Native code for the block, NULL if not translated
+    uint16_t start;      // Address of the first instruction
+    uint16_t end;        // Address just past the last instruction
+    uint16_t length;     // Number of CHIP-8 instructions in the block
+} Chip8JitBlock;
+
+// The dispatcher finds the entry for address pc at blocks + pc * 16
+_Static_assert(sizeof(Chip8JitBlock) == 16, "Chip8JitBlock must be 16 bytes");
+
+struct Chip8Jit
+{
+    Chip8JitBlock blocks[CHIP8_MEM_SIZE];               // Translated block starting at every address
+    Chip8Decoded decoded[CHIP8_MEM_SIZE];               // Operands passed to the handlers blocks call
+    uint8_t* code;                                      // Executable code buffer, starting with the dispatcher
+    uint32_t (*enter)(Chip8Machine* m, uint32_t count); // Dispatcher entry point
+    const uint8_t* dispatch;                            // Where blocks jump to with the next PC in eax
+    uint32_t codeStart;                                 // Bytes of the code buffer taken by the dispatcher
+    uint32_t codeUsed;                                  // Bytes of the code buffer handed out so far
+    Chip8JitStats stats;
+};
+
+// Output position while a block is being emitted
+typedef struct Chip8JitEmitter
+{
+    uint8_t* p;
+} Chip8JitEmitter;
+
+// Which guest V register is cached in which host register while a block is being emitted
+typedef struct Chip8JitRegs
+{
+    int8_t host[16];    // Host register caching each V register, or -1
+    bool dirty[16];     // V register was modified and has not been written back to the machine yet
+    uint32_t used[16];  // When each V register was last used, for picking one to evict
+    uint32_t clock;
+} Chip8JitRegs;
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static inline void emit8(Chip8JitEmitter* e, uint8_t value) { *e->p++ = value; }
+
+static inline void emit16(Chip8JitEmitter* e, uint16_t value)
+{
+    memcpy(e->p, &value, 2);
+    e->p += 2;
+}
+
+static inline void emit32(Chip8JitEmitter* e, uint32_t value)
+{
+    memcpy(e->p, &value, 4);
+    e->p += 4;
+}
+
+static inline void emit64(Chip8JitEmitter* e, uint64_t value)
+{
+    memcpy(e->p, &value, 8);
+    e->p += 8;
+}
+
+static inline uint8_t modrm(int mod, int reg, int rm) { return (uint8_t)((mod << 6) | ((reg & 7) << 3) | (rm & 7)); }
+
+// Emits a REX prefix if one is needed.  force is used for byte registers, where 4-7 mean spl/bpl/sil/dil with a REX.
+static inline void emitRex(Chip8JitEmitter* e, int reg, int rm, bool force)
+{
+    uint8_t rex = 0x40 | ((reg >> 3) << 2) | (rm >> 3);
+    if (rex != 0x40 || force) emit8(e, rex);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// op dst32, src32 with one of the ALU_ opcodes
+static void emitAlu(Chip8JitEmitter* e, uint8_t opcode, int dst, int src)
+{
+    emitRex(e, src, dst, false);
+    emit8(e, opcode);
+    emit8(e, modrm(3, src, dst));
+}
+
+// op dst32, imm32 with the /digit of the 81 group (0 = add, 7 = cmp)
+static void emitAluImm(Chip8JitEmitter* e, int digit, int dst, uint32_t imm)
+{
+    emitRex(e, 0, dst, false);
+    emit8(e, 0x81);
+    emit8(e, modrm(3, digit, dst));
+    emit32(e, imm);
+}
+
+// mov dst32, imm32
+static void emitMovImm(Chip8JitEmitter* e, int dst, uint32_t imm)
+{
+    emitRex(e, 0, dst, false);
+    emit8(e, 0xB8 + (dst & 7));
+    emit32(e, imm);
+}
+
+// shl/shr dst32, imm8 (digit 4 = shl, 5 = shr)
+static void emitShift(Chip8JitEmitter* e, int digit, int dst, uint8_t imm)
+{
+    emitRex(e, 0, dst, false);
+    emit8(e, 0xC1);
+    emit8(e, modrm(3, digit, dst));
+    emit8(e, imm);
+}
+
+// movzx dst32, dst8: truncates a register to the 8 bits of a V register
+static void emitTruncate8(Chip8JitEmitter* e, int dst)
+{
+    emitRex(e, dst, dst, true);
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit8(e, modrm(3, dst, dst));
+}
+
+// setcc dst8, then movzx dst32, dst8
+static void emitSetcc(Chip8JitEmitter* e, uint8_t cond, int dst)
+{
+    emitRex(e, 0, dst, true);
+    emit8(e, 0x0F);
+    emit8(e, 0x90 + cond);
+    emit8(e, modrm(3, 0, dst));
+    emitTruncate8(e, dst);
+}
+
+// cmovcc dst32, src32
+static void emitCmov(Chip8JitEmitter* e, uint8_t cond, int dst, int src)
+{
+    emitRex(e, dst, src, false);
+    emit8(e, 0x0F);
+    emit8(e, 0x40 + cond);
+    emit8(e, modrm(3, dst, src));
+}
+
+// movzx dst32, byte [rbx + offset]
+static void emitLoad8(Chip8JitEmitter* e, int dst, uint32_t offset)
+{
+    emitRex(e, dst, 0, false);
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit8(e, modrm(2, dst, HOST_RBX));
+    emit32(e, offset);
+}
+
+// mov byte [rbx + offset], src8
+static void emitStore8(Chip8JitEmitter* e, uint32_t offset, int src)
+{
+    emitRex(e, src, 0, true);
+    emit8(e, 0x88);
+    emit8(e, modrm(2, src, HOST_RBX));
+    emit32(e, offset);
+}
+
+// movzx dst32, word [rbx + offset]
+static void emitLoad16(Chip8JitEmitter* e, int dst, uint32_t offset)
+{
+    emitRex(e, dst, 0, false);
+    emit8(e, 0x0F);
+    emit8(e, 0xB7);
+    emit8(e, modrm(2, dst, HOST_RBX));
+    emit32(e, offset);
+}
+
+// mov word [rbx + offset], src16
+static void emitStore16(Chip8JitEmitter* e, uint32_t offset, int src)
+{
+    emit8(e, 0x66);
+    emitRex(e, src, 0, false);
+    emit8(e, 0x89);
+    emit8(e, modrm(2, src, HOST_RBX));
+    emit32(e, offset);
+}
+
+// mov word [rbx + offset], imm16
+static void emitStore16Imm(Chip8JitEmitter* e, uint32_t offset, uint16_t imm)
+{
+    emit8(e, 0x66);
+    emit8(e, 0xC7);
+    emit8(e, modrm(2, 0, HOST_RBX));
+    emit32(e, offset);
+    emit16(e, imm);
+}
+
+// jmp target
+static void emitJmp(Chip8JitEmitter* e, const uint8_t* target)
+{
+    emit8(e, 0xE9);
+    emit32(e, (uint32_t)(target - (e->p + 4)));
+}
+
+// Emits a call to the handler of an instruction that isn't translated, handler(m, &jit->decoded[address])
+static void emitHandlerCall(struct Chip8Jit* jit, Chip8JitEmitter* e, uint16_t instruction, uint16_t address)
+{
+    Chip8Decoded* d = &jit->decoded[address];
+    d->op = (uint8_t)chip8DecodeOp(instruction);
+    d->x = (instruction >> 8) & 0xF;
+    d->y = (instruction >> 4) & 0xF;
+    d->kk = instruction & 0xFF;
+    d->nnn = instruction & 0x0FFF;
+    d->nextPc = address + 2;
+
+    emit8(e, 0x48); // mov rdi, rbx
+    emit8(e, 0x89);
+    emit8(e, 0xDF);
+    emit8(e, 0x48); // mov rsi, d
+    emit8(e, 0xBE);
+    emit64(e, (uint64_t)(uintptr_t)d);
+    emit8(e, 0x48); // mov rax, handler
+    emit8(e, 0xB8);
+    emit64(e, (uint64_t)(uintptr_t)chip8GetHandler(d->op));
+    emit8(e, 0xFF); // call rax
+    emit8(e, 0xD0);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static inline uint32_t regOffset(uint8_t reg) { return (uint32_t)(offsetof(Chip8Machine, genRegs) + reg); }
+
+// Writes every modified V register back to the machine and forgets all cached registers
+static void regsFlush(Chip8JitEmitter* e, Chip8JitRegs* r)
+{
+    for (uint8_t reg = 0; reg < 16; reg++)
+    {
+        if (r->host[reg] >= 0 && r->dirty[reg]) emitStore8(e, regOffset(reg), r->host[reg]);
+        r->host[reg] = -1;
+        r->dirty[reg] = false;
+    }
+}
+
+// Gets the host register caching V register reg, assigning one first if necessary.  The registers in the keep mask
+// are never evicted to make room.  If load is false the current value is not needed because it is about to be
+// overwritten.
+static int regsGet(Chip8JitEmitter* e, Chip8JitRegs* r, uint8_t reg, uint16_t keep, bool load)
+{
+    r->used[reg] = ++r->clock;
+    if (r->host[reg] >= 0) return r->host[reg];
+
+    // Look for a free host register, otherwise evict the least recently used V register
+    int host = -1;
+    for (uint32_t h = 0; h < CHIP8_JIT_GUEST_HOST_REGS && host < 0; h++)
+    {
+        bool taken = false;
+        for (uint8_t other = 0; other < 16; other++)
+        {
+            if (r->host[other] == _jit_GuestHostRegs[h]) taken = true;
+        }
+        if (!taken) host = _jit_GuestHostRegs[h];
+    }
+    if (host < 0)
+    {
+        int victim = -1;
+        for (uint8_t other = 0; other < 16; other++)
+        {
+            if (r->host[other] < 0 || (keep & (1 << other)) != 0) continue;
+            if (victim < 0 || r->used[other] < r->used[victim]) victim = other;
+        }
+        host = r->host[victim];
+        if (r->dirty[victim]) emitStore8(e, regOffset((uint8_t)victim), host);
+        r->host[victim] = -1;
+        r->dirty[victim] = false;
+    }
+
+    if (load) emitLoad8(e, host, regOffset(reg));
+    r->host[reg] = (int8_t)host;
+    return host;
+}
+
+// Gets the host register for a V register that is about to be written
+static int regsSet(Chip8JitEmitter* e, Chip8JitRegs* r, uint8_t reg, uint16_t keep, bool load)
+{
+    int host = regsGet(e, r, reg, keep, load);
+    r->dirty[reg] = true;
+    return host;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Emits a 3xkk/4xkk/5xy0/9xy0 style skip: the flags of a preceding cmp select between the two possible PCs
+static void emitSkip(Chip8JitEmitter* e, uint8_t skipCond, uint16_t address)
+{
+    emitMovImm(e, HOST_RAX, (uint16_t)(address + 2));
+    emitMovImm(e, HOST_RCX, (uint16_t)(address + 4));
+    emitCmov(e, skipCond, HOST_RAX, HOST_RCX);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Emits the dispatcher, uint32_t enter(Chip8Machine* m, uint32_t count).  It keeps the machine in rbx and the
+// instruction budget on the stack, and jumps from block to block until the block at the next PC is missing, doesn't
+// fit in the remaining budget or the PC is out of range.  Blocks return to the dispatch label with the next PC in eax
+// and don't bother storing it, the dispatcher does that on the way out.
+static void emitDispatcher(struct Chip8Jit* jit, Chip8JitEmitter* e)
+{
+    static const uint8_t prologue[] = {
+        0x53,                   // push rbx
+        0x55,                   // push rbp
+        0x41, 0x54,             // push r12
+        0x41, 0x55,             // push r13
+        0x41, 0x56,             // push r14
+        0x41, 0x57,             // push r15
+        0x48, 0x83, 0xEC, 0x08, // sub rsp, 8 (keeps the stack 16 byte aligned for calls)
+        0x48, 0x89, 0xFB,       // mov rbx, rdi
+        0x89, 0x34, 0x24,       // mov [rsp], esi (instructions left)
+        0x89, 0x74, 0x24, 0x04, // mov [rsp + 4], esi (budget)
+    };
+    memcpy(e->p, prologue, sizeof(prologue));
+    e->p += sizeof(prologue);
+    emitLoad16(e, HOST_RAX, offsetof(Chip8Machine, programCounter));
+
+    jit->dispatch = e->p;
+    emitAluImm(e, 7, HOST_RAX, CHIP8_MEM_SIZE - 1); // cmp eax, CHIP8_MEM_SIZE - 1
+    emit8(e, 0x73);                                 // jae exit
+    uint8_t* exitJump1 = e->p;
+    emit8(e, 0);
+
+    // rcx = &m->jit->blocks[pc], rdx = its code
+    emit8(e, 0x48); // mov rcx, [rbx + jit]
+    emit8(e, 0x8B);
+    emit8(e, modrm(2, HOST_RCX, HOST_RBX));
+    emit32(e, offsetof(Chip8Machine, jit));
+    emitAlu(e, ALU_MOV, HOST_RDX, HOST_RAX);
+    emitShift(e, 4, HOST_RDX, 4);
+    emit8(e, 0x48); // lea rcx, [rcx + rdx + blocks]
+    emit8(e, 0x8D);
+    emit8(e, 0x8C);
+    emit8(e, 0x11);
+    emit32(e, offsetof(struct Chip8Jit, blocks));
+    emit8(e, 0x48); // mov rdx, [rcx + code]
+    emit8(e, 0x8B);
+    emit8(e, 0x51);
+    emit8(e, offsetof(Chip8JitBlock, code));
+    emit8(e, 0x48); // test rdx, rdx
+    emit8(e, 0x85);
+    emit8(e, 0xD2);
+    emit8(e, 0x74); // jz exit
+    uint8_t* exitJump2 = e->p;
+    emit8(e, 0);
+
+    // Only enter the block if all of it fits in the budget
+    emit8(e, 0x0F); // movzx ecx, word [rcx + length]
+    emit8(e, 0xB7);
+    emit8(e, 0x49);
+    emit8(e, offsetof(Chip8JitBlock, length));
+    emit8(e, 0x39); // cmp [rsp], ecx
+    emit8(e, 0x0C);
+    emit8(e, 0x24);
+    emit8(e, 0x72); // jb exit
+    uint8_t* exitJump3 = e->p;
+    emit8(e, 0);
+    emit8(e, 0x29); // sub [rsp], ecx
+    emit8(e, 0x0C);
+    emit8(e, 0x24);
+    emit8(e, 0xFF); // jmp rdx
+    emit8(e, 0xE2);
+
+    // exit: store the PC, return budget - left
+    *exitJump1 = (uint8_t)(e->p - exitJump1 - 1);
+    *exitJump2 = (uint8_t)(e->p - exitJump2 - 1);
+    *exitJump3 = (uint8_t)(e->p - exitJump3 - 1);
+    emitStore16(e, offsetof(Chip8Machine, programCounter), HOST_RAX);
+    static const uint8_t epilogue[] = {
+        0x8B, 0x44, 0x24, 0x04, // mov eax, [rsp + 4]
+        0x2B, 0x04, 0x24,       // sub eax, [rsp]
+        0x48, 0x83, 0xC4, 0x08, // add rsp, 8
+        0x41, 0x5F,             // pop r15
+        0x41, 0x5E,             // pop r14
+        0x41, 0x5D,             // pop r13
+        0x41, 0x5C,             // pop r12
+        0x5D,                   // pop rbp
+        0x5B,                   // pop rbx
+        0xC3,                   // ret
+    };
+    memcpy(e->p, epilogue, sizeof(epilogue));
+    e->p += sizeof(epilogue);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Translates the block starting at address into e.  Returns the number of instructions in the block, and the address
+// just past the last one in end.
+static uint16_t chip8JitTranslate(Chip8Machine* m, Chip8JitEmitter* e, uint16_t address, uint16_t* end)
+{
+    const uint8_t* dispatch = m->jit->dispatch;
+    Chip8JitRegs r;
+    memset(&r, 0, sizeof(r));
+    memset(r.host, -1, sizeof(r.host));
+
+    uint16_t length = 0;
+    bool done = false;
+
+    while (!done && length < CHIP8_JIT_MAX_BLOCK_LENGTH && address + 1 < CHIP8_MEM_SIZE)
+    {
+        uint16_t ins = m->mem[address] << 8 | m->mem[address + 1];
+        if (ins == 0) break; // 0000 halts execution, which is left to the interpreter
+
+        uint8_t x = (ins >> 8) & 0xF;
+        uint8_t y = (ins >> 4) & 0xF;
+        uint8_t kk = ins & 0xFF;
+        uint16_t keep = (1 << x) | (1 << y) | (1 << 0xF);
+        int rx, ry, rf;
+
+        // XO-CHIP skips jump over 2 or 4 bytes depending on the instruction after them, which isn't part of the block
+        // and can change without invalidating it, so their handlers work that out every time
+        Chip8Op op = chip8DecodeOp(ins);
+        bool skip = op == CHIP8_OP_3xkk || op == CHIP8_OP_4xkk || op == CHIP8_OP_5xy0 || op == CHIP8_OP_9xy0;
+        if (skip && m->variant == CHIP8_VARIANT_XOCHIP) op = CHIP8_OP_COUNT;
+
+        switch (op)
+        {
+        case CHIP8_OP_UNKNOWN:
+            // Does nothing and doesn't advance, so the interpreter would spin on it
+            emitMovImm(e, HOST_RAX, address);
+            done = true;
+            break;
+
+        case CHIP8_OP_00EE:
+            // eax = stack[sp], then sp-- unless it is already 0
+            emitLoad8(e, HOST_RCX, offsetof(Chip8Machine, stackPointer));
+            emit8(e, 0x0F); // movzx eax, word [rbx + rcx * 2 + stack]
+            emit8(e, 0xB7);
+            emit8(e, 0x84);
+            emit8(e, 0x4B);
+            emit32(e, offsetof(Chip8Machine, stack));
+            emit8(e, 0x8D); // lea edx, [rcx - 1]
+            emit8(e, 0x51);
+            emit8(e, 0xFF);
+            emit8(e, 0x85); // test ecx, ecx
+            emit8(e, 0xC9);
+            emitCmov(e, COND_NE, HOST_RCX, HOST_RDX);
+            emitStore8(e, offsetof(Chip8Machine, stackPointer), HOST_RCX);
+            done = true;
+            break;
+
+        case CHIP8_OP_2nnn:
+            // stack[++sp] = next PC, eax = nnn
+            emitLoad8(e, HOST_RAX, offsetof(Chip8Machine, stackPointer));
+            emitAluImm(e, 0, HOST_RAX, 1);
+            emitTruncate8(e, HOST_RAX);
+            emitStore8(e, offsetof(Chip8Machine, stackPointer), HOST_RAX);
+            emit8(e, 0x66); // mov word [rbx + rax * 2 + stack], next PC
+            emit8(e, 0xC7);
+            emit8(e, 0x84);
+            emit8(e, 0x43);
+            emit32(e, offsetof(Chip8Machine, stack));
+            emit16(e, address + 2);
+            emitMovImm(e, HOST_RAX, ins & 0x0FFF);
+            done = true;
+            break;
+
+        case CHIP8_OP_Bnnn:
+            // An out of range target makes the dispatcher hand the PC back to the interpreter.  The jump quirk adds Vx
+            // instead of V0.
+            rx = regsGet(e, &r, m->jumpQuirkMode ? x : 0, keep, true);
+            emitAlu(e, ALU_MOV, HOST_RAX, rx);
+            emitAluImm(e, 0, HOST_RAX, ins & 0x0FFF);
+            done = true;
+            break;
+
+        case CHIP8_OP_1nnn:
+            emitMovImm(e, HOST_RAX, ins & 0x0FFF);
+            done = true;
+            break;
+
+        case CHIP8_OP_3xkk:
+        case CHIP8_OP_4xkk:
+            rx = regsGet(e, &r, x, keep, true);
+            emitAluImm(e, 7, rx, kk);
+            emitSkip(e, op == CHIP8_OP_3xkk ? COND_E : COND_NE, address);
+            done = true;
+            break;
+
+        case CHIP8_OP_5xy0:
+        case CHIP8_OP_9xy0:
+            rx = regsGet(e, &r, x, keep, true);
+            ry = regsGet(e, &r, y, keep, true);
+            emitAlu(e, ALU_CMP, rx, ry);
+            emitSkip(e, op == CHIP8_OP_5xy0 ? COND_E : COND_NE, address);
+            done = true;
+            break;
+
+        case CHIP8_OP_6xkk:
+            rx = regsSet(e, &r, x, keep, false);
+            emitMovImm(e, rx, kk);
+            break;
+
+        case CHIP8_OP_7xkk:
+            rx = regsSet(e, &r, x, keep, true);
+            emitAluImm(e, 0, rx, kk);
+            emitTruncate8(e, rx);
+            break;
+
+        case CHIP8_OP_8xy0:
+            ry = regsGet(e, &r, y, keep, true);
+            rx = regsSet(e, &r, x, keep, x == y);
+            if (rx != ry) emitAlu(e, ALU_MOV, rx, ry);
+            break;
+
+        case CHIP8_OP_8xy1:
+        case CHIP8_OP_8xy2:
+        case CHIP8_OP_8xy3:
+            ry = regsGet(e, &r, y, keep, true);
+            rx = regsSet(e, &r, x, keep, true);
+            emitAlu(e, (ins & 0xF) == 1 ? ALU_OR : (ins & 0xF) == 2 ? ALU_AND : ALU_XOR, rx, ry);
+            break;
+
+        case CHIP8_OP_8xy4:
+            // Vx = low 8 bits of the sum, then VF = carry (so VF wins if x is F)
+            ry = regsGet(e, &r, y, keep, true);
+            rx = regsSet(e, &r, x, keep, true);
+            emitAlu(e, ALU_ADD, rx, ry);
+            emitAlu(e, ALU_MOV, HOST_RAX, rx);
+            emitShift(e, 5, HOST_RAX, 8);
+            emitTruncate8(e, rx);
+            rf = regsSet(e, &r, 0xF, keep, false);
+            emitAlu(e, ALU_MOV, rf, HOST_RAX);
+            break;
+
+        case CHIP8_OP_8xy5:
+        case CHIP8_OP_8xy7:
+            // VF = not borrow first, then the subtraction reads the registers again (matters if x or y is F)
+            ry = regsGet(e, &r, y, keep, true);
+            rx = regsSet(e, &r, x, keep, true);
+            if ((ins & 0xF) == 5)
+                emitAlu(e, ALU_CMP, rx, ry);
+            else
+                emitAlu(e, ALU_CMP, ry, rx);
+            emitSetcc(e, COND_A, HOST_RAX);
+            rf = regsSet(e, &r, 0xF, keep, false);
+            emitAlu(e, ALU_MOV, rf, HOST_RAX);
+            if ((ins & 0xF) == 5)
+            {
+                emitAlu(e, ALU_SUB, rx, ry);
+            }
+            else
+            {
+                emitAlu(e, ALU_MOV, HOST_RAX, ry);
+                emitAlu(e, ALU_SUB, HOST_RAX, rx);
+                emitAlu(e, ALU_MOV, rx, HOST_RAX);
+            }
+            emitTruncate8(e, rx);
+            break;
+
+        case CHIP8_OP_8xy6:
+        case CHIP8_OP_8xyE:
+            // Shifts read Vx or Vy depending on the quirk mode, which only changes on reset (and reset flushes the JIT)
+            ry = regsGet(e, &r, m->shiftQuirkMode ? x : y, keep, true);
+            emitAlu(e, ALU_MOV, HOST_RAX, ry);
+            emitAlu(e, ALU_MOV, HOST_RCX, HOST_RAX);
+            if ((ins & 0xF) == 6)
+            {
+                emitAluImm(e, 4, HOST_RCX, 0x01);
+                emitShift(e, 5, HOST_RAX, 1);
+            }
+            else
+            {
+                emitShift(e, 5, HOST_RCX, 7);
+                emitShift(e, 4, HOST_RAX, 1);
+                emitTruncate8(e, HOST_RAX);
+            }
+            rf = regsSet(e, &r, 0xF, keep, false);
+            emitAlu(e, ALU_MOV, rf, HOST_RCX);
+            rx = regsSet(e, &r, x, keep, false);
+            emitAlu(e, ALU_MOV, rx, HOST_RAX);
+            break;
+
+        case CHIP8_OP_Annn:
+            emitStore16Imm(e, offsetof(Chip8Machine, i), ins & 0x0FFF);
+            break;
+
+        case CHIP8_OP_Fx07:
+            rx = regsSet(e, &r, x, keep, false);
+            emitLoad8(e, rx, offsetof(Chip8Machine, delayTimerReg));
+            break;
+
+        case CHIP8_OP_Fx1E:
+            rx = regsGet(e, &r, x, keep, true);
+            emitLoad16(e, HOST_RAX, offsetof(Chip8Machine, i));
+            emitAlu(e, ALU_ADD, HOST_RAX, rx);
+            emitStore16(e, offsetof(Chip8Machine, i), HOST_RAX);
+            break;
+
+        case CHIP8_OP_Fx29:
+            rx = regsGet(e, &r, x, keep, true);
+            emitAlu(e, ALU_MOV, HOST_RAX, rx);
+            emit8(e, 0x8D); // lea eax, [rax + rax * 4 + CHIP8_HEX_SPRITE_START_OFFSET]
+            emit8(e, 0x84);
+            emit8(e, 0x80);
+            emit32(e, CHIP8_HEX_SPRITE_START_OFFSET);
+            emitStore16(e, offsetof(Chip8Machine, i), HOST_RAX);
+            break;
+
+        default:
+        {
+            // Everything else runs the interpreter's handler with the registers written back around it.  Control flow,
+            // Dxyn, Fx0A and the instructions that write memory (which may invalidate this very block) end the block.
+            op = chip8DecodeOp(ins);
+            regsFlush(e, &r);
+            emitStore16Imm(e, offsetof(Chip8Machine, programCounter), address);
+            emitHandlerCall(m->jit, e, ins, address);
+            done = !(op == CHIP8_OP_00E0 || op == CHIP8_OP_Cxkk || op == CHIP8_OP_Fx15 || op == CHIP8_OP_Fx18 ||
+                     op == CHIP8_OP_Fx65);
+            if (done) emitLoad16(e, HOST_RAX, offsetof(Chip8Machine, programCounter));
+            break;
+        }
+        }
+
+        address += 2;
+        length++;
+    }
+
+    // Blocks that end without a control transfer fall through to the next address
+    regsFlush(e, &r);
+    if (!done) emitMovImm(e, HOST_RAX, address);
+    emitJmp(e, dispatch);
+
+    *end = address;
+    return length;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8JitInit(Chip8Machine* m)
+{
+    if (m->jit != NULL) return true;
+
+    struct Chip8Jit* jit = calloc(1, sizeof(struct Chip8Jit));
+    if (jit == NULL) return false;
+
+    jit->code = mmap(NULL, CHIP8_JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED)
+    {
+        free(jit);
+        return false;
+    }
+
+    Chip8JitEmitter e = {jit->code};
+    emitDispatcher(jit, &e);
+    jit->enter = (uint32_t(*)(Chip8Machine*, uint32_t))jit->code;
+    jit->codeStart = jit->codeUsed = (uint32_t)(e.p - jit->code + 15) & ~15u;
+
+    m->jit = jit;
+    return true;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8JitDestroy(Chip8Machine* m)
+{
+    if (m->jit == NULL) return;
+
+    munmap(m->jit->code, CHIP8_JIT_CODE_SIZE);
+    free(m->jit);
+    m->jit = NULL;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static const Chip8JitBlock* chip8JitGetBlock(Chip8Machine* m, uint16_t address)
+{
+    struct Chip8Jit* jit = m->jit;
+    if (address >= CHIP8_MEM_SIZE - 1) return NULL;
+
+    Chip8JitBlock* block = &jit->blocks[address];
+    if (block->code != NULL) return block;
+
+    // Start over with an empty code buffer when it fills up.  Nothing is running at this point, so that's safe.
+    if (jit->codeUsed + CHIP8_JIT_MAX_BLOCK_BYTES > CHIP8_JIT_CODE_SIZE)
+    {
+        memset(jit->blocks, 0, sizeof(jit->blocks));
+        jit->codeUsed = jit->codeStart;
+        jit->stats.codeFlushes++;
+    }
+
+    Chip8JitEmitter e = {jit->code + jit->codeUsed};
+    uint16_t end;
+    uint16_t length = chip8JitTranslate(m, &e, address, &end);
+    if (length == 0) return NULL;
+
+    block->code = jit->code + jit->codeUsed;
+    block->start = address;
+    block->end = end;
+    block->length = length;
+
+    // Keep every block 16 byte aligned
+    jit->codeUsed = (uint32_t)(e.p - jit->code + 15) & ~15u;
+    jit->stats.blocksTranslated++;
+    return block;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+uint32_t chip8JitRun(Chip8Machine* m, uint32_t count)
+{
+    // The dispatcher stops at blocks it doesn't have, so make sure the first one exists and translate whatever it
+    // stopped at on later calls
+    const Chip8JitBlock* block = chip8JitGetBlock(m, m->programCounter);
+    if (block == NULL || block->length > count) return 0;
+
+    return m->jit->enter(m, count);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8JitInvalidate(Chip8Machine* m, uint32_t address, uint32_t length)
+{
+    struct Chip8Jit* jit = m->jit;
+    if (length == 0 || address >= CHIP8_MEM_SIZE) return;
+
+    // Only blocks starting up to a maximum block length before the range can overlap it.  Their code stays in the
+    // buffer (a block may invalidate itself while it is running), it just can't be found anymore.
+    uint32_t first = address > CHIP8_JIT_MAX_BLOCK_LENGTH * 2 ? address - CHIP8_JIT_MAX_BLOCK_LENGTH * 2 : 0;
+    uint32_t last = address + length;
+    if (last > CHIP8_MEM_SIZE) last = CHIP8_MEM_SIZE;
+
+    for (uint32_t start = first; start < last; start++)
+    {
+        Chip8JitBlock* block = &jit->blocks[start];
+        if (block->code != NULL && block->start < last && block->end > address)
+        {
+            block->code = NULL;
+            jit->stats.blocksInvalidated++;
+        }
+    }
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8JitGetStats(Chip8Machine* m, Chip8JitStats* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if (m->jit == NULL) return;
+
+    *stats = m->jit->stats;
+    stats->codeBytes = m->jit->codeUsed;
+}
+
+#else
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8JitInit(Chip8Machine* m) { return false; }
+
+void chip8JitDestroy(Chip8Machine* m) {}
+
+uint32_t chip8JitRun(Chip8Machine* m, uint32_t count) { return 0; }
+
+void chip8JitInvalidate(Chip8Machine* m, uint32_t address, uint32_t length) {}
+
+void chip8JitGetStats(Chip8Machine* m, Chip8JitStats* stats) { memset(stats, 0, sizeof(*stats)); }
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef CHIP_8_JIT_H_
+#define CHIP_8_JIT_H_
+
+#include "chip8.h"
+
+// Dynamic recompiler that translates basic blocks of CHIP-8 code into native x86-64.  Only available on x86-64 Linux,
+// everywhere else chip8JitInit() fails and the machine keeps using the interpreter.
+//
+// A block starts at any address and ends after a jump, call, return, skip, Dxyn, Fx0A, Fx33 or Fx55.  Register
+// only instructions and control flow are emitted natively with the guest V registers cached in host registers,
+// everything else calls the interpreter's handler for the instruction.  Blocks are looked up by address in a table and
+// chained through a small native dispatcher, so control only returns to C when a block has to be translated or the
+// instruction budget runs out.
+
+typedef struct Chip8JitStats
+{
+    uint64_t blocksTranslated;  // Blocks compiled, including recompiles after invalidation
+    uint64_t blocksInvalidated; // Blocks discarded because memory they were translated from was written
+    uint64_t codeFlushes;       // Times the code buffer filled up and every block was discarded
+    uint32_t codeBytes;         // Bytes of native code currently in use
+} Chip8JitStats;
+
+// Attaches a recompiler to the machine.  Returns false if the JIT is not supported on this platform or the code buffer
+// could not be allocated.  Set m->dispatch to CHIP8_DISPATCH_JIT to use it.
+bool chip8JitInit(Chip8Machine* m);
+
+// Frees the recompiler attached to the machine, if any
+void chip8JitDestroy(Chip8Machine* m);
+
+// Runs translated blocks from the program counter on, translating them as needed, until the next block would exceed
+// count instructions or can't be translated (end of memory, 0000).  Returns the number of instructions executed, 0 if
+// the interpreter has to execute the next instruction.
+uint32_t chip8JitRun(Chip8Machine* m, uint32_t count);
+
+// Discards every block translated from the given memory range.  Called by chip8InvalidateDecodeCache().
+void chip8JitInvalidate(Chip8Machine* m, uint32_t address, uint32_t length);
+
+// Gets the recompiler statistics
+void chip8JitGetStats(Chip8Machine* m, Chip8JitStats* stats);
+
+#endif
@@ -0,0 +1,259 @@
+#include "chip8movie.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHIP8_MOVIE_INITIAL_EVENTS 1024 // Events a recording has room for before the array first grows
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void chip8PutLittle32(uint8_t* p, uint32_t value)
+{
+    for (uint32_t n = 0; n < 4; n++) p[n] = (value >> (n * 8)) & 0xFF;
+}
+
+static uint32_t chip8GetLittle32(const uint8_t* p)
+{
+    return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static bool chip8MovieReserve(Chip8Movie* movie, uint32_t count)
+{
+    if (count <= movie->capacity) return true;
+
+    uint32_t capacity = movie->capacity > 0 ? movie->capacity : CHIP8_MOVIE_INITIAL_EVENTS;
+    while (capacity < count) capacity *= 2;
+    Chip8MovieEvent* events = realloc(movie->events, (size_t)capacity * sizeof(Chip8MovieEvent));
+    if (events == NULL) return false;
+    movie->events = events;
+    movie->capacity = capacity;
+    return true;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8MovieInit(Chip8Movie* movie, const char* filename)
+{
+    memset(movie, 0, sizeof(*movie));
+    snprintf(movie->filename, sizeof(movie->filename), "%s", filename);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8MovieDestroy(Chip8Movie* movie)
+{
+    free(movie->events);
+    movie->events = NULL;
+    movie->count = movie->capacity = 0;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8MovieRecord(Chip8Movie* movie, Chip8Machine* m)
+{
+    movie->count = 0;
+    if (!chip8MovieReserve(movie, CHIP8_MOVIE_INITIAL_EVENTS)) return false;
+
+    chip8SaveState(m, movie->start);
+    memcpy(movie->startKeys, m->keyboard, sizeof(movie->startKeys));
+    movie->startFrame = m->frameCount;
+    movie->frames = 0;
+    movie->next = 0;
+    movie->mode = CHIP8_MOVIE_RECORDING;
+    return true;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8MoviePlay(Chip8Movie* movie, Chip8Machine* m)
+{
+    if (!chip8LoadState(m, movie->start, CHIP8_STATE_SIZE)) return false;
+
+    // Publish right away, a paused machine would otherwise keep showing the old screen
+    chip8PublishScreen(m);
+    memcpy(movie->startKeys, m->keyboard, sizeof(movie->startKeys));
+    movie->startFrame = m->frameCount;
+    movie->next = 0;
+    movie->mode = CHIP8_MOVIE_PLAYING;
+    return true;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8MovieStop(Chip8Movie* movie, const Chip8Machine* m)
+{
+    // A frame stopped half way through (in step mode) is left out, along with the keys it saw
+    if (movie->mode == CHIP8_MOVIE_RECORDING)
+    {
+        movie->frames = (uint32_t)(m->frameCount - movie->startFrame);
+        while (movie->count > 0 && movie->events[movie->count - 1].frame >= movie->frames) movie->count--;
+    }
+    movie->mode = CHIP8_MOVIE_IDLE;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8MovieWrite(const Chip8Movie* movie, const char* filename)
+{
+    FILE* fp = fopen(filename, "wb");
+    if (fp == NULL) return false;
+
+    uint8_t header[16];
+    chip8PutLittle32(header, CHIP8_MOVIE_MAGIC);
+    chip8PutLittle32(header + 4, CHIP8_MOVIE_VERSION);
+    chip8PutLittle32(header + 8, movie->frames);
+    chip8PutLittle32(header + 12, movie->count);
+    bool ok = fwrite(header, 1, sizeof(header), fp) == sizeof(header);
+    uint32_t stateSize = chip8GetStateSize(movie->start);
+    ok = ok && fwrite(movie->start, 1, stateSize, fp) == stateSize;
+
+    for (uint32_t n = 0; n < movie->count && ok; n++)
+    {
+        uint8_t event[CHIP8_MOVIE_EVENT_SIZE];
+        chip8PutLittle32(event, movie->events[n].frame);
+        event[4] = movie->events[n].key;
+        event[5] = movie->events[n].pressed;
+        ok = fwrite(event, 1, sizeof(event), fp) == sizeof(event);
+    }
+    return fclose(fp) == 0 && ok;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8MovieRead(Chip8Movie* movie, const char* filename)
+{
+    movie->count = movie->frames = movie->next = 0;
+    FILE* fp = fopen(filename, "rb");
+    if (fp == NULL) return false;
+
+    uint8_t header[16];
+    bool ok = fread(header, 1, sizeof(header), fp) == sizeof(header) &&
+              chip8GetLittle32(header) == CHIP8_MOVIE_MAGIC && chip8GetLittle32(header + 4) == CHIP8_MOVIE_VERSION;
+
+    // The start state's header gives its size
+    ok = ok && fread(movie->start, 1, 12, fp) == 12;
+    uint32_t stateSize = ok ? chip8GetStateSize(movie->start) : 0;
+    ok = ok && stateSize >= 12 && stateSize <= CHIP8_STATE_SIZE;
+    ok = ok && fread(movie->start + 12, 1, stateSize - 12, fp) == stateSize - 12;
+    uint32_t frames = ok ? chip8GetLittle32(header + 8) : 0;
+    uint32_t count = ok ? chip8GetLittle32(header + 12) : 0;
+    ok = ok && chip8MovieReserve(movie, count);
+
+    // Events must be in frame order and inside the movie, playback relies on it
+    for (uint32_t n = 0; n < count && ok; n++)
+    {
+        uint8_t event[CHIP8_MOVIE_EVENT_SIZE];
+        ok = fread(event, 1, sizeof(event), fp) == sizeof(event);
+        Chip8MovieEvent* e = &movie->events[n];
+        e->frame = chip8GetLittle32(event);
+        e->key = event[4] & 0xF;
+        e->pressed = event[5] != 0;
+        ok = ok && e->frame < frames && (n == 0 || e->frame >= e[-1].frame);
+    }
+    fclose(fp);
+
+    if (!ok) return false;
+    movie->count = count;
+    movie->frames = frames;
+    return true;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8MovieLatchKeys(Chip8Movie* movie, Chip8Machine* m)
+{
+    uint32_t frame = (uint32_t)(m->frameCount - movie->startFrame);
+    if (movie->mode == CHIP8_MOVIE_PLAYING)
+    {
+        if (frame >= movie->frames)
+        {
+            chip8EndMovie(m);
+            return false;
+        }
+        for (; movie->next < movie->count && movie->events[movie->next].frame <= frame; movie->next++)
+            m->keyboard[movie->events[movie->next].key] = movie->events[movie->next].pressed;
+        return true;
+    }
+
+    uint32_t keys = platformAtomicLoad(&m->keyInput);
+    for (uint8_t k = 0; k < 16; k++)
+    {
+        bool pressed = (keys >> k) & 1;
+        if (pressed == m->keyboard[k]) continue;
+
+        // A recording that can't grow any further ends here, what it holds is still a valid movie
+        if (!chip8MovieReserve(movie, movie->count + 1))
+        {
+            chip8EndMovie(m);
+            return false;
+        }
+        movie->events[movie->count++] = (Chip8MovieEvent){frame, k, pressed};
+        m->keyboard[k] = pressed;
+    }
+    movie->frames = frame + 1;
+    return true;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8MovieRewound(Chip8Machine* m)
+{
+    Chip8Movie* movie = m->movie;
+    if (movie == NULL || movie->mode == CHIP8_MOVIE_IDLE) return;
+    if (movie->mode == CHIP8_MOVIE_PLAYING || m->frameCount < movie->startFrame)
+    {
+        chip8EndMovie(m);
+        return;
+    }
+
+    // Drop the frames after the one the machine is back at, and put back the keys the movie had held then.  The next
+    // frame compares the host's keys with those, so the recording carries on as if the dropped frames never ran.
+    uint32_t frame = (uint32_t)(m->frameCount - movie->startFrame);
+    while (movie->count > 0 && movie->events[movie->count - 1].frame >= frame) movie->count--;
+    movie->frames = frame;
+    memcpy(m->keyboard, movie->startKeys, sizeof(movie->startKeys));
+    for (uint32_t n = 0; n < movie->count; n++) m->keyboard[movie->events[n].key] = movie->events[n].pressed;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void chip8FinishMovie(Chip8Machine* m)
+{
+    Chip8Movie* movie = m->movie;
+    bool recording = movie->mode == CHIP8_MOVIE_RECORDING;
+    chip8MovieStop(movie, m);
+
+    // A movie is a few KB, small enough to write between two frames
+    if (recording) chip8MovieWrite(movie, movie->filename);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8EndMovie(Chip8Machine* m)
+{
+    if (m->movie == NULL) return;
+    platformAtomicExchange(&m->movieMode, CHIP8_MOVIE_IDLE);
+    if (m->movie->mode != CHIP8_MOVIE_IDLE) chip8FinishMovie(m);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8ProcessMovieRequest(Chip8Machine* m)
+{
+    Chip8Movie* movie = m->movie;
+    uint32_t mode = platformAtomicLoad(&m->movieMode);
+    if (movie == NULL || mode == movie->mode) return;
+
+    // Switching straight from one to the other finishes the first.  A movie that can't be started is given up on
+    // rather than retried every frame.
+    if (movie->mode != CHIP8_MOVIE_IDLE) chip8FinishMovie(m);
+    bool started = true;
+    if (mode == CHIP8_MOVIE_RECORDING)
+        started = chip8MovieRecord(movie, m);
+    else if (mode == CHIP8_MOVIE_PLAYING)
+        started = chip8MovieRead(movie, movie->filename) && chip8MoviePlay(movie, m);
+    if (!started) platformAtomicExchange(&m->movieMode, CHIP8_MOVIE_IDLE);
+}
@@ -0,0 +1,89 @@
+#ifndef CHIP_8_MOVIE_H_
+#define CHIP_8_MOVIE_H_
+
+#include "chip8state.h"
+
+// Input movies: a save state of the machine when recording started, plus every key press and release keyed by the
+// emulated frame it took effect in.  The core only looks at the keys at the start of a frame and Cxkk draws from the
+// machine's own seeded generator, so playing a movie back reproduces the recorded run exactly, at any speed, on any
+// host and with any dispatch engine.
+//
+// The file is a header (magic, version, length in frames, event count), the start state (as long as its own header
+// says), then 6 bytes per event (frame, key, pressed), all little endian.  Recording and playback run on the emulator
+// thread at frame boundaries; see Chip8Machine.movie.
+
+#define CHIP8_MOVIE_MAGIC 0x564D3843 // "C8MV"
+#define CHIP8_MOVIE_VERSION 2
+#define CHIP8_MOVIE_EVENT_SIZE 6 // Bytes an event takes in the file
+
+// What a movie is doing, and in Chip8Machine.movieMode what the frontend wants it to do
+typedef enum Chip8MovieMode
+{
+    CHIP8_MOVIE_IDLE,
+    CHIP8_MOVIE_RECORDING,
+    CHIP8_MOVIE_PLAYING,
+} Chip8MovieMode;
+
+// A key pressed or released
+typedef struct Chip8MovieEvent
+{
+    uint32_t frame; // Frame it took effect in, counted from the start of the movie
+    uint8_t key;    // Key 0-F
+    bool pressed;   // True if it went down, false if it came up
+} Chip8MovieEvent;
+
+typedef struct Chip8Movie
+{
+    char filename[CHIP8_STATE_PATH_SIZE]; // File chip8Run() saves recordings to and plays movies from
+    uint8_t start[CHIP8_STATE_SIZE];      // Machine when the movie starts
+    bool startKeys[16];                   // Keys held then, from the start state
+    uint64_t startFrame;                  // Chip8Machine.frameCount then, from the start state
+    Chip8MovieEvent* events;              // Key changes in frame order
+    uint32_t count;                       // Events held
+    uint32_t capacity;                    // Events the array has room for
+    uint32_t frames;                      // Length of the movie.  Grows as a recording runs.
+    uint32_t next;                        // Next event to play
+    volatile uint32_t mode;               // Chip8MovieMode.  Only changed by the thread running the machine.
+} Chip8Movie;
+
+// Sets up an empty movie.  chip8Run() saves recordings to filename and plays movies back from it.
+void chip8MovieInit(Chip8Movie* movie, const char* filename);
+
+// Frees the events
+void chip8MovieDestroy(Chip8Movie* movie);
+
+// Starts recording a new movie from the machine's current state, dropping the movie held.  m->movie must point to
+// it.  Returns false if the memory for the events could not be had.
+bool chip8MovieRecord(Chip8Movie* movie, Chip8Machine* m);
+
+// Loads the movie's start state into the machine and starts playing it.  m->movie must point to it.  Returns false,
+// leaving the machine alone, if the start state is not a save state of this version.
+bool chip8MoviePlay(Chip8Movie* movie, Chip8Machine* m);
+
+// Stops recording or playing.  A recording ends with the last frame the machine completed.
+void chip8MovieStop(Chip8Movie* movie, const Chip8Machine* m);
+
+// Writes the movie to a file.  Returns false if it could not be written.
+bool chip8MovieWrite(const Chip8Movie* movie, const char* filename);
+
+// Reads a movie written by chip8MovieWrite(), replacing the one held.  Returns false, leaving the movie empty, if the
+// file can't be read or is not a movie of this version.
+bool chip8MovieRead(Chip8Movie* movie, const char* filename);
+
+// Sets the keys for the frame about to start: from the movie while it plays, and from the host's keys, noting the
+// changes, while it records.  Returns false if playback just ran out, in which case the keys are left to the caller.
+bool chip8MovieLatchKeys(Chip8Movie* movie, Chip8Machine* m);
+
+// Called after the machine stepped back to an earlier frame.  A recording drops what it recorded after that frame
+// and carries on from there; playback stops.
+void chip8MovieRewound(Chip8Machine* m);
+
+// Stops the movie and clears m->movieMode, saving a recording to the movie's file.  Used when the machine jumps
+// somewhere the movie can't follow (a reset or a loaded state).
+void chip8EndMovie(Chip8Machine* m);
+
+// Starts or stops recording and playback when Chip8Machine.movieMode has changed.  Called by chip8Run() between
+// frames.
+void chip8ProcessMovieRequest(Chip8Machine* m);
+
+#endif
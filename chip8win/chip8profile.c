@@ -0,0 +1,164 @@
+#include "chip8profile.h"
+#include "chip8trace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8ProfileInit(Chip8Profile* profile, const char* filename)
+{
+    memset(profile, 0, sizeof(*profile));
+    snprintf(profile->filename, sizeof(profile->filename), "%s", filename);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8ProfileBegin(Chip8Profile* profile, const Chip8Machine* m)
+{
+    memset(profile->hits, 0, sizeof(profile->hits));
+    memset(profile->ops, 0, sizeof(profile->ops));
+
+    // Whatever runs now is the root, even if it is a subroutine: returns from it stay at the root
+    memset(&profile->nodes[0], 0, sizeof(profile->nodes[0]));
+    profile->nodeCount = 1;
+    profile->node = 0;
+    profile->lost = 0;
+    profile->lostCalls = 0;
+    profile->firstInstruction = m->instructionCount;
+    profile->firstFrame = m->frameCount;
+    profile->instructions = profile->frames = 0;
+    profile->active = true;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8ProfileEnd(Chip8Profile* profile, const Chip8Machine* m)
+{
+    profile->instructions = m->instructionCount - profile->firstInstruction;
+    profile->frames = m->frameCount - profile->firstFrame;
+    memcpy(profile->mem, m->mem, CHIP8_MEM_SIZE);
+    profile->disassembly = chip8GetDisassemblyFlags(m);
+    profile->active = false;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+uint32_t chip8ProfileCall(Chip8Profile* profile, uint32_t node, uint16_t address)
+{
+    // Once a call could not get a node, everything it calls is charged to the stack that made it as well
+    if (profile->lost > 0)
+    {
+        profile->lost++;
+        profile->lostCalls++;
+        return node;
+    }
+
+    Chip8ProfileNode* parent = &profile->nodes[node];
+    uint32_t child = parent->firstChild;
+    while (child != 0 && profile->nodes[child].address != address) child = profile->nodes[child].nextSibling;
+    if (child == 0)
+    {
+        if (profile->nodeCount == CHIP8_PROFILE_MAX_NODES)
+        {
+            profile->lost = 1;
+            profile->lostCalls++;
+            return node;
+        }
+        child = profile->nodeCount++;
+        profile->nodes[child] = (Chip8ProfileNode){address, node, 0, parent->firstChild, 0, 0, 0};
+        parent->firstChild = child;
+    }
+    profile->nodes[child].calls++;
+    return child;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+uint32_t chip8ProfileReturn(Chip8Profile* profile, uint32_t node)
+{
+    if (profile->lost == 0) return profile->nodes[node].parent;
+    profile->lost--;
+    return node;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8ProfileWrite(const Chip8Profile* profile, const char* filename)
+{
+    FILE* fp = fopen(filename, "wb");
+    if (fp == NULL) return false;
+
+    Chip8ProfileHeader header = {0};
+    header.magic = CHIP8_PROFILE_MAGIC;
+    header.version = CHIP8_PROFILE_VERSION;
+    header.opCount = CHIP8_OP_COUNT;
+    header.nodeCount = profile->nodeCount;
+    header.disassembly = profile->disassembly;
+    header.instructions = profile->instructions;
+    header.frames = profile->frames;
+    header.lostCalls = profile->lostCalls;
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    ok = ok && fwrite(profile->hits, sizeof(profile->hits), 1, fp) == 1;
+    ok = ok && fwrite(profile->ops, sizeof(profile->ops), 1, fp) == 1;
+    ok = ok && fwrite(profile->mem, sizeof(profile->mem), 1, fp) == 1;
+    ok = ok && fwrite(profile->nodes, sizeof(Chip8ProfileNode), profile->nodeCount, fp) == profile->nodeCount;
+    return fclose(fp) == 0 && ok;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8ProfileRead(Chip8Profile* profile, const char* filename)
+{
+    FILE* fp = fopen(filename, "rb");
+    if (fp == NULL) return false;
+
+    Chip8ProfileHeader header;
+    bool ok = fread(&header, sizeof(header), 1, fp) == 1 && header.magic == CHIP8_PROFILE_MAGIC &&
+              header.version == CHIP8_PROFILE_VERSION && header.opCount == CHIP8_OP_COUNT && header.nodeCount > 0 &&
+              header.nodeCount <= CHIP8_PROFILE_MAX_NODES;
+    ok = ok && fread(profile->hits, sizeof(profile->hits), 1, fp) == 1;
+    ok = ok && fread(profile->ops, sizeof(profile->ops), 1, fp) == 1;
+    ok = ok && fread(profile->mem, sizeof(profile->mem), 1, fp) == 1;
+    ok = ok && fread(profile->nodes, sizeof(Chip8ProfileNode), header.nodeCount, fp) == header.nodeCount;
+    fclose(fp);
+
+    // The nodes are walked by following their links.  Nodes are only ever added after their parent and put in front of
+    // their siblings, so a link that goes the other way can only come from a damaged file (and could loop).
+    for (uint32_t n = 0; n < header.nodeCount && ok; n++)
+    {
+        const Chip8ProfileNode* node = &profile->nodes[n];
+        ok = (n == 0 ? node->parent == 0 : node->parent < n) && node->firstChild < header.nodeCount &&
+             (node->firstChild == 0 || node->firstChild > n) && node->nextSibling < n + (n == 0);
+    }
+    if (!ok) return false;
+
+    profile->nodeCount = header.nodeCount;
+    profile->disassembly = header.disassembly;
+    profile->instructions = header.instructions;
+    profile->frames = header.frames;
+    profile->lostCalls = header.lostCalls;
+    profile->active = false;
+    return true;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8ProcessProfileRequest(Chip8Machine* m)
+{
+    Chip8Profile* profile = m->profile;
+    if (profile == NULL || m->profiling == profile->active) return;
+
+    if (m->profiling)
+    {
+        chip8ProfileBegin(profile, m);
+        return;
+    }
+
+    // A profile is about 420 KB: 256 KB of hit counts, 64 KB of memory and up to 96 KB of nodes.  Writing it takes
+    // about a millisecond, well inside a frame, and only happens once when profiling stops, so it stays on this thread
+    // rather than holding a second copy for a writer.
+    chip8ProfileEnd(profile, m);
+    chip8ProfileWrite(profile, profile->filename);
+}
@@ -0,0 +1,93 @@
+#ifndef CHIP_8_PROFILE_H_
+#define CHIP_8_PROFILE_H_
+
+#include "chip8.h"
+
+// Guest code profiler: counts the instructions executed at every address and of every Chip8Op, and follows 2nnn and
+// 00EE to charge every instruction to the call stack it ran in.  Stacks are kept as a tree of nodes, one per distinct
+// path of calls, so a report can give every subroutine's inclusive cost and write folded stacks for a flame graph.
+//
+// Counting is a few increments per instruction in a copy of the TABLE loop that only runs while a profile is active
+// (see Chip8Machine.profile), so the other engines and chip8ProcessInstruction() pay nothing for it.  The file is a
+// Chip8ProfileHeader followed by the hit counts, the op counts, the memory the addresses refer to and the nodes, in
+// host byte order.
+
+#define CHIP8_PROFILE_MAGIC 0x46503843 // "C8PF", reads differently on a host of the other byte order
+#define CHIP8_PROFILE_VERSION 3
+#define CHIP8_PROFILE_SLOTS (CHIP8_MEM_SIZE / 2) // Hit counts: one per even address, odd ones count with the one below
+#define CHIP8_PROFILE_MAX_NODES 4096             // Distinct call stacks a profile can tell apart
+
+// One call stack: a subroutine called from the stack of its parent node
+typedef struct Chip8ProfileNode
+{
+    uint16_t address;     // Subroutine the node is a call to.  0 for the root, the code running when profiling began.
+    uint16_t parent;      // Node of the caller.  The root is its own parent.
+    uint16_t firstChild;  // First subroutine called from this stack, 0 for none
+    uint16_t nextSibling; // Next subroutine called from the parent's stack, 0 for none
+    uint32_t calls;       // Times the subroutine was called from the parent's stack
+    uint32_t reserved;    // 0
+    uint64_t self;        // Instructions executed in the subroutine itself (not in what it called) on this stack
+} Chip8ProfileNode;
+
+// Start of a profile file
+typedef struct Chip8ProfileHeader
+{
+    uint32_t magic;        // CHIP8_PROFILE_MAGIC
+    uint32_t version;      // CHIP8_PROFILE_VERSION
+    uint32_t opCount;      // CHIP8_OP_COUNT, the number of op counts that follow the hit counts
+    uint32_t nodeCount;    // Nodes at the end of the file
+    uint32_t disassembly;  // CHIP8_DISASSEMBLE_ flags of the machine profiled
+    uint32_t reserved;     // 0
+    uint64_t instructions; // Instructions profiled
+    uint64_t frames;       // Emulated frames they ran in
+    uint64_t lostCalls;    // Calls made once every node was in use, charged to the stack that made them
+} Chip8ProfileHeader;
+
+typedef struct Chip8Profile
+{
+    char filename[CHIP8_STATE_PATH_SIZE];            // File chip8Run() writes a profile to when it stops
+    bool active;                                     // True between chip8ProfileBegin() and chip8ProfileEnd()
+    uint64_t hits[CHIP8_PROFILE_SLOTS];              // Instructions executed at each address
+    uint64_t ops[CHIP8_OP_COUNT];                    // Instructions executed of each Chip8Op
+    Chip8ProfileNode nodes[CHIP8_PROFILE_MAX_NODES]; // Call stacks, the root first
+    uint32_t nodeCount;                              // Nodes in use
+    uint32_t node;                                   // Node of the code running now
+    uint32_t lost;                                   // Calls made without a node that have not returned yet
+    uint64_t lostCalls;                              // Calls made without a node in all
+    uint64_t firstInstruction;                       // Chip8Machine.instructionCount when profiling began
+    uint64_t firstFrame;                             // Chip8Machine.frameCount then
+    uint64_t instructions;                           // Instructions profiled, set by chip8ProfileEnd()
+    uint64_t frames;                                 // Frames profiled, set by chip8ProfileEnd()
+    uint8_t mem[CHIP8_MEM_SIZE];                     // Memory when profiling ended, to disassemble the addresses
+    uint32_t disassembly;                            // chip8GetDisassemblyFlags() of the machine then
+} Chip8Profile;
+
+// Sets up an inactive profile.  chip8Run() writes profiles to filename.
+void chip8ProfileInit(Chip8Profile* profile, const char* filename);
+
+// Clears the counts and starts profiling the machine.  Emulator thread only.
+void chip8ProfileBegin(Chip8Profile* profile, const Chip8Machine* m);
+
+// Stops profiling and takes a copy of the machine's memory, and how to disassemble it, for the report.  Emulator
+// thread only.
+void chip8ProfileEnd(Chip8Profile* profile, const Chip8Machine* m);
+
+// Moves from node into a call to address, creating the node for it the first time.  Returns the new node.  Called by
+// the profiling loop after every 2nnn.
+uint32_t chip8ProfileCall(Chip8Profile* profile, uint32_t node, uint16_t address);
+
+// Moves from node back to its caller.  Returns the caller's node.  Called by the profiling loop after every 00EE.
+uint32_t chip8ProfileReturn(Chip8Profile* profile, uint32_t node);
+
+// Writes a finished profile to a file.  Returns false if it could not be written.
+bool chip8ProfileWrite(const Chip8Profile* profile, const char* filename);
+
+// Reads a profile written by chip8ProfileWrite().  Returns false if the file can't be read or is not a profile of
+// this version made with the same op list.
+bool chip8ProfileRead(Chip8Profile* profile, const char* filename);
+
+// Starts or stops profiling when Chip8Machine.profiling has changed, writing the profile out when it stops.  Called
+// by chip8Run() between frames.
+void chip8ProcessProfileRequest(Chip8Machine* m);
+
+#endif
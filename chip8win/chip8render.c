@@ -0,0 +1,194 @@
+#include "chip8render.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CHIP8_RENDER_SSE2
+#include <emmintrin.h>
+#endif
+
+// Colors an output row is expanded with: a pixel's color index is 1 if it is lit in the first plane plus 2 if it is
+// lit in the second, and the colors for a column's last pixel follow the others
+enum
+{
+    COLOR_UNLIT,
+    COLOR_EDGE = 4,
+    COLOR_COUNT = 8,
+};
+
+// A row of the second plane when the screen only uses the first
+static const uint64_t _chip8_BlankRow[CHIP8_ROW_WORDS];
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static uint32_t chip8Darken(uint32_t color) { return (color & 0xFF000000) | ((color >> 1) & 0x7F7F7F); }
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Color index of pixel x of a row, given the row in both planes
+static inline uint32_t chip8PixelIndex(const uint64_t* row0, const uint64_t* row1, uint32_t x)
+{
+    uint32_t shift = 63 - x % 64;
+    return ((row0[x / 64] >> shift) & 1) | ((row1[x / 64] >> shift) & 1) << 1;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void chip8ExpandRow(const Chip8Renderer* r, uint32_t* out, const uint64_t* row0, const uint64_t* row1,
+                           const uint32_t* colors)
+{
+    for (uint32_t x = 0; x < r->screenWidth; x++)
+    {
+        uint32_t index = chip8PixelIndex(row0, row1, x);
+        uint32_t color = colors[COLOR_UNLIT + index];
+        uint32_t run = r->runs[x];
+        for (uint32_t n = 1; n < run; n++) *out++ = color;
+        *out++ = colors[COLOR_EDGE + index];
+    }
+}
+
+#ifdef CHIP8_RENDER_SSE2
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Same as chip8ExpandRow().  A run of 4 pixels or more is filled with 4-pixel stores, the last one overlapping the one
+// before it instead of running into the next column, so nothing outside the row is ever written.
+static void chip8ExpandRowSse2(const Chip8Renderer* r, uint32_t* out, const uint64_t* row0, const uint64_t* row1,
+                               const uint32_t* colors)
+{
+    __m128i fill[4];
+    for (uint32_t index = 0; index < 4; index++) fill[index] = _mm_set1_epi32(colors[COLOR_UNLIT + index]);
+    for (uint32_t x = 0; x < r->screenWidth; x++)
+    {
+        uint32_t index = chip8PixelIndex(row0, row1, x);
+        uint32_t run = r->runs[x];
+        if (run >= 4)
+        {
+            __m128i color = fill[index];
+            for (uint32_t n = 0; n + 4 < run; n += 4) _mm_storeu_si128((__m128i*)(out + n), color);
+            _mm_storeu_si128((__m128i*)(out + run - 4), color);
+        }
+        else
+        {
+            for (uint32_t n = 0; n < run; n++) out[n] = colors[COLOR_UNLIT + index];
+        }
+        out[run - 1] = colors[COLOR_EDGE + index];
+        out += run;
+    }
+}
+#endif
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8RendererInit(Chip8Renderer* r)
+{
+    memset(r, 0, sizeof(*r));
+    r->foreground = 0xFFFFFFFF;
+    r->foreground2 = 0xFFFF6600;
+    r->foregroundBoth = 0xFF662200;
+    r->background = 0xFF000000;
+    r->screenWidth = CHIP8_LORES_WIDTH;
+    r->screenHeight = CHIP8_LORES_HEIGHT;
+#ifdef CHIP8_RENDER_SSE2
+    r->simd = true;
+#endif
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8RendererDestroy(Chip8Renderer* r)
+{
+    free(r->pixels);
+    r->pixels = NULL;
+    r->width = r->height = 0;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Works out the output pixels each emulated column and row covers for a screen of the given size
+static void chip8RendererLayout(Chip8Renderer* r, uint32_t screenWidth, uint32_t screenHeight)
+{
+    r->screenWidth = screenWidth;
+    r->screenHeight = screenHeight;
+
+    // Column x covers output pixels x * width / screenWidth up to the next column's first, so the runs add up to the
+    // width
+    for (uint32_t x = 0; x < screenWidth; x++)
+    {
+        uint64_t start = (uint64_t)x * r->width / screenWidth;
+        r->runs[x] = (uint16_t)((uint64_t)(x + 1) * r->width / screenWidth - start);
+    }
+    for (uint32_t y = 0; y <= screenHeight; y++)
+        r->rowStart[y] = (uint32_t)((uint64_t)y * r->height / screenHeight);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8RendererResize(Chip8Renderer* r, uint32_t width, uint32_t height)
+{
+    if (width < CHIP8_SCREEN_WIDTH) width = CHIP8_SCREEN_WIDTH;
+    if (height < CHIP8_SCREEN_HEIGHT) height = CHIP8_SCREEN_HEIGHT;
+    if (r->pixels != NULL && width == r->width && height == r->height) return true;
+
+    chip8RendererDestroy(r);
+    r->pixels = malloc((size_t)width * height * sizeof(uint32_t));
+    if (r->pixels == NULL) return false;
+    r->width = width;
+    r->height = height;
+    chip8RendererLayout(r, r->screenWidth, r->screenHeight);
+    return true;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8RenderScreen(Chip8Renderer* r, const Chip8Screen* screen, uint64_t rows)
+{
+    if (r->pixels == NULL) return;
+    if (screen->width != r->screenWidth || screen->height != r->screenHeight)
+    {
+        chip8RendererLayout(r, screen->width, screen->height);
+        rows = ~0ull;
+    }
+
+    // Colors of the plain rows and of the darkened ones, by color index
+    bool grid = (r->effects & CHIP8_RENDER_GRID) != 0;
+    bool scanlines = (r->effects & CHIP8_RENDER_SCANLINES) != 0;
+    uint32_t plain[4] = {r->background, r->foreground, r->foreground2, r->foregroundBoth};
+    uint32_t colors[2][COLOR_COUNT];
+    for (uint32_t index = 0; index < 4; index++)
+    {
+        uint32_t dark = chip8Darken(plain[index]);
+        colors[0][COLOR_UNLIT + index] = plain[index];
+        colors[0][COLOR_EDGE + index] = grid ? dark : plain[index];
+        colors[1][COLOR_UNLIT + index] = colors[1][COLOR_EDGE + index] = dark;
+    }
+
+    uint32_t stride = screen->width / 64;
+    for (uint32_t row = 0; row < screen->height; row++)
+    {
+        if ((rows & (1ull << row)) == 0) continue;
+        const uint64_t* row0 = screen->pixels[0] + row * stride;
+        const uint64_t* row1 = (screen->planes & 2) ? screen->pixels[1] + row * stride : _chip8_BlankRow;
+
+        // The first plain and the first darkened output row of the emulated row are expanded, the rest copy them
+        uint32_t* first[2] = {NULL, NULL};
+        uint32_t end = r->rowStart[row + 1];
+        for (uint32_t y = r->rowStart[row]; y < end; y++)
+        {
+            uint32_t dark = (scanlines && (y & 1) != 0) || (grid && y == end - 1);
+            uint32_t* out = r->pixels + (size_t)y * r->width;
+            if (first[dark] != NULL)
+            {
+                memcpy(out, first[dark], r->width * sizeof(uint32_t));
+                continue;
+            }
+#ifdef CHIP8_RENDER_SSE2
+            if (r->simd)
+                chip8ExpandRowSse2(r, out, row0, row1, colors[dark]);
+            else
+#endif
+                chip8ExpandRow(r, out, row0, row1, colors[dark]);
+            first[dark] = out;
+        }
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef CHIP_8_RENDER_H_
+#define CHIP_8_RENDER_H_
+
+#include "chip8.h"
+
+// Software scaler: expands the screen, 64x32 or 128x64, into a buffer of 32-bit pixels of any size, so the frontend
+// presents a frame with a single blit instead of drawing a rectangle per emulated pixel.  The scale doesn't have to be
+// a whole number: each column covers width / 64 (or 128) output pixels and each row height / 32 (or 64), rounded so
+// the columns and rows tile the buffer exactly.  A pixel's color depends on which of the two XO-CHIP planes it is lit
+// in.
+//
+// An output row only depends on the emulated row it shows and on whether it is darkened by an effect, so each
+// distinct row is expanded once, a run of identical pixels per column written 4 at a time with SSE2 where the host
+// has it, and the rows repeating it are copies of it.  Only the emulated rows asked for are redrawn, which fits the
+// damage the core reports (see chip8GetScreenDamage()).
+
+#define CHIP8_RENDER_SCANLINES 0x1 // Darkens every other output row, like the gaps between a CRT's scanlines
+#define CHIP8_RENDER_GRID 0x2      // Darkens the last output row and column of every emulated pixel
+
+typedef struct Chip8Renderer
+{
+    uint32_t width;                             // Width of the buffer in pixels
+    uint32_t height;                            // Height of the buffer in pixels
+    uint32_t* pixels;                           // width * height pixels, top row first, 0xAARRGGBB
+    uint32_t foreground;                        // Color of pixels lit in the first plane only
+    uint32_t foreground2;                       // Color of pixels lit in the second plane only (XO-CHIP)
+    uint32_t foregroundBoth;                    // Color of pixels lit in both planes (XO-CHIP)
+    uint32_t background;                        // Color of unlit pixels
+    uint32_t effects;                           // CHIP8_RENDER_ flags
+    bool simd;                                  // Set if the SSE2 path is used, clear to time the plain C one
+    uint32_t screenWidth;                       // Emulated columns runs was worked out for
+    uint32_t screenHeight;                      // Emulated rows rowStart was worked out for
+    uint16_t runs[CHIP8_SCREEN_WIDTH];          // Output pixels each column covers
+    uint32_t rowStart[CHIP8_SCREEN_HEIGHT + 1]; // First output row of each emulated row, then height
+} Chip8Renderer;
+
+// Sets up a renderer with no buffer, white on black (orange and brown for the second plane) and no effects
+void chip8RendererInit(Chip8Renderer* r);
+
+// Frees the buffer
+void chip8RendererDestroy(Chip8Renderer* r);
+
+// Resizes the buffer.  Sizes smaller than the screen are raised to it.  Returns false, leaving the renderer without a
+// buffer, if the memory could not be had.  The whole screen must be rendered after a resize.
+bool chip8RendererResize(Chip8Renderer* r, uint32_t width, uint32_t height);
+
+// Redraws the emulated rows set in rows (bit n for row n) of the screen.  Pass ~0ull after resizing or changing the
+// colors or effects.  A screen in another resolution than the last one is redrawn whole.
+void chip8RenderScreen(Chip8Renderer* r, const Chip8Screen* screen, uint64_t rows);
+
+#endif
@@ -0,0 +1,269 @@
+#include "chip8rewind.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define CHIP8_REWIND_LITERAL_END 4     // Zero bytes that end a run of literals, so short gaps don't cost a new run
+#define CHIP8_REWIND_MAX_COUNT 0xFFFF // Largest skip or literal count a run holds
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static uint64_t chip8RewindWord(const uint8_t* a, const uint8_t* b, uint32_t pos)
+{
+    uint64_t wa, wb = 0;
+    memcpy(&wa, a + pos, 8);
+    if (b != NULL) memcpy(&wb, b + pos, 8);
+    return wa ^ wb;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Encodes the first length bytes of a XOR b (or a alone if b is NULL) as runs of a 16-bit count of zero bytes to skip,
+// a 16-bit count of literal bytes and the literals, all little endian.  Zeros after the last literal are implied.
+// Returns the size.
+static uint32_t chip8RewindEncode(const uint8_t* a, const uint8_t* b, uint32_t length, uint8_t* out)
+{
+    uint32_t size = 0;
+    uint32_t pos = 0;
+    while (pos < length)
+    {
+        // Skip unchanged bytes, a word at a time while it lasts.  A longer gap than a count holds takes a run of no
+        // literals.
+        uint32_t start = pos;
+        while (pos + 8 <= length && chip8RewindWord(a, b, pos) == 0) pos += 8;
+        while (pos < length && (a[pos] ^ (b ? b[pos] : 0)) == 0) pos++;
+        if (pos == length) break;
+        uint32_t skip = pos - start;
+        if (skip > CHIP8_REWIND_MAX_COUNT)
+        {
+            pos = start + CHIP8_REWIND_MAX_COUNT;
+            skip = CHIP8_REWIND_MAX_COUNT;
+        }
+
+        // Changed bytes, up to the next few unchanged ones in a row
+        uint32_t literals = pos;
+        uint32_t zeros = 0;
+        uint32_t end = pos + CHIP8_REWIND_MAX_COUNT < length ? pos + CHIP8_REWIND_MAX_COUNT : length;
+        for (; pos < end && zeros < CHIP8_REWIND_LITERAL_END; pos++)
+            zeros = (a[pos] ^ (b ? b[pos] : 0)) == 0 ? zeros + 1 : 0;
+        pos -= zeros;
+        uint32_t count = pos - literals;
+
+        out[size++] = skip & 0xFF;
+        out[size++] = skip >> 8;
+        out[size++] = count & 0xFF;
+        out[size++] = count >> 8;
+        for (uint32_t i = literals; i < pos; i++) out[size++] = a[i] ^ (b ? b[i] : 0);
+    }
+    return size;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// XORs an encoded frame into state
+static void chip8RewindDecode(const uint8_t* in, uint32_t size, uint8_t* state)
+{
+    uint32_t pos = 0;
+    const uint8_t* end = in + size;
+    while (in < end)
+    {
+        pos += in[0] | in[1] << 8;
+        uint32_t length = in[2] | in[3] << 8;
+        in += 4;
+        for (uint32_t i = 0; i < length; i++) state[pos++] ^= *in++;
+    }
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static Chip8RewindEntry* chip8RewindEntry(const Chip8Rewind* rewind, uint32_t n)
+{
+    return &rewind->entries[(rewind->first + n) % rewind->maxFrames];
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void chip8RewindDecodeEntry(const Chip8Rewind* rewind, uint32_t n, uint8_t* state)
+{
+    const Chip8RewindEntry* entry = chip8RewindEntry(rewind, n);
+    if (entry->keyframe) memset(state, 0, CHIP8_STATE_SIZE);
+    chip8RewindDecode(rewind->data + entry->offset, entry->size, state);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Drops the oldest keyframe and the deltas that depend on it
+static void chip8RewindDropOldest(Chip8Rewind* rewind)
+{
+    do
+    {
+        Chip8RewindEntry* entry = chip8RewindEntry(rewind, 0);
+        rewind->bytesUsed -= entry->size;
+        rewind->keyframes -= entry->keyframe;
+        rewind->first = (rewind->first + 1) % rewind->maxFrames;
+        rewind->count--;
+    } while (rewind->count > 0 && !chip8RewindEntry(rewind, 0)->keyframe);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Finds size contiguous bytes in the ring for a new frame, dropping the oldest frames as needed.  Returns the offset,
+// or -1 if the frame is bigger than the whole ring.
+static int32_t chip8RewindReserve(Chip8Rewind* rewind, uint32_t size)
+{
+    if (size > rewind->dataSize) return -1;
+    if (rewind->count == rewind->maxFrames) chip8RewindDropOldest(rewind);
+
+    while (rewind->count > 0)
+    {
+        uint32_t head = rewind->dataHead;
+        uint32_t oldest = chip8RewindEntry(rewind, 0)->offset;
+        if (oldest < head)
+        {
+            // Frames held from oldest to head: free space after head, then from the start up to oldest
+            if (head + size <= rewind->dataSize) return head;
+            if (size <= oldest) return 0;
+        }
+        else if (head + size <= oldest)
+        {
+            // Frames held wrap around the end of the ring: the only free space is from head up to oldest
+            return head;
+        }
+        chip8RewindDropOldest(rewind);
+    }
+
+    rewind->dataHead = 0;
+    return 0;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8RewindInit(Chip8Rewind* rewind, double seconds, uint32_t budget, uint32_t keyframeInterval)
+{
+    memset(rewind, 0, sizeof(*rewind));
+    rewind->maxFrames = seconds * CHIP8_FRAME_RATE > 2 ? (uint32_t)(seconds * CHIP8_FRAME_RATE) : 2;
+    rewind->keyframeInterval = keyframeInterval > 0 ? keyframeInterval : 1;
+
+    // The budget covers the entries and the encoded frames
+    uint32_t entryBytes = rewind->maxFrames * sizeof(Chip8RewindEntry);
+    rewind->dataSize = budget > entryBytes ? budget - entryBytes : 0;
+    rewind->entries = malloc(entryBytes);
+    rewind->data = malloc(rewind->dataSize);
+    if (rewind->entries != NULL && rewind->data != NULL) return true;
+
+    chip8RewindDestroy(rewind);
+    return false;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8RewindDestroy(Chip8Rewind* rewind)
+{
+    free(rewind->entries);
+    free(rewind->data);
+    rewind->entries = NULL;
+    rewind->data = NULL;
+    rewind->count = 0;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8RewindClear(Chip8Rewind* rewind)
+{
+    rewind->first = 0;
+    rewind->count = 0;
+    rewind->keyframes = 0;
+    rewind->bytesUsed = 0;
+    rewind->dataHead = 0;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8RewindCapture(Chip8Rewind* rewind, Chip8Machine* m)
+{
+    uint64_t start = platformGetTick();
+    uint32_t stateSize = chip8SaveState(m, rewind->state);
+
+    // A delta needs both states to be laid out the same, which they aren't once the screen mode or variant changes
+    bool keyframe = rewind->count == 0 || rewind->sinceKeyframe >= rewind->keyframeInterval ||
+                    stateSize != chip8GetStateSize(rewind->newest);
+    uint32_t size = chip8RewindEncode(rewind->state, keyframe ? NULL : rewind->newest, stateSize, rewind->encoded);
+    int32_t offset = chip8RewindReserve(rewind, size);
+
+    // Making room may have dropped every frame, including the one the delta is from
+    if (!keyframe && rewind->count == 0)
+    {
+        keyframe = true;
+        size = chip8RewindEncode(rewind->state, NULL, stateSize, rewind->encoded);
+        offset = chip8RewindReserve(rewind, size);
+    }
+
+    if (offset >= 0)
+    {
+        memcpy(rewind->data + offset, rewind->encoded, size);
+        Chip8RewindEntry* entry = chip8RewindEntry(rewind, rewind->count++);
+        entry->offset = offset;
+        entry->size = size;
+        entry->keyframe = keyframe;
+        rewind->dataHead = offset + size;
+        rewind->bytesUsed += size;
+        rewind->keyframes += keyframe;
+        rewind->sinceKeyframe = keyframe ? 1 : rewind->sinceKeyframe + 1;
+        memcpy(rewind->newest, rewind->state, stateSize);
+    }
+
+    rewind->captureTicks += platformGetTick() - start;
+    rewind->captures++;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8RewindStep(Chip8Rewind* rewind, Chip8Machine* m)
+{
+    if (rewind->count < 2) return false;
+
+    uint32_t newest = rewind->count - 1;
+    Chip8RewindEntry* entry = chip8RewindEntry(rewind, newest);
+    if (!entry->keyframe)
+    {
+        // Undoing the delta gives the frame before
+        chip8RewindDecode(rewind->data + entry->offset, entry->size, rewind->newest);
+    }
+    else
+    {
+        // The frame before is the end of the previous keyframe's run of deltas.  The oldest frame is a keyframe, so
+        // there always is one.
+        uint32_t keyframe = newest - 1;
+        while (!chip8RewindEntry(rewind, keyframe)->keyframe) keyframe--;
+        for (uint32_t n = keyframe; n < newest; n++) chip8RewindDecodeEntry(rewind, n, rewind->newest);
+    }
+
+    rewind->count--;
+    rewind->bytesUsed -= entry->size;
+    rewind->keyframes -= entry->keyframe;
+    rewind->dataHead = entry->offset;
+    rewind->sinceKeyframe = 1;
+    while (rewind->sinceKeyframe < rewind->count && !chip8RewindEntry(rewind, newest - rewind->sinceKeyframe)->keyframe)
+        rewind->sinceKeyframe++;
+
+    // The player is holding the rewind key right now, not the keys held back then
+    bool keyboard[16];
+    memcpy(keyboard, m->keyboard, sizeof(keyboard));
+    chip8LoadState(m, rewind->newest, CHIP8_STATE_SIZE);
+    memcpy(m->keyboard, keyboard, sizeof(keyboard));
+    chip8PublishScreen(m);
+    return true;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8RewindGetStats(const Chip8Rewind* rewind, Chip8RewindStats* stats)
+{
+    stats->frames = rewind->count > 0 ? rewind->count - 1 : 0;
+    stats->keyframes = rewind->keyframes;
+    stats->bytesUsed = rewind->bytesUsed;
+    stats->budget = rewind->dataSize + rewind->maxFrames * sizeof(Chip8RewindEntry) + sizeof(Chip8Rewind);
+    stats->bytesPerFrame = rewind->count > 0 ? (double)rewind->bytesUsed / rewind->count : 0;
+    stats->captureMicros =
+        rewind->captures > 0 ? rewind->captureTicks * 1e6 / platformGetTickFrequency() / rewind->captures : 0;
+}
@@ -0,0 +1,76 @@
+#ifndef CHIP_8_REWIND_H_
+#define CHIP_8_REWIND_H_
+
+#include "chip8state.h"
+
+// Rewind: a save state of every emulated frame, kept in a fixed-size ring so gameplay can be stepped back frame by
+// frame.  Consecutive frames rarely differ in more than a few registers, bytes of memory and screen rows, so most
+// frames are stored as the XOR of their state with the previous frame's, run-length encoded to little more than the
+// bytes that changed.  Every keyframeInterval frames a complete (also run-length encoded) state is stored instead.
+//
+// Stepping back undoes the newest delta with another XOR, and when it crosses a keyframe rebuilds the frame before it
+// from the previous keyframe forward.  When the ring is full the oldest keyframe is dropped with all its deltas, so
+// the oldest frame held is always a keyframe.  Everything runs on the emulator thread at frame boundaries; see
+// Chip8Machine.rewind.
+
+// Where one frame is stored in the ring
+typedef struct Chip8RewindEntry
+{
+    uint32_t offset; // Start of the encoded frame in data
+    uint32_t size;   // Bytes it takes
+    bool keyframe;   // True for a complete state, false for a delta from the frame before
+} Chip8RewindEntry;
+
+// Memory use and cost of the rewind ring, for display.  Read without locking, so the figures are only advisory.
+typedef struct Chip8RewindStats
+{
+    uint32_t frames;         // Frames that can be stepped back
+    uint32_t keyframes;      // Keyframes among them
+    uint32_t bytesUsed;      // Bytes of the ring holding frames
+    uint32_t budget;         // Size of the ring, plus the fixed buffers
+    double bytesPerFrame;    // Average encoded size of a frame
+    double captureMicros;    // Average time taken to record a frame, in microseconds
+} Chip8RewindStats;
+
+typedef struct Chip8Rewind
+{
+    uint8_t* data;             // Ring holding the encoded frames
+    uint32_t dataSize;         // Size of data in bytes
+    uint32_t dataHead;         // Where the next frame is written, unless it has to wrap to the start
+    Chip8RewindEntry* entries; // Frames held, oldest at first
+    uint32_t maxFrames;        // Capacity of entries: the longest rewind allowed
+    uint32_t first;            // Index in entries of the oldest frame
+    uint32_t count;            // Number of frames held
+    uint32_t keyframes;        // Keyframes among them
+    uint32_t bytesUsed;        // Sum of the sizes of the frames held
+    uint32_t keyframeInterval; // Frames from one keyframe to the next
+    uint32_t sinceKeyframe;    // Frames recorded since the newest keyframe
+    uint64_t captureTicks;     // Time spent recording frames (platformGetTick)
+    uint64_t captures;         // Frames recorded
+
+    uint8_t newest[CHIP8_STATE_SIZE];      // State of the newest frame held
+    uint8_t state[CHIP8_STATE_SIZE];       // State being recorded
+    uint8_t encoded[CHIP8_STATE_SIZE * 2]; // Encoding of the frame being recorded.  Worst case fits.
+} Chip8Rewind;
+
+// Sets up a ring holding up to seconds of emulated frames in at most budget bytes, with a keyframe every
+// keyframeInterval frames.  Returns false if the memory could not be allocated.
+bool chip8RewindInit(Chip8Rewind* rewind, double seconds, uint32_t budget, uint32_t keyframeInterval);
+
+// Frees the ring
+void chip8RewindDestroy(Chip8Rewind* rewind);
+
+// Drops every frame held
+void chip8RewindClear(Chip8Rewind* rewind);
+
+// Records the machine's current state as the newest frame.  Called at the end of every frame.
+void chip8RewindCapture(Chip8Rewind* rewind, Chip8Machine* m);
+
+// Steps the machine back to the frame before the newest one and drops the newest one.  The keys stay as they are
+// now.  Returns false, leaving the machine alone, if there is nothing older to go back to.
+bool chip8RewindStep(Chip8Rewind* rewind, Chip8Machine* m);
+
+// Gets the ring's memory use and recording cost
+void chip8RewindGetStats(const Chip8Rewind* rewind, Chip8RewindStats* stats);
+
+#endif
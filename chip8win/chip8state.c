@@ -0,0 +1,420 @@
+#include "chip8state.h"
+#include "chip8movie.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ********************************************************************************************************************
+// Little endian field encoding.  Each function writes or reads one value at *p and advances p past it.
+// ********************************************************************************************************************
+static void put8(uint8_t** p, uint8_t value) { *(*p)++ = value; }
+
+static void put16(uint8_t** p, uint16_t value)
+{
+    put8(p, value & 0xFF);
+    put8(p, value >> 8);
+}
+
+static void put32(uint8_t** p, uint32_t value)
+{
+    put16(p, value & 0xFFFF);
+    put16(p, value >> 16);
+}
+
+static void put64(uint8_t** p, uint64_t value)
+{
+    put32(p, value & 0xFFFFFFFF);
+    put32(p, value >> 32);
+}
+
+static uint8_t get8(const uint8_t** p) { return *(*p)++; }
+
+static uint16_t get16(const uint8_t** p)
+{
+    uint16_t low = get8(p);
+    return low | (uint16_t)get8(p) << 8;
+}
+
+static uint32_t get32(const uint8_t** p)
+{
+    uint32_t low = get16(p);
+    return low | (uint32_t)get16(p) << 16;
+}
+
+static uint64_t get64(const uint8_t** p)
+{
+    uint64_t low = get32(p);
+    return low | (uint64_t)get32(p) << 32;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Size of the blob of a machine of the variant with the given screen
+static uint32_t chip8ComputeStateSize(Chip8Variant variant, const Chip8Screen* screen)
+{
+    uint32_t size = CHIP8_STATE_FIXED_SIZE + chip8GetMemorySize(variant);
+    for (uint32_t p = 0; p < CHIP8_PLANE_COUNT; p++)
+    {
+        if (screen->planes & (1u << p)) size += screen->height * (screen->width / 64) * 8;
+    }
+    return size;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Reads the variant and screen geometry of a blob, returning false if they aren't ones a machine can be in
+static bool chip8GetStateLayout(const uint8_t* state, Chip8Variant* variant, Chip8Screen* screen)
+{
+    const uint8_t* p = state + 12;
+    *variant = get8(&p);
+    screen->width = get8(&p);
+    screen->height = get8(&p);
+    screen->planes = get8(&p);
+
+    bool hires = screen->width == CHIP8_SCREEN_WIDTH && screen->height == CHIP8_SCREEN_HEIGHT;
+    bool lores = screen->width == CHIP8_LORES_WIDTH && screen->height == CHIP8_LORES_HEIGHT;
+    return *variant < CHIP8_VARIANT_COUNT && (hires || lores) && (screen->planes & 1) &&
+           screen->planes < (1u << CHIP8_PLANE_COUNT);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static bool chip8IsValidState(const uint8_t* state, uint32_t size)
+{
+    if (size < CHIP8_STATE_FIXED_SIZE) return false;
+
+    const uint8_t* p = state;
+    if (get32(&p) != CHIP8_STATE_MAGIC || get32(&p) != CHIP8_STATE_VERSION) return false;
+
+    // The blob has to be exactly as big as the machine it holds
+    uint32_t stateSize = get32(&p);
+    Chip8Variant variant;
+    Chip8Screen screen;
+    return stateSize <= size && chip8GetStateLayout(state, &variant, &screen) &&
+           stateSize == chip8ComputeStateSize(variant, &screen);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+uint32_t chip8GetStateSize(const uint8_t* state)
+{
+    const uint8_t* p = state + 8;
+    return get32(&p);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+uint32_t chip8SaveState(const Chip8Machine* m, uint8_t* state)
+{
+    uint32_t size = chip8ComputeStateSize(m->variant, &m->screen);
+    uint8_t* p = state;
+    put32(&p, CHIP8_STATE_MAGIC);
+    put32(&p, CHIP8_STATE_VERSION);
+    put32(&p, size);
+
+    // What the rest of the blob holds
+    put8(&p, m->variant);
+    put8(&p, m->screen.width);
+    put8(&p, m->screen.height);
+    put8(&p, m->screen.planes);
+
+    // Registers
+    memcpy(p, m->genRegs, 16);
+    p += 16;
+    put16(&p, m->i);
+    put16(&p, m->programCounter);
+    put8(&p, m->stackPointer);
+    put8(&p, m->delayTimerReg);
+    put8(&p, m->soundTimerReg);
+    put8(&p, m->shiftQuirkMode);
+    put8(&p, m->loadStoreQuirkMode);
+    put8(&p, m->jumpQuirkMode);
+    put8(&p, m->clipQuirkMode);
+    put8(&p, m->planeMask);
+
+    for (uint32_t s = 0; s < 16; s++) put16(&p, m->stack[s]);
+    for (uint32_t k = 0; k < 16; k++) put8(&p, m->keyboard[k]);
+    memcpy(p, m->rpl, 16);
+    p += 16;
+    memcpy(p, m->audioPattern, 16);
+    p += 16;
+    put8(&p, m->audioPitch);
+
+    // Where the scheduler is in the current frame, so a loaded state runs on exactly like the saved machine would
+    put32(&p, m->clockSpeed);
+    put32(&p, (uint32_t)m->frameCycles);
+    put32(&p, m->frameCycleFraction);
+    put64(&p, m->frameCount);
+    put64(&p, m->instructionCount);
+
+    // The generator too, so Cxkk draws the same numbers after a load as the saved machine would have
+    put64(&p, m->randomState);
+
+    // The rows of the planes in use, and the memory the variant has
+    uint32_t words = m->screen.height * (m->screen.width / 64);
+    for (uint32_t plane = 0; plane < CHIP8_PLANE_COUNT; plane++)
+    {
+        if ((m->screen.planes & (1u << plane)) == 0) continue;
+        for (uint32_t w = 0; w < words; w++) put64(&p, m->screen.pixels[plane][w]);
+    }
+    memcpy(p, m->mem, m->memSize);
+    return size;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8LoadState(Chip8Machine* m, const uint8_t* state, uint32_t size)
+{
+    if (!chip8IsValidState(state, size)) return false;
+
+    Chip8Variant variant;
+    chip8GetStateLayout(state, &variant, &m->screen);
+    m->variant = variant;
+    m->memSize = chip8GetMemorySize(variant);
+
+    const uint8_t* p = state + 16;
+    memcpy(m->genRegs, p, 16);
+    p += 16;
+    m->i = get16(&p);
+    m->programCounter = get16(&p) & (CHIP8_MEM_SIZE - 1);
+    m->stackPointer = get8(&p) & 0xF;
+    m->delayTimerReg = get8(&p);
+    m->soundTimerReg = get8(&p);
+    m->shiftQuirkMode = get8(&p) != 0;
+    m->loadStoreQuirkMode = get8(&p) != 0;
+    m->jumpQuirkMode = get8(&p) != 0;
+    m->clipQuirkMode = get8(&p) != 0;
+    m->planeMask = get8(&p) & ((1u << CHIP8_PLANE_COUNT) - 1);
+
+    for (uint32_t s = 0; s < 16; s++) m->stack[s] = get16(&p);
+    for (uint32_t k = 0; k < 16; k++) m->keyboard[k] = get8(&p) != 0;
+    memcpy(m->rpl, p, 16);
+    p += 16;
+    memcpy(m->audioPattern, p, 16);
+    p += 16;
+    m->audioPitch = get8(&p);
+
+    m->clockSpeed = get32(&p);
+    m->frameCycles = (int32_t)get32(&p);
+    m->frameCycleFraction = get32(&p);
+    m->frameCount = get64(&p);
+    m->instructionCount = get64(&p);
+    m->randomState = get64(&p);
+    if (m->randomState == 0) m->randomState = 1;
+
+    // Planes that weren't saved are blank
+    uint32_t words = m->screen.height * (m->screen.width / 64);
+    memset(m->screen.pixels, 0, sizeof(m->screen.pixels));
+    for (uint32_t plane = 0; plane < CHIP8_PLANE_COUNT; plane++)
+    {
+        if ((m->screen.planes & (1u << plane)) == 0) continue;
+        for (uint32_t w = 0; w < words; w++) m->screen.pixels[plane][w] = get64(&p);
+    }
+
+    // Memory past what the variant has reads as zero, as after loading a ROM
+    memcpy(m->mem, p, m->memSize);
+    memset(m->mem + m->memSize, 0, CHIP8_MEM_SIZE - m->memSize);
+
+    // All of memory may hold different code now, and the whole screen has to be repainted
+    chip8InvalidateDecodeCache(m, 0, CHIP8_MEM_SIZE);
+    m->damageRows = ~0ull;
+    for (uint32_t w = 0; w < CHIP8_ROW_WORDS; w++) m->damageColumns[w] = ~0ull;
+    return true;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8ReadStateFile(const char* filename, uint8_t* state)
+{
+    FILE* fp = fopen(filename, "rb");
+    if (fp == NULL) return false;
+
+    uint32_t size = fread(state, 1, CHIP8_STATE_SIZE, fp);
+    fclose(fp);
+    return chip8IsValidState(state, size);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8RequestSaveState(Chip8Machine* m, uint8_t* state, const char* filename)
+{
+    if (chip8StateRequestPending(m)) return false;
+
+    m->stateBuffer = state;
+    snprintf(m->statePath, sizeof(m->statePath), "%s", filename != NULL ? filename : "");
+
+    // The exchange is a full barrier, so the emulator thread sees the buffer and path once it sees the request
+    platformAtomicExchange(&m->stateRequest, CHIP8_STATE_REQUEST_SAVE);
+    chip8Wake(m);
+    return true;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8RequestLoadState(Chip8Machine* m, const uint8_t* state)
+{
+    if (chip8StateRequestPending(m) || !chip8IsValidState(state, CHIP8_STATE_SIZE)) return false;
+
+    m->stateBuffer = (uint8_t*)state;
+    platformAtomicExchange(&m->stateRequest, CHIP8_STATE_REQUEST_LOAD);
+    chip8Wake(m);
+    return true;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8StateRequestPending(Chip8Machine* m)
+{
+    return platformAtomicLoad(&m->stateRequest) != CHIP8_STATE_REQUEST_NONE;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8ProcessStateRequests(Chip8Machine* m)
+{
+    uint32_t request = platformAtomicLoad(&m->stateRequest);
+    if (request == CHIP8_STATE_REQUEST_SAVE)
+    {
+        chip8SaveState(m, m->stateBuffer);
+        if (m->statePath[0] != '\0' && m->stateWriter != NULL)
+            chip8StateWriterQueue(m->stateWriter, m->statePath, m->stateBuffer);
+    }
+    else if (request == CHIP8_STATE_REQUEST_LOAD)
+    {
+        // A movie can't follow the machine to another state.  Publish right away, a paused machine would otherwise keep
+        // showing the old screen.
+        chip8EndMovie(m);
+        chip8LoadState(m, m->stateBuffer, CHIP8_STATE_SIZE);
+        chip8PublishScreen(m);
+    }
+
+    // Clearing the request hands the buffer back to the thread that made it
+    if (request != CHIP8_STATE_REQUEST_NONE) platformAtomicExchange(&m->stateRequest, CHIP8_STATE_REQUEST_NONE);
+
+    // The first interval starts when autosaving is first seen enabled, so a fresh start doesn't overwrite the last
+    // session's autosave right away
+    if (m->autosaveInterval <= 0 || m->stateWriter == NULL) return;
+    if (m->autosaveTick == 0) m->autosaveTick = platformGetTick();
+    if (getElapsedTimeSinceHighPerfTick(m->autosaveTick) >= m->autosaveInterval)
+    {
+        // Each machine has its own buffer, too big for the stack, so machines on other threads can autosave at once.
+        // Without the memory the autosave is skipped until the next interval.
+        if (m->autosaveBuffer == NULL) m->autosaveBuffer = malloc(CHIP8_STATE_SIZE);
+        if (m->autosaveBuffer != NULL)
+        {
+            chip8SaveState(m, m->autosaveBuffer);
+            chip8StateWriterQueue(m->stateWriter, m->autosavePath, m->autosaveBuffer);
+        }
+        m->autosaveTick = platformGetTick();
+    }
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static bool chip8WriteStateFile(const char* filename, const uint8_t* state)
+{
+    // Write a temporary file and rename it over the old one, so a crash mid-write never leaves a truncated state
+    char temporary[CHIP8_STATE_PATH_SIZE + 4];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", filename);
+
+    FILE* fp = fopen(temporary, "wb");
+    if (fp == NULL) return false;
+    uint32_t size = chip8GetStateSize(state);
+    bool ok = fwrite(state, 1, size, fp) == size;
+    ok = fclose(fp) == 0 && ok;
+
+    // rename() won't replace an existing file on Windows
+    remove(filename);
+    return ok && rename(temporary, filename) == 0;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void chip8StateWriterThread(void* context)
+{
+    Chip8StateWriter* writer = context;
+
+    platformMutexLock(&writer->mutex);
+    while (true)
+    {
+        while (writer->count == 0 && writer->running) platformConditionWait(&writer->condition, &writer->mutex);
+        if (writer->count == 0) break;
+
+        // Take a copy so the emulator thread can queue more while the file is written
+        writer->current = writer->queue[writer->head];
+        writer->head = (writer->head + 1) % CHIP8_STATE_WRITER_QUEUE;
+        writer->count--;
+        platformMutexUnlock(&writer->mutex);
+
+        bool ok = chip8WriteStateFile(writer->current.filename, writer->current.state);
+
+        platformMutexLock(&writer->mutex);
+        if (ok)
+            writer->written++;
+        else
+            writer->failed++;
+    }
+    platformMutexUnlock(&writer->mutex);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8StateWriterStart(Chip8StateWriter* writer)
+{
+    memset(writer, 0, sizeof(*writer));
+    platformMutexInit(&writer->mutex);
+    platformConditionInit(&writer->condition);
+    writer->running = true;
+    if (platformThreadStart(&writer->thread, chip8StateWriterThread, writer)) return true;
+
+    platformConditionDestroy(&writer->condition);
+    platformMutexDestroy(&writer->mutex);
+    return false;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8StateWriterQueue(Chip8StateWriter* writer, const char* filename, const uint8_t* state)
+{
+    platformMutexLock(&writer->mutex);
+
+    // A newer state for a file replaces the one still waiting for it
+    Chip8StateWrite* write = NULL;
+    for (uint32_t n = 0; n < writer->count && write == NULL; n++)
+    {
+        Chip8StateWrite* pending = &writer->queue[(writer->head + n) % CHIP8_STATE_WRITER_QUEUE];
+        if (strcmp(pending->filename, filename) == 0) write = pending;
+    }
+
+    if (write == NULL)
+    {
+        if (writer->count == CHIP8_STATE_WRITER_QUEUE)
+        {
+            writer->head = (writer->head + 1) % CHIP8_STATE_WRITER_QUEUE;
+            writer->count--;
+            writer->dropped++;
+        }
+        write = &writer->queue[(writer->head + writer->count) % CHIP8_STATE_WRITER_QUEUE];
+        writer->count++;
+        snprintf(write->filename, sizeof(write->filename), "%s", filename);
+    }
+    memcpy(write->state, state, chip8GetStateSize(state));
+
+    platformConditionSignal(&writer->condition);
+    platformMutexUnlock(&writer->mutex);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8StateWriterStop(Chip8StateWriter* writer)
+{
+    platformMutexLock(&writer->mutex);
+    writer->running = false;
+    platformConditionSignal(&writer->condition);
+    platformMutexUnlock(&writer->mutex);
+
+    platformThreadJoin(&writer->thread);
+    platformConditionDestroy(&writer->condition);
+    platformMutexDestroy(&writer->mutex);
+}
@@ -0,0 +1,100 @@
+#ifndef CHIP_8_STATE_H_
+#define CHIP_8_STATE_H_
+
+#include "chip8.h"
+
+// Save states: the complete state of a machine (variant, registers, stack, timers, keyboard, memory, screen, the
+// scheduler's position in the frame and the random number generator) as a binary blob.  Saving and loading are a
+// handful of copies, and a background writer thread puts blobs on disk so the emulator thread never waits for the
+// file system.
+//
+// The blob is little endian whatever the host, and starts with a magic number, a format version and its size.  A blob
+// from another version is rejected rather than misread, so the version must be bumped whenever the layout changes.
+// The fixed-size fields come first, then the rows of the planes the screen uses and the variant's memory, so a classic
+// CHIP-8 machine in lo-res takes little more than its 4 KB of memory.
+
+#define CHIP8_STATE_MAGIC 0x54533843 // "C8ST"
+#define CHIP8_STATE_VERSION 3
+
+// Size of the fixed part of a version 3 blob: header, variant and screen geometry, registers and quirks, stack,
+// keyboard, RPL flags, audio pattern and pitch, scheduler and random generator
+#define CHIP8_STATE_FIXED_SIZE (12 + 4 + 28 + 32 + 16 + 16 + 17 + 28 + 8)
+
+// Size of the largest blob: XO-CHIP in hi-res with both planes.  Buffers for any state are this big.
+#define CHIP8_STATE_SIZE (CHIP8_STATE_FIXED_SIZE + CHIP8_PLANE_COUNT * CHIP8_SCREEN_WORDS * 8 + CHIP8_MEM_SIZE)
+
+#define CHIP8_STATE_WRITER_QUEUE 4 // Writes the writer thread can have pending
+
+// Save state operation waiting in Chip8Machine.stateRequest for the emulator thread
+typedef enum Chip8StateRequest
+{
+    CHIP8_STATE_REQUEST_NONE,
+    CHIP8_STATE_REQUEST_SAVE,
+    CHIP8_STATE_REQUEST_LOAD,
+} Chip8StateRequest;
+
+// A blob waiting to be written to a file
+typedef struct Chip8StateWrite
+{
+    char filename[CHIP8_STATE_PATH_SIZE];
+    uint8_t state[CHIP8_STATE_SIZE];
+} Chip8StateWrite;
+
+// Background thread writing save states to disk.  Queuing a write only copies the blob, the thread does the I/O.
+typedef struct Chip8StateWriter
+{
+    Chip8StateWrite queue[CHIP8_STATE_WRITER_QUEUE]; // Pending writes, the oldest at head
+    uint32_t head;                                   // Index of the oldest pending write
+    uint32_t count;                                  // Number of pending writes
+    bool running;                                    // Cleared to make the thread exit once the queue is empty
+    uint64_t written;                                // Files written successfully
+    uint64_t failed;                                 // Files that could not be written
+    uint64_t dropped;                                // Writes discarded because the queue was full
+    PlatformMutex mutex;                             // Protects everything above
+    PlatformCondition condition;                     // Signaled when a write is queued or the writer is stopped
+    PlatformThread thread;                           // Thread doing the writes
+    Chip8StateWrite current;                         // Write in progress, copied out of the queue.  Thread only.
+} Chip8StateWriter;
+
+// Saves the machine into state, which must hold CHIP8_STATE_SIZE bytes, and returns the size of the blob.  Only call
+// it from the thread running the machine, or while it is not running; chip8RequestSaveState() does this from other
+// threads.
+uint32_t chip8SaveState(const Chip8Machine* m, uint8_t* state);
+
+// Returns the size of a blob saved by chip8SaveState(), as its header gives it
+uint32_t chip8GetStateSize(const uint8_t* state);
+
+// Restores a machine saved by chip8SaveState().  Returns false, leaving the machine untouched, if the blob is not a
+// save state of this version.  Same threading rules as chip8SaveState().
+bool chip8LoadState(Chip8Machine* m, const uint8_t* state, uint32_t size);
+
+// Reads a save state file into state (CHIP8_STATE_SIZE bytes).  Returns false if the file can't be read or is not a
+// save state of this version.
+bool chip8ReadStateFile(const char* filename, uint8_t* state);
+
+// Asks the emulator thread to save the machine into state before it runs the next frame.  If filename is not NULL
+// the blob is then queued on m->stateWriter (which must be set) to be written to that file.  Returns false if a
+// request is already pending.  The state buffer must not be touched until chip8StateRequestPending() returns false.
+bool chip8RequestSaveState(Chip8Machine* m, uint8_t* state, const char* filename);
+
+// Asks the emulator thread to load the machine from state before it runs the next frame.  Returns false if a request
+// is already pending or the blob is not a save state of this version.
+bool chip8RequestLoadState(Chip8Machine* m, const uint8_t* state);
+
+// Returns true while a request made by chip8RequestSaveState() or chip8RequestLoadState() hasn't been carried out
+bool chip8StateRequestPending(Chip8Machine* m);
+
+// Carries out the pending request, if any, and the autosave if it is due.  Called by chip8Run() between frames.
+void chip8ProcessStateRequests(Chip8Machine* m);
+
+// Starts the writer thread.  Returns false if it could not be started.
+bool chip8StateWriterStart(Chip8StateWriter* writer);
+
+// Queues state to be written to filename.  Never blocks on I/O: a write queued for a file that already has one
+// pending replaces it, and if the queue is full the oldest pending write is dropped.
+void chip8StateWriterQueue(Chip8StateWriter* writer, const char* filename, const uint8_t* state);
+
+// Writes everything still queued, then stops the writer thread
+void chip8StateWriterStop(Chip8StateWriter* writer);
+
+#endif
@@ -0,0 +1,223 @@
+#include "chip8trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static bool chip8WriteTraceHeader(FILE* fp, const Chip8Trace* trace, uint64_t records)
+{
+    Chip8TraceHeader header = {0};
+    header.magic = CHIP8_TRACE_MAGIC;
+    header.version = CHIP8_TRACE_VERSION;
+    header.recordSize = sizeof(Chip8TraceRecord);
+    header.disassembly = trace->disassembly;
+    header.records = records;
+    header.firstInstruction = trace->firstInstruction;
+    return fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, fp) == 1;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static bool chip8WriteTraceRecords(void* context, FILE* file, uint32_t first, uint32_t last)
+{
+    Chip8Trace* trace = context;
+    uint32_t mask = trace->writer.capacity - 1;
+
+    // The records are in at most two pieces, before and after the end of the ring
+    for (uint32_t tail = first; tail != last;)
+    {
+        uint32_t start = tail & mask;
+        uint32_t length = last - tail < mask + 1 - start ? last - tail : mask + 1 - start;
+        if (fwrite(&trace->records[start], sizeof(Chip8TraceRecord), length, file) != length) return false;
+        tail += length;
+    }
+    trace->written += last - first;
+    return true;
+}
+
+static bool chip8FinishTraceFile(void* context, FILE* file, bool ok)
+{
+    // The header gets the count of the records written even if some were lost, so what is there can be read
+    chip8WriteTraceHeader(file, context, ((Chip8Trace*)context)->written);
+    return ok;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8TraceInit(Chip8Trace* trace, const char* filename, uint32_t capacity)
+{
+    memset(trace, 0, sizeof(*trace));
+    snprintf(trace->filename, sizeof(trace->filename), "%s", filename);
+    uint32_t size = CHIP8_TRACE_CHUNK;
+    while (size < capacity) size *= 2;
+
+    trace->records = malloc((size_t)size * sizeof(Chip8TraceRecord));
+    if (trace->records == NULL) return false;
+
+    // The ring may be a single chunk, the emulator waits for space when it is full
+    if (chip8WriterInit(&trace->writer, size, CHIP8_TRACE_CHUNK, chip8WriteTraceRecords, chip8FinishTraceFile, trace))
+        return true;
+
+    free(trace->records);
+    return false;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8TraceDestroy(Chip8Trace* trace)
+{
+    if (trace->active) chip8TraceEnd(trace);
+    chip8WriterDestroy(&trace->writer);
+    free(trace->records);
+    trace->records = NULL;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8TraceBegin(Chip8Trace* trace, const Chip8Machine* m)
+{
+    // The last trace must be finished before its file is replaced, and the writer is idle after that
+    chip8WriterWaitUntilClosed(&trace->writer);
+    FILE* fp = fopen(trace->filename, "wb");
+    if (fp == NULL) return false;
+
+    // The header is rewritten with the record count once the trace is finished
+    trace->firstInstruction = m->instructionCount;
+    trace->disassembly = chip8GetDisassemblyFlags(m);
+    if (!chip8WriteTraceHeader(fp, trace, 0))
+    {
+        fclose(fp);
+        return false;
+    }
+
+    trace->headLocal = trace->tailCached = 0;
+    trace->written = 0;
+    trace->active = true;
+    chip8WriterOpen(&trace->writer, fp);
+    return true;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8TraceEnd(Chip8Trace* trace)
+{
+    trace->active = false;
+    chip8WriterEnd(&trace->writer, trace->headLocal);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8TracePublish(Chip8Trace* trace) { chip8WriterPublish(&trace->writer, trace->headLocal); }
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8TraceWaitForSpace(Chip8Trace* trace)
+{
+    trace->tailCached = platformAtomicLoad(&trace->writer.tail);
+    if (trace->headLocal - trace->tailCached < trace->writer.capacity) return;
+
+    chip8WriterWaitForSpace(&trace->writer, trace->headLocal);
+    trace->tailCached = platformAtomicLoad(&trace->writer.tail);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8ProcessTraceRequest(Chip8Machine* m)
+{
+    if (m->trace == NULL || m->tracing == m->trace->active) return;
+
+    // A trace that can't be started is given up on rather than retried every frame
+    if (!m->tracing)
+        chip8TraceEnd(m->trace);
+    else if (!chip8TraceBegin(m->trace, m))
+        m->tracing = false;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+uint32_t chip8GetDisassemblyFlags(const Chip8Machine* m)
+{
+    uint32_t flags = 0;
+    if (m->shiftQuirkMode) flags |= CHIP8_DISASSEMBLE_SHIFT_QUIRK;
+    if (m->jumpQuirkMode) flags |= CHIP8_DISASSEMBLE_JUMP_QUIRK;
+    if (m->variant != CHIP8_VARIANT_CHIP8) flags |= CHIP8_DISASSEMBLE_BIG_SPRITES;
+    return flags;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8Disassemble(uint16_t instruction, uint32_t flags, char* buffer, uint32_t size)
+{
+    uint16_t nnn = instruction & 0x0FFF;
+    uint16_t kk = instruction & 0x00FF;
+    uint8_t x = (instruction & 0x0F00) >> 8;
+    uint8_t y = (instruction & 0x00F0) >> 4;
+    uint8_t n = instruction & 0x000F;
+    uint8_t shifted = flags & CHIP8_DISASSEMBLE_SHIFT_QUIRK ? x : y; // Register 8xy6 and 8xyE shift into Vx
+
+    switch (chip8DecodeOp(instruction))
+    {
+    case CHIP8_OP_00E0: snprintf(buffer, size, "CLEAR DISPLAY"); break;
+    case CHIP8_OP_00EE: snprintf(buffer, size, "RETURN"); break;
+    case CHIP8_OP_1nnn: snprintf(buffer, size, "JUMP TO %03X", nnn); break;
+    case CHIP8_OP_2nnn: snprintf(buffer, size, "CALL %03X", nnn); break;
+    case CHIP8_OP_3xkk: snprintf(buffer, size, "SKIP IF V%X == %02X", x, kk); break;
+    case CHIP8_OP_4xkk: snprintf(buffer, size, "SKIP IF V%X != %02X", x, kk); break;
+    case CHIP8_OP_5xy0: snprintf(buffer, size, "SKIP IF V%X == V%X", x, y); break;
+    case CHIP8_OP_6xkk: snprintf(buffer, size, "LOAD %02X INTO V%X", kk, x); break;
+    case CHIP8_OP_7xkk: snprintf(buffer, size, "SET V%X += %02X", x, kk); break;
+    case CHIP8_OP_8xy0: snprintf(buffer, size, "SET V%X = V%X", x, y); break;
+    case CHIP8_OP_8xy1: snprintf(buffer, size, "SET V%X |= V%X", x, y); break;
+    case CHIP8_OP_8xy2: snprintf(buffer, size, "SET V%X &= V%X", x, y); break;
+    case CHIP8_OP_8xy3: snprintf(buffer, size, "SET V%X ^= V%X", x, y); break;
+    case CHIP8_OP_8xy4: snprintf(buffer, size, "SET V%X += V%X, SET VF = CARRY", x, y); break;
+    case CHIP8_OP_8xy5: snprintf(buffer, size, "SET V%X -= V%X, SET VF = NOT BORROW", x, y); break;
+    case CHIP8_OP_8xy6: snprintf(buffer, size, "SET V%X = V%X >> 1, SET VF = DROPPED BIT", x, shifted); break;
+    case CHIP8_OP_8xy7: snprintf(buffer, size, "SET V%X = V%X - V%X, SET VF = NOT BORROW", x, y, x); break;
+    case CHIP8_OP_8xyE: snprintf(buffer, size, "SET V%X = V%X << 1, SET VF = DROPPED BIT", x, shifted); break;
+    case CHIP8_OP_9xy0: snprintf(buffer, size, "SKIP IF V%X != V%X", x, y); break;
+    case CHIP8_OP_Annn: snprintf(buffer, size, "SET I = %03X", nnn); break;
+    case CHIP8_OP_Bnnn:
+        if (flags & CHIP8_DISASSEMBLE_JUMP_QUIRK)
+            snprintf(buffer, size, "JUMP TO %03X + V%X", nnn, x);
+        else
+            snprintf(buffer, size, "JUMP TO %03X + V0", nnn);
+        break;
+    case CHIP8_OP_Cxkk: snprintf(buffer, size, "SET V%X = RANDOM & %02X", x, kk); break;
+    case CHIP8_OP_Dxyn:
+        if (n == 0 && (flags & CHIP8_DISASSEMBLE_BIG_SPRITES))
+            snprintf(buffer, size, "DRAW 16X16 SPRITE AT V%X,V%X", x, y);
+        else
+            snprintf(buffer, size, "DRAW %i-BYTE SPRITE AT V%X,V%X", n, x, y);
+        break;
+    case CHIP8_OP_Ex9E: snprintf(buffer, size, "SKIP IF KEY AT V%X IS PRESSED", x); break;
+    case CHIP8_OP_ExA1: snprintf(buffer, size, "SKIP IF KEY AT V%X IS NOT PRESSED", x); break;
+    case CHIP8_OP_Fx07: snprintf(buffer, size, "SET V%X = DT", x); break;
+    case CHIP8_OP_Fx0A: snprintf(buffer, size, "WAIT FOR KEY, STORE IN V%X", x); break;
+    case CHIP8_OP_Fx15: snprintf(buffer, size, "SET DT = V%X", x); break;
+    case CHIP8_OP_Fx18: snprintf(buffer, size, "SET ST = V%X", x); break;
+    case CHIP8_OP_Fx1E: snprintf(buffer, size, "SET I += V%X", x); break;
+    case CHIP8_OP_Fx29: snprintf(buffer, size, "SET I = SPRITE FOR DIGIT IN V%X", x); break;
+    case CHIP8_OP_Fx33: snprintf(buffer, size, "STORE BCD OF V%X IN I, I+1, I+2", x); break;
+    case CHIP8_OP_Fx55: snprintf(buffer, size, "STORE V0 THROUGH V%X AT LOCATION I", x); break;
+    case CHIP8_OP_Fx65: snprintf(buffer, size, "LOAD V0 THROUGH V%X FROM LOCATION I", x); break;
+    case CHIP8_OP_00Cn: snprintf(buffer, size, "SCROLL DOWN %X", n); break;
+    case CHIP8_OP_00Dn: snprintf(buffer, size, "SCROLL UP %X", n); break;
+    case CHIP8_OP_00FB: snprintf(buffer, size, "SCROLL RIGHT 4"); break;
+    case CHIP8_OP_00FC: snprintf(buffer, size, "SCROLL LEFT 4"); break;
+    case CHIP8_OP_00FD: snprintf(buffer, size, "EXIT"); break;
+    case CHIP8_OP_00FE: snprintf(buffer, size, "LOW RESOLUTION"); break;
+    case CHIP8_OP_00FF: snprintf(buffer, size, "HIGH RESOLUTION"); break;
+    case CHIP8_OP_5xy2: snprintf(buffer, size, "STORE V%X THROUGH V%X AT LOCATION I", x, y); break;
+    case CHIP8_OP_5xy3: snprintf(buffer, size, "LOAD V%X THROUGH V%X FROM LOCATION I", x, y); break;
+    case CHIP8_OP_F000: snprintf(buffer, size, "SET I = NEXT WORD"); break;
+    case CHIP8_OP_Fn01: snprintf(buffer, size, "SELECT PLANES %X", x); break;
+    case CHIP8_OP_F002: snprintf(buffer, size, "LOAD AUDIO PATTERN FROM LOCATION I"); break;
+    case CHIP8_OP_Fx30: snprintf(buffer, size, "SET I = BIG SPRITE FOR DIGIT IN V%X", x); break;
+    case CHIP8_OP_Fx3A: snprintf(buffer, size, "SET PITCH = V%X", x); break;
+    case CHIP8_OP_Fx75: snprintf(buffer, size, "STORE V0 THROUGH V%X IN FLAGS", x); break;
+    case CHIP8_OP_Fx85: snprintf(buffer, size, "LOAD V0 THROUGH V%X FROM FLAGS", x); break;
+    default: snprintf(buffer, size, "UNKNOWN"); break;
+    }
+}
@@ -0,0 +1,101 @@
+#ifndef CHIP_8_TRACE_H_
+#define CHIP_8_TRACE_H_
+
+#include "chip8.h"
+#include "chip8writer.h"
+
+#include <stdio.h>
+
+// Instruction trace: one fixed-size binary record per executed instruction, appended by the emulator thread to an
+// in-memory ring and streamed to a file by a background writer thread.  Appending is a handful of stores, so a ROM can
+// be traced for millions of instructions at close to full speed, unlike the debug string.  The writer falls behind only
+// if the disk can't keep up, and then the emulator waits for it rather than leaving holes in the trace.
+//
+// The file is a Chip8TraceHeader followed by packed Chip8TraceRecords in host byte order, so a reader can map it and
+// index records directly.  Record n is the (header.firstInstruction + n)th instruction the machine executed.  While
+// tracing, every dispatch engine runs as TABLE; see Chip8Machine.trace.
+
+#define CHIP8_TRACE_MAGIC 0x52543843 // "C8TR", reads differently on a host of the other byte order
+#define CHIP8_TRACE_VERSION 2
+#define CHIP8_TRACE_CAPACITY (1 << 20) // Records the ring holds by default (16 MB)
+#define CHIP8_TRACE_CHUNK 4096         // Records the writer waits for before writing, unless the trace is ending
+#define CHIP8_TRACE_NO_REGISTER 0xFF   // Chip8TraceRecord.reg of an instruction that writes no Vx
+
+// How chip8Disassemble() reads the instructions whose meaning depends on the variant and quirks
+#define CHIP8_DISASSEMBLE_SHIFT_QUIRK 0x1 // 8xy6 and 8xyE shift Vx itself (Chip8Machine.shiftQuirkMode)
+#define CHIP8_DISASSEMBLE_JUMP_QUIRK 0x2  // Bxnn jumps to xnn + Vx (Chip8Machine.jumpQuirkMode)
+#define CHIP8_DISASSEMBLE_BIG_SPRITES 0x4 // Dxy0 draws a 16x16 sprite (SUPER-CHIP and XO-CHIP)
+
+// State after one instruction
+typedef struct Chip8TraceRecord
+{
+    uint16_t pc;     // Address the instruction was fetched from
+    uint16_t opcode; // The instruction
+    uint16_t i;      // I after it ran
+    uint8_t reg;     // x of an instruction that writes Vx, or CHIP8_TRACE_NO_REGISTER.  Fx65 writes V0 to Vx.
+    uint8_t value;   // Vx after it ran
+    uint8_t vf;      // VF after it ran
+    uint8_t dt;      // Delay timer
+    uint8_t st;      // Sound timer
+    uint8_t sp;      // Stack pointer
+    uint32_t frame;  // Low 32 bits of Chip8Machine.frameCount when it ran
+} Chip8TraceRecord;
+
+// Start of a trace file
+typedef struct Chip8TraceHeader
+{
+    uint32_t magic;            // CHIP8_TRACE_MAGIC
+    uint32_t version;          // CHIP8_TRACE_VERSION
+    uint32_t recordSize;       // sizeof(Chip8TraceRecord)
+    uint32_t disassembly;      // CHIP8_DISASSEMBLE_ flags of the machine traced
+    uint64_t records;          // Records in the file, 0 until the trace is finished.  Use the file size if it is 0.
+    uint64_t firstInstruction; // Chip8Machine.instructionCount when tracing started
+} Chip8TraceHeader;
+
+typedef struct Chip8Trace
+{
+    Chip8TraceRecord* records;            // Ring of records, writer.capacity long
+    char filename[CHIP8_STATE_PATH_SIZE]; // File traces are written to
+    uint64_t firstInstruction;            // Chip8Machine.instructionCount when the current trace began
+    uint32_t disassembly;                 // chip8GetDisassemblyFlags() of the machine traced
+    uint64_t written;                     // Records written to the current file, by the writer thread
+    Chip8Writer writer;                   // Takes the records to the file.  writer.failed is set if some were lost.
+
+    // Only used by the emulator thread
+    bool active;         // True between chip8TraceBegin() and chip8TraceEnd()
+    uint32_t headLocal;  // Records appended, published to the writer at the end of every batch of instructions
+    uint32_t tailCached; // Last value of writer.tail seen
+} Chip8Trace;
+
+// Allocates a ring of capacity records (rounded up to a power of two) and starts the writer thread.  Traces go to
+// filename.  Returns false if the memory or the thread could not be had.
+bool chip8TraceInit(Chip8Trace* trace, const char* filename, uint32_t capacity);
+
+// Finishes the current trace, if any, stops the writer thread and frees the ring
+void chip8TraceDestroy(Chip8Trace* trace);
+
+// Starts a new trace file, replacing the last one, and starts recording instructions into it.  Waits for the
+// previous trace to be finished if it still is being written.  Emulator thread only.  Returns false if the file
+// can't be created.
+bool chip8TraceBegin(Chip8Trace* trace, const Chip8Machine* m);
+
+// Stops recording.  The writer finishes the file in the background.  Emulator thread only.
+void chip8TraceEnd(Chip8Trace* trace);
+
+// Hands the records appended since the last call to the writer.  Called by the dispatch loop after every batch.
+void chip8TracePublish(Chip8Trace* trace);
+
+// Waits for the writer to make room in a full ring.  Called by the dispatch loop.
+void chip8TraceWaitForSpace(Chip8Trace* trace);
+
+// Starts or stops tracing when Chip8Machine.tracing has changed.  Called by chip8Run() between frames.
+void chip8ProcessTraceRequest(Chip8Machine* m);
+
+// Writes a description of an instruction, e.g. "SKIP IF V3 == 1F", to buffer, reading it as the CHIP8_DISASSEMBLE_
+// flags say.  The tools and the register view all describe instructions with it.
+void chip8Disassemble(uint16_t instruction, uint32_t flags, char* buffer, uint32_t size);
+
+// Returns the CHIP8_DISASSEMBLE_ flags matching the machine's variant and quirks
+uint32_t chip8GetDisassemblyFlags(const Chip8Machine* m);
+
+#endif
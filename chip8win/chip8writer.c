@@ -0,0 +1,152 @@
+#include "chip8writer.h"
+
+#include <string.h>
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void chip8WriterThread(void* context)
+{
+    Chip8Writer* writer = context;
+
+    platformMutexLock(&writer->mutex);
+    while (true)
+    {
+        // Items are written in chunks, except for the last ones of a file
+        while (writer->running &&
+               !(writer->open && (writer->ending || writer->head - writer->tail >= writer->chunk)))
+            platformConditionWait(&writer->condition, &writer->mutex);
+        if (!writer->open) break;
+
+        // chip8WriterEnd() publishes the last items before it sets ending, so they are all in head by now.  A file
+        // still open when the writer is stopped is finished too.
+        bool finish = writer->ending || !writer->running;
+        uint32_t head = platformAtomicLoad(&writer->head);
+        bool ok = !writer->failed;
+        platformMutexUnlock(&writer->mutex);
+
+        ok = ok && writer->write(writer->owner, writer->file, writer->tail, head);
+        if (finish)
+        {
+            ok = writer->finish(writer->owner, writer->file, ok);
+            ok = fclose(writer->file) == 0 && ok;
+        }
+
+        platformMutexLock(&writer->mutex);
+        writer->failed = !ok;
+        platformAtomicExchange(&writer->tail, head);
+        if (finish)
+        {
+            writer->file = NULL;
+            writer->open = false;
+            writer->ending = false;
+        }
+
+        // Wakes up the producer if it is waiting for room in the ring or for the file to be closed
+        platformConditionSignal(&writer->condition);
+    }
+    platformMutexUnlock(&writer->mutex);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool chip8WriterInit(Chip8Writer* writer, uint32_t capacity, uint32_t chunk, Chip8WriterWrite write,
+                     Chip8WriterFinish finish, void* owner)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->capacity = capacity;
+    writer->chunk = chunk;
+    writer->write = write;
+    writer->finish = finish;
+    writer->owner = owner;
+
+    platformMutexInit(&writer->mutex);
+    platformConditionInit(&writer->condition);
+    writer->running = true;
+    if (platformThreadStart(&writer->thread, chip8WriterThread, writer)) return true;
+
+    platformConditionDestroy(&writer->condition);
+    platformMutexDestroy(&writer->mutex);
+    return false;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8WriterDestroy(Chip8Writer* writer)
+{
+    // The writer finishes the current file before it exits
+    platformMutexLock(&writer->mutex);
+    writer->running = false;
+    platformConditionSignal(&writer->condition);
+    platformMutexUnlock(&writer->mutex);
+
+    platformThreadJoin(&writer->thread);
+    platformConditionDestroy(&writer->condition);
+    platformMutexDestroy(&writer->mutex);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8WriterWaitUntilClosed(Chip8Writer* writer)
+{
+    platformMutexLock(&writer->mutex);
+    while (writer->open) platformConditionWait(&writer->condition, &writer->mutex);
+    platformMutexUnlock(&writer->mutex);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8WriterOpen(Chip8Writer* writer, FILE* file)
+{
+    // The writer thread is idle until open is set, so nothing else needs the lock
+    writer->file = file;
+    writer->head = writer->tail = 0;
+    writer->signaled = 0;
+    writer->failed = false;
+
+    platformMutexLock(&writer->mutex);
+    writer->open = true;
+    platformMutexUnlock(&writer->mutex);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8WriterPublish(Chip8Writer* writer, uint32_t head)
+{
+    platformAtomicExchange(&writer->head, head);
+
+    // Only wake the writer up once it has a whole chunk to write, that keeps the locking out of the common case
+    if (head - writer->signaled < writer->chunk) return;
+    writer->signaled = head;
+    platformMutexLock(&writer->mutex);
+    platformConditionSignal(&writer->condition);
+    platformMutexUnlock(&writer->mutex);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8WriterEnd(Chip8Writer* writer, uint32_t head)
+{
+    platformAtomicExchange(&writer->head, head);
+
+    platformMutexLock(&writer->mutex);
+    writer->ending = true;
+    platformConditionSignal(&writer->condition);
+    platformMutexUnlock(&writer->mutex);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8WriterWaitForSpace(Chip8Writer* writer, uint32_t head)
+{
+    // The ring is full, so the writer has more than a chunk to write.  Make sure it knows, then wait for it.
+    platformAtomicExchange(&writer->head, head);
+    writer->signaled = head;
+    platformMutexLock(&writer->mutex);
+    platformConditionSignal(&writer->condition);
+    while (head - writer->tail >= writer->capacity) platformConditionWait(&writer->condition, &writer->mutex);
+    platformMutexUnlock(&writer->mutex);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void chip8WriterRelease(Chip8Writer* writer, uint32_t tail) { platformAtomicExchange(&writer->tail, tail); }
@@ -0,0 +1,81 @@
+#ifndef CHIP_8_WRITER_H_
+#define CHIP_8_WRITER_H_
+
+#include "platform.h"
+
+#include <stdio.h>
+
+// Background file writer shared by the instruction trace and the frame capture.  One producer, the emulator thread,
+// fills a ring of items that belongs to the owner and publishes how far it got; a writer thread takes the items and
+// hands them to the owner's write function, so the producer never waits for the disk.  Slots are tracked with two
+// free-running counts rather than a lock: the producer only writes head and the writer only writes tail.
+//
+// The writer is only woken up once a chunk of items is waiting, or when the file is ending, so publishing usually
+// takes no lock at all.  What to do when the ring is full is up to the owner: the trace waits for room with
+// chip8WriterWaitForSpace(), the capture drops the item.
+//
+// A file goes through chip8WriterOpen(), any number of chip8WriterPublish() and chip8WriterEnd(), after which the
+// writer writes what is left, has the owner finish the file and closes it on its own.
+
+// Writes the items from first to last - 1, indexed modulo the capacity, to the file.  Returns false if it couldn't.
+// Called on the writer thread without the lock.
+typedef bool (*Chip8WriterWrite)(void* owner, FILE* file, uint32_t first, uint32_t last);
+
+// Completes the file once every item is written, ok saying whether they all were.  Returns whether the file is
+// complete.  Called on the writer thread without the lock, before the file is closed.
+typedef bool (*Chip8WriterFinish)(void* owner, FILE* file, bool ok);
+
+typedef struct Chip8Writer
+{
+    uint32_t capacity;        // Items the owner's ring holds, a power of two
+    uint32_t chunk;           // Items the writer waits for before it writes, unless the file is ending
+    Chip8WriterWrite write;   // Writes the owner's items
+    Chip8WriterFinish finish; // Completes the owner's file
+    void* owner;              // Passed to write and finish
+
+    // Free-running counts of items published and written, the difference is what the ring holds
+    volatile uint32_t head; // Items published by the producer
+    volatile uint32_t tail; // Items the writer thread is done with, whose slots can be reused
+
+    // Only used by the producer
+    uint32_t signaled; // head when the writer was last woken up
+
+    // Protected by mutex
+    bool open;    // A file is being written: set by chip8WriterOpen(), cleared when the writer has closed it
+    bool ending;  // Set by chip8WriterEnd(): the writer finishes the file once it has written every item
+    bool running; // Cleared to make the writer thread exit
+    bool failed;  // Writing the current file failed.  Items are still taken, but lost.
+    FILE* file;   // Current file.  Only touched by the writer while open.
+    PlatformMutex mutex;
+    PlatformCondition condition; // Signaled when a chunk is published, items are written or the file state changes
+    PlatformThread thread;       // Writer thread
+} Chip8Writer;
+
+// Starts the writer thread for a ring of capacity items, a power of two larger than chunk unless the owner waits for
+// space.  Returns false if the thread could not be started.
+bool chip8WriterInit(Chip8Writer* writer, uint32_t capacity, uint32_t chunk, Chip8WriterWrite write,
+                     Chip8WriterFinish finish, void* owner);
+
+// Stops the writer thread once it has finished the current file, if any
+void chip8WriterDestroy(Chip8Writer* writer);
+
+// Waits until the last file is finished and closed
+void chip8WriterWaitUntilClosed(Chip8Writer* writer);
+
+// Starts writing a new file, with an empty ring.  The last one must be closed.  Producer only.
+void chip8WriterOpen(Chip8Writer* writer, FILE* file);
+
+// Publishes the items before head, waking the writer up if a chunk of them is waiting.  Producer only.
+void chip8WriterPublish(Chip8Writer* writer, uint32_t head);
+
+// Publishes the items before head and has the writer finish the file in the background.  Producer only.
+void chip8WriterEnd(Chip8Writer* writer, uint32_t head);
+
+// Publishes the items before head and waits until the ring has room for another.  Producer only.
+void chip8WriterWaitForSpace(Chip8Writer* writer, uint32_t head);
+
+// Hands the slots of the items before tail back to the producer before the write they are part of is over, for
+// items that take long to write but are copied out first.  Called by the write function.
+void chip8WriterRelease(Chip8Writer* writer, uint32_t tail);
+
+#endif
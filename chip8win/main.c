@@ -2,6 +2,7 @@
 #include "chip8.h"
 #include "resource.h"
 
+#include <dwmapi.h>
 #include <stdio.h>
 #include <time.h>
 
@@ -14,7 +15,7 @@ int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
 {
     _redrawScreen = true;
     memset(_toastMsg, 0, sizeof(_toastMsg));
-    QueryPerformanceCounter(&_toastMsgTick);
+    _toastMsgTick = platformGetTick();
 
     _showRegisters = false;
 
@@ -30,12 +31,52 @@ int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
 
     // Create the window.  Sizes are magic numbers, which is not optimal.  It would be nice if there was a way to
     // programmatically adjust window size either here or when drawing the screen.
-    _hWnd = CreateWindowW(wc.lpszClassName, L"CHIP-8 Emulator", WS_OVERLAPPEDWINDOW | WS_VISIBLE, 100, 100,
-                          CHIP8_SCREEN_WIDTH * DEFAULT_PIXEL_SIZE + 18, CHIP8_SCREEN_HEIGHT * DEFAULT_PIXEL_SIZE + 60,
+    _hWnd = CreateWindowW(wc.lpszClassName, WINDOW_TITLE, WS_OVERLAPPEDWINDOW | WS_VISIBLE, 100, 100,
+                          CHIP8_LORES_WIDTH * DEFAULT_PIXEL_SIZE + 18, CHIP8_LORES_HEIGHT * DEFAULT_PIXEL_SIZE + 60,
                           NULL, NULL, hInstance, NULL);
 
-    chip8InitSound(hInstance, IDR_WAVE1);
-    chip8Init();
+    chip8Init(&_chip8);
+
+    // Same colors as the rectangles the screen used to be drawn with, and a grid in place of their outlines
+    chip8RendererInit(&_renderer);
+    _renderer.foreground = 0xFF808080;
+    _renderer.background = 0xFF181818;
+    _renderer.effects = CHIP8_RENDER_GRID;
+
+    // The tone is synthesized by the core and played on the default sound device.  Without one the emulator is silent.
+    if (chip8AudioOpen(&_audio, &chip8AudioDevice, NULL)) _chip8.audio = &_audio;
+
+    // Every frame is recorded so gameplay can be rewound.  Without the memory for it the emulator just can't rewind.
+    if (chip8RewindInit(&_rewind, REWIND_SECONDS, REWIND_BUDGET, REWIND_KEYFRAME_INTERVAL)) _chip8.rewind = &_rewind;
+
+    // The trace ring and its writer thread are set up once, F8 only starts and stops writing
+    if (chip8TraceInit(&_trace, TRACE_FILENAME, CHIP8_TRACE_CAPACITY)) _chip8.trace = &_trace;
+
+    // So are the capture ring and its writer, F11 starts and stops a video drawn in the same colors as the window
+    if (chip8CaptureInit(&_capture, CAPTURE_FILENAME, CHIP8_CAPTURE_CAPACITY, CHIP8_CAPTURE_SCALE))
+    {
+        _capture.colors[0] = _renderer.background;
+        _capture.colors[1] = _renderer.foreground;
+        _capture.colors[2] = _renderer.foreground2;
+        _capture.colors[3] = _renderer.foregroundBoth;
+        _chip8.capture = &_capture;
+    }
+
+    // F5 records a movie from wherever the machine is, F6 plays the last one back
+    chip8MovieInit(&_movie, MOVIE_FILENAME);
+    _chip8.movie = &_movie;
+
+    // F7 starts and stops profiling the guest code
+    chip8ProfileInit(&_profile, PROFILE_FILENAME);
+    _chip8.profile = &_profile;
+
+    // Save states go to disk on their own thread, and the machine is autosaved every so often
+    if (chip8StateWriterStart(&_stateWriter))
+    {
+        _chip8.stateWriter = &_stateWriter;
+        _chip8.autosaveInterval = AUTOSAVE_INTERVAL_S;
+        strcpy_s(_chip8.autosavePath, sizeof(_chip8.autosavePath), AUTOSAVE_FILENAME);
+    }
 
     HMENU CreateMenu();
 
@@ -62,13 +103,26 @@ int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
     }
 
     _running = false;
+    if (_chip8.stateWriter != NULL)
+    {
+        // Finish writing any state saved just before exiting
+        _chip8.autosaveInterval = 0;
+        chip8StateWriterStop(&_stateWriter);
+    }
+    chip8Destroy(&_chip8);
+    if (_chip8.rewind != NULL) chip8RewindDestroy(&_rewind);
+    if (_chip8.trace != NULL) chip8TraceDestroy(&_trace);
+    if (_chip8.capture != NULL) chip8CaptureDestroy(&_capture);
+    if (_chip8.audio != NULL) chip8AudioClose(&_audio);
+    chip8RendererDestroy(&_renderer);
+    chip8MovieDestroy(&_movie);
 
     return (int)msg.wParam;
 }
 
 // ********************************************************************************************************************
 // ********************************************************************************************************************
-void threadChip8() { chip8Run(); }
+void threadChip8() { chip8Run(&_chip8); }
 
 // ********************************************************************************************************************
 // ********************************************************************************************************************
@@ -79,8 +133,29 @@ void threadGuiRefresh()
     Sleep(200);
     while (_running)
     {
-        Sleep(25); // ~40fps  TODO: Make this configurable?
-        InvalidateRect(_hWnd, NULL, TRUE);
+        // Sleep until the core publishes a frame.  A static screen publishes nothing, so nothing is presented, but the
+        // registers change constantly and are refreshed at least every PRESENT_IDLE_MS.
+        chip8WaitForScreen(&_chip8, _showRegisters ? PRESENT_IDLE_MS : PRESENT_STATIC_MS);
+
+        // In turbo mode the title bar keeps reporting the speed reached, refreshed once a second.  Toasts are only
+        // drawn over the register view, the title bar is there whether or not it is shown.
+        if (chip8UpdateSpeedMeter(&_chip8, &_speedMeter, 1.0)) updateWindowTitle();
+        chip8UpdatePresentMeter(&_presentMeter, 1.0);
+
+        if (!_showRegisters && !_redrawScreen && !chip8HasNewScreen(&_chip8)) continue;
+
+        // Paint now rather than whenever the message loop gets to it, then wait for the compositor to put the frame on
+        // the display.  That keeps to one present per refresh even when the core publishes faster, as in turbo mode,
+        // and the frames published in between are merged into the next one by their damage.  Without composition
+        // there is no refresh to wait for and a 60 Hz one is assumed.
+        uint64_t start = platformGetTick();
+        RedrawWindow(_hWnd, NULL, NULL, RDW_INVALIDATE | RDW_UPDATENOW);
+        if (FAILED(DwmFlush()))
+        {
+            double spent = (platformGetTick() - start) * 1000.0 / platformGetTickFrequency();
+            if (spent < 1000.0 / 60) Sleep((DWORD)(1000.0 / 60 - spent));
+        }
+        chip8RecordPresent(&_chip8, &_presentMeter, platformGetTick(), _presentedKeyChanges);
     }
 }
 
@@ -112,7 +187,8 @@ LRESULT CALLBACK handleWin32Message(HWND hWnd, UINT msg, WPARAM wParam, LPARAM l
             MessageBoxA(hWnd,
                         "Emulator input:\n   Numpad 0-9: [0-9]\n   A-F: [A-F]\n\nEmulator configuration:\n   "
                         "Increase emulation speed: [NUMPAD +]\n   Decrease emulation speed: [NUMPAD -]\n   Single-step "
-                        "instruction: [SPACEBAR]\n   Exit single-step mode: [ENTER]",
+                        "instruction: [SPACEBAR]\n   Exit single-step mode: [ENTER]\n   Turbo mode on/off: [TAB]\n   "
+                        "Save state: [SHIFT + F1-F4]\n   Load state: [F1-F4]\n   Load autosave: [F9]",
                         "Help I'm stuck in an emulator!", MB_OK);
         }
 
@@ -159,7 +235,7 @@ LRESULT CALLBACK handleWin32Message(HWND hWnd, UINT msg, WPARAM wParam, LPARAM l
     case WM_DESTROY:
     {
         _running = false;
-        chip8Shutdown();
+        chip8Shutdown(&_chip8);
         PostQuitMessage(0);
         return 0;
     }
@@ -244,53 +320,61 @@ void handle_WM_PAINT(HWND hWnd)
         headerOffset = REGISTER_DISPLAY_HEIGHT_PX;
     }
 
-    // Draw the pixels of the screen
-    HBRUSH hBrushBg = CreateSolidBrush(RGB(24, 24, 24));
-    HBRUSH hBrushFg = CreateSolidBrush(RGB(128, 128, 128));
-
-    // Get a copy of the screen.  Static copy is used to compare to the previous frame so we can be smart about
-    // drawing rectangles and not have to draw the entire screen every time.
-    static bool prevScreen[CHIP8_SCREEN_WIDTH][CHIP8_SCREEN_HEIGHT] = {0};
-    bool screen[CHIP8_SCREEN_WIDTH][CHIP8_SCREEN_HEIGHT];
-    chip8GetScreen(&screen);
-
-    // Recalculate pixel size depending on window dimensions so that the screen always takes up as big a region as it
-    // can while maintaining the proper aspect ratio.  If screen is too small, a minimum is enforced.
-    int pxSize = DEFAULT_PIXEL_SIZE;
+    // The screen takes up as big a region as it can while keeping its 2:1 aspect ratio, at any scale, down to a
+    // minimum pixel size
     RECT rect;
-    GetClientRect(WindowFromDC(hDC), &rect);
-    double aspectRatio = (rect.right * 1.0) / (rect.bottom - headerOffset);
-    if (aspectRatio <= 2.0)
+    GetClientRect(hWnd, &rect);
+    uint32_t width = rect.right > 0 ? rect.right : 0;
+    uint32_t height = rect.bottom > (LONG)headerOffset ? rect.bottom - headerOffset : 0;
+    if (width > height * 2)
+        width = height * 2;
+    else
+        height = width / 2;
+    if (width < CHIP8_LORES_WIDTH * MIN_PIXEL_SIZE)
     {
-        // Aspect ratio < 2 means width is smaller than twice height, so width is limiting factor
-        // NOTE: If exactly 2, both calculations will give same result, doesn't matter which branch we take
-        pxSize = (rect.right * 1.0) / CHIP8_SCREEN_WIDTH;
+        width = CHIP8_LORES_WIDTH * MIN_PIXEL_SIZE;
+        height = CHIP8_LORES_HEIGHT * MIN_PIXEL_SIZE;
     }
-    else
+    if (width != _renderer.width || height != _renderer.height)
     {
-        // Aspect ratio > 2 means width is larger than twice height, so height is limiting aspect
-        pxSize = ((rect.bottom - headerOffset) * 1.0) / CHIP8_SCREEN_HEIGHT;
+        chip8RendererResize(&_renderer, width, height);
+        _redrawScreen = true;
     }
-    if (pxSize < MIN_PIXEL_SIZE) pxSize = MIN_PIXEL_SIZE;
 
-    for (int y = 0; y < CHIP8_SCREEN_HEIGHT; y++)
+    // Get a copy of the screen along with the rows the core says changed.  Only those rows are expanded again.  A
+    // full redraw, resizes included, needs the screen even when nothing changed, so this comes after the resize.
+    Chip8Screen screen;
+    Chip8Damage damage = {0};
+    if (chip8GetScreenDamage(&_chip8, &screen, &damage))
+        _presentedKeyChanges = damage.keyChanges;
+    else if (_redrawScreen)
+        chip8GetScreen(&_chip8, &screen);
+
+    // The renderer redraws the whole screen when the resolution changes, so the whole of it is blitted too
+    uint64_t rows = _redrawScreen ? ~0ull : damage.rows;
+    _redrawScreen = false;
+    if (rows != 0 && (screen.width != _renderer.screenWidth || screen.height != _renderer.screenHeight)) rows = ~0ull;
+    if (rows != 0 && _renderer.pixels != NULL)
     {
-        for (int x = 0; x < CHIP8_SCREEN_WIDTH; x++)
-        {
-            SelectObject(hDC, hBrushFg);
-            if (screen[x][y] == false) SelectObject(hDC, hBrushBg);
-
-            if (screen[x][y] != prevScreen[x][y] || _redrawScreen)
-            {
-                Rectangle(hDC, x * pxSize, y * pxSize + headerOffset, x * pxSize + pxSize,
-                          y * pxSize + pxSize + headerOffset);
-            }
-        }
+        chip8RenderScreen(&_renderer, &screen, rows);
+
+        // One blit of the band of output rows from the first emulated row redrawn to the last
+        uint32_t first = 0, last = screen.height - 1;
+        while ((rows & (1ull << first)) == 0) first++;
+        while ((rows & (1ull << last)) == 0) last--;
+        uint32_t top = _renderer.rowStart[first];
+        uint32_t bandHeight = _renderer.rowStart[last + 1] - top;
+
+        BITMAPINFO bmi = {0};
+        bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+        bmi.bmiHeader.biWidth = _renderer.width;
+        bmi.bmiHeader.biHeight = -(LONG)bandHeight; // Top-down, like the renderer's buffer
+        bmi.bmiHeader.biPlanes = 1;
+        bmi.bmiHeader.biBitCount = 32;
+        bmi.bmiHeader.biCompression = BI_RGB;
+        SetDIBitsToDevice(hDC, 0, headerOffset + top, _renderer.width, bandHeight, 0, 0, 0, bandHeight,
+                          _renderer.pixels + (size_t)top * _renderer.width, &bmi, DIB_RGB_COLORS);
     }
-    memcpy(prevScreen, screen, sizeof(screen));
-    _redrawScreen = false;
-    DeleteObject(hBrushBg);
-    DeleteObject(hBrushFg);
 
     // Draw the registers if necessary
     if (_showRegisters)
@@ -320,11 +404,69 @@ void handle_WM_PAINT(HWND hWnd)
         SetTextColor(hdcMem, RGB(0, 255, 0));
 
         // Print the debug msg to screen
-        // TODO: Come up with a more elegant way to do this?  Maybe wrap the mutex in an accessor function or have
-        // a method that returns a copy of the message for us to use, to keep the mutex wrangling internal to chip8
-        WaitForSingleObject(_chip8_Mutex, INFINITE);
-        DrawTextA(hdcMem, _chip8_Msg, -1, &rc, DT_LEFT);
-        ReleaseMutex(_chip8_Mutex);
+        static char msg[CHIP8_STR_SIZE];
+        chip8GetDebugString(&_chip8, msg, sizeof(msg));
+        DrawTextA(hdcMem, msg, -1, &rc, DT_LEFT);
+
+        // Measured speed in the top right corner
+        char speed[64];
+        sprintf_s(speed, sizeof(speed), "%s%.2f MIPS  %.1f fps", _chip8.realTime ? "" : "TURBO  ", _speedMeter.mips,
+                  _speedMeter.fps);
+        DrawTextA(hdcMem, speed, -1, &rc, DT_RIGHT);
+
+        // Presentation pacing and input latency at the bottom
+        char present[96];
+        sprintf_s(present, sizeof(present), "\n\n\nPresent %.1f fps  %.2f +/- %.2f ms  latency %.1f/%.1f ms",
+                  _presentMeter.fps, _presentMeter.intervalMs, _presentMeter.jitterMs, _presentMeter.latencyMs,
+                  _presentMeter.latencyMaxMs);
+        DrawTextA(hdcMem, present, -1, &rc, DT_RIGHT);
+
+        // Rewind memory use and recording cost below it
+        if (_chip8.rewind != NULL)
+        {
+            Chip8RewindStats stats;
+            chip8RewindGetStats(&_rewind, &stats);
+            char rewind[96];
+            sprintf_s(rewind, sizeof(rewind), "\n%sRewind %.1fs  %u/%u KB  %.2f us/frame",
+                      _chip8.rewinding ? "<< " : "", (double)stats.frames / CHIP8_FRAME_RATE, stats.bytesUsed / 1024,
+                      stats.budget / 1024, stats.captureMicros);
+            DrawTextA(hdcMem, rewind, -1, &rc, DT_RIGHT);
+        }
+
+        // Movie being recorded or played below that
+        uint32_t movieMode = _movie.mode;
+        if (movieMode != CHIP8_MOVIE_IDLE)
+        {
+            char movie[64];
+            if (movieMode == CHIP8_MOVIE_RECORDING)
+                sprintf_s(movie, sizeof(movie), "\n\nREC %.1fs", (double)_movie.frames / CHIP8_FRAME_RATE);
+            else
+                sprintf_s(movie, sizeof(movie), "\n\nPLAY %.1f/%.1fs",
+                          (double)(_chip8.frameCount - _movie.startFrame) / CHIP8_FRAME_RATE,
+                          (double)_movie.frames / CHIP8_FRAME_RATE);
+            DrawTextA(hdcMem, movie, -1, &rc, DT_RIGHT);
+        }
+
+        // Video being captured at the bottom
+        if (_chip8.capture != NULL && _capture.active)
+        {
+            char capture[96];
+            sprintf_s(capture, sizeof(capture), "\n\n\n\nCAP %.1fs  %llu screens  %llu dropped",
+                      (double)_capture.frame / CHIP8_FRAME_RATE, (unsigned long long)_capture.captured,
+                      (unsigned long long)_capture.dropped);
+            DrawTextA(hdcMem, capture, -1, &rc, DT_RIGHT);
+        }
+
+        // Time the sound waits on the device queue under that, on top of the frame it is synthesized in
+        if (_chip8.audio != NULL)
+        {
+            double latencyMaxMs;
+            double latencyMs = chip8AudioGetLatencyMs(&_audio, &latencyMaxMs);
+            char audio[96];
+            sprintf_s(audio, sizeof(audio), "\n\n\n\n\nAudio %.1f/%.1f ms queued  %llu dropped", latencyMs,
+                      latencyMaxMs, (unsigned long long)_audio.dropped);
+            DrawTextA(hdcMem, audio, -1, &rc, DT_RIGHT);
+        }
 
         // Cleanup
         DeleteObject(hFont);
@@ -376,6 +518,8 @@ void handle_WM_CREATE(HWND hWnd)
     AppendMenuW(hFileMenu, MF_STRING, IDM_FILE_EXIT, L"&Exit");
 
     AppendMenuW(hViewMenu, MF_STRING, IDM_VIEW_REGISTERS, L"&Show registers");
+    AppendMenuW(hViewMenu, MF_STRING, IDM_VIEW_SCANLINES, L"Scan&lines");
+    AppendMenuW(hViewMenu, MF_STRING | MF_CHECKED, IDM_VIEW_GRID, L"&Grid");
 
     AppendMenuW(hMenubar, MF_POPUP, (UINT_PTR)hFileMenu, L"&File");
     AppendMenuW(hMenubar, MF_POPUP, (UINT_PTR)hViewMenu, L"&View");
@@ -399,61 +543,162 @@ void handle_WM_KEY(UINT msg, WPARAM wParam)
     case VK_NUMPAD6:
     case VK_NUMPAD7:
     case VK_NUMPAD8:
-    case VK_NUMPAD9: _chip8_Keyboard[wParam - VK_NUMPAD0] = value; break;
+    case VK_NUMPAD9: chip8SetKey(&_chip8, wParam - VK_NUMPAD0, value); break;
 
-    case 0x41: _chip8_Keyboard[0xA] = value; break;
-    case 0x42: _chip8_Keyboard[0xB] = value; break;
-    case 0x43: _chip8_Keyboard[0xC] = value; break;
-    case 0x44: _chip8_Keyboard[0xD] = value; break;
-    case 0x45: _chip8_Keyboard[0xE] = value; break;
-    case 0x46: _chip8_Keyboard[0xF] = value; break;
+    case 0x41: chip8SetKey(&_chip8, 0xA, value); break;
+    case 0x42: chip8SetKey(&_chip8, 0xB, value); break;
+    case 0x43: chip8SetKey(&_chip8, 0xC, value); break;
+    case 0x44: chip8SetKey(&_chip8, 0xD, value); break;
+    case 0x45: chip8SetKey(&_chip8, 0xE, value); break;
+    case 0x46: chip8SetKey(&_chip8, 0xF, value); break;
 
     case VK_RETURN:
     {
-        if (_chip8_StepMode)
+        if (_chip8.stepMode)
         {
-            _chip8_StepMode = false;
+            _chip8.stepMode = false;
             setToastMsg("Step mode disabled");
         }
         break;
     }
     case VK_SPACE:
     {
-        if (!_chip8_StepMode)
+        if (!_chip8.stepMode)
         {
             setToastMsg("Step mode enabled");
         }
-        _chip8_StepOnIt = true;
-        _chip8_StepMode = true;
+        _chip8.stepOnIt = true;
+        _chip8.stepMode = true;
+        break;
+    }
+
+    case VK_TAB:
+    {
+        // Turbo runs frames as fast as the host allows.  The debug string would cap the speed at a fraction of what the
+        // compiled engines reach, so it is only rebuilt in real time.  Held keys repeat, only the first press counts.
+        static bool tabDown = false;
+        if (value && !tabDown)
+        {
+            _chip8.realTime = !_chip8.realTime;
+            _chip8.debugString = _chip8.realTime;
+            setToastMsg(_chip8.realTime ? "Turbo mode disabled" : "Turbo mode enabled");
+        }
+        tabDown = value;
+        break;
+    }
+
+    case VK_BACK:
+    {
+        // Rewinds one frame per emulated frame for as long as the key is held
+        if (value && !_chip8.rewinding) setToastMsg(_chip8.rewind != NULL ? "Rewinding" : "Rewind not available");
+        _chip8.rewinding = value;
+        break;
+    }
+
+    case VK_F1:
+    case VK_F2:
+    case VK_F3:
+    case VK_F4:
+    {
+        if (!value) break;
+        if (GetKeyState(VK_SHIFT) < 0)
+            saveStateSlot(wParam - VK_F1);
+        else
+            loadStateSlot(wParam - VK_F1);
+        break;
+    }
+    case VK_F5:
+    case VK_F6:
+    {
+        // The emulator thread starts and stops the movie between frames, and writes a recording out as it stops.
+        // Pressing the key of what is going on stops it.
+        if (!value) break;
+        uint32_t mode = wParam == VK_F5 ? CHIP8_MOVIE_RECORDING : CHIP8_MOVIE_PLAYING;
+        if (_chip8.movieMode == mode) mode = CHIP8_MOVIE_IDLE;
+        platformAtomicExchange(&_chip8.movieMode, mode);
+        if (mode == CHIP8_MOVIE_RECORDING)
+            setToastMsg("Recording movie");
+        else if (mode == CHIP8_MOVIE_PLAYING)
+            setToastMsg("Playing %s", MOVIE_FILENAME);
+        else
+            setToastMsg(wParam == VK_F5 ? "Movie written to %s" : "Movie stopped", MOVIE_FILENAME);
+        break;
+    }
+    case VK_F7:
+    {
+        // The emulator thread starts profiling between frames, and writes the profile out when it stops
+        if (!value) break;
+        _chip8.profiling = !_chip8.profiling;
+        setToastMsg(_chip8.profiling ? "Profiling" : "Profile written to %s", PROFILE_FILENAME);
+        break;
+    }
+    case VK_F8:
+    {
+        // The emulator thread opens and closes the file between frames
+        if (!value) break;
+        if (_chip8.trace == NULL)
+        {
+            setToastMsg("Tracing not available");
+            break;
+        }
+        _chip8.tracing = !_chip8.tracing;
+        setToastMsg(_chip8.tracing ? "Tracing to %s" : "Trace written to %s", TRACE_FILENAME);
+        break;
+    }
+    case VK_F9:
+    {
+        if (!value) break;
+        if (chip8StateRequestPending(&_chip8))
+            setToastMsg("Busy, try again");
+        else if (!chip8ReadStateFile(AUTOSAVE_FILENAME, _autosaveState))
+            setToastMsg("No autosave");
+        else if (chip8RequestLoadState(&_chip8, _autosaveState))
+            setToastMsg("Autosave loaded");
+        break;
+    }
+    case VK_F11:
+    {
+        // The emulator thread starts the video between frames, and its writer finishes the file when it stops
+        if (!value) break;
+        if (_chip8.capture == NULL)
+        {
+            setToastMsg("Capture not available");
+            break;
+        }
+        _chip8.capturing = !_chip8.capturing;
+        setToastMsg(_chip8.capturing ? "Capturing to %s" : "Video written to %s", CAPTURE_FILENAME);
         break;
     }
 
     case VK_ADD:
     {
 
-        if (_chip8_ClockSpeed == 1) // Minimum speed is 1Hz
-            _chip8_ClockSpeed = 100;
-        else if (_chip8_ClockSpeed < 1000) // Below 1000, increase by 100
-            _chip8_ClockSpeed += 100;
-        else if (_chip8_ClockSpeed < 50000) // Above 1000, increase by 100 to a max of 50000
-            _chip8_ClockSpeed += 1000;
+        if (_chip8.clockSpeed == 1) // Minimum speed is 1Hz
+            _chip8.clockSpeed = 100;
+        else if (_chip8.clockSpeed < 1000) // Below 1000, increase by 100
+            _chip8.clockSpeed += 100;
+        else if (_chip8.clockSpeed < 50000) // Above 1000, increase by 100 to a max of 50000
+            _chip8.clockSpeed += 1000;
 
-        setToastMsg("Emulation speed: %i Hz", _chip8_ClockSpeed);
+        setToastMsg("Emulation speed: %i Hz", _chip8.clockSpeed);
         break;
     }
     case VK_SUBTRACT:
     {
-        if (_chip8_ClockSpeed > 1000) // Above 1000, decrease by 1000
-            _chip8_ClockSpeed -= 1000;
-        else if (_chip8_ClockSpeed > 100) // Below 1000, decrease by 100
-            _chip8_ClockSpeed -= 100;
-        else if (_chip8_ClockSpeed == 100) // Minimum speed is 1 Hz
-            _chip8_ClockSpeed = 1;
-
-        setToastMsg("Emulation speed: %i Hz", _chip8_ClockSpeed);
+        if (_chip8.clockSpeed > 1000) // Above 1000, decrease by 1000
+            _chip8.clockSpeed -= 1000;
+        else if (_chip8.clockSpeed > 100) // Below 1000, decrease by 100
+            _chip8.clockSpeed -= 100;
+        else if (_chip8.clockSpeed == 100) // Minimum speed is 1 Hz
+            _chip8.clockSpeed = 1;
+
+        setToastMsg("Emulation speed: %i Hz", _chip8.clockSpeed);
         break;
     }
     }
+
+    // The emulator thread may be waiting for one of the flags set above to change
+    chip8Wake(&_chip8);
 }
 
 // ********************************************************************************************************************
@@ -464,32 +709,35 @@ void handle_WM_COMMAND(HWND hWnd, WPARAM wParam, bool* eraseBkgHandled)
     {
     case IDM_FILE_RESET:
     {
-        chip8Reset();
+        chip8Reset(&_chip8);
         break;
     }
     case IDM_FILE_LOAD:
     {
-        WCHAR szFile[260];
+        char szFile[260];
         memset(szFile, 0, sizeof(szFile));
 
-        OPENFILENAME ofn;
+        OPENFILENAMEA ofn;
         memset(&ofn, 0, sizeof(ofn));
         ofn.lStructSize = sizeof(ofn);
         ofn.hwndOwner = hWnd;
-        ofn.lpstrFile = (LPWSTR)szFile;
+        ofn.lpstrFile = szFile;
         ofn.nMaxFile = sizeof(szFile);
-        ofn.lpstrFilter = TEXT("All\0*.*\0");
+        ofn.lpstrFilter = "All\0*.*\0CHIP-8\0*.ch8\0SUPER-CHIP\0*.sc8\0XO-CHIP\0*.xo8\0";
         ofn.nFilterIndex = 1;
         ofn.lpstrFileTitle = NULL;
         ofn.nMaxFileTitle = 0;
         ofn.lpstrInitialDir = NULL;
         ofn.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST;
 
-        if (GetOpenFileName(&ofn) == TRUE)
+        if (GetOpenFileNameA(&ofn) == TRUE)
         {
             SetCurrentDirectory((LPCWSTR)_startDirectory);
-            chip8LoadRom(szFile);
-            chip8Reset();
+
+            // The extension picks the variant, which the reset below switches to
+            _chip8.variant = chip8GetRomVariant(szFile);
+            chip8LoadRom(&_chip8, szFile);
+            chip8Reset(&_chip8);
         }
         break;
     }
@@ -509,6 +757,17 @@ void handle_WM_COMMAND(HWND hWnd, WPARAM wParam, bool* eraseBkgHandled)
                      lpRect.bottom - lpRect.top + offset, SWP_NOMOVE);
         break;
     }
+    case IDM_VIEW_SCANLINES:
+    case IDM_VIEW_GRID:
+    {
+        // Toggle the effect and its check mark, then expand the whole screen again with it
+        uint32_t effect = LOWORD(wParam) == IDM_VIEW_GRID ? CHIP8_RENDER_GRID : CHIP8_RENDER_SCANLINES;
+        _renderer.effects ^= effect;
+        CheckMenuItem(GetMenu(hWnd), LOWORD(wParam), (_renderer.effects & effect) != 0 ? MF_CHECKED : MF_UNCHECKED);
+        _redrawScreen = true;
+        InvalidateRect(hWnd, NULL, FALSE);
+        break;
+    }
     case IDM_FILE_EXIT:
     {
         SendMessage(hWnd, WM_CLOSE, 0, 0);
@@ -517,6 +776,43 @@ void handle_WM_COMMAND(HWND hWnd, WPARAM wParam, bool* eraseBkgHandled)
     }
 }
 
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void saveStateSlot(uint32_t slot)
+{
+    // The emulator thread saves the state between two frames, so the slot is only handed over if it is idle
+    char filename[CHIP8_STATE_PATH_SIZE];
+    sprintf_s(filename, sizeof(filename), "slot%u.c8s", slot + 1);
+    if (!chip8RequestSaveState(&_chip8, _stateSlots[slot], _chip8.stateWriter != NULL ? filename : NULL))
+    {
+        setToastMsg("Busy, try again");
+        return;
+    }
+    _stateSlotFilled[slot] = true;
+    setToastMsg("Saved slot %u", slot + 1);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void loadStateSlot(uint32_t slot)
+{
+    if (chip8StateRequestPending(&_chip8))
+    {
+        setToastMsg("Busy, try again");
+        return;
+    }
+
+    // A slot not saved in this session may still have a file from an earlier one
+    char filename[CHIP8_STATE_PATH_SIZE];
+    sprintf_s(filename, sizeof(filename), "slot%u.c8s", slot + 1);
+    if (!_stateSlotFilled[slot]) _stateSlotFilled[slot] = chip8ReadStateFile(filename, _stateSlots[slot]);
+
+    if (_stateSlotFilled[slot] && chip8RequestLoadState(&_chip8, _stateSlots[slot]))
+        setToastMsg("Loaded slot %u", slot + 1);
+    else
+        setToastMsg("Slot %u is empty", slot + 1);
+}
+
 // ********************************************************************************************************************
 // ********************************************************************************************************************
 void setToastMsg(const char* format, ...)
@@ -526,5 +822,23 @@ void setToastMsg(const char* format, ...)
     vsprintf_s(_toastMsg, sizeof(_toastMsg), format, args);
     va_end(args);
 
-    QueryPerformanceCounter(&_toastMsgTick);
-}
\ No newline at end of file
+    _toastMsgTick = platformGetTick();
+}
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void updateWindowTitle()
+{
+    // Called by the GUI refresh thread each time the speed meter updates.  The real time title never changes, so it is
+    // only set once, on leaving turbo mode.
+    static bool turboShown = false;
+    if (_chip8.realTime && !turboShown) return;
+    turboShown = !_chip8.realTime;
+
+    WCHAR title[96];
+    if (turboShown)
+        swprintf_s(title, sizeof(title) / sizeof(title[0]), WINDOW_TITLE L" - Turbo: %.2f MIPS, %.0f fps",
+                   _speedMeter.mips, _speedMeter.fps);
+    else
+        wcscpy_s(title, sizeof(title) / sizeof(title[0]), WINDOW_TITLE);
+    SetWindowTextW(_hWnd, title);
+}
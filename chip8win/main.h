@@ -2,6 +2,15 @@
 #define MAIN_H_
 
 #include "Windows.h"
+#include "chip8.h"
+#include "chip8audio.h"
+#include "chip8capture.h"
+#include "chip8movie.h"
+#include "chip8profile.h"
+#include "chip8render.h"
+#include "chip8rewind.h"
+#include "chip8state.h"
+#include "chip8trace.h"
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -9,19 +18,67 @@
 #define IDM_FILE_LOAD 2
 #define IDM_FILE_EXIT 3
 #define IDM_VIEW_REGISTERS 4
+#define IDM_VIEW_SCANLINES 5
+#define IDM_VIEW_GRID 6
 #define MSG_WIDTH 2048
+#define WINDOW_TITLE L"CHIP-8 Emulator"
 #define DEFAULT_PIXEL_SIZE 20
 #define MIN_PIXEL_SIZE 5
 #define REGISTER_DISPLAY_HEIGHT_PX 180
 #define REGISTER_DISPLAY_WIDTH_PX 1200
+#define STATE_SLOT_COUNT 4     // Save state slots, on F1-F4
+#define AUTOSAVE_INTERVAL_S 30 // Seconds between autosaves
+#define AUTOSAVE_FILENAME "autosave.c8s"
+#define REWIND_SECONDS 60               // Longest rewind, in emulated seconds
+#define REWIND_BUDGET (4 * 1024 * 1024) // Bytes the rewind ring may use
+#define REWIND_KEYFRAME_INTERVAL 60     // Frames from one rewind keyframe to the next
+#define TRACE_FILENAME "trace.c8t"
+#define MOVIE_FILENAME "movie.c8m"
+#define PROFILE_FILENAME "profile.c8p"
+#define CAPTURE_FILENAME "capture.png"
+#define PRESENT_IDLE_MS 33    // Longest wait for a frame while the registers are shown
+#define PRESENT_STATIC_MS 250 // Longest wait for a frame otherwise, to keep the speed meter going
 
-HWND _hWnd;                 // Main window, used to redraw screen
-bool _running;              // Used to let GUI thread know to exit
-WCHAR _startDirectory[260]; // Stores the path to the start directory
-bool _showRegisters;        // Flag used to track when to draw registers
-char _toastMsg[100];        // Buffer to hold the toast message
-uint64_t _toastMsgTick;     // The tick when the toast msg was set, from QueryPerformanceCounter()
-bool _redrawScreen;         // Set when the entire CHIP-8 screen needs to be redrawn
+HWND _hWnd;                  // Main window, used to redraw screen
+bool _running;               // Used to let GUI thread know to exit
+WCHAR _startDirectory[260];  // Stores the path to the start directory
+bool _showRegisters;         // Flag used to track when to draw registers
+char _toastMsg[100];         // Buffer to hold the toast message
+uint64_t _toastMsgTick;      // The tick when the toast msg was set, from QueryPerformanceCounter()
+bool _redrawScreen;          // Set when the entire CHIP-8 screen needs to be redrawn
+Chip8Machine _chip8;         // The emulated machine
+Chip8SpeedMeter _speedMeter; // Emulation speed, measured by the GUI refresh thread
+
+// Presentation
+Chip8PresentMeter _presentMeter; // Pacing of the frames presented and the latency of the keys they showed
+uint32_t _presentedKeyChanges;   // Key changes seen by the last frame taken from the core, set by the paint handler
+
+// Save states
+Chip8StateWriter _stateWriter;                           // Writes save states to disk in the background
+uint8_t _stateSlots[STATE_SLOT_COUNT][CHIP8_STATE_SIZE]; // Save state in each slot
+bool _stateSlotFilled[STATE_SLOT_COUNT];                 // Set once a slot holds a state, saved or read from disk
+uint8_t _autosaveState[CHIP8_STATE_SIZE];                // Autosave read back from disk by F9
+
+// Rewind
+Chip8Rewind _rewind; // Recent frames, stepped back through while Backspace is held
+
+// Instruction trace
+Chip8Trace _trace; // Ring and writer thread the trace goes through, started and stopped with F8
+
+// Input movie
+Chip8Movie _movie; // Recorded with F5 and played back with F6
+
+// Guest profiler
+Chip8Profile _profile; // Counts of the code profiled with F7
+
+// Frame capture
+Chip8Capture _capture; // Ring and writer thread the video captured with F11 goes through
+
+// Sound
+Chip8Audio _audio; // Sound device the tone plays on
+
+// Screen
+Chip8Renderer _renderer; // Expands the screen to the window's size for a single blit
 
 // Body of the thread that runs the emulator
 void threadChip8();
@@ -44,7 +101,16 @@ void handle_WM_KEY(UINT msg, WPARAM wParam);
 // Handler for messages from the menu
 void handle_WM_COMMAND(HWND hWnd, WPARAM wParam, bool* eraseBkgd);
 
+// Saves the machine into a slot, and to the slot's file in the background
+void saveStateSlot(uint32_t slot);
+
+// Loads the machine from a slot, reading the slot's file if it was not saved in this session
+void loadStateSlot(uint32_t slot);
+
 // Sets the toast message that temporarily informs the user of information
 void setToastMsg(const char* format, ...);
 
+// Shows the speed reached in the title bar while in turbo mode, and the plain title otherwise
+void updateWindowTitle();
+
 #endif
@@ -0,0 +1,311 @@
+#include "platform.h"
+
+#ifdef _WIN32
+
+#include <Windows.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+static HWAVEOUT _platform_WaveOut;          // Sound device, NULL while closed
+static WAVEHDR* _platform_WaveBlocks;       // Ring of blocks queued on the device
+static int16_t* _platform_WaveSamples;      // Samples of the blocks, _platform_WaveBlockSamples each
+static uint32_t _platform_WaveBlockCount;   // Blocks in the ring
+static uint32_t _platform_WaveBlockSamples; // Samples a block holds at most
+static uint32_t _platform_WaveNext;         // Block the next samples go in
+static uint32_t _platform_WaveWritten;      // Samples queued since the device was opened, wrapping like its position
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+uint64_t platformGetTick()
+{
+    LARGE_INTEGER tick;
+    QueryPerformanceCounter(&tick);
+    return tick.QuadPart;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+uint64_t platformGetTickFrequency()
+{
+    static uint64_t systemTickFreq = 0;
+    if (systemTickFreq == 0)
+    {
+        LARGE_INTEGER freq;
+        QueryPerformanceFrequency(&freq);
+        systemTickFreq = freq.QuadPart;
+    }
+    return systemTickFreq;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void platformSleep(uint32_t milliseconds) { Sleep(milliseconds); }
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void platformMutexInit(PlatformMutex* mutex) { InitializeSRWLock((PSRWLOCK)mutex); }
+
+void platformMutexDestroy(PlatformMutex* mutex) {} // SRW locks have nothing to release
+
+void platformMutexLock(PlatformMutex* mutex) { AcquireSRWLockExclusive((PSRWLOCK)mutex); }
+
+void platformMutexUnlock(PlatformMutex* mutex) { ReleaseSRWLockExclusive((PSRWLOCK)mutex); }
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void platformConditionInit(PlatformCondition* condition)
+{
+    InitializeConditionVariable((PCONDITION_VARIABLE)condition);
+}
+
+void platformConditionDestroy(PlatformCondition* condition) {} // Condition variables have nothing to release
+
+void platformConditionWait(PlatformCondition* condition, PlatformMutex* mutex)
+{
+    SleepConditionVariableSRW((PCONDITION_VARIABLE)condition, (PSRWLOCK)mutex, INFINITE, 0);
+}
+
+bool platformConditionWaitTimeout(PlatformCondition* condition, PlatformMutex* mutex, uint32_t milliseconds)
+{
+    return SleepConditionVariableSRW((PCONDITION_VARIABLE)condition, (PSRWLOCK)mutex, milliseconds, 0) != 0;
+}
+
+void platformConditionSignal(PlatformCondition* condition) { WakeAllConditionVariable((PCONDITION_VARIABLE)condition); }
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static DWORD WINAPI platformThreadMain(LPVOID parameter)
+{
+    PlatformThread* thread = parameter;
+    thread->function(thread->context);
+    return 0;
+}
+
+bool platformThreadStart(PlatformThread* thread, PlatformThreadFunction function, void* context)
+{
+    thread->function = function;
+    thread->context = context;
+    thread->handle = CreateThread(NULL, 0, platformThreadMain, thread, 0, NULL);
+    return thread->handle != NULL;
+}
+
+void platformThreadJoin(PlatformThread* thread)
+{
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+uint32_t platformAtomicExchange(volatile uint32_t* target, uint32_t value)
+{
+    return InterlockedExchange((volatile LONG*)target, value);
+}
+
+uint32_t platformAtomicLoad(volatile uint32_t* target) { return InterlockedOr((volatile LONG*)target, 0); }
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool platformAudioOpen(uint32_t sampleRate, uint32_t blockSamples, uint32_t blockCount)
+{
+    WAVEFORMATEX format = {0};
+    format.wFormatTag = WAVE_FORMAT_PCM;
+    format.nChannels = 1;
+    format.nSamplesPerSec = sampleRate;
+    format.wBitsPerSample = 16;
+    format.nBlockAlign = format.nChannels * format.wBitsPerSample / 8;
+    format.nAvgBytesPerSec = format.nSamplesPerSec * format.nBlockAlign;
+    if (waveOutOpen(&_platform_WaveOut, WAVE_MAPPER, &format, 0, 0, CALLBACK_NULL) != MMSYSERR_NOERROR)
+    {
+        _platform_WaveOut = NULL;
+        return false;
+    }
+
+    _platform_WaveBlocks = calloc(blockCount, sizeof(WAVEHDR));
+    _platform_WaveSamples = calloc((size_t)blockCount * blockSamples, sizeof(int16_t));
+    if (_platform_WaveBlocks == NULL || _platform_WaveSamples == NULL)
+    {
+        free(_platform_WaveBlocks);
+        free(_platform_WaveSamples);
+        waveOutClose(_platform_WaveOut);
+        _platform_WaveOut = NULL;
+        return false;
+    }
+
+    _platform_WaveBlockCount = blockCount;
+    _platform_WaveBlockSamples = blockSamples;
+    _platform_WaveNext = 0;
+    _platform_WaveWritten = 0;
+    for (uint32_t n = 0; n < blockCount; n++)
+    {
+        WAVEHDR* block = &_platform_WaveBlocks[n];
+        block->lpData = (LPSTR)(_platform_WaveSamples + (size_t)n * blockSamples);
+        block->dwBufferLength = blockSamples * sizeof(int16_t);
+        waveOutPrepareHeader(_platform_WaveOut, block, sizeof(WAVEHDR));
+    }
+    return true;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool platformAudioWrite(const int16_t* samples, uint32_t count)
+{
+    // The device sets WHDR_DONE on a block once it played it, so the ring needs no callback to be refilled
+    WAVEHDR* block = &_platform_WaveBlocks[_platform_WaveNext];
+    if (_platform_WaveOut == NULL || (block->dwFlags & WHDR_INQUEUE) != 0) return false;
+
+    if (count > _platform_WaveBlockSamples) count = _platform_WaveBlockSamples;
+    memcpy(block->lpData, samples, count * sizeof(int16_t));
+    block->dwBufferLength = count * sizeof(int16_t);
+    waveOutWrite(_platform_WaveOut, block, sizeof(WAVEHDR));
+    _platform_WaveNext = (_platform_WaveNext + 1) % _platform_WaveBlockCount;
+    _platform_WaveWritten += count;
+    return true;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+uint32_t platformAudioQueued()
+{
+    if (_platform_WaveOut == NULL) return 0;
+
+    // The device's position is the sample it is playing, so everything written past it is still to be heard.  A
+    // driver that can't report samples is left with whole blocks, counting the one playing as unplayed.
+    MMTIME time = {0};
+    time.wType = TIME_SAMPLES;
+    if (waveOutGetPosition(_platform_WaveOut, &time, sizeof(time)) == MMSYSERR_NOERROR && time.wType == TIME_SAMPLES)
+        return _platform_WaveWritten - time.u.sample;
+
+    uint32_t queued = 0;
+    for (uint32_t n = 0; n < _platform_WaveBlockCount; n++)
+    {
+        if ((_platform_WaveBlocks[n].dwFlags & WHDR_INQUEUE) != 0)
+            queued += _platform_WaveBlocks[n].dwBufferLength / sizeof(int16_t);
+    }
+    return queued;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void platformAudioClose()
+{
+    if (_platform_WaveOut == NULL) return;
+
+    // Resetting hands every queued block back, after which they can be unprepared
+    waveOutReset(_platform_WaveOut);
+    for (uint32_t n = 0; n < _platform_WaveBlockCount; n++)
+        waveOutUnprepareHeader(_platform_WaveOut, &_platform_WaveBlocks[n], sizeof(WAVEHDR));
+    waveOutClose(_platform_WaveOut);
+    free(_platform_WaveBlocks);
+    free(_platform_WaveSamples);
+    _platform_WaveOut = NULL;
+}
+
+#else
+
+#include <time.h>
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+uint64_t platformGetTick()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+uint64_t platformGetTickFrequency() { return 1000000000ull; }
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void platformSleep(uint32_t milliseconds)
+{
+    struct timespec ts;
+    ts.tv_sec = milliseconds / 1000;
+    ts.tv_nsec = (milliseconds % 1000) * 1000000l;
+    nanosleep(&ts, NULL);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void platformMutexInit(PlatformMutex* mutex) { pthread_mutex_init(mutex, NULL); }
+
+void platformMutexDestroy(PlatformMutex* mutex) { pthread_mutex_destroy(mutex); }
+
+void platformMutexLock(PlatformMutex* mutex) { pthread_mutex_lock(mutex); }
+
+void platformMutexUnlock(PlatformMutex* mutex) { pthread_mutex_unlock(mutex); }
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+void platformConditionInit(PlatformCondition* condition)
+{
+    // Timed waits are measured on the same clock as platformGetTick(), so changes to the wall clock don't affect them
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(condition, &attributes);
+    pthread_condattr_destroy(&attributes);
+}
+
+void platformConditionDestroy(PlatformCondition* condition) { pthread_cond_destroy(condition); }
+
+void platformConditionWait(PlatformCondition* condition, PlatformMutex* mutex) { pthread_cond_wait(condition, mutex); }
+
+bool platformConditionWaitTimeout(PlatformCondition* condition, PlatformMutex* mutex, uint32_t milliseconds)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += milliseconds / 1000;
+    ts.tv_nsec += (milliseconds % 1000) * 1000000l;
+    if (ts.tv_nsec >= 1000000000l)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000l;
+    }
+    return pthread_cond_timedwait(condition, mutex, &ts) == 0;
+}
+
+void platformConditionSignal(PlatformCondition* condition) { pthread_cond_broadcast(condition); }
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void* platformThreadMain(void* parameter)
+{
+    PlatformThread* thread = parameter;
+    thread->function(thread->context);
+    return NULL;
+}
+
+bool platformThreadStart(PlatformThread* thread, PlatformThreadFunction function, void* context)
+{
+    thread->function = function;
+    thread->context = context;
+    return pthread_create(&thread->handle, NULL, platformThreadMain, thread) == 0;
+}
+
+void platformThreadJoin(PlatformThread* thread) { pthread_join(thread->handle, NULL); }
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+uint32_t platformAtomicExchange(volatile uint32_t* target, uint32_t value)
+{
+    return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+uint32_t platformAtomicLoad(volatile uint32_t* target) { return __atomic_load_n(target, __ATOMIC_ACQUIRE); }
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+bool platformAudioOpen(uint32_t sampleRate, uint32_t blockSamples, uint32_t blockCount) { return false; }
+
+bool platformAudioWrite(const int16_t* samples, uint32_t count) { return false; }
+
+uint32_t platformAudioQueued() { return 0; }
+
+void platformAudioClose() {}
+
+#endif
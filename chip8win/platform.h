@@ -0,0 +1,109 @@
+#ifndef PLATFORM_H_
+#define PLATFORM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Thin wrapper around the handful of OS services the emulator core needs (high resolution time, sleeping, threads,
+// locking, atomics and the sound device).  The core only ever talks to these functions so that it builds without
+// Windows.h; platform.c picks the Win32 or POSIX implementation at compile time.
+
+// Body of a thread started with platformThreadStart()
+typedef void (*PlatformThreadFunction)(void* context);
+
+#ifdef _WIN32
+typedef struct PlatformMutex
+{
+    void* opaque; // Same layout as an SRWLOCK
+} PlatformMutex;
+
+typedef struct PlatformCondition
+{
+    void* opaque; // Same layout as a CONDITION_VARIABLE
+} PlatformCondition;
+
+typedef struct PlatformThread
+{
+    void* handle; // Thread HANDLE
+    PlatformThreadFunction function;
+    void* context;
+} PlatformThread;
+#else
+#include <pthread.h>
+typedef pthread_mutex_t PlatformMutex;
+typedef pthread_cond_t PlatformCondition;
+
+typedef struct PlatformThread
+{
+    pthread_t handle;
+    PlatformThreadFunction function;
+    void* context;
+} PlatformThread;
+#endif
+
+// Gets the current value of the high resolution system timer
+uint64_t platformGetTick();
+
+// Gets the number of high resolution timer ticks per second
+uint64_t platformGetTickFrequency();
+
+// Suspends the calling thread for (at least) the given number of milliseconds
+void platformSleep(uint32_t milliseconds);
+
+// Initializes a mutex.  Must be called once before the mutex is used.
+void platformMutexInit(PlatformMutex* mutex);
+
+// Releases any resources held by a mutex
+void platformMutexDestroy(PlatformMutex* mutex);
+
+// Blocks until the mutex is acquired
+void platformMutexLock(PlatformMutex* mutex);
+
+// Releases a previously acquired mutex
+void platformMutexUnlock(PlatformMutex* mutex);
+
+// Initializes a condition variable.  Must be called once before it is used.
+void platformConditionInit(PlatformCondition* condition);
+
+// Releases any resources held by a condition variable
+void platformConditionDestroy(PlatformCondition* condition);
+
+// Atomically releases the mutex, which must be held, and blocks until the condition is signaled, then reacquires the
+// mutex.  Can wake up spuriously, so callers wait in a loop that checks what they are waiting for.
+void platformConditionWait(PlatformCondition* condition, PlatformMutex* mutex);
+
+// Like platformConditionWait(), but gives up after the given number of milliseconds.  Returns false if it timed out.
+bool platformConditionWaitTimeout(PlatformCondition* condition, PlatformMutex* mutex, uint32_t milliseconds);
+
+// Wakes up every thread waiting on the condition
+void platformConditionSignal(PlatformCondition* condition);
+
+// Starts a thread running function(context).  The PlatformThread must stay valid until platformThreadJoin() returns.
+// Returns false if the thread could not be created.
+bool platformThreadStart(PlatformThread* thread, PlatformThreadFunction function, void* context);
+
+// Waits for a thread started with platformThreadStart() to return and releases it
+void platformThreadJoin(PlatformThread* thread);
+
+// Atomically replaces *target with value and returns the value it had.  Acts as a full memory barrier.
+uint32_t platformAtomicExchange(volatile uint32_t* target, uint32_t value);
+
+// Atomically reads *target.  Memory accesses that follow can't be moved before the read.
+uint32_t platformAtomicLoad(volatile uint32_t* target);
+
+// Opens the sound device for 16-bit mono samples at the given rate, with a ring of blockCount blocks of up to
+// blockSamples samples each.  Returns false if there is no device to open, as on the headless POSIX builds.
+bool platformAudioOpen(uint32_t sampleRate, uint32_t blockSamples, uint32_t blockCount);
+
+// Queues a block of samples to play after those already queued.  Returns false, dropping the samples, if every block
+// of the ring is still queued.
+bool platformAudioWrite(const int16_t* samples, uint32_t count);
+
+// Returns the number of samples queued that the device has yet to play, which is how far behind the writes the sound
+// is heard
+uint32_t platformAudioQueued();
+
+// Stops playing and closes the sound device
+void platformAudioClose();
+
+#endif
@@ -2,7 +2,6 @@
 // Microsoft Visual C++ generated include file.
 // Used by chip8win.rc
 //
-#define IDR_WAVE1                       101
 
 // Next default values for new objects
 // 
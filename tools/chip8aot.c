@@ -0,0 +1,462 @@
+#include "chip8.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Ahead-of-time compiler from a CHIP-8 ROM to a C module for the runtime in chip8aot.h.  Follows the code reachable
+// from 0x200 (jumps, calls, returns to after a call, both sides of skips), splits it into basic blocks and emits one C
+// function per block.  Register-only instructions and control flow are emitted inline with the V registers held in
+// locals, everything else calls the interpreter's handler.  Computed Bnnn targets are left to the interpreter.
+
+static uint8_t _mem[CHIP8_MEM_SIZE];
+static uint32_t _romSize;
+static bool _reachable[CHIP8_MEM_SIZE]; // An instruction starting at this address is reachable
+static bool _leader[CHIP8_MEM_SIZE];    // A basic block starts at this address
+static uint16_t _work[CHIP8_MEM_SIZE];  // Addresses still to be followed
+static uint32_t _workCount;
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void printUsage()
+{
+    printf("usage: chip8aot [-n name] rom [output.c]\n");
+    printf("  -n  Name of the module, the generated symbol is chip8aot_<name> (default: the ROM file name)\n");
+    printf("Writes to stdout if no output file is given.\n");
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static uint16_t readInstruction(uint16_t address) { return _mem[address] << 8 | _mem[address + 1]; }
+
+static bool isCode(uint16_t address) { return address < CHIP8_MEM_SIZE - 1 && readInstruction(address) != 0; }
+
+// Compiled ROMs only run as classic CHIP-8, where the SUPER-CHIP and XO-CHIP instructions are unknown ones
+static Chip8Op decodeOp(uint16_t ins)
+{
+    Chip8Op op = chip8DecodeOp(ins);
+    return op >= CHIP8_OP_FIRST_EXTENDED ? CHIP8_OP_UNKNOWN : op;
+}
+
+// Marks address as the start of a block and queues it to be followed
+static void addLeader(uint16_t address)
+{
+    if (!isCode(address) || _leader[address]) return;
+    _leader[address] = true;
+    _work[_workCount++] = address;
+}
+
+// Instructions after which a block ends: anything that changes the PC other than falling through, anything the
+// interpreter has to wait on, and the memory writes that may modify code
+static bool isBlockEnd(Chip8Op op)
+{
+    switch (op)
+    {
+    case CHIP8_OP_UNKNOWN:
+    case CHIP8_OP_00EE:
+    case CHIP8_OP_1nnn:
+    case CHIP8_OP_2nnn:
+    case CHIP8_OP_3xkk:
+    case CHIP8_OP_4xkk:
+    case CHIP8_OP_5xy0:
+    case CHIP8_OP_9xy0:
+    case CHIP8_OP_Bnnn:
+    case CHIP8_OP_Dxyn:
+    case CHIP8_OP_Ex9E:
+    case CHIP8_OP_ExA1:
+    case CHIP8_OP_Fx0A:
+    case CHIP8_OP_Fx33:
+    case CHIP8_OP_Fx55:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void findBlocks()
+{
+    addLeader(CHIP8_PROGRAM_START_OFFSET);
+
+    while (_workCount > 0)
+    {
+        uint16_t address = _work[--_workCount];
+
+        // Walk forward until the block ends, queuing every address control can reach from it
+        while (isCode(address))
+        {
+            if (_reachable[address])
+            {
+                // Ran into code that was already followed, which starts a block of its own from here on
+                addLeader(address);
+                break;
+            }
+            _reachable[address] = true;
+
+            uint16_t ins = readInstruction(address);
+            Chip8Op op = decodeOp(ins);
+            if (op == CHIP8_OP_UNKNOWN || op == CHIP8_OP_Fx0A)
+            {
+                // These can leave the PC where it is, so give them a block of their own to spin on
+                addLeader(address);
+            }
+
+            if (op == CHIP8_OP_1nnn || op == CHIP8_OP_2nnn) addLeader(ins & 0x0FFF);
+            if (op == CHIP8_OP_3xkk || op == CHIP8_OP_4xkk || op == CHIP8_OP_5xy0 || op == CHIP8_OP_9xy0 ||
+                op == CHIP8_OP_Ex9E || op == CHIP8_OP_ExA1)
+            {
+                addLeader(address + 4);
+            }
+            if (isBlockEnd(op))
+            {
+                if (op != CHIP8_OP_UNKNOWN && op != CHIP8_OP_00EE && op != CHIP8_OP_1nnn && op != CHIP8_OP_Bnnn)
+                {
+                    addLeader(address + 2);
+                }
+                break;
+            }
+            address += 2;
+        }
+    }
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Bit mask of the V registers an instruction reads or writes, for the ones emitted inline
+static uint16_t usedRegisters(uint16_t ins, Chip8Op op)
+{
+    uint16_t x = 1 << ((ins >> 8) & 0xF);
+    uint16_t y = 1 << ((ins >> 4) & 0xF);
+
+    switch (op)
+    {
+    case CHIP8_OP_3xkk:
+    case CHIP8_OP_4xkk:
+    case CHIP8_OP_6xkk:
+    case CHIP8_OP_7xkk:
+    case CHIP8_OP_Fx07:
+    case CHIP8_OP_Fx1E:
+    case CHIP8_OP_Fx29:
+        return x;
+    case CHIP8_OP_5xy0:
+    case CHIP8_OP_9xy0:
+    case CHIP8_OP_8xy0:
+    case CHIP8_OP_8xy1:
+    case CHIP8_OP_8xy2:
+    case CHIP8_OP_8xy3:
+        return x | y;
+    case CHIP8_OP_8xy4:
+    case CHIP8_OP_8xy5:
+    case CHIP8_OP_8xy6:
+    case CHIP8_OP_8xy7:
+    case CHIP8_OP_8xyE:
+        return x | y | 1 << 0xF;
+    case CHIP8_OP_Bnnn:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Bit mask of the V registers an inline instruction writes
+static uint16_t writtenRegisters(uint16_t ins, Chip8Op op)
+{
+    uint16_t x = 1 << ((ins >> 8) & 0xF);
+
+    switch (op)
+    {
+    case CHIP8_OP_6xkk:
+    case CHIP8_OP_7xkk:
+    case CHIP8_OP_8xy0:
+    case CHIP8_OP_8xy1:
+    case CHIP8_OP_8xy2:
+    case CHIP8_OP_8xy3:
+    case CHIP8_OP_Fx07:
+        return x;
+    case CHIP8_OP_8xy4:
+    case CHIP8_OP_8xy5:
+    case CHIP8_OP_8xy6:
+    case CHIP8_OP_8xy7:
+    case CHIP8_OP_8xyE:
+        return x | 1 << 0xF;
+    default:
+        return 0;
+    }
+}
+
+// Inline instructions that don't touch the V registers
+static bool isInlineWithoutRegisters(Chip8Op op)
+{
+    return op == CHIP8_OP_00EE || op == CHIP8_OP_1nnn || op == CHIP8_OP_2nnn || op == CHIP8_OP_Annn;
+}
+
+// Emits one statement per register in mask, using format with the register number filled in twice
+static void emitRegisters(FILE* out, uint16_t mask, const char* format)
+{
+    for (uint32_t reg = 0; reg < 16; reg++)
+    {
+        if (mask & (1 << reg)) fprintf(out, format, reg, reg);
+    }
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Emits the function for the block starting at start.  Returns the address just past its last instruction.
+static uint16_t emitBlock(FILE* out, uint16_t start, uint16_t* length)
+{
+    // First pass: find where the block ends and which registers it keeps in locals
+    uint16_t end = start;
+    uint16_t used = 0;
+    uint16_t written = 0;
+    *length = 0;
+    while (isCode(end) && (end == start || !_leader[end]))
+    {
+        uint16_t ins = readInstruction(end);
+        Chip8Op op = decodeOp(ins);
+        used |= usedRegisters(ins, op);
+        written |= writtenRegisters(ins, op);
+        end += 2;
+        (*length)++;
+        if (isBlockEnd(op)) break;
+    }
+
+    fprintf(out, "static void block%03X(Chip8Machine* m)\n{\n", start);
+    emitRegisters(out, used, "    uint8_t v%X = m->genRegs[%u];\n");
+    if (used != 0) fprintf(out, "\n");
+
+    bool fallsThrough = true;
+    bool inHandler = false; // The last instruction was run by a handler, so the locals are already written back
+    for (uint16_t address = start; address < end; address += 2)
+    {
+        uint16_t ins = readInstruction(address);
+        Chip8Op op = decodeOp(ins);
+        uint32_t x = (ins >> 8) & 0xF;
+        uint32_t y = (ins >> 4) & 0xF;
+        uint32_t kk = ins & 0xFF;
+        uint32_t nnn = ins & 0x0FFF;
+        uint32_t next = address + 2;
+
+        fprintf(out, "    // %03X: %04X\n", address, ins);
+        inHandler = usedRegisters(ins, op) == 0 && !isInlineWithoutRegisters(op);
+        switch (op)
+        {
+        case CHIP8_OP_00EE:
+            fprintf(out, "    m->programCounter = m->stack[m->stackPointer];\n");
+            fprintf(out, "    if (m->stackPointer > 0) m->stackPointer--;\n");
+            break;
+        case CHIP8_OP_1nnn:
+            fprintf(out, "    m->programCounter = 0x%03X;\n", nnn);
+            break;
+        case CHIP8_OP_2nnn:
+            fprintf(out, "    m->stack[++m->stackPointer] = 0x%03X;\n", next);
+            fprintf(out, "    m->programCounter = 0x%03X;\n", nnn);
+            break;
+        case CHIP8_OP_3xkk:
+        case CHIP8_OP_4xkk:
+            fprintf(out, "    m->programCounter = v%X %s 0x%02X ? 0x%03X : 0x%03X;\n", x,
+                    op == CHIP8_OP_3xkk ? "==" : "!=", kk, next + 2, next);
+            break;
+        case CHIP8_OP_5xy0:
+        case CHIP8_OP_9xy0:
+            fprintf(out, "    m->programCounter = v%X %s v%X ? 0x%03X : 0x%03X;\n", x,
+                    op == CHIP8_OP_5xy0 ? "==" : "!=", y, next + 2, next);
+            break;
+        case CHIP8_OP_6xkk:
+            fprintf(out, "    v%X = 0x%02X;\n", x, kk);
+            break;
+        case CHIP8_OP_7xkk:
+            fprintf(out, "    v%X += 0x%02X;\n", x, kk);
+            break;
+        case CHIP8_OP_8xy0:
+            fprintf(out, "    v%X = v%X;\n", x, y);
+            break;
+        case CHIP8_OP_8xy1:
+        case CHIP8_OP_8xy2:
+        case CHIP8_OP_8xy3:
+            fprintf(out, "    v%X %s= v%X;\n", x, op == CHIP8_OP_8xy1 ? "|" : op == CHIP8_OP_8xy2 ? "&" : "^", y);
+            break;
+        case CHIP8_OP_8xy4:
+            fprintf(out, "    {\n        uint16_t sum = v%X + v%X;\n        v%X = (uint8_t)sum;\n", x, y, x);
+            fprintf(out, "        vF = sum > 0xFF;\n    }\n");
+            break;
+        case CHIP8_OP_8xy5:
+            fprintf(out, "    vF = v%X > v%X;\n    v%X -= v%X;\n", x, y, x, y);
+            break;
+        case CHIP8_OP_8xy7:
+            fprintf(out, "    vF = v%X > v%X;\n    v%X = v%X - v%X;\n", y, x, x, y, x);
+            break;
+        case CHIP8_OP_8xy6:
+        case CHIP8_OP_8xyE:
+            fprintf(out, "    {\n        uint8_t value = m->shiftQuirkMode ? v%X : v%X;\n", x, y);
+            if (op == CHIP8_OP_8xy6)
+                fprintf(out, "        vF = value & 0x01;\n        v%X = value >> 1;\n    }\n", x);
+            else
+                fprintf(out, "        vF = value >> 7;\n        v%X = value << 1;\n    }\n", x);
+            break;
+        case CHIP8_OP_Annn:
+            fprintf(out, "    m->i = 0x%03X;\n", nnn);
+            break;
+        case CHIP8_OP_Bnnn:
+            fprintf(out, "    m->programCounter = 0x%03X + v0;\n", nnn);
+            break;
+        case CHIP8_OP_Fx07:
+            fprintf(out, "    v%X = m->delayTimerReg;\n", x);
+            break;
+        case CHIP8_OP_Fx1E:
+            fprintf(out, "    m->i += v%X;\n", x);
+            break;
+        case CHIP8_OP_Fx29:
+            fprintf(out, "    m->i = CHIP8_HEX_SPRITE_START_OFFSET + CHIP8_HEX_SPRITE_SIZE_PER * v%X;\n", x);
+            break;
+        default:
+        {
+            // The handler works on the machine's registers, so write the locals back before and reload them after
+            static const char* const names[] = {
+#define CHIP8_OP_NAME(name) #name,
+                CHIP8_OP_LIST(CHIP8_OP_NAME)
+#undef CHIP8_OP_NAME
+            };
+            emitRegisters(out, written, "    m->genRegs[%u] = v%X;\n");
+            fprintf(out, "    {\n");
+            fprintf(out, "        static const Chip8Decoded d = {CHIP8_OP_%s, 0x%X, 0x%X, 0x%02X, 0x%03X, 0x%03X};\n",
+                    names[op], x, y, kk, nnn, next);
+            fprintf(out, "        chip8GetHandler(CHIP8_OP_%s)(m, &d);\n    }\n", names[op]);
+            if (address + 2 < end) emitRegisters(out, used, "    v%X = m->genRegs[%u];\n");
+            break;
+        }
+        }
+
+        if (isBlockEnd(op)) fallsThrough = false;
+    }
+
+    // Modified registers are written back on the way out, unless a handler call at the end already did that
+    if (!inHandler && written != 0)
+    {
+        fprintf(out, "\n");
+        emitRegisters(out, written, "    m->genRegs[%u] = v%X;\n");
+    }
+    if (fallsThrough) fprintf(out, "    m->programCounter = 0x%03X;\n", end);
+    fprintf(out, "}\n\n");
+    return end;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+int main(int argc, char** argv)
+{
+    const char* name = NULL;
+
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-'; argi++)
+    {
+        if (strcmp(argv[argi], "-n") == 0 && argi + 1 < argc)
+        {
+            name = argv[++argi];
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+    if (argi >= argc || argc - argi > 2)
+    {
+        printUsage();
+        return 1;
+    }
+
+    const char* romFile = argv[argi];
+    FILE* fp = fopen(romFile, "rb");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Could not open %s\n", romFile);
+        return 1;
+    }
+    _romSize = fread(_mem + CHIP8_PROGRAM_START_OFFSET, 1, CHIP8_CLASSIC_MEM_SIZE - CHIP8_PROGRAM_START_OFFSET, fp);
+    bool tooLarge = fgetc(fp) != EOF;
+    fclose(fp);
+    if (tooLarge)
+    {
+        fprintf(stderr, "%s is too large\n", romFile);
+        return 1;
+    }
+
+    if (name == NULL)
+    {
+        name = strrchr(romFile, '/');
+        name = name ? name + 1 : romFile;
+    }
+
+    // The module symbol is the name with everything that can't appear in an identifier replaced
+    char symbol[256];
+    uint32_t symbolLength = 0;
+    for (const char* c = name; *c != '\0' && symbolLength < sizeof(symbol) - 1; c++)
+    {
+        symbol[symbolLength++] = isalnum((unsigned char)*c) ? *c : '_';
+    }
+    symbol[symbolLength] = '\0';
+
+    FILE* out = stdout;
+    if (argi + 1 < argc)
+    {
+        out = fopen(argv[argi + 1], "w");
+        if (out == NULL)
+        {
+            fprintf(stderr, "Could not create %s\n", argv[argi + 1]);
+            return 1;
+        }
+    }
+
+    findBlocks();
+
+    fprintf(out, "// Generated by chip8aot from %s.  Do not edit.\n\n", name);
+    fprintf(out, "#include \"chip8aot.h\"\n\n");
+
+    fprintf(out, "static const uint8_t _rom[%u] = {", _romSize);
+    for (uint32_t i = 0; i < _romSize; i++)
+    {
+        fprintf(out, "%s0x%02X,", i % 16 == 0 ? "\n    " : " ", _mem[CHIP8_PROGRAM_START_OFFSET + i]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    static uint16_t ends[CHIP8_MEM_SIZE];
+    static uint16_t lengths[CHIP8_MEM_SIZE];
+    uint32_t blocks = 0;
+    uint32_t instructions = 0;
+    uint32_t maxBlockBytes = 0;
+    for (uint32_t address = 0; address < CHIP8_MEM_SIZE; address++)
+    {
+        if (!_leader[address]) continue;
+
+        ends[address] = emitBlock(out, address, &lengths[address]);
+        if (ends[address] - address > maxBlockBytes) maxBlockBytes = ends[address] - address;
+        blocks++;
+    }
+    for (uint32_t address = 0; address < CHIP8_MEM_SIZE; address++)
+    {
+        if (_reachable[address]) instructions++;
+    }
+
+    // The table only goes up to the last block, not all of memory
+    uint32_t blockCount = 0;
+    for (uint32_t address = 0; address < CHIP8_MEM_SIZE; address++)
+    {
+        if (_leader[address]) blockCount = address + 1;
+    }
+    fprintf(out, "static const Chip8AotBlock _blocks[0x%03X] = {\n", blockCount);
+    for (uint32_t address = 0; address < CHIP8_MEM_SIZE; address++)
+    {
+        if (!_leader[address]) continue;
+        fprintf(out, "    [0x%03X] = {block%03X, 0x%03X, %u},\n", address, address, ends[address], lengths[address]);
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "const Chip8AotModule chip8aot_%s = {\"%s\", _rom, sizeof(_rom), _blocks, 0x%03X, %u};\n", symbol,
+            symbol, blockCount, maxBlockBytes);
+
+    if (out != stdout) fclose(out);
+    fprintf(stderr, "%s: %u blocks, %u reachable instructions\n", name, blocks, instructions);
+    return 0;
+}
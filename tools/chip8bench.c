@@ -0,0 +1,207 @@
+#include "chip8.h"
+#include "chip8aot.h"
+#include "common.h"
+#include "chip8jit.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Headless throughput benchmark for the CHIP-8 core.  Runs each ROM for a fixed number of instructions with every
+// dispatch engine and reports the instructions per second achieved, so changes to the hot path can be measured on the
+// bundled ROMs.
+
+#define DEFAULT_INSTRUCTIONS 20000000
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void printUsage()
+{
+    printf("usage: chip8bench [-n instructions] [-c hz] [-e " ENGINE_NAMES "] rom...\n");
+    printf("  -n  Instructions to execute per ROM and engine (default %u)\n", DEFAULT_INSTRUCTIONS);
+    printf("  -c  Emulated clock speed in instructions per second (default %u)\n", CHIP8_CLOCK_SPEED_HZ);
+    printf("  -e  Only benchmark the given engine (default: all)\n");
+    printf("The aot engine only runs ROMs compiled into chip8bench, see AOT_ROMS in the Makefile.\n");
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Returns the time taken in seconds, or a negative value if the engine can't run the ROM.  The fused engine adds its
+// statistics to fusionTotals.
+static double runRom(const uint8_t* rom, uint32_t romSize, Chip8Variant variant, Chip8Dispatch dispatch,
+                     uint64_t instructions, uint32_t clockSpeed, uint64_t* executed, Chip8FusionStats* fusionTotals)
+{
+    const Chip8AotModule* module = NULL;
+    if (dispatch == CHIP8_DISPATCH_AOT && (module = findAotModule(rom, romSize)) == NULL) return -1;
+
+    static Chip8Machine m;
+    chip8Init(&m);
+    chip8SetVariant(&m, variant);
+    m.dispatch = dispatch;
+    if (module != NULL) chip8AotAttach(&m, module);
+    if (dispatch == CHIP8_DISPATCH_JIT && !chip8JitInit(&m))
+    {
+        fprintf(stderr, "JIT not available, jit column uses the table engine\n");
+    }
+    m.debugString = false;
+    m.skipIdleLoops = false; // Idle loops are code the engines have to run fast as well
+    chip8LoadRomData(&m, rom, romSize);
+    m.clockSpeed = clockSpeed;
+    chip8SeedRandom(&m, 1);
+
+    *executed = 0;
+    uint64_t start = platformGetTick();
+    while (*executed < instructions)
+    {
+        // Emulated frames tick the timers the same way for every engine, so delay loops terminate identically
+        uint32_t ran = chip8RunFrame(&m);
+        *executed += ran;
+        if (ran == 0) break; // Stuck on a 0000 instruction, the ROM has crashed or ended
+    }
+    double elapsed = getElapsedTimeSinceHighPerfTick(start);
+
+    Chip8FusionStats fusion;
+    chip8GetFusionStats(&m, &fusion);
+    fusionTotals->executed += fusion.executed;
+    for (uint32_t f = 0; f < CHIP8_FUSION_COUNT; f++)
+    {
+        fusionTotals->hits[f] += fusion.hits[f];
+        fusionTotals->instructions[f] += fusion.instructions[f];
+    }
+
+    chip8Destroy(&m);
+    return elapsed;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+int main(int argc, char** argv)
+{
+    uint64_t instructions = DEFAULT_INSTRUCTIONS;
+    uint32_t clockSpeed = CHIP8_CLOCK_SPEED_HZ;
+    int32_t onlyEngine = -1;
+
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-'; argi++)
+    {
+        if (strcmp(argv[argi], "-n") == 0 && argi + 1 < argc)
+        {
+            instructions = strtoull(argv[++argi], NULL, 0);
+        }
+        else if (strcmp(argv[argi], "-c") == 0 && argi + 1 < argc)
+        {
+            clockSpeed = strtoul(argv[++argi], NULL, 0);
+            if (clockSpeed < CHIP8_FRAME_RATE) clockSpeed = CHIP8_FRAME_RATE;
+        }
+        else if (strcmp(argv[argi], "-e") == 0 && argi + 1 < argc)
+        {
+            onlyEngine = findEngine(argv[++argi]);
+            if (onlyEngine < 0)
+            {
+                printUsage();
+                return 1;
+            }
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+    if (argi >= argc)
+    {
+        printUsage();
+        return 1;
+    }
+
+    double totalTime[ENGINE_COUNT] = {0};
+    uint64_t totalInstructions[ENGINE_COUNT] = {0};
+    double chainTime[ENGINE_COUNT] = {0};           // Time chain took on the ROMs each engine ran
+    uint64_t chainInstructions[ENGINE_COUNT] = {0}; // Instructions chain executed on the ROMs each engine ran
+    Chip8FusionStats fusionTotals = {0};
+
+    printf("%-48s", "ROM");
+    for (uint32_t e = 0; e < ENGINE_COUNT; e++)
+    {
+        if (onlyEngine < 0 || onlyEngine == (int32_t)e) printf(" %10s", engines[e].name);
+    }
+    printf("   (MIPS)\n");
+
+    for (; argi < argc; argi++)
+    {
+        uint32_t romSize;
+        uint8_t* rom = readFile(argv[argi], &romSize);
+        Chip8Variant variant = chip8GetRomVariant(argv[argi]);
+        if (rom == NULL || romSize > chip8GetMemorySize(variant) - CHIP8_PROGRAM_START_OFFSET)
+        {
+            fprintf(stderr, "Skipping %s: could not read ROM\n", argv[argi]);
+            free(rom);
+            continue;
+        }
+
+        const char* name = strrchr(argv[argi], '/');
+        name = name ? name + 1 : argv[argi];
+        printf("%-48.48s", name);
+
+        double romChainTime = 0;
+        uint64_t romChainInstructions = 0;
+        for (uint32_t e = 0; e < ENGINE_COUNT; e++)
+        {
+            if (onlyEngine >= 0 && onlyEngine != (int32_t)e) continue;
+
+            uint64_t executed;
+            double elapsed = runRom(rom, romSize, variant, engines[e].dispatch, instructions, clockSpeed, &executed,
+                                    &fusionTotals);
+            if (elapsed < 0)
+            {
+                printf(" %10s", "-");
+                continue;
+            }
+            if (e == 0)
+            {
+                romChainTime = elapsed;
+                romChainInstructions = executed;
+            }
+            totalTime[e] += elapsed;
+            totalInstructions[e] += executed;
+            chainTime[e] += romChainTime;
+            chainInstructions[e] += romChainInstructions;
+            printf(" %10.2f", elapsed > 0 ? executed / elapsed / 1e6 : 0.0);
+        }
+        printf("\n");
+        fflush(stdout);
+        free(rom);
+    }
+
+    // Summary: overall throughput of each engine and its speedup over the original if/else chain
+    printf("%-48s", "TOTAL");
+    for (uint32_t e = 0; e < ENGINE_COUNT; e++)
+    {
+        if (onlyEngine < 0 || onlyEngine == (int32_t)e)
+            printf(" %10.2f", totalTime[e] > 0 ? totalInstructions[e] / totalTime[e] / 1e6 : 0.0);
+    }
+    printf("\n");
+    if (onlyEngine < 0)
+    {
+        for (uint32_t e = 1; e < ENGINE_COUNT; e++)
+        {
+            if (totalTime[e] <= 0 || chainTime[e] <= 0) continue;
+            printf("Speedup of %s over chain: %.2fx\n", engines[e].name,
+                   totalInstructions[e] / totalTime[e] / (chainInstructions[e] / chainTime[e]));
+        }
+    }
+
+    // Share of the fused engine's instructions that ran inside each superinstruction
+    if (fusionTotals.executed > 0)
+    {
+        printf("Fusion hit rates:\n");
+        for (uint32_t f = CHIP8_FUSION_NONE + 1; f < CHIP8_FUSION_COUNT; f++)
+        {
+            double share = 100.0 * fusionTotals.instructions[f] / fusionTotals.executed;
+            printf("  %-16s %12llu hits %6.2f%% of instructions\n", chip8GetFusionName(f),
+                   (unsigned long long)fusionTotals.hits[f], share);
+        }
+    }
+
+    return 0;
+}
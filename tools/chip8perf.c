@@ -0,0 +1,414 @@
+#include "chip8.h"
+#include "chip8aot.h"
+#include "common.h"
+#include "chip8jit.h"
+#include "chip8render.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Benchmark suite for the CHIP-8 core, with machine-readable JSON output so runs can be compared automatically.
+//
+// The micro benchmarks loop a synthetic program made of one instruction repeated, so they measure what each handler
+// costs on each dispatch engine, what chip8BuildDebugString() adds per instruction, and how Dxyn scales with the
+// sprite height.  The macro benchmarks run real ROMs for a fixed number of instructions, like chip8bench.  The render
+// benchmarks time the software scaler expanding a full screen at common window sizes, with and without SSE2.
+
+#define DEFAULT_MICRO_INSTRUCTIONS 2000000
+#define DEFAULT_MACRO_INSTRUCTIONS 20000000
+#define REPEATS 3          // Each micro benchmark is timed this many times and the fastest run is reported
+#define CHUNK 10000        // Instructions per chip8ExecuteInstructions() call in the micro benchmarks
+#define LOOP_LENGTH 64     // Copies of the instruction in the loop of a micro benchmark, before the jump back
+#define DATA_ADDRESS 0xE00 // I points here: 16 bytes of 0xFF for sprites, scratch space for Fx33 and Fx55
+#define RENDER_PIXELS 100000000 // Output pixels per render benchmark run
+
+// How the loop of a micro benchmark is built from its instruction
+typedef enum LoopKind
+{
+    LOOP_REPEAT, // The instruction repeated as is
+    LOOP_CHAIN,  // The instruction plus the address of the next one (1nnn and Bnnn jumping to the next instruction)
+    LOOP_CALL,   // Calls of a subroutine that only returns, so 2nnn and 00EE are measured together
+} LoopKind;
+
+// One micro benchmark.  The machine starts with V1 = 1, every other register 0 and key 1 held down, and the
+// instructions are picked so none of them skips or blocks with that state.
+typedef struct MicroTest
+{
+    const char* name;
+    uint16_t instruction;
+    LoopKind kind;
+} MicroTest;
+
+static const MicroTest _microTests[] = {
+    {"00E0", 0x00E0, LOOP_REPEAT}, {"1nnn", 0x1000, LOOP_CHAIN},  {"2nnn_00EE", 0x2300, LOOP_CALL},
+    {"3xkk", 0x3001, LOOP_REPEAT}, {"4xkk", 0x4000, LOOP_REPEAT}, {"5xy0", 0x5010, LOOP_REPEAT},
+    {"6xkk", 0x6312, LOOP_REPEAT}, {"7xkk", 0x7301, LOOP_REPEAT}, {"8xy0", 0x8340, LOOP_REPEAT},
+    {"8xy1", 0x8341, LOOP_REPEAT}, {"8xy2", 0x8342, LOOP_REPEAT}, {"8xy3", 0x8343, LOOP_REPEAT},
+    {"8xy4", 0x8344, LOOP_REPEAT}, {"8xy5", 0x8345, LOOP_REPEAT}, {"8xy6", 0x8346, LOOP_REPEAT},
+    {"8xy7", 0x8347, LOOP_REPEAT}, {"8xyE", 0x834E, LOOP_REPEAT}, {"9xy0", 0x9020, LOOP_REPEAT},
+    {"Annn", 0xAE00, LOOP_REPEAT}, {"Bnnn", 0xB000, LOOP_CHAIN},  {"Cxkk", 0xC3FF, LOOP_REPEAT},
+    {"Dxyn", 0xD015, LOOP_REPEAT}, {"Ex9E", 0xE09E, LOOP_REPEAT}, {"ExA1", 0xE1A1, LOOP_REPEAT},
+    {"Fx07", 0xF307, LOOP_REPEAT}, {"Fx0A", 0xF30A, LOOP_REPEAT}, {"Fx15", 0xF315, LOOP_REPEAT},
+    {"Fx18", 0xF318, LOOP_REPEAT}, {"Fx1E", 0xF21E, LOOP_REPEAT}, {"Fx29", 0xF329, LOOP_REPEAT},
+    {"Fx33", 0xF333, LOOP_REPEAT}, {"Fx55", 0xF555, LOOP_REPEAT}, {"Fx65", 0xF565, LOOP_REPEAT},
+};
+#define MICRO_TEST_COUNT (sizeof(_microTests) / sizeof(_microTests[0]))
+
+// Output sizes of the render benchmarks: whole scales of 10 to 60, and 1366 x 683, which isn't one
+typedef struct RenderSize
+{
+    uint32_t width;
+    uint32_t height;
+} RenderSize;
+
+static const RenderSize _renderSizes[] = {{640, 320},   {1280, 640},  {1366, 683},
+                                          {1920, 960}, {2560, 1280}, {3840, 1920}};
+#define RENDER_SIZE_COUNT (sizeof(_renderSizes) / sizeof(_renderSizes[0]))
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void printUsage()
+{
+    printf("usage: chip8perf [-m instructions] [-n instructions] [-c hz] [-e " ENGINE_NAMES "] [-o file] [rom...]\n");
+    printf("  -m  Instructions per micro benchmark run (default %u)\n", DEFAULT_MICRO_INSTRUCTIONS);
+    printf("  -n  Instructions per ROM and engine in the macro benchmarks (default %u)\n", DEFAULT_MACRO_INSTRUCTIONS);
+    printf("  -c  Emulated clock speed of the macro benchmarks (default %u)\n", CHIP8_CLOCK_SPEED_HZ);
+    printf("  -e  Only benchmark the given engine: chain, table, threaded, jit, aot or fused (default: all)\n");
+    printf("  -o  Write the JSON results to a file instead of stdout\n");
+    printf("The micro benchmarks skip the aot engine, which only runs ROMs compiled into chip8perf.\n");
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void printJsonString(FILE* out, const char* text)
+{
+    fputc('"', out);
+    for (; *text != '\0'; text++)
+    {
+        if (*text == '"' || *text == '\\') fputc('\\', out);
+        if ((unsigned char)*text >= ' ') fputc(*text, out);
+    }
+    fputc('"', out);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Builds the loop of a micro benchmark and loads it into a freshly initialized machine
+static void setupMicro(Chip8Machine* m, Chip8Dispatch dispatch, uint16_t instruction, LoopKind kind)
+{
+    uint8_t program[0x200] = {0};
+    for (uint32_t n = 0; n < LOOP_LENGTH; n++)
+    {
+        uint16_t address = CHIP8_PROGRAM_START_OFFSET + n * 2;
+        uint16_t ins = kind == LOOP_CHAIN ? instruction | (address + 2) : instruction;
+        program[n * 2] = ins >> 8;
+        program[n * 2 + 1] = ins & 0xFF;
+    }
+    program[LOOP_LENGTH * 2] = 0x12; // 1200, back to the start
+    program[LOOP_LENGTH * 2 + 1] = 0x00;
+    if (kind == LOOP_CALL)
+    {
+        // The subroutine at (instruction & 0xFFF)
+        program[(instruction & 0xFFF) - CHIP8_PROGRAM_START_OFFSET] = 0x00;
+        program[(instruction & 0xFFF) - CHIP8_PROGRAM_START_OFFSET + 1] = 0xEE;
+    }
+
+    chip8Init(m);
+    m->dispatch = dispatch;
+    if (dispatch == CHIP8_DISPATCH_JIT) chip8JitInit(m);
+    m->debugString = false;
+    chip8LoadRomData(m, program, sizeof(program));
+    memset(m->mem + DATA_ADDRESS, 0xFF, 16);
+    chip8InvalidateDecodeCache(m, DATA_ADDRESS, 16);
+    m->genRegs[1] = 1;
+    m->i = DATA_ADDRESS;
+    m->keyboard[1] = true;
+    chip8SeedRandom(m, 1);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Returns the nanoseconds per instruction of the fastest of REPEATS runs of the loop loaded into the machine
+static double timeMicro(Chip8Machine* m, uint64_t instructions)
+{
+    // Warm up: fill the decode cache and translate the JIT blocks before anything is timed
+    chip8ExecuteInstructions(m, CHUNK);
+
+    double best = 0;
+    for (uint32_t r = 0; r < REPEATS; r++)
+    {
+        uint64_t executed = 0;
+        uint64_t start = platformGetTick();
+        while (executed < instructions)
+        {
+            uint32_t ran = chip8ExecuteInstructions(m, CHUNK);
+            if (ran == 0) return -1; // The loop ran into a 0000, the benchmark is broken
+            executed += ran;
+        }
+        double ns = getElapsedTimeSinceHighPerfTick(start) * 1e9 / executed;
+        if (r == 0 || ns < best) best = ns;
+    }
+    return best;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Returns the nanoseconds per frame of the fastest of REPEATS runs of the renderer expanding the whole screen
+static double timeRender(Chip8Renderer* r, const Chip8Screen* screen)
+{
+    uint32_t frames = RENDER_PIXELS / (r->width * r->height) + 1;
+    chip8RenderScreen(r, screen, ~0ull);
+
+    double best = 0;
+    for (uint32_t repeat = 0; repeat < REPEATS; repeat++)
+    {
+        uint64_t start = platformGetTick();
+        for (uint32_t f = 0; f < frames; f++) chip8RenderScreen(r, screen, ~0ull);
+        double ns = getElapsedTimeSinceHighPerfTick(start) * 1e9 / frames;
+        if (repeat == 0 || ns < best) best = ns;
+    }
+    return best;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Returns the time taken in seconds, or a negative value if the engine can't run the ROM
+static double runRom(const uint8_t* rom, uint32_t romSize, Chip8Variant variant, Chip8Dispatch dispatch,
+                     uint64_t instructions, uint32_t clockSpeed, uint64_t* executed)
+{
+    const Chip8AotModule* module = NULL;
+    if (dispatch == CHIP8_DISPATCH_AOT && (module = findAotModule(rom, romSize)) == NULL) return -1;
+
+    static Chip8Machine m;
+    chip8Init(&m);
+    chip8SetVariant(&m, variant);
+    m.dispatch = dispatch;
+    if (module != NULL) chip8AotAttach(&m, module);
+    if (dispatch == CHIP8_DISPATCH_JIT) chip8JitInit(&m);
+    m.debugString = false;
+    m.skipIdleLoops = false; // Idle loops are code the engines have to run fast as well
+    chip8LoadRomData(&m, rom, romSize);
+    m.clockSpeed = clockSpeed;
+    chip8SeedRandom(&m, 1);
+
+    *executed = 0;
+    uint64_t start = platformGetTick();
+    while (*executed < instructions)
+    {
+        uint32_t ran = chip8RunFrame(&m);
+        *executed += ran;
+        if (ran == 0) break; // Stuck on a 0000 instruction, the ROM has crashed or ended
+    }
+    double elapsed = getElapsedTimeSinceHighPerfTick(start);
+
+    chip8Destroy(&m);
+    return elapsed;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+int main(int argc, char** argv)
+{
+    uint64_t microInstructions = DEFAULT_MICRO_INSTRUCTIONS;
+    uint64_t macroInstructions = DEFAULT_MACRO_INSTRUCTIONS;
+    uint32_t clockSpeed = CHIP8_CLOCK_SPEED_HZ;
+    int32_t onlyEngine = -1;
+    const char* outputFile = NULL;
+
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-'; argi++)
+    {
+        bool hasValue = argi + 1 < argc;
+        if (strcmp(argv[argi], "-m") == 0 && hasValue)
+        {
+            microInstructions = strtoull(argv[++argi], NULL, 0);
+        }
+        else if (strcmp(argv[argi], "-n") == 0 && hasValue)
+        {
+            macroInstructions = strtoull(argv[++argi], NULL, 0);
+        }
+        else if (strcmp(argv[argi], "-c") == 0 && hasValue)
+        {
+            clockSpeed = strtoul(argv[++argi], NULL, 0);
+            if (clockSpeed < CHIP8_FRAME_RATE) clockSpeed = CHIP8_FRAME_RATE;
+        }
+        else if (strcmp(argv[argi], "-e") == 0 && hasValue)
+        {
+            onlyEngine = findEngine(argv[++argi]);
+            if (onlyEngine < 0)
+            {
+                printUsage();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[argi], "-o") == 0 && hasValue)
+        {
+            outputFile = argv[++argi];
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+    if (microInstructions < CHUNK) microInstructions = CHUNK;
+
+    FILE* out = stdout;
+    if (outputFile != NULL && (out = fopen(outputFile, "w")) == NULL)
+    {
+        fprintf(stderr, "Could not write %s\n", outputFile);
+        return 1;
+    }
+
+    static Chip8Machine m;
+    chip8Init(&m);
+    if (!chip8JitInit(&m)) fprintf(stderr, "JIT not available, the jit results use the table engine\n");
+    chip8Destroy(&m);
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"micro_instructions\": %llu,\n", (unsigned long long)microInstructions);
+    fprintf(out, "  \"macro_instructions\": %llu,\n", (unsigned long long)macroInstructions);
+    fprintf(out, "  \"clock_speed\": %u,\n", clockSpeed);
+
+    // Cost of every instruction on every engine.  1/65 of each figure is the jump closing the loop.
+    fprintf(stderr, "Opcodes...\n");
+    fprintf(out, "  \"opcodes\": [");
+    const char* separator = "\n";
+    for (uint32_t e = 0; e < ENGINE_COUNT; e++)
+    {
+        if ((onlyEngine >= 0 && onlyEngine != (int32_t)e) || engines[e].dispatch == CHIP8_DISPATCH_AOT) continue;
+        for (uint32_t t = 0; t < MICRO_TEST_COUNT; t++)
+        {
+            setupMicro(&m, engines[e].dispatch, _microTests[t].instruction, _microTests[t].kind);
+            double ns = timeMicro(&m, microInstructions);
+            chip8Destroy(&m);
+            fprintf(out, "%s    {\"engine\": \"%s\", \"op\": \"%s\", \"ns_per_instruction\": %.3f}", separator,
+                    engines[e].name, _microTests[t].name, ns);
+            separator = ",\n";
+        }
+    }
+    fprintf(out, "\n  ],\n");
+
+    // What building the debug string adds to an instruction.  It disables the compiled engines, so only the
+    // interpreters are measured, and it is slow enough that a hundredth of the instructions gives a stable figure.
+    fprintf(stderr, "Debug string...\n");
+    fprintf(out, "  \"debug_string\": [");
+    separator = "\n";
+    for (uint32_t e = 0; e < ENGINE_COUNT; e++)
+    {
+        Chip8Dispatch dispatch = engines[e].dispatch;
+        if (onlyEngine >= 0 && onlyEngine != (int32_t)e) continue;
+        if (dispatch != CHIP8_DISPATCH_CHAIN && dispatch != CHIP8_DISPATCH_TABLE) continue;
+
+        setupMicro(&m, dispatch, 0x7301, LOOP_REPEAT);
+        double without = timeMicro(&m, microInstructions);
+        m.debugString = true;
+        double with = timeMicro(&m, microInstructions / 100 > CHUNK ? microInstructions / 100 : CHUNK);
+        chip8Destroy(&m);
+        fprintf(out, "%s    {\"engine\": \"%s\", \"ns_without\": %.3f, \"ns_with\": %.3f, \"ns_added\": %.3f}",
+                separator, engines[e].name, without, with, with - without);
+        separator = ",\n";
+    }
+    fprintf(out, "\n  ],\n");
+
+    // Dxyn by sprite height, drawn at an x that isn't a multiple of 8 so every row straddles two bytes
+    fprintf(stderr, "Dxyn...\n");
+    fprintf(out, "  \"draw\": [");
+    separator = "\n";
+    for (uint32_t e = 0; e < ENGINE_COUNT; e++)
+    {
+        if ((onlyEngine >= 0 && onlyEngine != (int32_t)e) || engines[e].dispatch == CHIP8_DISPATCH_AOT) continue;
+        for (uint32_t height = 1; height <= 15; height++)
+        {
+            setupMicro(&m, engines[e].dispatch, 0xD010 | height, LOOP_REPEAT);
+            m.genRegs[0] = 3;
+            double ns = timeMicro(&m, microInstructions);
+            chip8Destroy(&m);
+            fprintf(out, "%s    {\"engine\": \"%s\", \"height\": %u, \"ns_per_instruction\": %.3f}", separator,
+                    engines[e].name, height, ns);
+            separator = ",\n";
+        }
+    }
+    fprintf(out, "\n  ],\n");
+
+    // The software scaler at each output size and effect, on a low resolution screen of random pixels
+    fprintf(stderr, "Render...\n");
+    fprintf(out, "  \"render\": [");
+    separator = "\n";
+    static Chip8Screen screen = {CHIP8_LORES_WIDTH, CHIP8_LORES_HEIGHT, 1, {{0}}};
+    uint64_t seed = 0x9E3779B97F4A7C15ull;
+    for (uint32_t y = 0; y < CHIP8_LORES_HEIGHT; y++)
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        screen.pixels[0][y] = seed;
+    }
+    static const char* effectNames[] = {"none", "scanlines", "grid"};
+    static const uint32_t effects[] = {0, CHIP8_RENDER_SCANLINES, CHIP8_RENDER_GRID};
+    for (uint32_t s = 0; s < RENDER_SIZE_COUNT; s++)
+    {
+        for (uint32_t e = 0; e < sizeof(effects) / sizeof(effects[0]); e++)
+        {
+            Chip8Renderer renderer;
+            chip8RendererInit(&renderer);
+            bool simd = renderer.simd;
+            if (!chip8RendererResize(&renderer, _renderSizes[s].width, _renderSizes[s].height)) continue;
+            renderer.effects = effects[e];
+            double ns = timeRender(&renderer, &screen);
+            renderer.simd = false;
+            double nsScalar = timeRender(&renderer, &screen);
+            chip8RendererDestroy(&renderer);
+
+            double pixels = (double)_renderSizes[s].width * _renderSizes[s].height;
+            fprintf(out,
+                    "%s    {\"width\": %u, \"height\": %u, \"effects\": \"%s\", \"simd\": %s, \"ns_per_frame\": %.1f,"
+                    " \"mpixels_per_second\": %.1f, \"scalar_ns_per_frame\": %.1f}",
+                    separator, _renderSizes[s].width, _renderSizes[s].height, effectNames[e], simd ? "true" : "false",
+                    ns, pixels * 1e3 / ns, nsScalar);
+            separator = ",\n";
+        }
+    }
+    fprintf(out, "\n  ],\n");
+
+    // Throughput on real ROMs
+    fprintf(out, "  \"roms\": [");
+    separator = "\n";
+    for (; argi < argc; argi++)
+    {
+        uint32_t romSize;
+        uint8_t* rom = readFile(argv[argi], &romSize);
+        Chip8Variant variant = chip8GetRomVariant(argv[argi]);
+        if (rom == NULL || romSize > chip8GetMemorySize(variant) - CHIP8_PROGRAM_START_OFFSET)
+        {
+            fprintf(stderr, "Skipping %s: could not read ROM\n", argv[argi]);
+            free(rom);
+            continue;
+        }
+
+        const char* name = strrchr(argv[argi], '/');
+        name = name ? name + 1 : argv[argi];
+        fprintf(stderr, "%s...\n", name);
+        for (uint32_t e = 0; e < ENGINE_COUNT; e++)
+        {
+            if (onlyEngine >= 0 && onlyEngine != (int32_t)e) continue;
+
+            uint64_t executed;
+            double elapsed = runRom(rom, romSize, variant, engines[e].dispatch, macroInstructions, clockSpeed,
+                                    &executed);
+            if (elapsed < 0) continue;
+            fprintf(out, "%s    {\"engine\": \"%s\", \"rom\": ", separator, engines[e].name);
+            printJsonString(out, name);
+            fprintf(out, ", \"variant\": \"%s\", \"instructions\": %llu, \"seconds\": %.6f, \"mips\": %.3f}",
+                    chip8GetVariantName(variant), (unsigned long long)executed, elapsed,
+                    elapsed > 0 ? executed / elapsed / 1e6 : 0.0);
+            separator = ",\n";
+        }
+        free(rom);
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout) fclose(out);
+    return 0;
+}
@@ -0,0 +1,217 @@
+#include "chip8profile.h"
+#include "chip8trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Reports on a guest profile written by chip8profile.c: the hottest addresses with their disassembly, how often each
+// op ran, and every subroutine's calls and inclusive cost.  With -a it lists every address that ran instead of only
+// the hottest, and with -F it writes the call stacks in the folded format flamegraph.pl and speedscope read.
+
+#define DEFAULT_TOP 20
+
+// Totals of one subroutine over every stack it was called on
+typedef struct Subroutine
+{
+    uint32_t address;
+    uint64_t calls;
+    uint64_t self;      // Instructions run in it, not counting what it called
+    uint64_t inclusive; // Instructions run from its calls to its returns.  A recursive call isn't counted twice.
+} Subroutine;
+
+static Chip8Profile _profile;
+static uint64_t _totals[CHIP8_PROFILE_MAX_NODES]; // Instructions run on each node's stack and the stacks below it
+static Subroutine _subroutines[CHIP8_MEM_SIZE];   // Indexed by address
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void printUsage()
+{
+    printf("usage: chip8prof [-n count] [-a] [-F folded] profile\n");
+    printf("  -n  Show the given number of hottest addresses and subroutines (default %u)\n", DEFAULT_TOP);
+    printf("  -a  List every address that ran, in address order\n");
+    printf("  -F  Write the call stacks to the given file for flamegraph.pl\n");
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Sums the instructions run on every stack below node.  onStack[a] is set while a subroutine at a is a caller.
+static uint64_t sumNode(uint32_t index, bool* onStack)
+{
+    const Chip8ProfileNode* node = &_profile.nodes[index];
+    uint64_t total = node->self;
+    bool recursive = index != 0 && onStack[node->address];
+    if (index != 0) onStack[node->address] = true;
+    for (uint32_t child = node->firstChild; child != 0; child = _profile.nodes[child].nextSibling)
+        total += sumNode(child, onStack);
+    if (index != 0 && !recursive) onStack[node->address] = false;
+
+    _totals[index] = total;
+    if (index != 0)
+    {
+        Subroutine* sub = &_subroutines[node->address];
+        sub->address = node->address;
+        sub->calls += node->calls;
+        sub->self += node->self;
+        if (!recursive) sub->inclusive += total;
+    }
+    return total;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Writes "main;sub_2A4;sub_310 count" for every stack that ran instructions of its own
+static void writeFolded(FILE* fp, uint32_t index, char* path, size_t length, size_t size)
+{
+    const Chip8ProfileNode* node = &_profile.nodes[index];
+    int added;
+    if (index == 0)
+        added = snprintf(path, size, "main");
+    else
+        added = snprintf(path + length, size - length, ";sub_%03X", node->address);
+    if (added < 0 || length + added >= size) return; // Too deep to name, which takes thousands of calls
+    length += added;
+
+    if (node->self > 0) fprintf(fp, "%s %llu\n", path, (unsigned long long)node->self);
+    for (uint32_t child = node->firstChild; child != 0; child = _profile.nodes[child].nextSibling)
+        writeFolded(fp, child, path, length, size);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void printAddress(uint32_t slot)
+{
+    uint32_t address = slot * 2;
+    uint16_t instruction = _profile.mem[address] << 8 | _profile.mem[address + 1];
+    char text[64];
+    chip8Disassemble(instruction, _profile.disassembly, text, sizeof(text));
+    printf("%14llu %6.2f%%  %03X  %04X  %s\n", (unsigned long long)_profile.hits[slot],
+           _profile.hits[slot] * 100.0 / _profile.instructions, address, instruction, text);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static int compareHits(const void* a, const void* b)
+{
+    uint64_t ha = _profile.hits[*(const uint32_t*)a], hb = _profile.hits[*(const uint32_t*)b];
+    return ha < hb ? 1 : ha > hb ? -1 : 0;
+}
+
+static int compareInclusive(const void* a, const void* b)
+{
+    const Subroutine* sa = a;
+    const Subroutine* sb = b;
+    return sa->inclusive < sb->inclusive ? 1 : sa->inclusive > sb->inclusive ? -1 : 0;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+int main(int argc, char** argv)
+{
+    uint32_t top = DEFAULT_TOP;
+    bool all = false;
+    const char* foldedFile = NULL;
+
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-'; argi++)
+    {
+        if (strcmp(argv[argi], "-n") == 0 && argi + 1 < argc)
+        {
+            top = strtoul(argv[++argi], NULL, 0);
+        }
+        else if (strcmp(argv[argi], "-a") == 0)
+        {
+            all = true;
+        }
+        else if (strcmp(argv[argi], "-F") == 0 && argi + 1 < argc)
+        {
+            foldedFile = argv[++argi];
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+    if (argi + 1 != argc)
+    {
+        printUsage();
+        return 1;
+    }
+
+    if (!chip8ProfileRead(&_profile, argv[argi]))
+    {
+        fprintf(stderr, "%s is not a version %u profile written by this build on a host of this byte order\n",
+                argv[argi], CHIP8_PROFILE_VERSION);
+        return 1;
+    }
+    if (_profile.instructions == 0)
+    {
+        printf("No instructions were profiled\n");
+        return 0;
+    }
+
+    static bool onStack[CHIP8_MEM_SIZE];
+    sumNode(0, onStack);
+    printf("%llu instructions in %llu frames, %u call stacks", (unsigned long long)_profile.instructions,
+           (unsigned long long)_profile.frames, _profile.nodeCount);
+    if (_profile.lostCalls > 0) printf(", %llu calls not told apart", (unsigned long long)_profile.lostCalls);
+    printf("\n");
+
+    // Hottest addresses, or all of them in address order
+    static uint32_t slots[CHIP8_PROFILE_SLOTS];
+    uint32_t slotCount = 0;
+    for (uint32_t slot = 0; slot < CHIP8_PROFILE_SLOTS; slot++)
+        if (_profile.hits[slot] > 0) slots[slotCount++] = slot;
+    if (!all) qsort(slots, slotCount, sizeof(slots[0]), compareHits);
+    printf("\n%14s %7s  %-4s %-4s  %s\n", "executed", "", "addr", "op", all ? "every address" : "hottest addresses");
+    for (uint32_t n = 0; n < slotCount && (all || n < top); n++) printAddress(slots[n]);
+
+    // Ops, most frequent first
+    uint32_t ops[CHIP8_OP_COUNT];
+    for (uint32_t op = 0; op < CHIP8_OP_COUNT; op++) ops[op] = op;
+    for (uint32_t i = 1; i < CHIP8_OP_COUNT; i++)
+    {
+        for (uint32_t j = i; j > 0 && _profile.ops[ops[j]] > _profile.ops[ops[j - 1]]; j--)
+        {
+            uint32_t swap = ops[j];
+            ops[j] = ops[j - 1];
+            ops[j - 1] = swap;
+        }
+    }
+    printf("\n%14s %7s  %s\n", "executed", "", "op");
+    for (uint32_t n = 0; n < CHIP8_OP_COUNT && _profile.ops[ops[n]] > 0; n++)
+        printf("%14llu %6.2f%%  %s\n", (unsigned long long)_profile.ops[ops[n]],
+               _profile.ops[ops[n]] * 100.0 / _profile.instructions, chip8GetOpName(ops[n]));
+
+    // Subroutines by inclusive cost.  The root (whatever ran when profiling began) comes first.
+    uint32_t subroutineCount = 0;
+    for (uint32_t address = 0; address < CHIP8_MEM_SIZE; address++)
+        if (_subroutines[address].calls > 0) _subroutines[subroutineCount++] = _subroutines[address];
+    qsort(_subroutines, subroutineCount, sizeof(Subroutine), compareInclusive);
+    printf("\n%-8s %10s %14s %7s %14s\n", "sub", "calls", "inclusive", "", "self");
+    printf("%-8s %10s %14llu %6.2f%% %14llu %6.2f%%\n", "main", "", (unsigned long long)_totals[0], 100.0,
+           (unsigned long long)_profile.nodes[0].self, _profile.nodes[0].self * 100.0 / _profile.instructions);
+    for (uint32_t n = 0; n < subroutineCount && n < top; n++)
+    {
+        const Subroutine* sub = &_subroutines[n];
+        printf("sub_%03X  %10llu %14llu %6.2f%% %14llu %6.2f%%\n", sub->address, (unsigned long long)sub->calls,
+               (unsigned long long)sub->inclusive, sub->inclusive * 100.0 / _profile.instructions,
+               (unsigned long long)sub->self, sub->self * 100.0 / _profile.instructions);
+    }
+
+    if (foldedFile != NULL)
+    {
+        FILE* fp = fopen(foldedFile, "w");
+        if (fp == NULL)
+        {
+            fprintf(stderr, "Could not write %s\n", foldedFile);
+            return 1;
+        }
+        static char path[65536];
+        writeFolded(fp, 0, path, 0, sizeof(path));
+        fclose(fp);
+    }
+    return 0;
+}
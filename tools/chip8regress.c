@@ -0,0 +1,488 @@
+#include "chip8.h"
+#include "chip8capture.h"
+#include "chip8jit.h"
+#include "chip8movie.h"
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Headless regression runner.  Runs every ROM given for a fixed number of emulated frames with scripted key input,
+// hashing the screen every few frames, and compares the hashes with a golden file so changes to the core that alter
+// what a ROM draws are caught.  ROMs are spread over one worker process per core.  Every ROM's machine seeds its own
+// random number generator (used by Cxkk) with the same value, so the results don't depend on the scheduling.  ROMs run
+// as the variant their file name extension says (.sc8 SUPER-CHIP, .xo8 XO-CHIP, anything else CHIP-8).  With -m every
+// run is also recorded as an input movie, to be played back by chip8replay.  With -v every run is captured as an APNG
+// video, and the videos of the ROMs that pass are deleted afterwards, leaving the ones to look at.
+
+#define DEFAULT_FRAMES 600
+#define DEFAULT_INTERVAL 60
+#define MAX_CHECKPOINTS 64
+#define MAX_KEY_EVENTS 1024
+#define MAX_NAME 256
+#define MAX_VIDEO_SCREENS 4096 // Ring of a video capture.  Runs are short, so the writer never has to drop a screen.
+
+// A key pressed or released before the given frame runs
+typedef struct KeyEvent
+{
+    uint32_t frame;
+    uint8_t key;
+    bool pressed;
+} KeyEvent;
+
+// Everything a worker needs to run the ROMs.  Set up before the workers are forked, read-only afterwards.
+typedef struct Settings
+{
+    uint32_t frames;        // Emulated frames each ROM runs for
+    uint32_t interval;      // Frames between checkpoints
+    uint32_t clockSpeed;    // Emulated instructions per second
+    Chip8Dispatch dispatch; // Engine the ROMs run on
+    KeyEvent* keys;         // Key script, sorted by frame
+    uint32_t keyCount;      // Events in the key script
+    const char* movieDir;   // Directory the runs are recorded to as movies, NULL for none
+    const char* videoDir;   // Directory the runs are captured to as videos, NULL for none
+    bool skipIdleLoops;     // Chip8Machine.skipIdleLoops
+} Settings;
+
+// Outcome of one ROM, written by the worker that ran it into memory shared with the parent
+typedef struct RomResult
+{
+    uint64_t hashes[MAX_CHECKPOINTS]; // Screen hash at every checkpoint
+    uint64_t instructions;            // Instructions executed over all frames
+    uint64_t idleInstructions;        // Of those, the ones skipped in idle loops
+    double seconds;                   // Time the run took
+    bool done;                        // False if the worker died before finishing the ROM
+} RomResult;
+
+// A ROM's hashes from the golden file
+typedef struct Golden
+{
+    char name[MAX_NAME];
+    uint64_t hashes[MAX_CHECKPOINTS];
+    uint32_t count;
+} Golden;
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void printUsage()
+{
+    printf("usage: chip8regress [options] rom...\n");
+    printf("  -f  Emulated frames to run each ROM for (default %u)\n", DEFAULT_FRAMES);
+    printf("  -i  Frames between screen hashes (default %u)\n", DEFAULT_INTERVAL);
+    printf("  -c  Emulated clock speed in instructions per second (default %u)\n", CHIP8_CLOCK_SPEED_HZ);
+    printf("  -e  Dispatch engine: " ENGINE_NAMES " (default table).  aot runs the ROMs in AOT_ROMS compiled, the\n"
+           "      others on table.\n");
+    printf("  -j  Worker processes (default: one per core)\n");
+    printf("  -k  Key script: lines of \"frame key down|up\", key in hex\n");
+    printf("  -g  Golden file to compare the hashes with\n");
+    printf("  -u  Write the hashes to the golden file instead of comparing\n");
+    printf("  -m  Record every run as a movie, named after the ROM, in the given directory\n");
+    printf("  -v  Capture every run as a video in the given directory, keeping those of ROMs that don't pass\n");
+    printf("  -I  Execute idle loops instead of skipping them\n");
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static const char* baseName(const char* path)
+{
+    const char* name = strrchr(path, '/');
+    return name ? name + 1 : path;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Returns the number of events read, or -1 if the file can't be read or has a malformed line
+static int32_t readKeyScript(const char* filename, KeyEvent* keys)
+{
+    FILE* fp = fopen(filename, "r");
+    if (fp == NULL) return -1;
+
+    uint32_t count = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        unsigned frame, key;
+        char action[8];
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') continue;
+        if (count == MAX_KEY_EVENTS || sscanf(line, "%u %x %7s", &frame, &key, action) != 3 || key > 0xF ||
+            (strcmp(action, "down") != 0 && strcmp(action, "up") != 0))
+        {
+            fclose(fp);
+            return -1;
+        }
+        // Insert sorted by frame.  Events for the same frame keep the order of the file, so a press and a release
+        // in one frame don't swap.
+        uint32_t i = count++;
+        for (; i > 0 && keys[i - 1].frame > frame; i--) keys[i] = keys[i - 1];
+        keys[i].frame = frame;
+        keys[i].key = key;
+        keys[i].pressed = strcmp(action, "down") == 0;
+    }
+    fclose(fp);
+    return count;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void runRom(const Settings* settings, const char* name, const uint8_t* rom, uint32_t romSize, RomResult* result)
+{
+    static Chip8Machine m;
+    chip8Init(&m);
+    chip8SetVariant(&m, chip8GetRomVariant(name));
+    m.dispatch = settings->dispatch;
+    if (settings->dispatch == CHIP8_DISPATCH_JIT) chip8JitInit(&m);
+    const Chip8AotModule* module = settings->dispatch == CHIP8_DISPATCH_AOT ? findAotModule(rom, romSize) : NULL;
+    if (module != NULL) chip8AotAttach(&m, module);
+    m.debugString = false;
+    m.clockSpeed = settings->clockSpeed;
+    m.skipIdleLoops = settings->skipIdleLoops;
+    chip8LoadRomData(&m, rom, romSize);
+    chip8SeedRandom(&m, 1);
+
+    // Recorded from the freshly loaded ROM, so playing the movie back goes through exactly the same frames
+    static Chip8Movie movie;
+    if (settings->movieDir != NULL)
+    {
+        chip8MovieInit(&movie, "");
+        m.movie = &movie;
+        if (!chip8MovieRecord(&movie, &m)) m.movie = NULL;
+    }
+
+    // Captured from the first frame like the movie.  The run never waits for the writer, but shares the core with it.
+    static Chip8Capture capture;
+    if (settings->videoDir != NULL)
+    {
+        char path[CHIP8_STATE_PATH_SIZE];
+        snprintf(path, sizeof(path), "%s/%s.png", settings->videoDir, name);
+        uint32_t capacity = settings->frames < MAX_VIDEO_SCREENS ? settings->frames + 1 : MAX_VIDEO_SCREENS;
+        if (chip8CaptureInit(&capture, path, capacity, CHIP8_CAPTURE_SCALE))
+        {
+            m.capture = &capture;
+            if (!chip8CaptureBegin(&capture, &m))
+            {
+                chip8CaptureDestroy(&capture);
+                m.capture = NULL;
+            }
+        }
+        if (m.capture == NULL) fprintf(stderr, "Could not capture to %s\n", path);
+    }
+
+    uint32_t nextKey = 0;
+    uint64_t start = platformGetTick();
+    for (uint32_t frame = 0; frame < settings->frames; frame++)
+    {
+        for (; nextKey < settings->keyCount && settings->keys[nextKey].frame <= frame; nextKey++)
+            chip8SetKey(&m, settings->keys[nextKey].key, settings->keys[nextKey].pressed);
+
+        chip8RunFrame(&m);
+        if ((frame + 1) % settings->interval == 0) result->hashes[frame / settings->interval] = hashScreen(&m.screen);
+    }
+    result->seconds = getElapsedTimeSinceHighPerfTick(start);
+    result->instructions = m.instructionCount;
+    result->idleInstructions = m.idleInstructions;
+    result->done = true;
+
+    if (m.movie != NULL)
+    {
+        char path[CHIP8_STATE_PATH_SIZE];
+        snprintf(path, sizeof(path), "%s/%s.c8m", settings->movieDir, name);
+        chip8MovieStop(&movie, &m);
+        if (!chip8MovieWrite(&movie, path)) fprintf(stderr, "Could not write %s\n", path);
+        chip8MovieDestroy(&movie);
+    }
+
+    // Waits for the video to be finished
+    if (m.capture != NULL)
+    {
+        chip8CaptureDestroy(&capture);
+        if (capture.writer.failed) fprintf(stderr, "Could not write all of %s\n", capture.filename);
+    }
+    chip8Destroy(&m);
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Returns the number of ROMs read from the golden file, or -1 if it doesn't exist or was made with other settings
+static int32_t readGolden(const char* filename, const char* header, Golden* golden, uint32_t maxRoms)
+{
+    FILE* fp = fopen(filename, "r");
+    if (fp == NULL) return -1;
+
+    char line[MAX_NAME + MAX_CHECKPOINTS * 17 + 16];
+    if (fgets(line, sizeof(line), fp) == NULL || strcmp(line, header) != 0)
+    {
+        fclose(fp);
+        return -1;
+    }
+
+    // Every other line is the hashes separated by spaces, a tab and the ROM name (which may contain spaces)
+    uint32_t count = 0;
+    while (count < maxRoms && fgets(line, sizeof(line), fp) != NULL)
+    {
+        char* tab = strchr(line, '\t');
+        if (tab == NULL) continue;
+        *tab = '\0';
+        Golden* g = &golden[count++];
+        snprintf(g->name, sizeof(g->name), "%.*s", (int)strcspn(tab + 1, "\r\n"), tab + 1);
+
+        g->count = 0;
+        char* hash = strtok(line, " ");
+        for (; hash != NULL && g->count < MAX_CHECKPOINTS; hash = strtok(NULL, " "))
+            g->hashes[g->count++] = strtoull(hash, NULL, 16);
+    }
+    fclose(fp);
+    return count;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+int main(int argc, char** argv)
+{
+    Settings settings = {DEFAULT_FRAMES, DEFAULT_INTERVAL, CHIP8_CLOCK_SPEED_HZ, CHIP8_DISPATCH_TABLE, NULL, 0, NULL,
+                         NULL, true};
+    const char* engineName = "table";
+    const char* keyFile = NULL;
+    const char* goldenFile = NULL;
+    bool update = false;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-'; argi++)
+    {
+        bool hasValue = argi + 1 < argc;
+        if (strcmp(argv[argi], "-f") == 0 && hasValue)
+        {
+            settings.frames = strtoul(argv[++argi], NULL, 0);
+        }
+        else if (strcmp(argv[argi], "-i") == 0 && hasValue)
+        {
+            settings.interval = strtoul(argv[++argi], NULL, 0);
+        }
+        else if (strcmp(argv[argi], "-c") == 0 && hasValue)
+        {
+            settings.clockSpeed = strtoul(argv[++argi], NULL, 0);
+            if (settings.clockSpeed < CHIP8_FRAME_RATE) settings.clockSpeed = CHIP8_FRAME_RATE;
+        }
+        else if (strcmp(argv[argi], "-e") == 0 && hasValue)
+        {
+            engineName = argv[++argi];
+            int32_t e = findEngine(engineName);
+            if (e < 0)
+            {
+                printUsage();
+                return 1;
+            }
+            settings.dispatch = engines[e].dispatch;
+        }
+        else if (strcmp(argv[argi], "-j") == 0 && hasValue)
+        {
+            jobs = strtol(argv[++argi], NULL, 0);
+        }
+        else if (strcmp(argv[argi], "-k") == 0 && hasValue)
+        {
+            keyFile = argv[++argi];
+        }
+        else if (strcmp(argv[argi], "-g") == 0 && hasValue)
+        {
+            goldenFile = argv[++argi];
+        }
+        else if (strcmp(argv[argi], "-u") == 0)
+        {
+            update = true;
+        }
+        else if (strcmp(argv[argi], "-m") == 0 && hasValue)
+        {
+            settings.movieDir = argv[++argi];
+        }
+        else if (strcmp(argv[argi], "-v") == 0 && hasValue)
+        {
+            settings.videoDir = argv[++argi];
+        }
+        else if (strcmp(argv[argi], "-I") == 0)
+        {
+            settings.skipIdleLoops = false;
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+    if (argi >= argc || settings.interval == 0 || settings.frames / settings.interval > MAX_CHECKPOINTS ||
+        (update && goldenFile == NULL))
+    {
+        printUsage();
+        return 1;
+    }
+    if (jobs < 1) jobs = 1;
+
+    static KeyEvent keys[MAX_KEY_EVENTS];
+    if (keyFile != NULL)
+    {
+        int32_t keyCount = readKeyScript(keyFile, keys);
+        if (keyCount < 0)
+        {
+            fprintf(stderr, "Could not read key script %s\n", keyFile);
+            return 1;
+        }
+        settings.keys = keys;
+        settings.keyCount = keyCount;
+    }
+
+    // Read every ROM up front so the workers only have to run them
+    uint32_t romCount = argc - argi;
+    const char** names = calloc(romCount, sizeof(char*));
+    uint8_t** roms = calloc(romCount, sizeof(uint8_t*));
+    uint32_t* romSizes = calloc(romCount, sizeof(uint32_t));
+    if (names == NULL || roms == NULL || romSizes == NULL)
+    {
+        fprintf(stderr, "Could not allocate the ROM list\n");
+        return 1;
+    }
+    for (uint32_t r = 0; r < romCount; r++)
+    {
+        names[r] = baseName(argv[argi + r]);
+        roms[r] = readFile(argv[argi + r], &romSizes[r]);
+        uint32_t memSize = chip8GetMemorySize(chip8GetRomVariant(names[r]));
+        if (roms[r] == NULL || romSizes[r] > memSize - CHIP8_PROGRAM_START_OFFSET)
+        {
+            fprintf(stderr, "Could not read ROM %s\n", argv[argi + r]);
+            return 1;
+        }
+    }
+
+    // The results, and the index of the next ROM to hand out, live in memory shared with the workers.  Each worker
+    // takes ROMs until none are left, so a slow ROM doesn't hold up the ones queued behind it.
+    size_t sharedSize = sizeof(uint32_t) * 16 + romCount * sizeof(RomResult);
+    uint32_t* nextRom = mmap(NULL, sharedSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (nextRom == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+    RomResult* results = (RomResult*)(nextRom + 16); // Own cache line for the counter
+    if (jobs > romCount) jobs = romCount;
+
+    uint64_t start = platformGetTick();
+    for (long j = 0; j < jobs; j++)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            perror("fork");
+            return 1;
+        }
+        if (pid > 0) continue;
+
+        uint32_t r;
+        while ((r = __atomic_fetch_add(nextRom, 1, __ATOMIC_RELAXED)) < romCount)
+            runRom(&settings, names[r], roms[r], romSizes[r], &results[r]);
+        _exit(0);
+    }
+    while (wait(NULL) > 0) continue; // Every worker has exited
+    double elapsed = getElapsedTimeSinceHighPerfTick(start);
+
+    // The header records the settings, so hashes made with other settings are never compared
+    char header[256];
+    snprintf(header, sizeof(header), "# chip8regress frames %u interval %u clock %u keys %s\n", settings.frames,
+             settings.interval, settings.clockSpeed, keyFile ? baseName(keyFile) : "none");
+    uint32_t checkpoints = settings.frames / settings.interval;
+
+    static Golden golden[1024];
+    int32_t goldenCount = -1;
+    if (goldenFile != NULL && !update)
+    {
+        goldenCount = readGolden(goldenFile, header, golden, sizeof(golden) / sizeof(golden[0]));
+        if (goldenCount < 0) fprintf(stderr, "No golden hashes for these settings in %s\n", goldenFile);
+    }
+
+    uint32_t passed = 0, failed = 0, missing = 0, crashed = 0, videos = 0;
+    uint64_t totalInstructions = 0, totalIdle = 0;
+    printf("%-48s %-8s %10s %8s %6s\n", "ROM", "result", "MIPS", "ms", "idle");
+    for (uint32_t r = 0; r < romCount; r++)
+    {
+        const RomResult* result = &results[r];
+        char status[32] = "ok";
+        if (!result->done)
+        {
+            snprintf(status, sizeof(status), "CRASH");
+            crashed++;
+        }
+        else if (goldenCount >= 0)
+        {
+            const Golden* g = NULL;
+            for (int32_t i = 0; i < goldenCount && g == NULL; i++)
+            {
+                if (strcmp(golden[i].name, names[r]) == 0) g = &golden[i];
+            }
+
+            // Report the first checkpoint that differs, later ones usually follow from it
+            uint32_t c = 0;
+            while (g != NULL && c < checkpoints && c < g->count && g->hashes[c] == result->hashes[c]) c++;
+            if (g == NULL)
+            {
+                snprintf(status, sizeof(status), "new");
+                missing++;
+            }
+            else if (c < checkpoints)
+            {
+                snprintf(status, sizeof(status), "FAIL@%u", (c + 1) * settings.interval);
+                failed++;
+            }
+            else
+            {
+                passed++;
+            }
+        }
+        totalInstructions += result->instructions;
+        totalIdle += result->idleInstructions;
+
+        // Only the videos of ROMs that need looking at are kept.  A worker that crashed left its video unfinished.
+        if (settings.videoDir != NULL)
+        {
+            char path[CHIP8_STATE_PATH_SIZE];
+            snprintf(path, sizeof(path), "%s/%s.png", settings.videoDir, names[r]);
+            if (result->done && goldenCount >= 0 && strcmp(status, "ok") == 0)
+                remove(path);
+            else
+                videos++;
+        }
+        printf("%-48.48s %-8s %10.2f %8.2f %5.1f%%\n", names[r], status,
+               result->seconds > 0 ? result->instructions / result->seconds / 1e6 : 0.0, result->seconds * 1000,
+               result->instructions > 0 ? result->idleInstructions * 100.0 / result->instructions : 0.0);
+    }
+
+    printf("%u ROMs, %u frames each, engine %s, %ld workers: %.2f s, %.2f MIPS overall\n", romCount, settings.frames,
+           engineName, jobs, elapsed, elapsed > 0 ? totalInstructions / elapsed / 1e6 : 0.0);
+    printf("%llu of %llu instructions (%.1f%%) skipped in idle loops\n", (unsigned long long)totalIdle,
+           (unsigned long long)totalInstructions, totalInstructions > 0 ? totalIdle * 100.0 / totalInstructions : 0.0);
+    if (goldenCount >= 0)
+        printf("%u passed, %u failed, %u not in the golden file, %u crashed\n", passed, failed, missing, crashed);
+    if (settings.videoDir != NULL) printf("%u videos kept in %s\n", videos, settings.videoDir);
+
+    if (update)
+    {
+        FILE* fp = fopen(goldenFile, "w");
+        if (fp == NULL)
+        {
+            fprintf(stderr, "Could not write %s\n", goldenFile);
+            return 1;
+        }
+        fputs(header, fp);
+        for (uint32_t r = 0; r < romCount; r++)
+        {
+            if (!results[r].done) continue;
+            for (uint32_t c = 0; c < checkpoints; c++)
+                fprintf(fp, "%s%016llx", c > 0 ? " " : "", (unsigned long long)results[r].hashes[c]);
+            fprintf(fp, "\t%s\n", names[r]);
+        }
+        fclose(fp);
+        printf("Wrote %u checkpoints per ROM to %s\n", checkpoints, goldenFile);
+    }
+
+    return failed > 0 || crashed > 0 ? 1 : 0;
+}
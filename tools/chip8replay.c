@@ -0,0 +1,156 @@
+#include "chip8.h"
+#include "chip8jit.h"
+#include "chip8movie.h"
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Plays input movies back headless, as fast as the host allows, and reports the throughput reached on real gameplay
+// along with a hash of the last screen.  A movie holds the machine it starts from, so no ROM is needed.  With -a the
+// movie is played on every engine and the hashes must agree, which checks the engines against each other on input
+// no synthetic benchmark exercises.
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void printUsage()
+{
+    printf("usage: chip8replay [-e " ENGINE_NAMES "] [-a] [-n repeats] movie...\n");
+    printf("  -e  Dispatch engine (default table)\n");
+    printf("  -a  Play every movie on every engine and check they end on the same screen\n");
+    printf("  -n  Play each movie the given number of times and report the fastest (default 1)\n");
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Plays the movie through once.  Returns the time taken in seconds, or a negative value if it can't be played.
+static double playMovie(Chip8Movie* movie, Chip8Dispatch dispatch, uint64_t* instructions, uint64_t* hash)
+{
+    static Chip8Machine m;
+    chip8Init(&m);
+    m.dispatch = dispatch;
+    if (dispatch == CHIP8_DISPATCH_JIT && !chip8JitInit(&m))
+    {
+        chip8Destroy(&m);
+        return -1;
+    }
+    m.debugString = false;
+    m.realTime = false;
+    m.movie = movie;
+    if (!chip8MoviePlay(movie, &m))
+    {
+        chip8Destroy(&m);
+        return -1;
+    }
+
+    // The movie only has the machine it starts from, so the compiled module is found by the ROM in its memory
+    const Chip8AotModule* module = dispatch == CHIP8_DISPATCH_AOT ? findLoadedAotModule(&m) : NULL;
+    if (dispatch == CHIP8_DISPATCH_AOT && (module == NULL || !chip8AotAttach(&m, module)))
+    {
+        chip8MovieStop(movie, &m);
+        chip8Destroy(&m);
+        return -1;
+    }
+
+    // The movie ends with the last frame recorded, the one after would go back to the (absent) host's keys
+    uint64_t firstInstruction = m.instructionCount;
+    uint64_t start = platformGetTick();
+    for (uint32_t frame = 0; frame < movie->frames; frame++) chip8RunFrame(&m);
+    double elapsed = getElapsedTimeSinceHighPerfTick(start);
+
+    chip8MovieStop(movie, &m);
+    *instructions = m.instructionCount - firstInstruction;
+    *hash = hashScreen(&m.screen);
+    chip8Destroy(&m);
+    return elapsed;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+int main(int argc, char** argv)
+{
+    uint32_t firstEngine = 1, lastEngine = 1; // table
+    uint32_t repeats = 1;
+
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-'; argi++)
+    {
+        if (strcmp(argv[argi], "-e") == 0 && argi + 1 < argc)
+        {
+            int32_t e = findEngine(argv[++argi]);
+            if (e < 0)
+            {
+                printUsage();
+                return 1;
+            }
+            firstEngine = lastEngine = e;
+        }
+        else if (strcmp(argv[argi], "-a") == 0)
+        {
+            firstEngine = 0;
+            lastEngine = ENGINE_COUNT - 1;
+        }
+        else if (strcmp(argv[argi], "-n") == 0 && argi + 1 < argc)
+        {
+            repeats = strtoul(argv[++argi], NULL, 0);
+            if (repeats < 1) repeats = 1;
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+    if (argi >= argc)
+    {
+        printUsage();
+        return 1;
+    }
+
+    uint32_t mismatches = 0;
+    static Chip8Movie movie;
+    chip8MovieInit(&movie, "");
+    printf("%-32s %-9s %10s %14s %10s %10s  %s\n", "movie", "engine", "frames", "instructions", "MIPS", "x real",
+           "screen");
+    for (; argi < argc; argi++)
+    {
+        if (!chip8MovieRead(&movie, argv[argi]))
+        {
+            fprintf(stderr, "Could not read movie %s\n", argv[argi]);
+            return 1;
+        }
+
+        uint64_t firstHash = 0;
+        bool first = true;
+        for (uint32_t e = firstEngine; e <= lastEngine; e++)
+        {
+            double best = -1;
+            uint64_t instructions = 0, hash = 0;
+            for (uint32_t r = 0; r < repeats; r++)
+            {
+                double seconds = playMovie(&movie, engines[e].dispatch, &instructions, &hash);
+                if (seconds >= 0 && (best < 0 || seconds < best)) best = seconds;
+            }
+            if (best < 0)
+            {
+                printf("%-32.32s %-9s not available\n", argv[argi], engines[e].name);
+                continue;
+            }
+
+            // Every engine must end on the screen the first one did
+            bool mismatch = !first && hash != firstHash;
+            if (first) firstHash = hash;
+            first = false;
+            mismatches += mismatch;
+            double seconds = movie.frames / (double)CHIP8_FRAME_RATE;
+            printf("%-32.32s %-9s %10u %14llu %10.2f %10.1f  %016llx%s\n", argv[argi], engines[e].name, movie.frames,
+                   (unsigned long long)instructions, best > 0 ? instructions / best / 1e6 : 0.0,
+                   best > 0 ? seconds / best : 0.0, (unsigned long long)hash, mismatch ? "  MISMATCH" : "");
+        }
+    }
+    chip8MovieDestroy(&movie);
+
+    if (mismatches > 0) printf("%u engines ended on a different screen\n", mismatches);
+    return mismatches > 0 ? 1 : 0;
+}
@@ -0,0 +1,309 @@
+#include "chip8.h"
+#include "chip8audio.h"
+#include "chip8capture.h"
+#include "chip8jit.h"
+#include "chip8profile.h"
+#include "chip8rewind.h"
+#include "chip8trace.h"
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Runs a ROM headless in turbo mode: emulated frames back to back, as fast as the host allows, with the timers still
+// ticking once per frame.  Reports the instructions and emulated frames per second every second, the same figures
+// the Windows frontend shows in its overlay.  With -r it also records every frame for rewinding like the frontend
+// does, reports what that costs, and at the end steps all the way back to measure rewinding.  With -T it writes an
+// instruction trace for chip8traceview, with -P a guest profile for chip8prof, with -A the sound the ROM makes as a
+// WAV file, or played with -A device, along with how far behind the emulation it is heard, and with -C a video of the
+// screen (APNG, or Y4M if the name ends in .y4m).  Loops that only wait for the delay timer or a key are skipped to
+// the end of the frame unless -I is given.  The ROM runs as the variant its file name extension says unless -V picks
+// one.
+
+#define DEFAULT_SECONDS 10
+#define REWIND_BUDGET (4 * 1024 * 1024) // Bytes the rewind ring may use, as in the frontend
+#define REWIND_KEYFRAME_INTERVAL 60
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void printUsage()
+{
+    printf("usage: chip8run [-t seconds] [-f frames] [-c hz] [-e " ENGINE_NAMES "] [-r seconds]"
+           " [-T trace] [-P profile] [-A wav] [-C video] [-I] [-V chip8|schip|xochip] rom\n");
+    printf("  -t  Stop after the given wall-clock time (default %u)\n", DEFAULT_SECONDS);
+    printf("  -f  Stop after the given number of emulated frames instead\n");
+    printf("  -c  Emulated clock speed in instructions per second (default %u)\n", CHIP8_CLOCK_SPEED_HZ);
+    printf("  -e  Dispatch engine (default table)\n");
+    printf("  -r  Record the given number of seconds of emulated frames for rewinding\n");
+    printf("  -T  Write a trace of every instruction executed to the given file\n");
+    printf("  -P  Profile the guest code and write the profile to the given file\n");
+    printf("  -A  Write the sound to the given WAV file, or only synthesize it if the file is \"null\" and play it if\n"
+           "      it is \"device\"\n");
+    printf("  -C  Capture the screen to the given APNG file, or Y4M if it ends in .y4m\n");
+    printf("  -I  Execute idle loops instead of skipping them\n");
+    printf("  -V  Variant to run the ROM as (default: from the extension, .sc8 schip, .xo8 xochip, else chip8)\n");
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+int main(int argc, char** argv)
+{
+    double seconds = DEFAULT_SECONDS;
+    uint64_t maxFrames = 0;
+    uint32_t clockSpeed = CHIP8_CLOCK_SPEED_HZ;
+    Chip8Dispatch dispatch = CHIP8_DISPATCH_TABLE;
+    double rewindSeconds = 0;
+    const char* traceFile = NULL;
+    const char* profileFile = NULL;
+    const char* audioFile = NULL;
+    const char* captureFile = NULL;
+    bool skipIdleLoops = true;
+    int32_t variant = -1; // From the extension
+
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-'; argi++)
+    {
+        if (strcmp(argv[argi], "-t") == 0 && argi + 1 < argc)
+        {
+            seconds = strtod(argv[++argi], NULL);
+        }
+        else if (strcmp(argv[argi], "-f") == 0 && argi + 1 < argc)
+        {
+            maxFrames = strtoull(argv[++argi], NULL, 0);
+        }
+        else if (strcmp(argv[argi], "-c") == 0 && argi + 1 < argc)
+        {
+            clockSpeed = strtoul(argv[++argi], NULL, 0);
+            if (clockSpeed < CHIP8_FRAME_RATE) clockSpeed = CHIP8_FRAME_RATE;
+        }
+        else if (strcmp(argv[argi], "-T") == 0 && argi + 1 < argc)
+        {
+            traceFile = argv[++argi];
+        }
+        else if (strcmp(argv[argi], "-P") == 0 && argi + 1 < argc)
+        {
+            profileFile = argv[++argi];
+        }
+        else if (strcmp(argv[argi], "-A") == 0 && argi + 1 < argc)
+        {
+            audioFile = argv[++argi];
+        }
+        else if (strcmp(argv[argi], "-C") == 0 && argi + 1 < argc)
+        {
+            captureFile = argv[++argi];
+        }
+        else if (strcmp(argv[argi], "-I") == 0)
+        {
+            skipIdleLoops = false;
+        }
+        else if (strcmp(argv[argi], "-V") == 0 && argi + 1 < argc)
+        {
+            argi++;
+            for (uint32_t v = 0; v < CHIP8_VARIANT_COUNT; v++)
+            {
+                if (strcmp(argv[argi], chip8GetVariantName(v)) == 0) variant = v;
+            }
+            if (variant < 0)
+            {
+                printUsage();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[argi], "-r") == 0 && argi + 1 < argc)
+        {
+            rewindSeconds = strtod(argv[++argi], NULL);
+        }
+        else if (strcmp(argv[argi], "-e") == 0 && argi + 1 < argc)
+        {
+            int32_t engine = findEngine(argv[++argi]);
+            if (engine < 0)
+            {
+                printUsage();
+                return 1;
+            }
+            dispatch = engines[engine].dispatch;
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+    if (argi + 1 != argc)
+    {
+        printUsage();
+        return 1;
+    }
+
+    static Chip8Machine m;
+    chip8Init(&m);
+    chip8SetVariant(&m, variant >= 0 ? (Chip8Variant)variant : chip8GetRomVariant(argv[argi]));
+    if (chip8LoadRom(&m, argv[argi]) < 0)
+    {
+        fprintf(stderr, "Could not load %s\n", argv[argi]);
+        return 1;
+    }
+    m.dispatch = dispatch;
+    if (dispatch == CHIP8_DISPATCH_JIT && !chip8JitInit(&m)) fprintf(stderr, "JIT not available, using table\n");
+    const Chip8AotModule* module = dispatch == CHIP8_DISPATCH_AOT ? findLoadedAotModule(&m) : NULL;
+    if (dispatch == CHIP8_DISPATCH_AOT && (module == NULL || !chip8AotAttach(&m, module)))
+        fprintf(stderr, "%s was not compiled ahead of time, using table\n", argv[argi]);
+    m.debugString = false;
+    m.realTime = false;
+    m.clockSpeed = clockSpeed;
+    m.skipIdleLoops = skipIdleLoops;
+
+    static Chip8Rewind rewind;
+    if (rewindSeconds > 0)
+    {
+        if (!chip8RewindInit(&rewind, rewindSeconds, REWIND_BUDGET, REWIND_KEYFRAME_INTERVAL))
+        {
+            fprintf(stderr, "Could not allocate the rewind ring\n");
+            return 1;
+        }
+        m.rewind = &rewind;
+    }
+
+    static Chip8Trace trace;
+    if (traceFile != NULL)
+    {
+        if (!chip8TraceInit(&trace, traceFile, CHIP8_TRACE_CAPACITY) || !chip8TraceBegin(&trace, &m))
+        {
+            fprintf(stderr, "Could not start tracing to %s\n", traceFile);
+            return 1;
+        }
+        m.trace = &trace;
+    }
+
+    static Chip8Profile profile;
+    if (profileFile != NULL)
+    {
+        chip8ProfileInit(&profile, profileFile);
+        chip8ProfileBegin(&profile, &m);
+        m.profile = &profile;
+        m.profiling = true;
+    }
+
+    static Chip8Audio audio;
+    if (audioFile != NULL)
+    {
+        const Chip8AudioBackend* backend = &chip8AudioWav;
+        if (strcmp(audioFile, "null") == 0) backend = &chip8AudioNull;
+        if (strcmp(audioFile, "device") == 0) backend = &chip8AudioDevice;
+        if (!chip8AudioOpen(&audio, backend, audioFile))
+        {
+            if (backend == &chip8AudioDevice)
+                fprintf(stderr, "No sound device to play on\n");
+            else
+                fprintf(stderr, "Could not write %s\n", audioFile);
+            return 1;
+        }
+        m.audio = &audio;
+    }
+
+    static Chip8Capture capture;
+    if (captureFile != NULL)
+    {
+        if (!chip8CaptureInit(&capture, captureFile, CHIP8_CAPTURE_CAPACITY, CHIP8_CAPTURE_SCALE) ||
+            !chip8CaptureBegin(&capture, &m))
+        {
+            fprintf(stderr, "Could not start capturing to %s\n", captureFile);
+            return 1;
+        }
+        m.capture = &capture;
+    }
+
+    Chip8SpeedMeter meter = {0};
+    chip8UpdateSpeedMeter(&m, &meter, 0);
+    uint64_t start = meter.tick;
+
+    printf("%8s %12s %14s %10s %10s\n", "time", "frames", "instructions", "MIPS", "fps");
+    while (maxFrames > 0 ? m.frameCount < maxFrames : getElapsedTimeSinceHighPerfTick(start) < seconds)
+    {
+        // Frames are short, so the clock is only read every few of them
+        chip8RunFrame(&m);
+        if (m.rewind != NULL) chip8RewindCapture(m.rewind, &m);
+        if ((m.frameCount & 63) != 0 || !chip8UpdateSpeedMeter(&m, &meter, 1.0)) continue;
+        printf("%7.1fs %12llu %14llu %10.2f %10.1f\n", getElapsedTimeSinceHighPerfTick(start),
+               (unsigned long long)m.frameCount, (unsigned long long)m.instructionCount, meter.mips, meter.fps);
+        fflush(stdout);
+    }
+
+    double elapsed = getElapsedTimeSinceHighPerfTick(start);
+    printf("%7.1fs %12llu %14llu %10.2f %10.1f  (average, %.1fx real time)\n", elapsed,
+           (unsigned long long)m.frameCount, (unsigned long long)m.instructionCount,
+           elapsed > 0 ? m.instructionCount / elapsed / 1e6 : 0.0, elapsed > 0 ? m.frameCount / elapsed : 0.0,
+           elapsed > 0 ? m.frameCount / elapsed / CHIP8_FRAME_RATE : 0.0);
+    printf("idle: %llu instructions (%.1f%%) skipped in idle loops, %llu executed\n",
+           (unsigned long long)m.idleInstructions,
+           m.instructionCount > 0 ? m.idleInstructions * 100.0 / m.instructionCount : 0.0,
+           (unsigned long long)(m.instructionCount - m.idleInstructions));
+
+    if (m.trace != NULL)
+    {
+        // Waits for the writer to put the rest of the trace on disk
+        chip8TraceDestroy(&trace);
+        printf("trace: %llu instructions written to %s%s\n", (unsigned long long)trace.written, traceFile,
+               trace.writer.failed ? ", some could not be written" : "");
+    }
+
+    if (m.profile != NULL)
+    {
+        chip8ProfileEnd(&profile, &m);
+        bool written = chip8ProfileWrite(&profile, profileFile);
+        printf("profile: %llu instructions, %u call stacks, %s %s\n", (unsigned long long)profile.instructions,
+               profile.nodeCount, written ? "written to" : "could not write", profileFile);
+    }
+
+    if (m.audio != NULL)
+    {
+        bool toFile = audio.backend == &chip8AudioWav;
+        chip8AudioClose(&audio);
+        printf("audio: %llu frames (%.1fs), %llu beeps lasting %llu frames", (unsigned long long)audio.frames,
+               (double)audio.frames / CHIP8_FRAME_RATE, (unsigned long long)audio.beeps,
+               (unsigned long long)audio.toneFrames);
+        if (toFile)
+            printf(", %s %s", audio.failed ? "could not write all of" : "written to", audioFile);
+        printf("\n");
+
+        // Beeps only start and stop at frame boundaries, and a frame is handed over once it has run, so a frame's
+        // worth of samples comes on top of whatever the backend queued
+        double latencyMaxMs;
+        double latencyMs = chip8AudioGetLatencyMs(&audio, &latencyMaxMs);
+        printf("audio latency: %.1f ms queued on average, %.1f ms at most, plus %.1f ms for the frame, "
+               "%llu frames dropped\n",
+               latencyMs, latencyMaxMs, 1000.0 / CHIP8_FRAME_RATE, (unsigned long long)audio.dropped);
+    }
+
+    if (m.capture != NULL)
+    {
+        // Waits for the writer to finish the video.  Turbo mode can outrun it, and the screens that found the ring
+        // full are only in the video if they stayed up.
+        chip8CaptureDestroy(&capture);
+        printf("capture: %llu screens, %llu frames unchanged, %llu dropped, %llu video frames %s %s\n",
+               (unsigned long long)capture.captured, (unsigned long long)capture.unchanged,
+               (unsigned long long)capture.dropped, (unsigned long long)capture.written,
+               capture.writer.failed ? "could not all be written to" : "written to", captureFile);
+    }
+
+    if (m.rewind != NULL)
+    {
+        Chip8RewindStats stats;
+        chip8RewindGetStats(&rewind, &stats);
+        printf("rewind: %u frames (%.1fs), %u keyframes, %u of %u KB, %.0f bytes/frame, %.2f us/frame to record\n",
+               stats.frames, (double)stats.frames / CHIP8_FRAME_RATE, stats.keyframes, stats.bytesUsed / 1024,
+               stats.budget / 1024, stats.bytesPerFrame, stats.captureMicros);
+
+        uint64_t rewindStart = platformGetTick();
+        uint32_t steps = 0;
+        while (chip8RewindStep(&rewind, &m)) steps++;
+        double rewindElapsed = getElapsedTimeSinceHighPerfTick(rewindStart);
+        printf("rewind: stepped back %u frames to frame %llu, %.2f us/frame\n", steps,
+               (unsigned long long)m.frameCount, steps > 0 ? rewindElapsed * 1e6 / steps : 0.0);
+        chip8RewindDestroy(&rewind);
+    }
+
+    chip8Destroy(&m);
+    return 0;
+}
@@ -0,0 +1,216 @@
+#include "chip8trace.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Prints an instruction trace written by chip8trace.c with the disassembly of every instruction, or with -c how
+// often each instruction was executed.  The file is mapped rather than read, so filtering a trace of hundreds of
+// millions of instructions only costs a pass over memory.
+
+// Which records to show.  A record is shown if it passes every filter.
+typedef struct Filter
+{
+    uint32_t pcLow, pcHigh;       // Range of addresses
+    uint16_t opcodeMask;          // Bits of the opcode that must equal opcodeValue
+    uint16_t opcodeValue;         // Opcode pattern
+    uint32_t reg;                 // Register the instruction must have changed, or CHIP8_TRACE_NO_REGISTER for any
+    uint64_t frameLow, frameHigh; // Range of frames (low 32 bits)
+} Filter;
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static void printUsage()
+{
+    printf("usage: chip8traceview [-p addr[-addr]] [-o pattern] [-r reg] [-f frame[-frame]] [-s first] [-n count] [-c]"
+           " trace\n");
+    printf("  -p  Only instructions at the given address or range of addresses (hex)\n");
+    printf("  -o  Only instructions matching the pattern: hex digits must match, anything else matches any digit,\n");
+    printf("      so Dxyn is every draw and F?65 every Fx65\n");
+    printf("  -r  Only instructions that wrote the given register (hex, F for VF)\n");
+    printf("  -f  Only instructions run in the given frame or range of frames\n");
+    printf("  -s  Start at the given record\n");
+    printf("  -n  Stop after printing the given number of records\n");
+    printf("  -c  Count the matching instructions by opcode instead of printing them\n");
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// Parses "low" or "low-high" in the given base.  Returns false if it is malformed.
+static bool parseRange(const char* text, int base, uint64_t* low, uint64_t* high)
+{
+    char* end;
+    *low = strtoull(text, &end, base);
+    if (end == text) return false;
+    *high = *low;
+    if (*end == '-')
+    {
+        const char* start = end + 1;
+        *high = strtoull(start, &end, base);
+        if (end == start) return false;
+    }
+    return *end == '\0' && *low <= *high;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+static bool parsePattern(const char* text, Filter* filter)
+{
+    if (strlen(text) != 4) return false;
+    for (uint32_t n = 0; n < 4; n++)
+    {
+        char c = text[n];
+        int32_t digit = c >= '0' && c <= '9' ? c - '0' : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if (digit < 0) continue;
+        filter->opcodeMask |= 0xF000 >> (n * 4);
+        filter->opcodeValue |= digit << (12 - n * 4);
+    }
+    return true;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+// previous is the record before, NULL for the first one
+static bool matches(const Filter* filter, const Chip8TraceRecord* record, const Chip8TraceRecord* previous)
+{
+    if (record->pc < filter->pcLow || record->pc > filter->pcHigh) return false;
+    if ((record->opcode & filter->opcodeMask) != filter->opcodeValue) return false;
+    if (record->frame < filter->frameLow || record->frame > filter->frameHigh) return false;
+    if (filter->reg == CHIP8_TRACE_NO_REGISTER) return true;
+
+    // VF is recorded after every instruction, so it changed if it differs from the record before.  Fx65 writes every
+    // register up to the one recorded.
+    if (filter->reg == 0xF && previous != NULL && record->vf != previous->vf) return true;
+    if (record->reg == CHIP8_TRACE_NO_REGISTER) return false;
+    if ((record->opcode & 0xF0FF) == 0xF065) return filter->reg <= record->reg;
+    return record->reg == filter->reg;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+int main(int argc, char** argv)
+{
+    Filter filter = {0, CHIP8_MEM_SIZE - 1, 0, 0, CHIP8_TRACE_NO_REGISTER, 0, UINT32_MAX};
+    uint64_t first = 0;
+    uint64_t limit = UINT64_MAX;
+    bool count = false;
+
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-'; argi++)
+    {
+        uint64_t low, high;
+        if (strcmp(argv[argi], "-p") == 0 && argi + 1 < argc && parseRange(argv[argi + 1], 16, &low, &high))
+        {
+            filter.pcLow = low;
+            filter.pcHigh = high;
+            argi++;
+        }
+        else if (strcmp(argv[argi], "-o") == 0 && argi + 1 < argc && parsePattern(argv[argi + 1], &filter))
+        {
+            argi++;
+        }
+        else if (strcmp(argv[argi], "-r") == 0 && argi + 1 < argc)
+        {
+            filter.reg = strtoul(argv[++argi], NULL, 16) & 0xF;
+        }
+        else if (strcmp(argv[argi], "-f") == 0 && argi + 1 < argc && parseRange(argv[argi + 1], 10, &low, &high))
+        {
+            filter.frameLow = low;
+            filter.frameHigh = high;
+            argi++;
+        }
+        else if (strcmp(argv[argi], "-s") == 0 && argi + 1 < argc)
+        {
+            first = strtoull(argv[++argi], NULL, 0);
+        }
+        else if (strcmp(argv[argi], "-n") == 0 && argi + 1 < argc)
+        {
+            limit = strtoull(argv[++argi], NULL, 0);
+        }
+        else if (strcmp(argv[argi], "-c") == 0)
+        {
+            count = true;
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+    if (argi + 1 != argc)
+    {
+        printUsage();
+        return 1;
+    }
+
+    int fd = open(argv[argi], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Chip8TraceHeader))
+    {
+        fprintf(stderr, "Could not read %s\n", argv[argi]);
+        return 1;
+    }
+    const uint8_t* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map %s\n", argv[argi]);
+        return 1;
+    }
+
+    const Chip8TraceHeader* header = (const Chip8TraceHeader*)data;
+    if (header->magic != CHIP8_TRACE_MAGIC || header->version != CHIP8_TRACE_VERSION ||
+        header->recordSize != sizeof(Chip8TraceRecord))
+    {
+        fprintf(stderr, "%s is not a version %u trace written on a host of this byte order\n", argv[argi],
+                CHIP8_TRACE_VERSION);
+        return 1;
+    }
+
+    // A trace that was never finished (the emulator crashed or is still running) has no count in its header
+    const Chip8TraceRecord* records = (const Chip8TraceRecord*)(header + 1);
+    uint64_t total = (st.st_size - sizeof(Chip8TraceHeader)) / sizeof(Chip8TraceRecord);
+    if (header->records != 0 && header->records < total) total = header->records;
+
+    uint64_t matched = 0;
+    static uint64_t opcodes[65536];
+    for (uint64_t n = first; n < total && matched < limit; n++)
+    {
+        const Chip8TraceRecord* record = &records[n];
+        if (!matches(&filter, record, n > 0 ? record - 1 : NULL)) continue;
+        matched++;
+        if (count)
+        {
+            opcodes[record->opcode]++;
+            continue;
+        }
+
+        char text[64];
+        chip8Disassemble(record->opcode, header->disassembly, text, sizeof(text));
+        char change[16] = "";
+        if (record->reg != CHIP8_TRACE_NO_REGISTER)
+            snprintf(change, sizeof(change), "V%X=%02X", record->reg, record->value);
+        printf("%12llu %10u  %03X  %04X  %-38s I=%03X %-6s VF=%02X DT=%02X ST=%02X SP=%X\n",
+               (unsigned long long)(header->firstInstruction + n), record->frame, record->pc, record->opcode, text,
+               record->i, change, record->vf, record->dt, record->st, record->sp);
+    }
+
+    if (count)
+    {
+        for (uint32_t opcode = 0; opcode < 65536; opcode++)
+        {
+            if (opcodes[opcode] == 0) continue;
+            char text[64];
+            chip8Disassemble(opcode, header->disassembly, text, sizeof(text));
+            printf("%12llu  %04X  %s\n", (unsigned long long)opcodes[opcode], opcode, text);
+        }
+    }
+    fprintf(stderr, "%llu of %llu records matched\n", (unsigned long long)matched, (unsigned long long)total);
+
+    munmap((void*)data, st.st_size);
+    return 0;
+}
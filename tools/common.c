@@ -0,0 +1,90 @@
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ROMs compiled ahead of time by chip8aot, from the generated aot/modules.c
+extern const Chip8AotModule* const chip8AotModules[];
+extern const uint32_t chip8AotModuleCount;
+
+const Engine engines[ENGINE_COUNT] = {
+    {"chain", CHIP8_DISPATCH_CHAIN}, {"table", CHIP8_DISPATCH_TABLE}, {"threaded", CHIP8_DISPATCH_THREADED},
+    {"jit", CHIP8_DISPATCH_JIT},     {"aot", CHIP8_DISPATCH_AOT},     {"fused", CHIP8_DISPATCH_FUSED},
+};
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+int32_t findEngine(const char* name)
+{
+    for (uint32_t e = 0; e < ENGINE_COUNT; e++)
+    {
+        if (strcmp(name, engines[e].name) == 0) return e;
+    }
+    return -1;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+uint8_t* readFile(const char* filename, uint32_t* size)
+{
+    FILE* fp = fopen(filename, "rb");
+    if (fp == NULL) return NULL;
+
+    uint8_t* data = malloc(CHIP8_MEM_SIZE);
+    if (data == NULL)
+    {
+        fclose(fp);
+        return NULL;
+    }
+    *size = fread(data, 1, CHIP8_MEM_SIZE, fp);
+    fclose(fp);
+    return data;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+const Chip8AotModule* findAotModule(const uint8_t* rom, uint32_t romSize)
+{
+    for (uint32_t i = 0; i < chip8AotModuleCount; i++)
+    {
+        const Chip8AotModule* module = chip8AotModules[i];
+        if (module->romSize == romSize && memcmp(module->rom, rom, romSize) == 0) return module;
+    }
+    return NULL;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+const Chip8AotModule* findLoadedAotModule(const Chip8Machine* m)
+{
+    for (uint32_t i = 0; i < chip8AotModuleCount; i++)
+    {
+        const Chip8AotModule* module = chip8AotModules[i];
+        if (module->romSize <= m->memSize - CHIP8_PROGRAM_START_OFFSET &&
+            memcmp(module->rom, m->mem + CHIP8_PROGRAM_START_OFFSET, module->romSize) == 0)
+            return module;
+    }
+    return NULL;
+}
+
+// ********************************************************************************************************************
+// ********************************************************************************************************************
+uint64_t hashScreen(const Chip8Screen* screen)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    uint32_t words = screen->height * (screen->width / 64);
+    for (uint32_t p = 0; p < CHIP8_PLANE_COUNT; p++)
+    {
+        if ((screen->planes & (1u << p)) == 0) continue;
+        for (uint32_t w = 0; w < words; w++)
+        {
+            for (int32_t shift = 56; shift >= 0; shift -= 8)
+            {
+                hash ^= (screen->pixels[p][w] >> shift) & 0xFF;
+                hash *= 0x100000001b3ull;
+            }
+        }
+    }
+    return hash;
+}
@@ -0,0 +1,41 @@
+#ifndef CHIP_8_TOOLS_COMMON_H_
+#define CHIP_8_TOOLS_COMMON_H_
+
+#include "chip8.h"
+#include "chip8aot.h"
+
+// What the headless tools share: the dispatch engines they select by name, reading a ROM, finding the module a ROM
+// was compiled to ahead of time, and the screen hash the regression and replay tools compare.  Linked into every tool
+// that runs ROMs along with the core and the generated aot/ modules, so there is one definition of each.
+
+#define ENGINE_COUNT 6
+#define ENGINE_NAMES "chain|table|threaded|jit|aot|fused" // For usage messages, in the order of engines[]
+
+typedef struct Engine
+{
+    const char* name;
+    Chip8Dispatch dispatch;
+} Engine;
+
+// Every dispatch engine, chain first as the baseline the others are compared with
+extern const Engine engines[ENGINE_COUNT];
+
+// Returns the index in engines[] of the engine with the given name, or -1 if there is none
+int32_t findEngine(const char* name);
+
+// Reads a ROM into a buffer of CHIP8_MEM_SIZE bytes that the caller frees.  Returns NULL if the file can't be read.
+uint8_t* readFile(const char* filename, uint32_t* size);
+
+// Returns the module compiled from the given ROM by chip8aot and linked into the tools, or NULL if it wasn't one of
+// AOT_ROMS in the Makefile
+const Chip8AotModule* findAotModule(const uint8_t* rom, uint32_t romSize);
+
+// Same, for a machine that was loaded some other way, such as from a movie: the module whose ROM the machine's memory
+// holds at CHIP8_PROGRAM_START_OFFSET.  Blocks check their bytes before they run, so code changed since is interpreted.
+const Chip8AotModule* findLoadedAotModule(const Chip8Machine* m);
+
+// FNV-1a over the rows of each plane in use, a byte at a time from the most significant end so hashes don't depend on
+// the host.  A lo-res CHIP-8 screen hashes the same 32 words it always did.
+uint64_t hashScreen(const Chip8Screen* screen);
+
+#endif
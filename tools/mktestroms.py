@@ -0,0 +1,191 @@
+#!/usr/bin/env python3
+# Writes the SUPER-CHIP, XO-CHIP and quirks test ROMs in ../roms that the regression run covers the variants with
+# (python3 mktestroms.py [dir]).  Each ROM draws a stage, waits a second on the delay timer and moves on, so the
+# hashes chip8regress takes every 60 frames see every stage.  Run make regress-update after changing one.
+
+import sys
+
+# A two pass assembler: labels, instructions, instructions taking a label's address and raw data
+class Asm:
+    def __init__(self):
+        self.items = []   # (kind, value) in order
+        self.labels = {}
+        self.org = 0x200
+    def label(self, name):
+        self.items.append(('label', name))
+    def op(self, word):
+        self.items.append(('op', word))
+    def ref(self, fmt, name):
+        self.items.append(('ref', (fmt, name)))
+    def long(self, name):
+        self.items.append(('long', name))
+    def data(self, bs):
+        self.items.append(('data', bytes(bs)))
+    def align(self, addr):
+        self.items.append(('pad', addr))
+    def build(self):
+        for _ in range(2):
+            out = bytearray()
+            pc = self.org
+            for kind, v in self.items:
+                if kind == 'label':
+                    self.labels[v] = pc
+                elif kind == 'op':
+                    out += bytes([v >> 8, v & 0xFF]); pc += 2
+                elif kind == 'ref':
+                    fmt, name = v
+                    w = fmt | (self.labels.get(name, 0) & 0xFFF)
+                    out += bytes([w >> 8, w & 0xFF]); pc += 2
+                elif kind == 'long':
+                    a = self.labels.get(v, 0)
+                    out += bytes([0xF0, 0x00, a >> 8, a & 0xFF]); pc += 4
+                elif kind == 'data':
+                    out += v; pc += len(v)
+                elif kind == 'pad':
+                    out += bytes(v - pc); pc = v
+        return bytes(out)
+
+def wait(a):
+    a.ref(0x2000, 'wait')
+
+def wait_sub(a):
+    # Waits a second on the delay timer
+    a.label('wait')
+    a.op(0x6E3C); a.op(0xFE15)
+    a.label('wait_loop')
+    a.op(0xFE07); a.op(0x3E00); a.ref(0x1000, 'wait_loop')
+    a.op(0x00EE)
+
+def digit(a, x, vx, vy):
+    # Small font digit of Vx at (Vvx, Vvy), then Vvx += 5
+    a.op(0xF029 | x << 8); a.op(0xD005 | vx << 8 | vy << 4); a.op(0x7005 | vx << 8)
+
+def halt(a, name):
+    a.label(name); a.ref(0x1000, name)
+
+SPRITE16 = [0xFF, 0xFF, 0xC0, 0x03, 0xA0, 0x05, 0x90, 0x09, 0x88, 0x11, 0x84, 0x21, 0x82, 0x41, 0x81, 0x81,
+            0x81, 0x81, 0x82, 0x41, 0x84, 0x21, 0x88, 0x11, 0x90, 0x09, 0xA0, 0x05, 0xC0, 0x03, 0xFF, 0xFF]
+SPRITE16B = [0x00, 0x00, 0x7F, 0xFE, 0x40, 0x02, 0x5F, 0xFA, 0x50, 0x0A, 0x57, 0xEA, 0x54, 0x2A, 0x55, 0xAA,
+             0x55, 0xAA, 0x54, 0x2A, 0x57, 0xEA, 0x50, 0x0A, 0x5F, 0xFA, 0x40, 0x02, 0x7F, 0xFE, 0x00, 0x00]
+BOX8 = [0xFF, 0x81, 0xBD, 0xA5, 0xA5, 0xBD, 0x81, 0xFF]
+
+# ---------------------------------------------------------------- SUPER-CHIP
+def schip():
+    a = Asm()
+    # Stage 1: hi-res, 16x16 sprites, big font, sprites cut off at the right and bottom edges
+    a.op(0x00FF)
+    a.op(0x6008); a.op(0x6108); a.ref(0xA000, 'sprite16'); a.op(0xD010)
+    a.op(0x6078); a.op(0x6120); a.op(0xD010)            # x = 120: cut off at the right
+    a.op(0x6040); a.op(0x6138); a.op(0xD010)            # y = 56: cut off at the bottom
+    a.op(0x6220); a.op(0x6308); a.op(0x6401)
+    for d in (1, 2, 3):
+        a.op(0x6500 | d); a.op(0xF530); a.op(0xD23A); a.op(0x720A)
+    a.op(0x6230); a.op(0x6318); a.ref(0xA000, 'sprite16'); a.op(0xD230)   # Erase test: draw twice, VF = 1
+    a.op(0xD230); a.op(0x8AF0)
+    a.op(0x6230); a.op(0x6320); digit(a, 0xA, 2, 3)
+    wait(a)
+    # Stage 2: scroll down 3, right 4
+    a.op(0x00C3); wait(a)
+    a.op(0x00FB); wait(a)
+    # Stage 3: scroll left twice
+    a.op(0x00FC); a.op(0x00FC); wait(a)
+    # Stage 4: Fx75/Fx85 round trip through the flags
+    a.op(0x00E0)
+    a.op(0x6001); a.op(0x6102); a.op(0x6203); a.op(0x6304); a.op(0xF375)
+    a.op(0x6000); a.op(0x6100); a.op(0x6200); a.op(0x6300); a.op(0xF385)
+    a.op(0x6A10); a.op(0x6B10)
+    for r in range(4): digit(a, r, 0xA, 0xB)
+    wait(a)
+    # Stage 5: back to lo-res, a 16x16 sprite and a big digit there
+    a.op(0x00FE)
+    a.op(0x6004); a.op(0x6104); a.ref(0xA000, 'sprite16'); a.op(0xD010)
+    a.op(0x6018); a.op(0x6509); a.op(0xF530); a.op(0xD01A)
+    wait(a)
+    a.op(0x00FD)
+    wait_sub(a)
+    a.label('sprite16'); a.data(SPRITE16)
+    return a.build()
+
+# ---------------------------------------------------------------- XO-CHIP
+def xochip():
+    a = Asm()
+    # Stage 1: hi-res, a sprite in each plane and one drawn into both
+    a.op(0x00FF)
+    a.op(0xF101); a.op(0x6008); a.op(0x6108); a.ref(0xA000, 'sprite16'); a.op(0xD010)
+    a.op(0xF201); a.op(0x6010); a.op(0x6110); a.ref(0xA000, 'sprite16b'); a.op(0xD010)
+    a.op(0xF301); a.op(0x6030); a.op(0x610C); a.ref(0xA000, 'sprite16'); a.op(0xD010)  # 32 bytes per plane
+    a.op(0x6050); a.op(0x6108); a.ref(0xA000, 'box8'); a.op(0xD018)                  # 8 bytes per plane
+    wait(a)
+    # Stage 2: scroll plane 2 up 4, then plane 1 down 2
+    a.op(0xF201); a.op(0x00D4); a.op(0xF101); a.op(0x00C2); wait(a)
+    # Stage 3: clear plane 1 only, scroll plane 2 left
+    a.op(0x00E0); a.op(0xF201); a.op(0x00FC); wait(a)
+    # Stage 4: F000 nnnn past 4 KB, and a skip over it that must jump all 4 bytes
+    a.op(0xF301); a.op(0x00E0)
+    a.op(0xF101); a.long('far')
+    a.op(0x6505); a.op(0x3505); a.long('farbad')
+    a.op(0x6010); a.op(0x6110); a.op(0xD010)
+    a.op(0x4505); a.long('farbad')                                          # Not taken: loads the other sprite
+    a.op(0x6030); a.op(0xD010)
+    wait(a)
+    # Stage 5: 5xy2 stores V1..V4, 5xy3 loads them back reversed, I is left alone so F065 reads the first byte
+    a.op(0xF301); a.op(0x00E0); a.op(0xF101)
+    a.op(0x6101); a.op(0x6202); a.op(0x6303); a.op(0x6404); a.ref(0xA000, 'buffer')
+    a.op(0x5142); a.op(0x6100); a.op(0x6200); a.op(0x6300); a.op(0x6400)
+    a.op(0x5413); a.op(0xF065)
+    a.op(0x6A10); a.op(0x6B10)
+    for r in range(5): digit(a, r, 0xA, 0xB)
+    a.ref(0xA000, 'buffer'); a.op(0x5322)                                    # x > y stores reversed: V3, V2
+    a.op(0xF165)
+    a.op(0x6A10); a.op(0x6B18)
+    for r in range(2): digit(a, r, 0xA, 0xB)
+    # Fx75/Fx85 with registers past V7
+    a.op(0x6909); a.op(0xF975); a.op(0x6900); a.op(0xF985); digit(a, 9, 0xA, 0xB)
+    wait(a)
+    # Stage 6: lo-res, both planes, a big digit
+    a.op(0x00FE); a.op(0xF301)
+    a.op(0x6010); a.op(0x6108); a.op(0x650E); a.op(0xF530); a.op(0xD01A)
+    a.op(0xF201); a.op(0x6014); a.op(0xD01A)
+    halt(a, 'end')
+    wait_sub(a)
+    a.label('sprite16'); a.data(SPRITE16)
+    a.label('sprite16b'); a.data(SPRITE16B)
+    a.label('box8'); a.data(BOX8); a.data([0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF])
+    a.label('buffer'); a.data(bytes(8))
+    a.align(0x1000)
+    a.label('far'); a.data(SPRITE16B)
+    a.label('farbad'); a.data(SPRITE16)
+    return a.build()
+
+# ---------------------------------------------------------------- Quirks, the same program under every variant
+def quirks():
+    a = Asm()
+    a.ref(0x1000, 'start')
+    # Bnnn targets: nnn + V0 lands on the first, Bxnn with V2 = 4 on the second
+    a.label('jumps')
+    a.op(0x6A01); a.ref(0x1000, 'jumped')
+    a.op(0x6A02); a.ref(0x1000, 'jumped')
+    a.label('start')
+    a.op(0x6C02); a.op(0x6D02)
+    # 8xy6/8xyE: shifts Vy into Vx, or Vx itself with the shift quirk
+    a.op(0x6606); a.op(0x6710); a.op(0x8676); digit(a, 6, 0xC, 0xD)
+    a.op(0x6603); a.op(0x6704); a.op(0x867E); digit(a, 6, 0xC, 0xD)
+    # Fx55/Fx65: I advances past the registers with the load/store quirk
+    a.ref(0xA000, 'buffer'); a.op(0x6001); a.op(0x6102); a.op(0xF155); a.op(0xF065); digit(a, 0, 0xC, 0xD)
+    # Bnnn or Bxnn
+    a.op(0x6000); a.op(0x6204)
+    a.ref(0xB000, 'jumps')
+    a.label('jumped'); digit(a, 0xA, 0xC, 0xD)
+    # Sprites over the right and bottom edges wrap, or are cut off with the clip quirk
+    a.op(0x603C); a.op(0x611E); a.ref(0xA000, 'box'); a.op(0xD018)
+    halt(a, 'end')
+    a.label('box'); a.data(BOX8)
+    a.label('buffer'); a.data([0, 0, 9, 9])
+    return a.build()
+
+out = sys.argv[1] if len(sys.argv) > 1 else '../roms'
+open(out + '/schip_test.sc8', 'wb').write(schip())
+open(out + '/xochip_test.xo8', 'wb').write(xochip())
+q = quirks()
+for ext in ('ch8', 'sc8', 'xo8'):
+    open(out + '/quirks_test.' + ext, 'wb').write(q)